@@ -135,6 +135,14 @@ KP_SHARE DWORD GetEntryPosInGroup(void *pMgr, const PW_ENTRY *pEntry)
 	return p->GetEntryPosInGroup(pEntry);
 }
 
+// Returns the number of entries in the group; *ppIndices receives their
+// indices, valid until the entry list is modified
+KP_SHARE DWORD GetEntryIndicesInGroup(void *pMgr, DWORD idGroup, const DWORD **ppIndices)
+{
+	DECL_MGR_N(pMgr);
+	return p->GetEntryIndicesInGroup(idGroup, ppIndices);
+}
+
 KP_SHARE PW_ENTRY *GetLastEditedEntry(void *pMgr)
 {
 	DECL_MGR_P(pMgr);
@@ -211,6 +219,12 @@ KP_SHARE BOOL AddEntry(void *pMgr, const PW_ENTRY *pTemplate)
 	return p->AddEntry(pTemplate);
 }
 
+KP_SHARE BOOL AddEntries(void *pMgr, const PW_ENTRY *pTemplates, DWORD dwCount)
+{
+	DECL_MGR_B(pMgr);
+	return p->AddEntries(pTemplates, dwCount);
+}
+
 // pe must be unlocked already, pbGroupCreated is optional
 KP_SHARE BOOL BackupEntry(void *pMgr, const PW_ENTRY *pe, BOOL *pbGroupCreated)
 {
@@ -225,6 +239,13 @@ KP_SHARE BOOL DeleteEntry(void *pMgr, DWORD dwIndex)
 	return p->DeleteEntry(dwIndex);
 }
 
+// Returns the number of deleted entries
+KP_SHARE DWORD DeleteEntries(void *pMgr, const DWORD *pIndices, DWORD dwCount)
+{
+	DECL_MGR_N(pMgr);
+	return p->DeleteEntries(pIndices, dwCount);
+}
+
 KP_SHARE BOOL DeleteGroupById(void *pMgr, DWORD uGroupId)
 {
 	DECL_MGR_B(pMgr);
@@ -243,6 +264,12 @@ KP_SHARE BOOL SetEntry(void *pMgr, DWORD dwIndex, const PW_ENTRY *pTemplate)
 	return p->SetEntry(dwIndex, pTemplate);
 }
 
+KP_SHARE BOOL SetEntryGroup(void *pMgr, DWORD dwIndex, DWORD idGroup)
+{
+	DECL_MGR_B(pMgr);
+	return p->SetEntryGroup(dwIndex, idGroup);
+}
+
 // DWORD MakeGroupTree(LPCTSTR lpTreeString, TCHAR tchSeparator);
 
 // Use these functions to make passwords in PW_ENTRY structures readable
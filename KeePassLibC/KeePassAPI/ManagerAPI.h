@@ -43,6 +43,7 @@ KP_SHARE DWORD GetEntryByGroupN(void *pMgr, DWORD idGroup, DWORD dwIndex);
 KP_SHARE PW_ENTRY *GetEntryByUuid(void *pMgr, const BYTE *pUuid);
 KP_SHARE DWORD GetEntryByUuidN(void *pMgr, const BYTE *pUuid); // Returns the index of the item with pUuid
 KP_SHARE DWORD GetEntryPosInGroup(void *pMgr, const PW_ENTRY *pEntry);
+KP_SHARE DWORD GetEntryIndicesInGroup(void *pMgr, DWORD idGroup, const DWORD **ppIndices);
 KP_SHARE PW_ENTRY *GetLastEditedEntry(void *pMgr);
 
 // Access group information
@@ -58,14 +59,17 @@ KP_SHARE BOOL GetGroupTree(void *pMgr, DWORD idGroup, DWORD *pGroupIndexes);
 // Add entries and groups
 KP_SHARE BOOL AddGroup(void *pMgr, const PW_GROUP *pTemplate);
 KP_SHARE BOOL AddEntry(void *pMgr, const PW_ENTRY *pTemplate);
+KP_SHARE BOOL AddEntries(void *pMgr, const PW_ENTRY *pTemplates, DWORD dwCount);
 KP_SHARE BOOL BackupEntry(void *pMgr, const PW_ENTRY *pe, BOOL *pbGroupCreated); // pe must be unlocked already, pbGroupCreated is optional
 
 // Delete entries and groups
 KP_SHARE BOOL DeleteEntry(void *pMgr, DWORD dwIndex);
+KP_SHARE DWORD DeleteEntries(void *pMgr, const DWORD *pIndices, DWORD dwCount);
 KP_SHARE BOOL DeleteGroupById(void *pMgr, DWORD uGroupId);
 
 KP_SHARE BOOL SetGroup(void *pMgr, DWORD dwIndex, const PW_GROUP *pTemplate);
 KP_SHARE BOOL SetEntry(void *pMgr, DWORD dwIndex, const PW_ENTRY *pTemplate);
+KP_SHARE BOOL SetEntryGroup(void *pMgr, DWORD dwIndex, DWORD idGroup);
 // DWORD MakeGroupTree(LPCTSTR lpTreeString, TCHAR tchSeparator);
 
 // Use these functions to make passwords in PW_ENTRY structures readable
@@ -21,6 +21,7 @@
 #include "StructAPI.h"
 #include "../../KeePassLibCpp/Util/StrUtil.h"
 #include "../../KeePassLibCpp/Util/MemUtil.h"
+#include "../../KeePassLibCpp/Util/StringArena.h"
 
 KP_SHARE DWORD PG_GetID(PW_GROUP *pGroup)
 {
@@ -247,7 +248,7 @@ KP_SHARE BOOL PE_SetImageID(PW_ENTRY *pEntry, DWORD dwImageID)
 KP_SHARE BOOL PE_SetTitle(PW_ENTRY *pEntry, LPCTSTR lpTitle)
 {
 	ASSERT(pEntry != NULL); if(pEntry == NULL) return FALSE;
-	SAFE_DELETE_ARRAY(pEntry->pszTitle);
+	CStringArena::FreeString(pEntry->pszTitle);
 	pEntry->pszTitle = _TcsSafeDupAlloc(lpTitle);
 	return TRUE;
 }
@@ -255,7 +256,7 @@ KP_SHARE BOOL PE_SetTitle(PW_ENTRY *pEntry, LPCTSTR lpTitle)
 KP_SHARE BOOL PE_SetURL(PW_ENTRY *pEntry, LPCTSTR lpURL)
 {
 	ASSERT(pEntry != NULL); if(pEntry == NULL) return FALSE;
-	SAFE_DELETE_ARRAY(pEntry->pszURL);
+	CStringArena::FreeString(pEntry->pszURL);
 	pEntry->pszURL = _TcsSafeDupAlloc(lpURL);
 	return TRUE;
 }
@@ -263,7 +264,7 @@ KP_SHARE BOOL PE_SetURL(PW_ENTRY *pEntry, LPCTSTR lpURL)
 KP_SHARE BOOL PE_SetUserName(PW_ENTRY *pEntry, LPCTSTR lpUserName)
 {
 	ASSERT(pEntry != NULL); if(pEntry == NULL) return FALSE;
-	SAFE_DELETE_ARRAY(pEntry->pszUserName);
+	CStringArena::FreeString(pEntry->pszUserName);
 	pEntry->pszUserName = _TcsSafeDupAlloc(lpUserName);
 	return TRUE;
 }
@@ -286,7 +287,7 @@ KP_SHARE BOOL PE_SetPasswordAndLock(void *pMgr, PW_ENTRY *pEntry, LPCTSTR lpPass
 KP_SHARE BOOL PE_SetNotes(PW_ENTRY *pEntry, LPCTSTR lpNotes)
 {
 	ASSERT(pEntry != NULL); if(pEntry == NULL) return FALSE;
-	SAFE_DELETE_ARRAY(pEntry->pszAdditional);
+	CStringArena::FreeString(pEntry->pszAdditional);
 	pEntry->pszAdditional = _TcsSafeDupAlloc(lpNotes);
 	return TRUE;
 }
@@ -322,7 +323,7 @@ KP_SHARE BOOL PE_SetExpireTime(PW_ENTRY *pEntry, const PW_TIME *pTime)
 KP_SHARE BOOL PE_SetBinaryDesc(PW_ENTRY *pEntry, LPCTSTR lpDesc)
 {
 	ASSERT(pEntry != NULL); if(pEntry == NULL) return FALSE;
-	SAFE_DELETE_ARRAY(pEntry->pszBinaryDesc);
+	CStringArena::FreeString(pEntry->pszBinaryDesc);
 	pEntry->pszBinaryDesc = _TcsSafeDupAlloc(lpDesc);
 	return TRUE;
 }
@@ -256,12 +256,20 @@ uint32_t index_alpha(const argon2_instance_t *instance,
     return absolute_position;
 }
 
+static int is_cancelled(const argon2_instance_t *instance) {
+    const volatile long *cancel = instance->context_ptr->cancel;
+    return ((cancel != NULL) && (*cancel != 0));
+}
+
 /* Single-threaded version for p=1 case */
 static int fill_memory_blocks_st(argon2_instance_t *instance) {
     uint32_t r, s, l;
 
     for (r = 0; r < instance->passes; ++r) {
         for (s = 0; s < ARGON2_SYNC_POINTS; ++s) {
+            if (is_cancelled(instance)) {
+                return ARGON2_CANCELLED;
+            }
             for (l = 0; l < instance->lanes; ++l) {
                 argon2_position_t position = {r, l, (uint8_t)s, 0};
                 fill_segment(instance, position);
@@ -312,6 +320,11 @@ static int fill_memory_blocks_mt(argon2_instance_t *instance) {
         for (s = 0; s < ARGON2_SYNC_POINTS; ++s) {
             uint32_t l, ll;
 
+            if (is_cancelled(instance)) {
+                rc = ARGON2_CANCELLED;
+                goto fail;
+            }
+
             /* 2. Calling threads */
             for (l = 0; l < instance->lanes; ++l) {
                 argon2_position_t position;
@@ -351,6 +351,7 @@ int decode_string(argon2_context *ctx, const char *str, argon2_type type) {
     ctx->allocate_cbk = NULL;
     ctx->free_cbk = NULL;
     ctx->flags = ARGON2_DEFAULT_FLAGS;
+    ctx->cancel = NULL;
 
     /* On return, must have valid context */
     validation_result = validate_inputs(ctx);
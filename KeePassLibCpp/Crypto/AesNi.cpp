@@ -0,0 +1,394 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "StdAfx.h"
+#include "AesNi.h"
+
+#ifdef KP_AESNI_AVAILABLE
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#include "Rijndael.h"
+
+#ifdef KP_AESNI_AVAILABLE
+
+static volatile LONG g_lAesNiSupported = -1;
+
+static bool AesNi_QueryCpu()
+{
+	UINT32 uEcx = 0, uEdx = 0;
+
+#ifdef _MSC_VER
+	int vInfo[4] = { 0, 0, 0, 0 };
+	__cpuid(vInfo, 0);
+	if(vInfo[0] < 1) return false;
+
+	__cpuid(vInfo, 1);
+	uEcx = static_cast<UINT32>(vInfo[2]);
+	uEdx = static_cast<UINT32>(vInfo[3]);
+#else
+	unsigned int a = 0, b = 0, c = 0, d = 0;
+	if(__get_cpuid(1, &a, &b, &c, &d) == 0) return false;
+	uEcx = c;
+	uEdx = d;
+#endif
+
+	const bool bSse2 = ((uEdx & (1U << 26)) != 0);
+	const bool bAes = ((uEcx & (1U << 25)) != 0);
+	return (bSse2 && bAes);
+}
+
+bool AesNi_IsSupported()
+{
+	if(g_lAesNiSupported < 0) // Result is the same for all threads
+		g_lAesNiSupported = (AesNi_QueryCpu() ? 1 : 0);
+
+	return (g_lAesNiSupported != 0);
+}
+
+KP_AESNI_TARGET static void AesNi_LoadKeys(const UINT8* pbKeys, UINT32 uRounds,
+	__m128i* pKeys)
+{
+	ASSERT((uRounds >= 10) && (uRounds <= RD_MAX_ROUNDS));
+	for(UINT32 r = 0; r <= uRounds; ++r)
+		pKeys[r] = _mm_loadu_si128((const __m128i*)(pbKeys + (r << 4)));
+}
+
+KP_AESNI_TARGET static void AesNi_EraseKeys(__m128i* pKeys)
+{
+	const __m128i z = _mm_setzero_si128();
+	for(UINT32 r = 0; r <= RD_MAX_ROUNDS; ++r) pKeys[r] = z;
+}
+
+KP_AESNI_TARGET static __m128i AesNi_Enc(__m128i b, const __m128i* pKeys,
+	UINT32 uRounds)
+{
+	b = _mm_xor_si128(b, pKeys[0]);
+	for(UINT32 r = 1; r < uRounds; ++r) b = _mm_aesenc_si128(b, pKeys[r]);
+	return _mm_aesenclast_si128(b, pKeys[uRounds]);
+}
+
+KP_AESNI_TARGET static __m128i AesNi_Dec(__m128i b, const __m128i* pKeys,
+	UINT32 uRounds)
+{
+	b = _mm_xor_si128(b, pKeys[uRounds]);
+	for(UINT32 r = uRounds - 1; r > 0; --r) b = _mm_aesdec_si128(b, pKeys[r]);
+	return _mm_aesdeclast_si128(b, pKeys[0]);
+}
+
+KP_AESNI_TARGET static void AesNi_Dec4(__m128i& b0, __m128i& b1, __m128i& b2,
+	__m128i& b3, const __m128i* pKeys, UINT32 uRounds)
+{
+	const __m128i kLast = pKeys[uRounds];
+	b0 = _mm_xor_si128(b0, kLast);
+	b1 = _mm_xor_si128(b1, kLast);
+	b2 = _mm_xor_si128(b2, kLast);
+	b3 = _mm_xor_si128(b3, kLast);
+
+	for(UINT32 r = uRounds - 1; r > 0; --r)
+	{
+		const __m128i k = pKeys[r];
+		b0 = _mm_aesdec_si128(b0, k);
+		b1 = _mm_aesdec_si128(b1, k);
+		b2 = _mm_aesdec_si128(b2, k);
+		b3 = _mm_aesdec_si128(b3, k);
+	}
+
+	const __m128i kFirst = pKeys[0];
+	b0 = _mm_aesdeclast_si128(b0, kFirst);
+	b1 = _mm_aesdeclast_si128(b1, kFirst);
+	b2 = _mm_aesdeclast_si128(b2, kFirst);
+	b3 = _mm_aesdeclast_si128(b3, kFirst);
+}
+
+KP_AESNI_TARGET void AesNi_EncryptEcb(const UINT8* pbKeys, UINT32 uRounds,
+	const UINT8* pbIn, UINT8* pbOut, size_t cBlocks)
+{
+	__m128i vKeys[RD_MAX_ROUNDS + 1];
+	AesNi_LoadKeys(pbKeys, uRounds, &vKeys[0]);
+
+	for(; cBlocks >= 4; cBlocks -= 4)
+	{
+		__m128i b0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)pbIn), vKeys[0]);
+		__m128i b1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(pbIn + 16)), vKeys[0]);
+		__m128i b2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(pbIn + 32)), vKeys[0]);
+		__m128i b3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(pbIn + 48)), vKeys[0]);
+
+		for(UINT32 r = 1; r < uRounds; ++r)
+		{
+			const __m128i k = vKeys[r];
+			b0 = _mm_aesenc_si128(b0, k);
+			b1 = _mm_aesenc_si128(b1, k);
+			b2 = _mm_aesenc_si128(b2, k);
+			b3 = _mm_aesenc_si128(b3, k);
+		}
+
+		const __m128i kLast = vKeys[uRounds];
+		_mm_storeu_si128((__m128i*)pbOut, _mm_aesenclast_si128(b0, kLast));
+		_mm_storeu_si128((__m128i*)(pbOut + 16), _mm_aesenclast_si128(b1, kLast));
+		_mm_storeu_si128((__m128i*)(pbOut + 32), _mm_aesenclast_si128(b2, kLast));
+		_mm_storeu_si128((__m128i*)(pbOut + 48), _mm_aesenclast_si128(b3, kLast));
+
+		pbIn += 64;
+		pbOut += 64;
+	}
+
+	for(; cBlocks != 0; --cBlocks)
+	{
+		const __m128i b = _mm_loadu_si128((const __m128i*)pbIn);
+		_mm_storeu_si128((__m128i*)pbOut, AesNi_Enc(b, &vKeys[0], uRounds));
+
+		pbIn += 16;
+		pbOut += 16;
+	}
+
+	AesNi_EraseKeys(&vKeys[0]);
+}
+
+KP_AESNI_TARGET void AesNi_DecryptEcb(const UINT8* pbKeys, UINT32 uRounds,
+	const UINT8* pbIn, UINT8* pbOut, size_t cBlocks)
+{
+	__m128i vKeys[RD_MAX_ROUNDS + 1];
+	AesNi_LoadKeys(pbKeys, uRounds, &vKeys[0]);
+
+	for(; cBlocks >= 4; cBlocks -= 4)
+	{
+		__m128i b0 = _mm_loadu_si128((const __m128i*)pbIn);
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(pbIn + 16));
+		__m128i b2 = _mm_loadu_si128((const __m128i*)(pbIn + 32));
+		__m128i b3 = _mm_loadu_si128((const __m128i*)(pbIn + 48));
+
+		AesNi_Dec4(b0, b1, b2, b3, &vKeys[0], uRounds);
+
+		_mm_storeu_si128((__m128i*)pbOut, b0);
+		_mm_storeu_si128((__m128i*)(pbOut + 16), b1);
+		_mm_storeu_si128((__m128i*)(pbOut + 32), b2);
+		_mm_storeu_si128((__m128i*)(pbOut + 48), b3);
+
+		pbIn += 64;
+		pbOut += 64;
+	}
+
+	for(; cBlocks != 0; --cBlocks)
+	{
+		const __m128i b = _mm_loadu_si128((const __m128i*)pbIn);
+		_mm_storeu_si128((__m128i*)pbOut, AesNi_Dec(b, &vKeys[0], uRounds));
+
+		pbIn += 16;
+		pbOut += 16;
+	}
+
+	AesNi_EraseKeys(&vKeys[0]);
+}
+
+KP_AESNI_TARGET void AesNi_EncryptCbc(const UINT8* pbKeys, UINT32 uRounds,
+	UINT8* pbIV16, const UINT8* pbIn, UINT8* pbOut, size_t cBlocks)
+{
+	__m128i vKeys[RD_MAX_ROUNDS + 1];
+	AesNi_LoadKeys(pbKeys, uRounds, &vKeys[0]);
+
+	// CBC encryption is inherently sequential
+	__m128i iv = _mm_loadu_si128((const __m128i*)pbIV16);
+	for(; cBlocks != 0; --cBlocks)
+	{
+		const __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i*)pbIn), iv);
+		iv = AesNi_Enc(b, &vKeys[0], uRounds);
+		_mm_storeu_si128((__m128i*)pbOut, iv);
+
+		pbIn += 16;
+		pbOut += 16;
+	}
+	_mm_storeu_si128((__m128i*)pbIV16, iv);
+
+	AesNi_EraseKeys(&vKeys[0]);
+}
+
+KP_AESNI_TARGET void AesNi_DecryptCbc(const UINT8* pbKeys, UINT32 uRounds,
+	UINT8* pbIV16, const UINT8* pbIn, UINT8* pbOut, size_t cBlocks)
+{
+	__m128i vKeys[RD_MAX_ROUNDS + 1];
+	AesNi_LoadKeys(pbKeys, uRounds, &vKeys[0]);
+
+	// Each plaintext block only depends on two ciphertext blocks, thus
+	// multiple blocks can be decrypted interleaved; the ciphertext is
+	// loaded before storing, because pbIn and pbOut may be equal
+	__m128i iv = _mm_loadu_si128((const __m128i*)pbIV16);
+	for(; cBlocks >= 8; cBlocks -= 8)
+	{
+		__m128i vC[8], vB[8];
+		for(size_t i = 0; i < 8; ++i)
+		{
+			vC[i] = _mm_loadu_si128((const __m128i*)(pbIn + (i << 4)));
+			vB[i] = _mm_xor_si128(vC[i], vKeys[uRounds]);
+		}
+
+		for(UINT32 r = uRounds - 1; r > 0; --r)
+		{
+			const __m128i k = vKeys[r];
+			for(size_t i = 0; i < 8; ++i) vB[i] = _mm_aesdec_si128(vB[i], k);
+		}
+
+		for(size_t i = 0; i < 8; ++i)
+		{
+			const __m128i b = _mm_aesdeclast_si128(vB[i], vKeys[0]);
+			_mm_storeu_si128((__m128i*)(pbOut + (i << 4)), _mm_xor_si128(b,
+				((i == 0) ? iv : vC[i - 1])));
+		}
+		iv = vC[7];
+
+		pbIn += 128;
+		pbOut += 128;
+	}
+
+	for(; cBlocks >= 4; cBlocks -= 4)
+	{
+		const __m128i c0 = _mm_loadu_si128((const __m128i*)pbIn);
+		const __m128i c1 = _mm_loadu_si128((const __m128i*)(pbIn + 16));
+		const __m128i c2 = _mm_loadu_si128((const __m128i*)(pbIn + 32));
+		const __m128i c3 = _mm_loadu_si128((const __m128i*)(pbIn + 48));
+
+		__m128i b0 = c0, b1 = c1, b2 = c2, b3 = c3;
+		AesNi_Dec4(b0, b1, b2, b3, &vKeys[0], uRounds);
+
+		_mm_storeu_si128((__m128i*)pbOut, _mm_xor_si128(b0, iv));
+		_mm_storeu_si128((__m128i*)(pbOut + 16), _mm_xor_si128(b1, c0));
+		_mm_storeu_si128((__m128i*)(pbOut + 32), _mm_xor_si128(b2, c1));
+		_mm_storeu_si128((__m128i*)(pbOut + 48), _mm_xor_si128(b3, c2));
+		iv = c3;
+
+		pbIn += 64;
+		pbOut += 64;
+	}
+
+	for(; cBlocks != 0; --cBlocks)
+	{
+		const __m128i c = _mm_loadu_si128((const __m128i*)pbIn);
+		const __m128i b = AesNi_Dec(c, &vKeys[0], uRounds);
+		_mm_storeu_si128((__m128i*)pbOut, _mm_xor_si128(b, iv));
+		iv = c;
+
+		pbIn += 16;
+		pbOut += 16;
+	}
+	_mm_storeu_si128((__m128i*)pbIV16, iv);
+
+	AesNi_EraseKeys(&vKeys[0]);
+}
+
+KP_AESNI_TARGET void AesNi_EncryptRepeated(const UINT8* pbKeys, UINT32 uRounds,
+	UINT8* pbBlocks, size_t cBlocks, UINT64 qwCount)
+{
+	__m128i vKeys[RD_MAX_ROUNDS + 1];
+	AesNi_LoadKeys(pbKeys, uRounds, &vKeys[0]);
+
+	// Two chains at once (the key transformation has two blocks)
+	for(; cBlocks >= 2; cBlocks -= 2)
+	{
+		__m128i b0 = _mm_loadu_si128((const __m128i*)pbBlocks);
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(pbBlocks + 16));
+
+		for(UINT64 qw = qwCount; qw != 0; --qw)
+		{
+			b0 = _mm_xor_si128(b0, vKeys[0]);
+			b1 = _mm_xor_si128(b1, vKeys[0]);
+			for(UINT32 r = 1; r < uRounds; ++r)
+			{
+				b0 = _mm_aesenc_si128(b0, vKeys[r]);
+				b1 = _mm_aesenc_si128(b1, vKeys[r]);
+			}
+			b0 = _mm_aesenclast_si128(b0, vKeys[uRounds]);
+			b1 = _mm_aesenclast_si128(b1, vKeys[uRounds]);
+		}
+
+		_mm_storeu_si128((__m128i*)pbBlocks, b0);
+		_mm_storeu_si128((__m128i*)(pbBlocks + 16), b1);
+		pbBlocks += 32;
+	}
+
+	if(cBlocks != 0)
+	{
+		__m128i b = _mm_loadu_si128((const __m128i*)pbBlocks);
+		for(UINT64 qw = qwCount; qw != 0; --qw)
+			b = AesNi_Enc(b, &vKeys[0], uRounds);
+		_mm_storeu_si128((__m128i*)pbBlocks, b);
+	}
+
+	AesNi_EraseKeys(&vKeys[0]);
+}
+
+#else // !KP_AESNI_AVAILABLE
+
+bool AesNi_IsSupported()
+{
+	return false;
+}
+
+void AesNi_EncryptEcb(const UINT8* pbKeys, UINT32 uRounds, const UINT8* pbIn,
+	UINT8* pbOut, size_t cBlocks)
+{
+	UNREFERENCED_PARAMETER(pbKeys); UNREFERENCED_PARAMETER(uRounds);
+	UNREFERENCED_PARAMETER(pbIn); UNREFERENCED_PARAMETER(pbOut);
+	UNREFERENCED_PARAMETER(cBlocks);
+	ASSERT(FALSE);
+}
+
+void AesNi_DecryptEcb(const UINT8* pbKeys, UINT32 uRounds, const UINT8* pbIn,
+	UINT8* pbOut, size_t cBlocks)
+{
+	UNREFERENCED_PARAMETER(pbKeys); UNREFERENCED_PARAMETER(uRounds);
+	UNREFERENCED_PARAMETER(pbIn); UNREFERENCED_PARAMETER(pbOut);
+	UNREFERENCED_PARAMETER(cBlocks);
+	ASSERT(FALSE);
+}
+
+void AesNi_EncryptCbc(const UINT8* pbKeys, UINT32 uRounds, UINT8* pbIV16,
+	const UINT8* pbIn, UINT8* pbOut, size_t cBlocks)
+{
+	UNREFERENCED_PARAMETER(pbKeys); UNREFERENCED_PARAMETER(uRounds);
+	UNREFERENCED_PARAMETER(pbIV16); UNREFERENCED_PARAMETER(pbIn);
+	UNREFERENCED_PARAMETER(pbOut); UNREFERENCED_PARAMETER(cBlocks);
+	ASSERT(FALSE);
+}
+
+void AesNi_DecryptCbc(const UINT8* pbKeys, UINT32 uRounds, UINT8* pbIV16,
+	const UINT8* pbIn, UINT8* pbOut, size_t cBlocks)
+{
+	UNREFERENCED_PARAMETER(pbKeys); UNREFERENCED_PARAMETER(uRounds);
+	UNREFERENCED_PARAMETER(pbIV16); UNREFERENCED_PARAMETER(pbIn);
+	UNREFERENCED_PARAMETER(pbOut); UNREFERENCED_PARAMETER(cBlocks);
+	ASSERT(FALSE);
+}
+
+void AesNi_EncryptRepeated(const UINT8* pbKeys, UINT32 uRounds,
+	UINT8* pbBlocks, size_t cBlocks, UINT64 qwCount)
+{
+	UNREFERENCED_PARAMETER(pbKeys); UNREFERENCED_PARAMETER(uRounds);
+	UNREFERENCED_PARAMETER(pbBlocks); UNREFERENCED_PARAMETER(cBlocks);
+	UNREFERENCED_PARAMETER(qwCount);
+	ASSERT(FALSE);
+}
+
+#endif // KP_AESNI_AVAILABLE
@@ -0,0 +1,64 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef ___AES_NI_H___
+#define ___AES_NI_H___
+
+#pragma once
+
+#include "../SysDefEx.h"
+
+// The AES-NI intrinsics (wmmintrin.h) require Visual Studio 2008 SP1
+#if !defined(_WIN32_WCE) && (defined(_M_IX86) || defined(_M_X64)) && \
+	defined(_MSC_FULL_VER) && (_MSC_FULL_VER >= 150030729)
+#define KP_AESNI_AVAILABLE
+#define KP_AESNI_TARGET
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define KP_AESNI_AVAILABLE
+#define KP_AESNI_TARGET __attribute__((target("aes,sse2")))
+#endif
+
+// The following functions use the AES instructions of x86/x64 processors.
+// The round keys (uRounds + 1 consecutive 16-byte keys) have the layout
+// of CRijndael's expanded key; for decryption, they are the keys of the
+// equivalent inverse cipher. Except AesNi_IsSupported, the functions may
+// only be called if AesNi_IsSupported returns true.
+
+bool AesNi_IsSupported();
+
+void AesNi_EncryptEcb(const UINT8* pbKeys, UINT32 uRounds, const UINT8* pbIn,
+	UINT8* pbOut, size_t cBlocks);
+void AesNi_DecryptEcb(const UINT8* pbKeys, UINT32 uRounds, const UINT8* pbIn,
+	UINT8* pbOut, size_t cBlocks);
+
+// pbIV16 is updated (to the last ciphertext block); pbIn and pbOut may
+// be the same buffer
+void AesNi_EncryptCbc(const UINT8* pbKeys, UINT32 uRounds, UINT8* pbIV16,
+	const UINT8* pbIn, UINT8* pbOut, size_t cBlocks);
+void AesNi_DecryptCbc(const UINT8* pbKeys, UINT32 uRounds, UINT8* pbIV16,
+	const UINT8* pbIn, UINT8* pbOut, size_t cBlocks);
+
+// Encrypt each of the blocks qwCount times (ECB); the blocks are
+// independent chains, which are processed interleaved in order to keep
+// the AES pipeline of the processor busy
+void AesNi_EncryptRepeated(const UINT8* pbKeys, UINT32 uRounds,
+	UINT8* pbBlocks, size_t cBlocks, UINT64 qwCount);
+
+#endif // ___AES_NI_H___
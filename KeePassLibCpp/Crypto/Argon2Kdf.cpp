@@ -0,0 +1,146 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "StdAfx.h"
+#include "../SysDefEx.h"
+#include <mmsystem.h>
+#include "Argon2Kdf.h"
+#include "../Util/MemUtil.h"
+#include "../../KeePassLibC/Lib/Argon2/include/argon2.h"
+
+#include <boost/static_assert.hpp>
+
+BOOST_STATIC_ASSERT(ARGON2_TYPE_D == static_cast<int>(Argon2_d));
+BOOST_STATIC_ASSERT(ARGON2_TYPE_ID == static_cast<int>(Argon2_id));
+
+DWORD CArgon2Kdf::GetProcessorCount()
+{
+	// No multi-threading support for _WIN32_WCE builds
+#ifdef _WIN32_WCE
+	return 1;
+#else
+	SYSTEM_INFO si;
+	ZeroMemory(&si, sizeof(SYSTEM_INFO));
+	GetSystemInfo(&si);
+
+	return ((si.dwNumberOfProcessors != 0) ? si.dwNumberOfProcessors : 1);
+#endif
+}
+
+void CArgon2Kdf::GetDefaultParams(PW_ARGON2_PARAMS* pParams)
+{
+	if(pParams == NULL) { ASSERT(FALSE); return; }
+
+	pParams->dwType = ARGON2_TYPE_D;
+	pParams->dwVersion = ARGON2_VERSION_13;
+	pParams->dwIterations = ARGON2KDF_STD_ITERATIONS;
+	pParams->dwMemoryKB = ARGON2KDF_STD_MEMORY_KB;
+	pParams->dwParallelism = min(GetProcessorCount(), static_cast<DWORD>(
+		ARGON2KDF_STD_PARALLELISM));
+}
+
+bool CArgon2Kdf::IsValid(const PW_ARGON2_PARAMS* pParams)
+{
+	if(pParams == NULL) { ASSERT(FALSE); return false; }
+
+	if((pParams->dwType != ARGON2_TYPE_D) && (pParams->dwType != ARGON2_TYPE_ID))
+		return false;
+	if((pParams->dwVersion != ARGON2_VERSION_10) && (pParams->dwVersion !=
+		ARGON2_VERSION_13)) return false;
+	if(pParams->dwIterations < ARGON2_MIN_TIME) return false;
+	if((pParams->dwParallelism < ARGON2_MIN_LANES) || (pParams->dwParallelism >
+		ARGON2KDF_MAX_PARALLELISM)) return false;
+
+	// At least 8 KB per lane (ARGON2_SYNC_POINTS * 2 blocks)
+	if(pParams->dwMemoryKB < (8 * pParams->dwParallelism)) return false;
+	if(pParams->dwMemoryKB > ARGON2KDF_MAX_MEMORY_KB) return false;
+
+	return true;
+}
+
+bool CArgon2Kdf::Transform(const PW_ARGON2_PARAMS* pParams, BYTE* pbKey32,
+	const BYTE* pbSeed32, const volatile LONG* plCancel)
+{
+	if((pbKey32 == NULL) || (pbSeed32 == NULL)) { ASSERT(FALSE); return false; }
+	if(!IsValid(pParams)) { ASSERT(FALSE); return false; }
+
+	BYTE vOut[32];
+	BYTE vSalt[32];
+	memcpy(&vSalt[0], pbSeed32, 32);
+
+	argon2_context ctx;
+	ZeroMemory(&ctx, sizeof(argon2_context));
+	ctx.out = &vOut[0];
+	ctx.outlen = 32;
+	ctx.pwd = pbKey32;
+	ctx.pwdlen = 32;
+	ctx.salt = &vSalt[0];
+	ctx.saltlen = 32;
+	ctx.t_cost = pParams->dwIterations;
+	ctx.m_cost = pParams->dwMemoryKB;
+	ctx.lanes = pParams->dwParallelism;
+	ctx.threads = min(pParams->dwParallelism, GetProcessorCount()); // Result independent of this
+	ctx.version = pParams->dwVersion;
+	ctx.flags = ARGON2_DEFAULT_FLAGS; // The memory blocks are erased by core.c
+	ctx.cancel = plCancel;
+
+	const int r = argon2_ctx(&ctx, static_cast<argon2_type>(pParams->dwType));
+	if(r == ARGON2_OK) memcpy(pbKey32, &vOut[0], 32);
+	else { ASSERT((r == ARGON2_MEMORY_ALLOCATION_ERROR) || (r == ARGON2_CANCELLED)); }
+
+	mem_erase(&vOut[0], 32);
+	return (r == ARGON2_OK);
+}
+
+DWORD CArgon2Kdf::Benchmark(const PW_ARGON2_PARAMS* pParams, DWORD dwTimeMs)
+{
+	if(dwTimeMs == 0) { ASSERT(FALSE); return ARGON2_MIN_TIME; }
+
+	PW_ARGON2_PARAMS p;
+	memcpy(&p, pParams, sizeof(PW_ARGON2_PARAMS));
+	p.dwIterations = ARGON2_MIN_TIME;
+	if(!IsValid(&p)) { ASSERT(FALSE); return ARGON2_MIN_TIME; }
+
+	BYTE vKey[32], vSeed[32];
+	memset(&vKey[0], 0x4B, 32);
+	memset(&vSeed[0], 0x7E, 32);
+
+	// The time per iteration is roughly constant, but the first one
+	// includes the memory allocation; measure with at least a quarter of
+	// the requested time and extrapolate
+	const DWORD dwMinMeasure = max(dwTimeMs >> 2, static_cast<DWORD>(1));
+	DWORD dwElapsed = 0;
+	while(true)
+	{
+		const DWORD dwStartTime = timeGetTime();
+		if(!Transform(&p, &vKey[0], &vSeed[0])) return ARGON2_MIN_TIME;
+		dwElapsed = timeGetTime() - dwStartTime;
+
+		if((dwElapsed >= dwMinMeasure) || (p.dwIterations >= (DWORD_MAX >> 1)))
+			break;
+		p.dwIterations <<= 1;
+	}
+
+	const UINT64 qwIterations = (static_cast<UINT64>(p.dwIterations) *
+		dwTimeMs) / max(dwElapsed, static_cast<DWORD>(1));
+	if(qwIterations < ARGON2_MIN_TIME) return ARGON2_MIN_TIME;
+	if(qwIterations > static_cast<UINT64>(DWORD_MAX - 1)) return (DWORD_MAX - 1);
+	return static_cast<DWORD>(qwIterations);
+}
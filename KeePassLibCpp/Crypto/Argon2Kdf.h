@@ -0,0 +1,68 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef ___ARGON2_KDF_H___
+#define ___ARGON2_KDF_H___
+
+#pragma once
+
+#include "../PwStructs.h"
+
+// Argon2 variants (dwType field of PW_ARGON2_PARAMS; values of argon2_type)
+#define ARGON2_TYPE_D  0
+#define ARGON2_TYPE_ID 2
+
+#define ARGON2KDF_STD_ITERATIONS  2
+#define ARGON2KDF_STD_MEMORY_KB   (64 * 1024)
+#define ARGON2KDF_STD_PARALLELISM 16 // Upper bound, see GetDefaultParams
+
+#define ARGON2KDF_MAX_PARALLELISM 64
+
+// Upper bound for the memory parameter; protects against files that
+// would make the application allocate all of the address space
+#ifdef _WIN64
+#define ARGON2KDF_MAX_MEMORY_KB (4 * 1024 * 1024)
+#else
+#define ARGON2KDF_MAX_MEMORY_KB (1024 * 1024)
+#endif
+
+// Key derivation using the reference Argon2 implementation (KeePassLibC/Lib/Argon2);
+// the lanes are processed by up to one thread per processor
+class CArgon2Kdf
+{
+public:
+	// Argon2d with one lane per processor (at most ARGON2KDF_STD_PARALLELISM)
+	static void GetDefaultParams(PW_ARGON2_PARAMS* pParams);
+	static bool IsValid(const PW_ARGON2_PARAMS* pParams);
+
+	// Transform the 32-byte key pbKey32 in-place, using the 32-byte salt pbSeed32;
+	// fails as soon as *plCancel (if not NULL) becomes nonzero
+	static bool Transform(const PW_ARGON2_PARAMS* pParams, BYTE* pbKey32,
+		const BYTE* pbSeed32, const volatile LONG* plCancel = NULL);
+
+	// Number of iterations that take about dwTimeMs (with the type,
+	// memory and parallelism of pParams)
+	static DWORD Benchmark(const PW_ARGON2_PARAMS* pParams, DWORD dwTimeMs);
+
+private:
+	static DWORD GetProcessorCount();
+};
+
+#endif // ___ARGON2_KDF_H___
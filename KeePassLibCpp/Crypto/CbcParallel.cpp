@@ -0,0 +1,303 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "StdAfx.h"
+#include "CbcParallel.h"
+#include "../PwManager.h"
+#include "../Util/MemUtil.h"
+
+#include <boost/static_assert.hpp>
+
+BOOST_STATIC_ASSERT((CBCPD_MIN_RANGE_SIZE % 16) == 0);
+
+// Memory-mapped ciphertexts raise EXCEPTION_IN_PAGE_ERROR on I/O errors;
+// no C++ objects must be used within these functions (SEH)
+static int Priv_ChainDecrypt(CRijndael* pAes, CTwofish* pTwofish,
+	int nAlgorithm, const BYTE* pbIn, int cbIn, BYTE* pbOut)
+{
+#if defined(_MSC_VER) && !defined(_WIN32_WCE)
+	__try
+	{
+#endif
+		if(nAlgorithm == ALGO_AES)
+			return pAes->ChainDecrypt(pbIn, cbIn, pbOut);
+		if(nAlgorithm == ALGO_TWOFISH)
+			return pTwofish->ChainDecrypt(pbIn, static_cast<INT32>(cbIn), pbOut);
+#if defined(_MSC_VER) && !defined(_WIN32_WCE)
+	}
+	__except((GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR) ?
+		EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+	{
+		return CBCPD_IN_PAGE_ERROR;
+	}
+#endif
+
+	ASSERT(FALSE);
+	return -1;
+}
+
+static bool Priv_CopyBlock(const BYTE* pbSrc, BYTE* pbDst16)
+{
+#if defined(_MSC_VER) && !defined(_WIN32_WCE)
+	__try
+	{
+#endif
+		memcpy(pbDst16, pbSrc, 16);
+		return true;
+#if defined(_MSC_VER) && !defined(_WIN32_WCE)
+	}
+	__except((GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR) ?
+		EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+	{
+		return false;
+	}
+#endif
+}
+
+static bool Priv_InitCipher(CRijndael* pAes, CTwofish* pTwofish, int nAlgorithm,
+	const BYTE* pbKey32, const BYTE* pbIV16)
+{
+	if(nAlgorithm == ALGO_AES)
+		return (pAes->Init(CRijndael::CBC, CRijndael::DecryptDir, pbKey32,
+			CRijndael::Key32Bytes, pbIV16) == RIJNDAEL_SUCCESS);
+	if(nAlgorithm == ALGO_TWOFISH)
+		return pTwofish->Init(pbKey32, 32, pbIV16);
+
+	ASSERT(FALSE);
+	return false;
+}
+
+CCbcParallelDecryptor::CCbcParallelDecryptor() : m_nAlgorithm(-1), m_lExit(0)
+{
+	ZeroMemory(m_aKey, 32);
+}
+
+CCbcParallelDecryptor::~CCbcParallelDecryptor()
+{
+	StopWorkers();
+	mem_erase(m_aKey, 32);
+}
+
+DWORD CCbcParallelDecryptor::GetMaxThreads()
+{
+	// No multi-threading support for _WIN32_WCE builds
+#ifdef _WIN32_WCE
+	return 1;
+#else
+	SYSTEM_INFO si;
+	ZeroMemory(&si, sizeof(SYSTEM_INFO));
+	GetSystemInfo(&si);
+
+	const DWORD dwCpus = ((si.dwNumberOfProcessors != 0) ? si.dwNumberOfProcessors : 1);
+	return min(dwCpus, static_cast<DWORD>(CBCPD_MAX_THREADS));
+#endif
+}
+
+bool CCbcParallelDecryptor::Init(int nAlgorithm, const BYTE* pbKey32,
+	const BYTE* pbIV16)
+{
+	m_nAlgorithm = -1;
+	if((pbKey32 == NULL) || (pbIV16 == NULL)) { ASSERT(FALSE); return false; }
+
+	if(!Priv_InitCipher(&m_aes, &m_twofish, nAlgorithm, pbKey32, pbIV16))
+		return false;
+
+	memcpy(m_aKey, pbKey32, 32);
+	m_nAlgorithm = nAlgorithm;
+	return true;
+}
+
+int CCbcParallelDecryptor::ChainDecrypt(const BYTE* pbIn, int cbIn, BYTE* pbOut)
+{
+	if(m_nAlgorithm < 0) { ASSERT(FALSE); return -1; }
+	if((pbIn == NULL) || (pbOut == NULL) || (cbIn <= 0)) return 0;
+	if((cbIn % 16) != 0) { ASSERT(FALSE); return -1; }
+
+	size_t cRanges = min(static_cast<size_t>(GetMaxThreads()),
+		static_cast<size_t>(cbIn / CBCPD_MIN_RANGE_SIZE));
+	if(cRanges > 1) cRanges = min(cRanges, StartWorkers(cRanges - 1) + 1);
+
+	if(cRanges <= 1)
+		return Priv_ChainDecrypt(&m_aes, &m_twofish, m_nAlgorithm, pbIn, cbIn, pbOut);
+
+	// The chaining values (previous ciphertext blocks) must be read
+	// before any range is decrypted, as the decryption may be in-place
+	BYTE aNextIV[16];
+	if(!Priv_CopyBlock(pbIn + cbIn - 16, aNextIV)) return CBCPD_IN_PAGE_ERROR;
+
+	const size_t cBlocks = static_cast<size_t>(cbIn / 16);
+	const size_t cBlocksPerRange = cBlocks / cRanges;
+
+	CBCPD_JOB jFirst;
+	ZeroMemory(&jFirst, sizeof(CBCPD_JOB));
+
+	size_t iBlock = 0;
+	for(size_t i = 0; i < cRanges; ++i)
+	{
+		CBCPD_JOB* p = ((i == 0) ? &jFirst : m_vWorkers[i - 1]);
+		const size_t cRangeBlocks = ((i == (cRanges - 1)) ? (cBlocks - iBlock) :
+			cBlocksPerRange);
+
+		p->pbIn = pbIn + (iBlock << 4);
+		p->pbOut = pbOut + (iBlock << 4);
+		p->cb = static_cast<int>(cRangeBlocks << 4);
+		p->nResult = -1;
+
+		if(i != 0)
+		{
+			if(!Priv_CopyBlock(p->pbIn - 16, p->aIV)) return CBCPD_IN_PAGE_ERROR;
+		}
+
+		iBlock += cRangeBlocks;
+	}
+	ASSERT(iBlock == cBlocks);
+
+	std::vector<HANDLE> vDone;
+	for(size_t i = 1; i < cRanges; ++i)
+	{
+		vDone.push_back(m_vWorkers[i - 1]->hDone);
+		VERIFY(SetEvent(m_vWorkers[i - 1]->hStart));
+	}
+
+	// The first range continues the current chain
+	jFirst.nResult = Priv_ChainDecrypt(&m_aes, &m_twofish, m_nAlgorithm,
+		jFirst.pbIn, jFirst.cb, jFirst.pbOut);
+
+	VERIFY(WaitForMultipleObjects(static_cast<DWORD>(vDone.size()), &vDone[0],
+		TRUE, INFINITE) != WAIT_FAILED);
+
+	int nResult = cbIn;
+	for(size_t i = 0; i < cRanges; ++i)
+	{
+		const CBCPD_JOB* p = ((i == 0) ? &jFirst : m_vWorkers[i - 1]);
+		if(p->nResult == CBCPD_IN_PAGE_ERROR) nResult = CBCPD_IN_PAGE_ERROR;
+		else if((p->nResult != p->cb) && (nResult > 0)) nResult = -1;
+	}
+
+	// Continue the chain after the last range
+	if(!Priv_InitCipher(&m_aes, &m_twofish, m_nAlgorithm, m_aKey, aNextIV))
+		{ ASSERT(FALSE); return -1; }
+	return nResult;
+}
+
+int CCbcParallelDecryptor::PadDecrypt(const BYTE* pbIn, int cbIn, BYTE* pbOut)
+{
+	if((pbIn == NULL) || (pbOut == NULL) || (cbIn <= 0)) return 0;
+	if((cbIn % 16) != 0) return -1;
+
+	const int nDec = ChainDecrypt(pbIn, cbIn, pbOut);
+	if(nDec != cbIn) return ((nDec < 0) ? nDec : -1);
+
+	const BYTE bPad = pbOut[cbIn - 1];
+	if((bPad == 0) || (bPad > 16)) return -1;
+	for(int i = cbIn - bPad; i < cbIn; ++i)
+	{
+		if(pbOut[i] != bPad) return -1;
+	}
+
+	return (cbIn - bPad);
+}
+
+void CCbcParallelDecryptor::RunJob(CBCPD_JOB* pJob) const
+{
+	CRijndael aes;
+	CTwofish twofish;
+	if(!Priv_InitCipher(&aes, &twofish, m_nAlgorithm, m_aKey, pJob->aIV))
+		{ pJob->nResult = -1; return; }
+
+	pJob->nResult = Priv_ChainDecrypt(&aes, &twofish, m_nAlgorithm, pJob->pbIn,
+		pJob->cb, pJob->pbOut);
+}
+
+DWORD WINAPI CCbcParallelDecryptor::WorkerThreadProc(LPVOID lpParameter)
+{
+	CBCPD_JOB* p = (CBCPD_JOB*)lpParameter;
+	if(p == NULL) { ASSERT(FALSE); return 0; }
+
+	while(WaitForSingleObject(p->hStart, INFINITE) == WAIT_OBJECT_0)
+	{
+		if(p->pOwner->m_lExit != 0) break;
+
+		p->pOwner->RunJob(p);
+		VERIFY(SetEvent(p->hDone));
+	}
+
+	return 0;
+}
+
+// Returns the number of available workers (may be less than requested)
+size_t CCbcParallelDecryptor::StartWorkers(size_t cWorkers)
+{
+	// No multi-threading support for _WIN32_WCE builds
+#ifndef _WIN32_WCE
+	while(m_vWorkers.size() < cWorkers)
+	{
+		CBCPD_JOB* p = NULL;
+		try { p = new CBCPD_JOB; }
+		catch(...) { p = NULL; }
+		if(p == NULL) { ASSERT(FALSE); break; }
+		ZeroMemory(p, sizeof(CBCPD_JOB));
+
+		p->pOwner = this;
+		p->hStart = CreateEvent(NULL, FALSE, FALSE, NULL);
+		p->hDone = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+		DWORD dwThreadId = 0; // Pointer may not be NULL on Windows 9x/Me
+		if((p->hStart != NULL) && (p->hDone != NULL))
+			p->hThread = CreateThread(NULL, 0, WorkerThreadProc, p, 0, &dwThreadId);
+
+		if(p->hThread == NULL)
+		{
+			ASSERT(FALSE);
+			if(p->hStart != NULL) VERIFY(CloseHandle(p->hStart));
+			if(p->hDone != NULL) VERIFY(CloseHandle(p->hDone));
+			delete p;
+			break;
+		}
+
+		m_vWorkers.push_back(p);
+	}
+#else
+	UNREFERENCED_PARAMETER(cWorkers);
+#endif
+
+	return m_vWorkers.size();
+}
+
+void CCbcParallelDecryptor::StopWorkers()
+{
+	InterlockedExchange(&m_lExit, 1);
+
+	for(size_t i = 0; i < m_vWorkers.size(); ++i)
+	{
+		CBCPD_JOB* p = m_vWorkers[i];
+
+		VERIFY(SetEvent(p->hStart));
+		VERIFY(WaitForSingleObject(p->hThread, INFINITE) == WAIT_OBJECT_0);
+
+		VERIFY(CloseHandle(p->hThread));
+		VERIFY(CloseHandle(p->hStart));
+		VERIFY(CloseHandle(p->hDone));
+		delete p;
+	}
+
+	m_vWorkers.clear();
+	InterlockedExchange(&m_lExit, 0);
+}
@@ -0,0 +1,102 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef ___CBC_PARALLEL_H___
+#define ___CBC_PARALLEL_H___
+
+#pragma once
+
+#include "../SysDefEx.h"
+#include "Rijndael.h"
+#include "TwofishClass.h"
+#include <vector>
+#include <boost/utility.hpp>
+
+// Returned by ChainDecrypt and PadDecrypt when an I/O error occurred while
+// reading the ciphertext from a memory-mapped file
+#define CBCPD_IN_PAGE_ERROR (-1000)
+
+// Ciphertexts shorter than this are not split (per thread)
+#define CBCPD_MIN_RANGE_SIZE 65536
+
+#define CBCPD_MAX_THREADS 8
+
+// CBC decryption is parallelizable, because each plaintext block only
+// depends on two ciphertext blocks. This class splits the ciphertext into
+// ranges, which are decrypted concurrently by the calling thread and a set
+// of worker threads. The workers are created on first use and terminated
+// by the destructor, thus one object should be used for all chunks of one
+// ciphertext.
+class CCbcParallelDecryptor : boost::noncopyable
+{
+public:
+	CCbcParallelDecryptor();
+	virtual ~CCbcParallelDecryptor();
+
+	// nAlgorithm is ALGO_AES or ALGO_TWOFISH
+	bool Init(int nAlgorithm, const BYTE* pbKey32, const BYTE* pbIV16);
+
+	// Decrypts complete blocks and keeps the chaining value
+	// Input len is in BYTES and must be a multiple of 16!
+	// pbIn and pbOut may be the same buffer
+	// Returns the decrypted buffer length in BYTES or an error code < 0
+	int ChainDecrypt(const BYTE* pbIn, int cbIn, BYTE* pbOut);
+
+	// Decrypts a complete ciphertext; the padding (PKCS #7) is checked
+	// and removed at the end only
+	// Returns the plaintext length in BYTES or an error code < 0
+	int PadDecrypt(const BYTE* pbIn, int cbIn, BYTE* pbOut);
+
+	// Maximum number of threads (including the calling one) used
+	static DWORD GetMaxThreads();
+
+private:
+	struct CBCPD_JOB
+	{
+		CCbcParallelDecryptor* pOwner;
+		HANDLE hThread;
+		HANDLE hStart; // Auto-reset
+		HANDLE hDone; // Auto-reset
+
+		const BYTE* pbIn;
+		BYTE* pbOut;
+		int cb;
+		BYTE aIV[16];
+		int nResult;
+	};
+
+	size_t StartWorkers(size_t cWorkers);
+	void StopWorkers();
+	void RunJob(CBCPD_JOB* pJob) const;
+	static DWORD WINAPI WorkerThreadProc(LPVOID lpParameter);
+
+	int m_nAlgorithm;
+	BYTE m_aKey[32];
+
+	// Used by the calling thread if the ciphertext is not split; they
+	// hold the chaining value
+	CRijndael m_aes;
+	CTwofish m_twofish;
+
+	std::vector<CBCPD_JOB*> m_vWorkers;
+	volatile LONG m_lExit;
+};
+
+#endif // ___CBC_PARALLEL_H___
@@ -21,23 +21,47 @@
 #include <boost/static_assert.hpp>
 #include "SHA2/EDefs.h"
 #include "../Util/MemUtil.h"
+#include <mmsystem.h>
+#include <vector>
 #include "ChaCha20.h"
+#include "ChaCha20Simd.h"
 
 #pragma intrinsic(_rotl, _rotr)
 
-CChaCha20::CChaCha20(const BYTE* pbKey32, const BYTE* pbIV12, bool bLargeCounter) :
-	CCtrBlockCipher(64), m_bLargeCounter(bLargeCounter)
+static void ChaCha20_InitState(UINT32* s, const BYTE* pbKey32, const BYTE* pbIV12)
 {
-	m_s[0] = 0x61707865;
-	m_s[1] = 0x3320646E;
-	m_s[2] = 0x79622D32;
-	m_s[3] = 0x6B206574;
+	s[0] = 0x61707865;
+	s[1] = 0x3320646E;
+	s[2] = 0x79622D32;
+	s[3] = 0x6B206574;
 
 	BOOST_STATIC_ASSERT(PLATFORM_BYTE_ORDER == IS_LITTLE_ENDIAN);
-	memcpy(&m_s[4], pbKey32, 32); // m_s[4] to m_s[11]
+	memcpy(&s[4], pbKey32, 32); // s[4] to s[11]
+
+	s[12] = 0; // Counter
+	memcpy(&s[13], pbIV12, 12); // s[13] to s[15]
+}
+
+// Compute the block x for the state s (without incrementing the counter)
+static void ChaCha20_Block(const UINT32* s, UINT32* x);
+
+// Returns false if the counter overflows and no large counter is used
+static bool ChaCha20_IncCounter(UINT32* s, bool bLargeCounter)
+{
+	++s[12];
+	if(s[12] == 0)
+	{
+		if(!bLargeCounter) { ASSERT(FALSE); return false; }
+		++s[13]; // Increment high half of large counter
+	}
 
-	m_s[12] = 0; // Counter
-	memcpy(&m_s[13], pbIV12, 12); // m_s[13] to m_s[15]
+	return true;
+}
+
+CChaCha20::CChaCha20(const BYTE* pbKey32, const BYTE* pbIV12, bool bLargeCounter) :
+	CCtrBlockCipher(64), m_bLargeCounter(bLargeCounter)
+{
+	ChaCha20_InitState(&m_s[0], pbKey32, pbIV12);
 }
 
 CChaCha20::~CChaCha20()
@@ -49,8 +73,14 @@ HRESULT CChaCha20::NextBlock(BYTE* pbBlock)
 {
 	if(pbBlock == NULL) { ASSERT(FALSE); return E_POINTER; }
 
-	UINT32* s = &m_s[0];
-	UINT32* x = reinterpret_cast<UINT32*>(pbBlock);
+	ChaCha20_Block(&m_s[0], reinterpret_cast<UINT32*>(pbBlock));
+
+	if(!ChaCha20_IncCounter(&m_s[0], m_bLargeCounter)) return E_FAIL;
+	return S_OK;
+}
+
+static void ChaCha20_Block(const UINT32* s, UINT32* x)
+{
 	memcpy(x, s, 16 * sizeof(UINT32));
 
 	// 10 * 8 quarter rounds = 20 rounds
@@ -132,15 +162,6 @@ HRESULT CChaCha20::NextBlock(BYTE* pbBlock)
 	}
 
 	for(size_t i = 0; i < 16; ++i) x[i] += s[i];
-
-	++s[12];
-	if(s[12] == 0)
-	{
-		if(!m_bLargeCounter) { ASSERT(FALSE); return E_FAIL; }
-		++s[13]; // Increment high half of large counter
-	}
-
-	return S_OK;
 }
 
 HRESULT CChaCha20::Seek(INT64 iOffset, int sOrigin)
@@ -161,6 +182,15 @@ HRESULT CChaCha20::Seek(INT64 iOffset, int sOrigin)
 
 HRESULT CChaCha20::Crypt(BYTE* pbMsg, size_t cbMsg, const BYTE* pbKey32,
 	const BYTE* pbIV12, bool bLargeCounter)
+{
+	return CryptEx(pbMsg, cbMsg, pbKey32, pbIV12, bLargeCounter, true);
+}
+
+// Same result as Encrypt of a new CChaCha20 object, but without any heap
+// allocation (this is called for each entry password that is protected
+// or unprotected)
+HRESULT CChaCha20::CryptEx(BYTE* pbMsg, size_t cbMsg, const BYTE* pbKey32,
+	const BYTE* pbIV12, bool bLargeCounter, bool bSimd)
 {
 	if(pbMsg == NULL) { ASSERT(FALSE); return E_POINTER; }
 	if(cbMsg == 0) return S_OK;
@@ -170,6 +200,69 @@ HRESULT CChaCha20::Crypt(BYTE* pbMsg, size_t cbMsg, const BYTE* pbKey32,
 	if(pbIV12 != NULL) memcpy(aIV, pbIV12, 12);
 	else memset(aIV, 0, 12);
 
-	CChaCha20 c(pbKey32, aIV, bLargeCounter);
-	return c.Encrypt(pbMsg, 0, cbMsg);
+	UINT32 s[16];
+	ChaCha20_InitState(&s[0], pbKey32, aIV);
+
+	const size_t cSimd = (bSimd ? ChaCha20Simd_GetBlocks() : 0);
+	if(cSimd != 0)
+	{
+		// The SIMD code does not handle a wrapping 32-bit counter
+		UINT64 qwMaxBlocks = (cbMsg >> 6) / cSimd * cSimd;
+		const UINT64 qwToWrap = static_cast<UINT64>(UINT32_MAX) - s[12];
+		if(qwMaxBlocks > qwToWrap) qwMaxBlocks = qwToWrap / cSimd * cSimd;
+
+		const size_t cBlocks = static_cast<size_t>(qwMaxBlocks);
+		if(cBlocks != 0)
+		{
+			ChaCha20Simd_Xor(&s[0], pbMsg, cBlocks);
+
+			s[12] += static_cast<UINT32>(cBlocks);
+			pbMsg += (cBlocks << 6);
+			cbMsg -= (cBlocks << 6);
+		}
+	}
+
+	HRESULT hr = S_OK;
+	UINT32 x[16];
+	while(cbMsg != 0)
+	{
+		ChaCha20_Block(&s[0], &x[0]);
+		if(!ChaCha20_IncCounter(&s[0], bLargeCounter)) { hr = E_FAIL; break; }
+
+		const BYTE* pbBlock = reinterpret_cast<const BYTE*>(&x[0]);
+		const size_t cbBlock = min(cbMsg, static_cast<size_t>(64));
+		for(size_t u = 0; u < cbBlock; ++u) pbMsg[u] ^= pbBlock[u];
+
+		pbMsg += cbBlock;
+		cbMsg -= cbBlock;
+	}
+
+	mem_erase(&x[0], 16 * sizeof(UINT32));
+	mem_erase(&s[0], 16 * sizeof(UINT32));
+	return hr;
+}
+
+UINT64 CChaCha20::Benchmark(size_t cbMsg, DWORD dwTimeMs, bool bSimd)
+{
+	if((cbMsg == 0) || (dwTimeMs == 0)) { ASSERT(FALSE); return 0; }
+
+	BYTE vKey[32];
+	memset(&vKey[0], 0x4B, 32);
+
+	std::vector<BYTE> vMsg(cbMsg, 0x7E);
+
+	UINT64 qwBytes = 0;
+	const DWORD dwStartTime = timeGetTime();
+	DWORD dwElapsed = 0;
+	do
+	{
+		if(FAILED(CryptEx(&vMsg[0], cbMsg, &vKey[0], NULL, true, bSimd)))
+			{ ASSERT(FALSE); return 0; }
+
+		qwBytes += cbMsg;
+		dwElapsed = timeGetTime() - dwStartTime;
+	}
+	while(dwElapsed < dwTimeMs);
+
+	return ((qwBytes * 1000) / max(dwElapsed, static_cast<DWORD>(1)));
 }
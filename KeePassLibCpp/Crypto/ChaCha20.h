@@ -37,8 +37,16 @@ public:
 
 	HRESULT Seek(INT64 iOffset, int sOrigin);
 
+	// Encrypt/decrypt a message starting at block 0; long messages are
+	// processed 4/8 blocks at once using SSE2/AVX2, if supported
 	static HRESULT Crypt(BYTE* pbMsg, size_t cbMsg, const BYTE* pbKey32,
 		const BYTE* pbIV12 = NULL, bool bLargeCounter = true);
+	static HRESULT CryptEx(BYTE* pbMsg, size_t cbMsg, const BYTE* pbKey32,
+		const BYTE* pbIV12, bool bLargeCounter, bool bSimd);
+
+	// Number of bytes per second that CryptEx processes (in messages of
+	// cbMsg bytes)
+	static UINT64 Benchmark(size_t cbMsg, DWORD dwTimeMs, bool bSimd);
 
 protected:
 	virtual HRESULT NextBlock(BYTE* pbBlock);
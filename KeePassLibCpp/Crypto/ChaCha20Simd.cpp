@@ -0,0 +1,288 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "StdAfx.h"
+#include "ChaCha20Simd.h"
+#include "../Util/MemUtil.h"
+
+#ifdef KP_CHACHA20_SSE2_AVAILABLE
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <emmintrin.h>
+#endif
+
+#ifdef KP_CHACHA20_AVX2_AVAILABLE
+#include <immintrin.h>
+#endif
+
+#ifdef KP_CHACHA20_SSE2_AVAILABLE
+
+static volatile LONG g_lChaCha20SimdBlocks = -1;
+
+#ifdef KP_CHACHA20_AVX2_AVAILABLE
+static bool ChaCha20Simd_QueryAvx2(UINT32 uEcx1)
+{
+	// The OS must save the YMM registers (OSXSAVE, AVX, XCR0 bits 1 and 2)
+	if((uEcx1 & ((1U << 27) | (1U << 28))) != ((1U << 27) | (1U << 28)))
+		return false;
+
+#ifdef _MSC_VER
+	if((_xgetbv(0) & 6) != 6) return false;
+
+	int vInfo[4] = { 0, 0, 0, 0 };
+	__cpuid(vInfo, 0);
+	if(vInfo[0] < 7) return false;
+
+	__cpuidex(vInfo, 7, 0);
+	const UINT32 uEbx7 = static_cast<UINT32>(vInfo[1]);
+#else
+	UINT32 uXcrLow = 0, uXcrHigh = 0;
+	__asm__ __volatile__("xgetbv" : "=a"(uXcrLow), "=d"(uXcrHigh) : "c"(0));
+	if((uXcrLow & 6) != 6) return false;
+
+	if(__get_cpuid_max(0, NULL) < 7) return false;
+
+	unsigned int a = 0, b = 0, c = 0, d = 0;
+	__cpuid_count(7, 0, a, b, c, d);
+	const UINT32 uEbx7 = b;
+#endif
+
+	return ((uEbx7 & (1U << 5)) != 0);
+}
+#endif
+
+static LONG ChaCha20Simd_QueryCpu()
+{
+	UINT32 uEcx = 0, uEdx = 0;
+
+#ifdef _MSC_VER
+	int vInfo[4] = { 0, 0, 0, 0 };
+	__cpuid(vInfo, 0);
+	if(vInfo[0] < 1) return 0;
+
+	__cpuid(vInfo, 1);
+	uEcx = static_cast<UINT32>(vInfo[2]);
+	uEdx = static_cast<UINT32>(vInfo[3]);
+#else
+	unsigned int a = 0, b = 0, c = 0, d = 0;
+	if(__get_cpuid(1, &a, &b, &c, &d) == 0) return 0;
+	uEcx = c;
+	uEdx = d;
+#endif
+
+	if((uEdx & (1U << 26)) == 0) return 0; // No SSE2
+
+#ifdef KP_CHACHA20_AVX2_AVAILABLE
+	if(ChaCha20Simd_QueryAvx2(uEcx)) return 8;
+#else
+	UNREFERENCED_PARAMETER(uEcx);
+#endif
+
+	return 4;
+}
+
+size_t ChaCha20Simd_GetBlocks()
+{
+	if(g_lChaCha20SimdBlocks < 0) // Result is the same for all threads
+		g_lChaCha20SimdBlocks = ChaCha20Simd_QueryCpu();
+
+	return static_cast<size_t>(g_lChaCha20SimdBlocks);
+}
+
+#define CC20_ROTL_SSE2(v, n) _mm_or_si128(_mm_slli_epi32((v), (n)), \
+	_mm_srli_epi32((v), 32 - (n)))
+
+#define CC20_QR_SSE2(a, b, c, d) { \
+	a = _mm_add_epi32(a, b); d = CC20_ROTL_SSE2(_mm_xor_si128(d, a), 16); \
+	c = _mm_add_epi32(c, d); b = CC20_ROTL_SSE2(_mm_xor_si128(b, c), 12); \
+	a = _mm_add_epi32(a, b); d = CC20_ROTL_SSE2(_mm_xor_si128(d, a), 8); \
+	c = _mm_add_epi32(c, d); b = CC20_ROTL_SSE2(_mm_xor_si128(b, c), 7); }
+
+KP_CHACHA20_SSE2_TARGET static void ChaCha20Simd_Xor16(BYTE* pb, __m128i k)
+{
+	_mm_storeu_si128((__m128i*)pb, _mm_xor_si128(_mm_loadu_si128(
+		(const __m128i*)pb), k));
+}
+
+// Four blocks; x[i] contains word i of the four blocks
+KP_CHACHA20_SSE2_TARGET static void ChaCha20Simd_Xor4(const UINT32* s, BYTE* pb)
+{
+	__m128i o[16], x[16];
+	for(size_t i = 0; i < 16; ++i) o[i] = _mm_set1_epi32(static_cast<int>(s[i]));
+	o[12] = _mm_add_epi32(o[12], _mm_set_epi32(3, 2, 1, 0));
+	for(size_t i = 0; i < 16; ++i) x[i] = o[i];
+
+	for(size_t r = 0; r < 10; ++r)
+	{
+		CC20_QR_SSE2(x[0], x[4], x[ 8], x[12]);
+		CC20_QR_SSE2(x[1], x[5], x[ 9], x[13]);
+		CC20_QR_SSE2(x[2], x[6], x[10], x[14]);
+		CC20_QR_SSE2(x[3], x[7], x[11], x[15]);
+
+		CC20_QR_SSE2(x[0], x[5], x[10], x[15]);
+		CC20_QR_SSE2(x[1], x[6], x[11], x[12]);
+		CC20_QR_SSE2(x[2], x[7], x[ 8], x[13]);
+		CC20_QR_SSE2(x[3], x[4], x[ 9], x[14]);
+	}
+
+	for(size_t i = 0; i < 16; i += 4)
+	{
+		const __m128i a = _mm_add_epi32(x[i], o[i]);
+		const __m128i b = _mm_add_epi32(x[i + 1], o[i + 1]);
+		const __m128i c = _mm_add_epi32(x[i + 2], o[i + 2]);
+		const __m128i d = _mm_add_epi32(x[i + 3], o[i + 3]);
+
+		// Transpose, such that each vector contains 4 words of one block
+		const __m128i t0 = _mm_unpacklo_epi32(a, b);
+		const __m128i t1 = _mm_unpacklo_epi32(c, d);
+		const __m128i t2 = _mm_unpackhi_epi32(a, b);
+		const __m128i t3 = _mm_unpackhi_epi32(c, d);
+
+		BYTE* p = pb + (i << 2);
+		ChaCha20Simd_Xor16(p, _mm_unpacklo_epi64(t0, t1));
+		ChaCha20Simd_Xor16(p + 64, _mm_unpackhi_epi64(t0, t1));
+		ChaCha20Simd_Xor16(p + 128, _mm_unpacklo_epi64(t2, t3));
+		ChaCha20Simd_Xor16(p + 192, _mm_unpackhi_epi64(t2, t3));
+	}
+
+	mem_erase(&o[0], sizeof(o));
+	mem_erase(&x[0], sizeof(x));
+}
+
+#ifdef KP_CHACHA20_AVX2_AVAILABLE
+
+#define CC20_ROTL_AVX2(v, n) _mm256_or_si256(_mm256_slli_epi32((v), (n)), \
+	_mm256_srli_epi32((v), 32 - (n)))
+
+// Rotations by 16 and 8 bits are byte shuffles
+#define CC20_QR_AVX2(a, b, c, d) { \
+	a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), r16); \
+	c = _mm256_add_epi32(c, d); b = CC20_ROTL_AVX2(_mm256_xor_si256(b, c), 12); \
+	a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), r8); \
+	c = _mm256_add_epi32(c, d); b = CC20_ROTL_AVX2(_mm256_xor_si256(b, c), 7); }
+
+// Eight blocks; the 128-bit lanes contain blocks 0 to 3 and 4 to 7
+KP_CHACHA20_AVX2_TARGET static void ChaCha20Simd_Xor8(const UINT32* s, BYTE* pb)
+{
+	const __m256i r16 = _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10,
+		5, 4, 7, 6, 1, 0, 3, 2, 13, 12, 15, 14, 9, 8, 11, 10,
+		5, 4, 7, 6, 1, 0, 3, 2);
+	const __m256i r8 = _mm256_set_epi8(14, 13, 12, 15, 10, 9, 8, 11,
+		6, 5, 4, 7, 2, 1, 0, 3, 14, 13, 12, 15, 10, 9, 8, 11,
+		6, 5, 4, 7, 2, 1, 0, 3);
+
+	__m256i o[16], x[16];
+	for(size_t i = 0; i < 16; ++i) o[i] = _mm256_set1_epi32(static_cast<int>(s[i]));
+	o[12] = _mm256_add_epi32(o[12], _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+	for(size_t i = 0; i < 16; ++i) x[i] = o[i];
+
+	for(size_t r = 0; r < 10; ++r)
+	{
+		CC20_QR_AVX2(x[0], x[4], x[ 8], x[12]);
+		CC20_QR_AVX2(x[1], x[5], x[ 9], x[13]);
+		CC20_QR_AVX2(x[2], x[6], x[10], x[14]);
+		CC20_QR_AVX2(x[3], x[7], x[11], x[15]);
+
+		CC20_QR_AVX2(x[0], x[5], x[10], x[15]);
+		CC20_QR_AVX2(x[1], x[6], x[11], x[12]);
+		CC20_QR_AVX2(x[2], x[7], x[ 8], x[13]);
+		CC20_QR_AVX2(x[3], x[4], x[ 9], x[14]);
+	}
+
+	for(size_t i = 0; i < 16; i += 4)
+	{
+		const __m256i a = _mm256_add_epi32(x[i], o[i]);
+		const __m256i b = _mm256_add_epi32(x[i + 1], o[i + 1]);
+		const __m256i c = _mm256_add_epi32(x[i + 2], o[i + 2]);
+		const __m256i d = _mm256_add_epi32(x[i + 3], o[i + 3]);
+
+		// The unpack instructions operate on each 128-bit lane
+		const __m256i t0 = _mm256_unpacklo_epi32(a, b);
+		const __m256i t1 = _mm256_unpacklo_epi32(c, d);
+		const __m256i t2 = _mm256_unpackhi_epi32(a, b);
+		const __m256i t3 = _mm256_unpackhi_epi32(c, d);
+
+		const __m256i k0 = _mm256_unpacklo_epi64(t0, t1);
+		const __m256i k1 = _mm256_unpackhi_epi64(t0, t1);
+		const __m256i k2 = _mm256_unpacklo_epi64(t2, t3);
+		const __m256i k3 = _mm256_unpackhi_epi64(t2, t3);
+
+		BYTE* p = pb + (i << 2);
+		ChaCha20Simd_Xor16(p, _mm256_castsi256_si128(k0));
+		ChaCha20Simd_Xor16(p + 64, _mm256_castsi256_si128(k1));
+		ChaCha20Simd_Xor16(p + 128, _mm256_castsi256_si128(k2));
+		ChaCha20Simd_Xor16(p + 192, _mm256_castsi256_si128(k3));
+		ChaCha20Simd_Xor16(p + 256, _mm256_extracti128_si256(k0, 1));
+		ChaCha20Simd_Xor16(p + 320, _mm256_extracti128_si256(k1, 1));
+		ChaCha20Simd_Xor16(p + 384, _mm256_extracti128_si256(k2, 1));
+		ChaCha20Simd_Xor16(p + 448, _mm256_extracti128_si256(k3, 1));
+	}
+
+	mem_erase(&o[0], sizeof(o));
+	mem_erase(&x[0], sizeof(x));
+	_mm256_zeroupper();
+}
+
+#endif // KP_CHACHA20_AVX2_AVAILABLE
+
+void ChaCha20Simd_Xor(const UINT32* pState16, BYTE* pb, size_t cBlocks)
+{
+	const size_t cSimd = ChaCha20Simd_GetBlocks();
+	if((pState16 == NULL) || (pb == NULL) || (cSimd == 0)) { ASSERT(FALSE); return; }
+	ASSERT((cBlocks % cSimd) == 0);
+	ASSERT((static_cast<UINT64>(pState16[12]) + cBlocks) <= 0x100000000ULL);
+
+	UINT32 s[16];
+	memcpy(&s[0], pState16, 16 * sizeof(UINT32));
+
+	for(size_t i = cSimd; i <= cBlocks; i += cSimd)
+	{
+#ifdef KP_CHACHA20_AVX2_AVAILABLE
+		if(cSimd == 8) ChaCha20Simd_Xor8(&s[0], pb);
+		else
+#endif
+			ChaCha20Simd_Xor4(&s[0], pb);
+
+		s[12] += static_cast<UINT32>(cSimd);
+		pb += (cSimd << 6);
+	}
+
+	mem_erase(&s[0], 16 * sizeof(UINT32));
+}
+
+#else // !KP_CHACHA20_SSE2_AVAILABLE
+
+size_t ChaCha20Simd_GetBlocks()
+{
+	return 0;
+}
+
+void ChaCha20Simd_Xor(const UINT32* pState16, BYTE* pb, size_t cBlocks)
+{
+	UNREFERENCED_PARAMETER(pState16);
+	UNREFERENCED_PARAMETER(pb);
+	UNREFERENCED_PARAMETER(cBlocks);
+	ASSERT(FALSE);
+}
+
+#endif // KP_CHACHA20_SSE2_AVAILABLE
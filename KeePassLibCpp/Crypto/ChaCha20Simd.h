@@ -0,0 +1,56 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef ___CHACHA20_SIMD_H___
+#define ___CHACHA20_SIMD_H___
+
+#pragma once
+
+#include "../SysDefEx.h"
+
+// The SSE2 intrinsics are supported by all compilers that can build
+// KeePass; the AVX2 intrinsics require Visual Studio 2012
+#if !defined(_WIN32_WCE) && (defined(_M_IX86) || defined(_M_X64)) && \
+	defined(_MSC_VER)
+#define KP_CHACHA20_SSE2_AVAILABLE
+#define KP_CHACHA20_SSE2_TARGET
+#if (_MSC_VER >= 1700)
+#define KP_CHACHA20_AVX2_AVAILABLE
+#define KP_CHACHA20_AVX2_TARGET
+#endif
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define KP_CHACHA20_SSE2_AVAILABLE
+#define KP_CHACHA20_SSE2_TARGET __attribute__((target("sse2")))
+#define KP_CHACHA20_AVX2_AVAILABLE
+#define KP_CHACHA20_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+// Number of ChaCha20 blocks that ChaCha20Simd_Xor processes at once:
+// 8 (AVX2), 4 (SSE2) or 0 (no SIMD support)
+size_t ChaCha20Simd_GetBlocks();
+
+// XOR pb with cBlocks keystream blocks (64 bytes each), using the state
+// pState16 (RFC 8439 layout; the block counter pState16[12] is the
+// counter of the first block). cBlocks must be a multiple of
+// ChaCha20Simd_GetBlocks and the 32-bit counter must not wrap.
+// pState16 is not modified.
+void ChaCha20Simd_Xor(const UINT32* pState16, BYTE* pb, size_t cBlocks);
+
+#endif // ___CHACHA20_SIMD_H___
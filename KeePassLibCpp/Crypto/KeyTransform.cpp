@@ -52,7 +52,8 @@ void CKeyTransform::Run()
 	if(pbData == NULL) { ASSERT(FALSE); return; }
 
 	CKeyTransformBCrypt ktBCrypt;
-	if(FAILED(ktBCrypt.TransformKey(m_pKey, pbData, m_qwRounds)))
+	if(CRijndael::IsAesNiSupported() ||
+		FAILED(ktBCrypt.TransformKey(m_pKey, pbData, m_qwRounds)))
 	{
 		memcpy(pbData, m_pBuf, 16);
 
@@ -60,8 +61,7 @@ void CKeyTransform::Run()
 		if(aes.Init(CRijndael::ECB, CRijndael::EncryptDir, m_pKey,
 			CRijndael::Key32Bytes, 0) != RIJNDAEL_SUCCESS) { ASSERT(FALSE); return; }
 
-		for(UINT64 qw = m_qwRounds; qw != 0; --qw)
-			aes.BlockEncrypt(pbData, 128, pbData);
+		if(aes.EncryptRepeated(pbData, 1, m_qwRounds) != 1) { ASSERT(FALSE); return; }
 	}
 
 	memcpy(m_pBuf, pbData, 16);
@@ -89,6 +89,23 @@ bool CKeyTransform::Transform256(UINT64 qwRounds, UINT8* pBuffer256,
 	BYTE vKey[32]; // Local copy of the transformation key
 	memcpy(&vKey[0], pKeySeed256, 32);
 
+	// With AES-NI, both halves are transformed interleaved by one thread,
+	// which keeps the AES pipeline of the processor busy
+	if(CRijndael::IsAesNiSupported())
+	{
+		CRijndael aes;
+		const bool bAes = ((aes.Init(CRijndael::ECB, CRijndael::EncryptDir,
+			&vKey[0], CRijndael::Key32Bytes, NULL) == RIJNDAEL_SUCCESS) &&
+			(aes.EncryptRepeated(&vBuf[0], 2, qwRounds) == 2));
+
+		if(bAes) memcpy(pBuffer256, &vBuf[0], 32);
+		else { ASSERT(FALSE); }
+
+		mem_erase(&vBuf[0], 32);
+		mem_erase(&vKey[0], 32);
+		return bAes;
+	}
+
 	CKeyTransform ktLeft(qwRounds, &vBuf[0], &vKey[0]);
 	CKeyTransform ktRight(qwRounds, &vBuf[16], &vKey[0]);
 
@@ -99,9 +116,16 @@ bool CKeyTransform::Transform256(UINT64 qwRounds, UINT8* pBuffer256,
 #else
 	DWORD dwThreadId = 0; // Pointer may not be NULL on Windows 9x/Me
 	HANDLE hLeft = CreateThread(NULL, 0, CKeyTrf_ThreadProc,
-		&ktLeft, 0, &dwThreadId);
+		&ktLeft, CREATE_SUSPENDED, &dwThreadId);
 	if(hLeft == NULL) { ASSERT(FALSE); return false; }
 
+	// Run both halves with the priority of the calling thread (which
+	// may be a low-priority background thread)
+	const int nPriority = GetThreadPriority(GetCurrentThread());
+	if(nPriority != THREAD_PRIORITY_ERROR_RETURN)
+		SetThreadPriority(hLeft, nPriority);
+	VERIFY(ResumeThread(hLeft) != static_cast<DWORD>(-1));
+
 	ktRight.Run();
 
 	VERIFY(WaitForSingleObject(hLeft, INFINITE) == WAIT_OBJECT_0);
@@ -118,6 +142,14 @@ bool CKeyTransform::Transform256(UINT64 qwRounds, UINT8* pBuffer256,
 
 UINT64 CKeyTransform::Benchmark(DWORD dwTimeMs)
 {
+	// Same as in Transform256: one thread transforms both halves
+	if(CRijndael::IsAesNiSupported())
+	{
+		CKeyTransformBenchmark kt(dwTimeMs);
+		kt.Run();
+		return kt.GetComputedRounds();
+	}
+
 	CKeyTransformBenchmark ktLeft(dwTimeMs), ktRight(dwTimeMs);
 
 	// No multi-threading support for _WIN32_WCE builds
@@ -159,26 +191,30 @@ void CKeyTransformBenchmark::Run()
 	BYTE vKey[32];
 	memset(&vKey[0], 0x4B, 32);
 
-	CAlignedBuffer abData(16, 16, false, false);
+	CAlignedBuffer abData(32, 16, false, false);
 	BYTE* pbData = abData.Data();
 	if(pbData == NULL) { ASSERT(FALSE); return; }
-	memset(pbData, 0x7E, 16);
+	memset(pbData, 0x7E, 32);
+
+	// With AES-NI, two blocks (as in Transform256) are transformed
+	const bool bAesNi = CRijndael::IsAesNiSupported();
 
 	CKeyTransformBCrypt ktBCrypt;
-	if(SUCCEEDED(ktBCrypt.Benchmark(&vKey[0], pbData, &m_qwComputedRounds, m_dwTimeMs)))
+	if(!bAesNi && SUCCEEDED(ktBCrypt.Benchmark(&vKey[0], pbData,
+		&m_qwComputedRounds, m_dwTimeMs)))
 		return;
 
 	CRijndael aes;
 	if(aes.Init(CRijndael::ECB, CRijndael::EncryptDir, &vKey[0],
 		CRijndael::Key32Bytes, 0) != RIJNDAEL_SUCCESS) { ASSERT(FALSE); return; }
 
-	const UINT64 qwStep = 1024;
+	const UINT64 qwStep = (bAesNi ? 16384 : 1024);
+	const int nBlocks = (bAesNi ? 2 : 1);
 	const DWORD dwStartTime = timeGetTime();
 
 	while((timeGetTime() - dwStartTime) < m_dwTimeMs)
 	{
-		for(UINT64 qw = qwStep; qw != 0; --qw)
-			aes.BlockEncrypt(pbData, 128, pbData);
+		aes.EncryptRepeated(pbData, nBlocks, qwStep);
 
 		m_qwComputedRounds += qwStep;
 		if(m_qwComputedRounds < qwStep) // Overflow
@@ -33,6 +33,7 @@
 
 #include "StdAfx.h"
 #include "Rijndael.h"
+#include "AesNi.h"
 
 static const UINT8 g_S[256]=
 {
@@ -905,6 +906,7 @@ static const UINT32 g_RCON[30]=
 CRijndael::CRijndael()
 {
 	m_state = Invalid;
+	m_bAesNi = false;
 }
 
 CRijndael::~CRijndael()
@@ -972,6 +974,7 @@ int CRijndael::Init(Mode mode, Direction dir, const UINT8 *key, KeyLength keyLen
 
 	KeySched(keyMatrix);
 	if(m_direction == DecryptDir) KeyEncToDec();
+	m_bAesNi = AesNi_IsSupported();
 	m_state = Valid;
 
 	return RIJNDAEL_SUCCESS;
@@ -989,6 +992,20 @@ int CRijndael::BlockEncrypt(const UINT8 *input, int inputLen, UINT8 *outBuffer)
 
 	numBlocks = inputLen / 128;
 
+	if(m_bAesNi && (m_mode == ECB))
+	{
+		AesNi_EncryptEcb(m_expandedKey[0][0], m_uRounds, input, outBuffer,
+			static_cast<size_t>(numBlocks));
+		return 128 * numBlocks;
+	}
+	if(m_bAesNi && (m_mode == CBC))
+	{
+		memcpy(block, m_initVector, 16);
+		AesNi_EncryptCbc(m_expandedKey[0][0], m_uRounds, block, input,
+			outBuffer, static_cast<size_t>(numBlocks));
+		return 128 * numBlocks;
+	}
+
 	switch(m_mode)
 	{
 		case ECB:
@@ -1081,11 +1098,21 @@ int CRijndael::PadEncrypt(const UINT8 *input, int inputOctets, UINT8 *outBuffer)
 	switch(m_mode)
 	{
 		case ECB:
-			for(i = numBlocks; i > 0; i--)
+			if(m_bAesNi)
 			{
-				Encrypt(input, outBuffer);
-				input += 16;
-				outBuffer += 16;
+				AesNi_EncryptEcb(m_expandedKey[0][0], m_uRounds, input,
+					outBuffer, static_cast<size_t>(numBlocks));
+				input += 16 * numBlocks;
+				outBuffer += 16 * numBlocks;
+			}
+			else
+			{
+				for(i = numBlocks; i > 0; i--)
+				{
+					Encrypt(input, outBuffer);
+					input += 16;
+					outBuffer += 16;
+				}
 			}
 			padLen = 16 - (inputOctets - 16*numBlocks);
 //			assert(padLen > 0 && padLen <= 16);
@@ -1096,16 +1123,28 @@ int CRijndael::PadEncrypt(const UINT8 *input, int inputOctets, UINT8 *outBuffer)
 
 		case CBC:
 			iv = m_initVector;
-			for(i = numBlocks; i > 0; i--)
+			if(m_bAesNi && (numBlocks > 0))
 			{
-				((UINT32 *)block)[0] = ((UINT32 *)input)[0] ^ ((UINT32 *)iv)[0];
-				((UINT32 *)block)[1] = ((UINT32 *)input)[1] ^ ((UINT32 *)iv)[1];
-				((UINT32 *)block)[2] = ((UINT32 *)input)[2] ^ ((UINT32 *)iv)[2];
-				((UINT32 *)block)[3] = ((UINT32 *)input)[3] ^ ((UINT32 *)iv)[3];
-				Encrypt(block, outBuffer);
-				iv = outBuffer;
-				input += 16;
-				outBuffer += 16;
+				memcpy(block, m_initVector, 16);
+				AesNi_EncryptCbc(m_expandedKey[0][0], m_uRounds, block, input,
+					outBuffer, static_cast<size_t>(numBlocks));
+				iv = outBuffer + 16 * (numBlocks - 1);
+				input += 16 * numBlocks;
+				outBuffer += 16 * numBlocks;
+			}
+			else
+			{
+				for(i = numBlocks; i > 0; i--)
+				{
+					((UINT32 *)block)[0] = ((UINT32 *)input)[0] ^ ((UINT32 *)iv)[0];
+					((UINT32 *)block)[1] = ((UINT32 *)input)[1] ^ ((UINT32 *)iv)[1];
+					((UINT32 *)block)[2] = ((UINT32 *)input)[2] ^ ((UINT32 *)iv)[2];
+					((UINT32 *)block)[3] = ((UINT32 *)input)[3] ^ ((UINT32 *)iv)[3];
+					Encrypt(block, outBuffer);
+					iv = outBuffer;
+					input += 16;
+					outBuffer += 16;
+				}
 			}
 			padLen = 16 - (inputOctets - 16*numBlocks);
 //			assert(padLen > 0 && padLen <= 16); // DO SOMETHING HERE ?
@@ -1138,6 +1177,20 @@ int CRijndael::BlockDecrypt(const UINT8 *input, int inputLen, UINT8 *outBuffer)
 
 	numBlocks = inputLen/128;
 
+	if(m_bAesNi && (m_mode == ECB))
+	{
+		AesNi_DecryptEcb(m_expandedKey[0][0], m_uRounds, input, outBuffer,
+			static_cast<size_t>(numBlocks));
+		return 128 * numBlocks;
+	}
+	if(m_bAesNi && (m_mode == CBC))
+	{
+		memcpy(block, m_initVector, 16);
+		AesNi_DecryptCbc(m_expandedKey[0][0], m_uRounds, block, input,
+			outBuffer, static_cast<size_t>(numBlocks));
+		return 128 * numBlocks;
+	}
+
 	switch(m_mode)
 	{
 		case ECB:
@@ -1263,17 +1316,27 @@ int CRijndael::PadDecrypt(const UINT8 *input, int inputOctets, UINT8 *outBuffer)
 		case CBC:
 			memcpy(iv, m_initVector, 16);
 			/* all blocks but last */
-			for (i = numBlocks - 1; i > 0; i--)
+			if(m_bAesNi)
 			{
-				Decrypt(input, block);
-				((UINT32 *)block)[0] ^= iv[0];
-				((UINT32 *)block)[1] ^= iv[1];
-				((UINT32 *)block)[2] ^= iv[2];
-				((UINT32 *)block)[3] ^= iv[3];
-				memcpy(iv, input, 16);
-				memcpy(outBuffer, block, 16);
-				input += 16;
-				outBuffer += 16;
+				AesNi_DecryptCbc(m_expandedKey[0][0], m_uRounds, (UINT8 *)iv,
+					input, outBuffer, static_cast<size_t>(numBlocks - 1));
+				input += 16 * (numBlocks - 1);
+				outBuffer += 16 * (numBlocks - 1);
+			}
+			else
+			{
+				for (i = numBlocks - 1; i > 0; i--)
+				{
+					Decrypt(input, block);
+					((UINT32 *)block)[0] ^= iv[0];
+					((UINT32 *)block)[1] ^= iv[1];
+					((UINT32 *)block)[2] ^= iv[2];
+					((UINT32 *)block)[3] ^= iv[3];
+					memcpy(iv, input, 16);
+					memcpy(outBuffer, block, 16);
+					input += 16;
+					outBuffer += 16;
+				}
 			}
 			/* last block */
 			Decrypt(input, block);
@@ -1298,6 +1361,110 @@ int CRijndael::PadDecrypt(const UINT8 *input, int inputOctets, UINT8 *outBuffer)
 	return (16 * numBlocks) - padLen;
 }
 
+int CRijndael::ChainDecrypt(const UINT8 *input, int inputOctets, UINT8 *outBuffer)
+{
+	int i;
+	UINT8 block[16];
+
+	if(m_state != Valid) return RIJNDAEL_NOT_INITIALIZED;
+	if(m_direction != DecryptDir) return RIJNDAEL_BAD_DIRECTION;
+	if(m_mode != CBC) return RIJNDAEL_UNSUPPORTED_MODE;
+
+	if((input == NULL) || (inputOctets <= 0)) return 0;
+
+	if((inputOctets % 16) != 0) return RIJNDAEL_CORRUPTED_DATA;
+
+	if(m_bAesNi)
+	{
+		AesNi_DecryptCbc(m_expandedKey[0][0], m_uRounds, m_initVector, input,
+			outBuffer, static_cast<size_t>(inputOctets / 16));
+		return inputOctets;
+	}
+
+	for(i = inputOctets / 16; i > 0; i--)
+	{
+		Decrypt(input, block);
+		((UINT32 *)block)[0] ^= ((UINT32 *)m_initVector)[0];
+		((UINT32 *)block)[1] ^= ((UINT32 *)m_initVector)[1];
+		((UINT32 *)block)[2] ^= ((UINT32 *)m_initVector)[2];
+		((UINT32 *)block)[3] ^= ((UINT32 *)m_initVector)[3];
+		memcpy(m_initVector, input, 16);
+		memcpy(outBuffer, block, 16);
+		input += 16;
+		outBuffer += 16;
+	}
+
+	return inputOctets;
+}
+
+int CRijndael::ChainEncrypt(const UINT8 *input, int inputOctets, UINT8 *outBuffer)
+{
+	int i;
+	UINT8 block[16];
+
+	if(m_state != Valid) return RIJNDAEL_NOT_INITIALIZED;
+	if(m_direction != EncryptDir) return RIJNDAEL_BAD_DIRECTION;
+	if(m_mode != CBC) return RIJNDAEL_UNSUPPORTED_MODE;
+
+	if((input == NULL) || (inputOctets <= 0)) return 0;
+
+	if((inputOctets % 16) != 0) return RIJNDAEL_CORRUPTED_DATA;
+
+	if(m_bAesNi)
+	{
+		AesNi_EncryptCbc(m_expandedKey[0][0], m_uRounds, m_initVector, input,
+			outBuffer, static_cast<size_t>(inputOctets / 16));
+		return inputOctets;
+	}
+
+	for(i = inputOctets / 16; i > 0; i--)
+	{
+		((UINT32 *)block)[0] = ((UINT32 *)input)[0] ^ ((UINT32 *)m_initVector)[0];
+		((UINT32 *)block)[1] = ((UINT32 *)input)[1] ^ ((UINT32 *)m_initVector)[1];
+		((UINT32 *)block)[2] = ((UINT32 *)input)[2] ^ ((UINT32 *)m_initVector)[2];
+		((UINT32 *)block)[3] = ((UINT32 *)input)[3] ^ ((UINT32 *)m_initVector)[3];
+		Encrypt(block, outBuffer);
+		memcpy(m_initVector, outBuffer, 16);
+		input += 16;
+		outBuffer += 16;
+	}
+
+	return inputOctets;
+}
+
+int CRijndael::EncryptRepeated(UINT8 *blocks, int numBlocks, UINT64 count)
+{
+	if(m_state != Valid) return RIJNDAEL_NOT_INITIALIZED;
+	if(m_direction != EncryptDir) return RIJNDAEL_BAD_DIRECTION;
+
+	if((blocks == NULL) || (numBlocks <= 0)) return 0;
+
+	if(m_bAesNi)
+	{
+		AesNi_EncryptRepeated(m_expandedKey[0][0], m_uRounds, blocks,
+			static_cast<size_t>(numBlocks), count);
+		return numBlocks;
+	}
+
+	for(int i = 0; i < numBlocks; ++i)
+	{
+		UINT8 *pb = blocks + (i << 4);
+		for(UINT64 qw = count; qw != 0; --qw) Encrypt(pb, pb);
+	}
+
+	return numBlocks;
+}
+
+bool CRijndael::IsAesNiSupported()
+{
+	return AesNi_IsSupported();
+}
+
+void CRijndael::SetAesNi(bool bUse)
+{
+	m_bAesNi = (bUse && AesNi_IsSupported());
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // ALGORITHM
 //////////////////////////////////////////////////////////////////////////////
@@ -1399,6 +1566,8 @@ void CRijndael::Encrypt(const UINT8 a[16], UINT8 b[16])
 	int r;
 	UINT8 temp[4][4];
 
+	if(m_bAesNi) { AesNi_EncryptEcb(m_expandedKey[0][0], m_uRounds, a, b, 1); return; }
+
     *((UINT32 *)temp[0]) = *((UINT32 *)(a   )) ^ *((UINT32 *)m_expandedKey[0][0]);
     *((UINT32 *)temp[1]) = *((UINT32 *)(a+ 4)) ^ *((UINT32 *)m_expandedKey[0][1]);
     *((UINT32 *)temp[2]) = *((UINT32 *)(a+ 8)) ^ *((UINT32 *)m_expandedKey[0][2]);
@@ -1474,6 +1643,8 @@ void CRijndael::Decrypt(const UINT8 a[16], UINT8 b[16])
 	int r;
 	UINT8 temp[4][4];
 
+	if(m_bAesNi) { AesNi_DecryptEcb(m_expandedKey[0][0], m_uRounds, a, b, 1); return; }
+
     *((UINT32 *)temp[0]) = *((UINT32 *)(a   )) ^ *((UINT32 *)m_expandedKey[m_uRounds][0]);
     *((UINT32 *)temp[1]) = *((UINT32 *)(a+ 4)) ^ *((UINT32 *)m_expandedKey[m_uRounds][1]);
     *((UINT32 *)temp[2]) = *((UINT32 *)(a+ 8)) ^ *((UINT32 *)m_expandedKey[m_uRounds][2]);
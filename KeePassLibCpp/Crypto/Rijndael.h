@@ -99,6 +99,7 @@ protected:
 	UINT8     m_initVector[RD_MAX_IV_SIZE];
 	UINT32    m_uRounds;
 	UINT8     m_expandedKey[RD_MAX_ROUNDS+1][4][4];
+	bool      m_bAesNi; // Use the AES instructions of the processor
 
 public:
 	//////////////////////////////////////////////////////////////////////////
@@ -149,6 +150,33 @@ public:
 	// Returns the decrypted buffer length in BYTES and an error code < 0 in case of error
 	int PadDecrypt(const UINT8 *input, int inputOctets, UINT8 *outBuffer);
 
+	// Decrypts complete blocks in CBC mode and keeps the chaining value,
+	// thus a long ciphertext can be decrypted in consecutive calls
+	// Input len is in BYTES and must be a multiple of 16!
+	// input and outBuffer may be the same buffer
+	// Returns the decrypted buffer length in BYTES or an error code < 0
+	int ChainDecrypt(const UINT8 *input, int inputOctets, UINT8 *outBuffer);
+
+	// Encrypts complete blocks in CBC mode and keeps the chaining value;
+	// the final (partial) block can be padded and encrypted afterwards
+	// using PadEncrypt
+	// Input len is in BYTES and must be a multiple of 16!
+	// input and outBuffer may be the same buffer
+	// Returns the encrypted buffer length in BYTES or an error code < 0
+	int ChainEncrypt(const UINT8 *input, int inputOctets, UINT8 *outBuffer);
+
+	// Encrypts each of the numBlocks 16-byte blocks count times (ECB),
+	// in place; the blocks are processed interleaved if possible
+	// Returns numBlocks or an error code < 0
+	int EncryptRepeated(UINT8 *blocks, int numBlocks, UINT64 count);
+
+	// The AES instructions of the processor (AES-NI) are used if supported;
+	// SetAesNi(false) forces the table-based implementation (must be called
+	// after Init)
+	static bool IsAesNiSupported();
+	void SetAesNi(bool bUse);
+	bool IsAesNiUsed() const { return m_bAesNi; }
+
 protected:
 	void KeySched(UINT8 key[RD_MAX_KEY_COLUMNS][4]);
 	void KeyEncToDec();
@@ -26,6 +26,8 @@
 #include "ARCFour.h"
 #include "ChaCha20.h"
 #include "../Util/StrUtil.h"
+#include "../PwManager.h"
+#include <algorithm>
 
 static const char g_szVectABCX[] =
 	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
@@ -85,6 +87,19 @@ static const unsigned char g_uVectRijndaelZeroDec[16] =
 	0x0f, 0x8f, 0xbb, 0xb3, 0x66, 0xb5, 0x31, 0xb4
 };
 
+// Test vector from FIPS-197, appendix C.3 (the key is 00 01 02 ... 1F)
+static const unsigned char g_uVectAes256Plain[16] =
+{
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+	0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF
+};
+
+static const unsigned char g_uVectAes256Cipher[16] =
+{
+	0x8E, 0xA2, 0xB7, 0xCA, 0x51, 0x67, 0x45, 0xBF,
+	0xEA, 0xFC, 0x49, 0x90, 0x4B, 0x49, 0x60, 0x89
+};
+
 static const unsigned char g_uVectTwofishKey[32] =
 {
 	0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF,
@@ -128,6 +143,421 @@ static const unsigned char g_uVectChaCha20Cipher[g_cbVectChaCha20] =
 	0x87, 0x4D
 };
 
+static bool TestRijndaelKat(bool bAesNi)
+{
+	UINT8 aKey[32], aBuf[16];
+	for(size_t i = 0; i < 32; ++i) aKey[i] = (UINT8)i;
+
+	CRijndael aes;
+	if(aes.Init(CRijndael::ECB, CRijndael::EncryptDir, aKey,
+		CRijndael::Key32Bytes, NULL) != RIJNDAEL_SUCCESS) return false;
+	aes.SetAesNi(bAesNi);
+	if(aes.IsAesNiUsed() != bAesNi) return false;
+
+	if(aes.BlockEncrypt(g_uVectAes256Plain, 128, aBuf) != 128) return false;
+	if(memcmp(aBuf, g_uVectAes256Cipher, 16) != 0) return false;
+
+	if(aes.Init(CRijndael::ECB, CRijndael::DecryptDir, aKey,
+		CRijndael::Key32Bytes, NULL) != RIJNDAEL_SUCCESS) return false;
+	aes.SetAesNi(bAesNi);
+
+	if(aes.BlockDecrypt(g_uVectAes256Cipher, 128, aBuf) != 128) return false;
+	return (memcmp(aBuf, g_uVectAes256Plain, 16) == 0);
+}
+
+// Compare the AES-NI implementation with the table-based one for all
+// modes that have a separate AES-NI code path
+static bool TestAesNiConsistency()
+{
+	const int cbData = 16 * 9 + 5; // Not a multiple of the 4-block batches
+	UINT8 aKey[32], aIV[16], aData[cbData];
+	UINT8 aEncSw[cbData + 16], aEncNi[cbData + 16];
+	UINT8 aDecSw[cbData + 16], aDecNi[cbData + 16];
+
+	for(int i = 0; i < 32; ++i) aKey[i] = (UINT8)(i * 7 + 3);
+	for(int i = 0; i < 16; ++i) aIV[i] = (UINT8)(0xF0 - i);
+	for(int i = 0; i < cbData; ++i) aData[i] = (UINT8)(i * 13);
+
+	CRijndael sw, ni;
+	for(int m = 0; m < 2; ++m)
+	{
+		const CRijndael::Mode md = ((m == 0) ? CRijndael::ECB : CRijndael::CBC);
+
+		if(sw.Init(md, CRijndael::EncryptDir, aKey, CRijndael::Key32Bytes,
+			aIV) != RIJNDAEL_SUCCESS) return false;
+		sw.SetAesNi(false);
+		if(ni.Init(md, CRijndael::EncryptDir, aKey, CRijndael::Key32Bytes,
+			aIV) != RIJNDAEL_SUCCESS) return false;
+		if(!ni.IsAesNiUsed()) return false;
+
+		const int cbEnc = sw.PadEncrypt(aData, cbData, aEncSw);
+		if((cbEnc <= cbData) || (ni.PadEncrypt(aData, cbData, aEncNi) != cbEnc))
+			return false;
+		if(memcmp(aEncSw, aEncNi, cbEnc) != 0) return false;
+
+		if(sw.Init(md, CRijndael::DecryptDir, aKey, CRijndael::Key32Bytes,
+			aIV) != RIJNDAEL_SUCCESS) return false;
+		sw.SetAesNi(false);
+		if(ni.Init(md, CRijndael::DecryptDir, aKey, CRijndael::Key32Bytes,
+			aIV) != RIJNDAEL_SUCCESS) return false;
+
+		if(sw.BlockDecrypt(aEncSw, cbEnc * 8, aDecSw) != (cbEnc * 8)) return false;
+		if(ni.BlockDecrypt(aEncSw, cbEnc * 8, aDecNi) != (cbEnc * 8)) return false;
+		if(memcmp(aDecSw, aDecNi, cbEnc) != 0) return false;
+		if(memcmp(aDecNi, aData, cbData) != 0) return false;
+
+		if(ni.PadDecrypt(aEncSw, cbEnc, aDecNi) != cbData) return false;
+		if(memcmp(aDecNi, aData, cbData) != 0) return false;
+	}
+
+	// In-place CBC decryption in two parts
+	if(ni.Init(CRijndael::CBC, CRijndael::DecryptDir, aKey, CRijndael::Key32Bytes,
+		aIV) != RIJNDAEL_SUCCESS) return false;
+	memcpy(aDecNi, aEncSw, 16 * 10);
+	if(ni.ChainDecrypt(aDecNi, 16 * 5, aDecNi) != (16 * 5)) return false;
+	if(ni.ChainDecrypt(aDecNi + 16 * 5, 16 * 5, aDecNi + 16 * 5) != (16 * 5))
+		return false;
+	if(memcmp(aDecNi, aData, cbData) != 0) return false;
+
+	// Key transformation
+	if(sw.Init(CRijndael::ECB, CRijndael::EncryptDir, aKey, CRijndael::Key32Bytes,
+		NULL) != RIJNDAEL_SUCCESS) return false;
+	sw.SetAesNi(false);
+	if(ni.Init(CRijndael::ECB, CRijndael::EncryptDir, aKey, CRijndael::Key32Bytes,
+		NULL) != RIJNDAEL_SUCCESS) return false;
+
+	memcpy(aEncSw, aData, 48);
+	memcpy(aEncNi, aData, 48);
+	if(sw.EncryptRepeated(aEncSw, 3, 1000) != 3) return false;
+	if(ni.EncryptRepeated(aEncNi, 3, 1000) != 3) return false;
+	return (memcmp(aEncSw, aEncNi, 48) == 0);
+}
+
+// Compare the SIMD implementation of CChaCha20::CryptEx (if supported)
+// with the scalar one and with the CCtrBlockCipher interface
+static bool TestChaCha20Consistency()
+{
+	const size_t cbData = 64 * 19 + 7; // SIMD batches, single blocks, partial block
+	BYTE aKey[32], aIV[12];
+	BYTE aSimd[cbData], aScalar[cbData], aCtr[cbData];
+
+	for(size_t i = 0; i < 32; ++i) aKey[i] = (BYTE)(i * 7 + 1);
+	for(size_t i = 0; i < 12; ++i) aIV[i] = (BYTE)(i * 3);
+	for(size_t i = 0; i < cbData; ++i) aSimd[i] = (BYTE)(i * 13);
+	memcpy(aScalar, aSimd, cbData);
+	memcpy(aCtr, aSimd, cbData);
+
+	if(FAILED(CChaCha20::CryptEx(aSimd, cbData, aKey, aIV, true, true))) return false;
+	if(FAILED(CChaCha20::CryptEx(aScalar, cbData, aKey, aIV, true, false))) return false;
+
+	CChaCha20 c(aKey, aIV, true);
+	if(FAILED(c.Encrypt(aCtr, 0, cbData))) return false;
+
+	return ((memcmp(aSimd, aScalar, cbData) == 0) && (memcmp(aScalar,
+		aCtr, cbData) == 0));
+}
+
+// Compare all implementations of SU_FindSubString with a lower-case
+// conversion followed by _tcsstr, for all text and search string lengths
+// around the SIMD block sizes (8 and 16 characters)
+static bool TestFindSubStringConsistency()
+{
+	const TCHAR vChars[] = { _T('a'), _T('b'), _T('A'), _T('B'), _T('['), _T('@')
+#ifdef _UNICODE
+		, static_cast<TCHAR>(0xC4), static_cast<TCHAR>(0xE4)
+#endif
+	};
+	const UINT32 uChars = static_cast<UINT32>(sizeof(vChars) / sizeof(TCHAR));
+
+	const size_t cchMaxText = 40, cchMaxFind = 20;
+	TCHAR vText[cchMaxText + 1], vLower[cchMaxText + 1];
+	TCHAR vFind[cchMaxFind + 1], vFindLower[cchMaxFind + 1];
+	UINT32 uRand = 0x2F6B1E5D; // Deterministic linear congruential generator
+
+	for(size_t cchText = 0; cchText <= cchMaxText; ++cchText)
+	{
+		for(size_t cchFind = 1; cchFind <= cchMaxFind; ++cchFind)
+		{
+			for(int iTrial = 0; iTrial < 2; ++iTrial)
+			{
+				for(size_t i = 0; i < cchText; ++i)
+				{
+					uRand = uRand * 1664525 + 1013904223;
+					vText[i] = vChars[(uRand >> 24) % uChars];
+				}
+				vText[cchText] = 0;
+
+				for(size_t i = 0; i < cchFind; ++i)
+				{
+					uRand = uRand * 1664525 + 1013904223;
+					vFind[i] = vChars[(uRand >> 24) % uChars];
+				}
+				vFind[cchFind] = 0;
+
+				// Half of the search strings are taken from the text
+				if(((iTrial & 1) != 0) && (cchFind <= cchText))
+				{
+					uRand = uRand * 1664525 + 1013904223;
+					const size_t iPos = (uRand >> 16) % (cchText - cchFind + 1);
+					memcpy(vFind, &vText[iPos], cchFind * sizeof(TCHAR));
+				}
+
+				for(size_t i = 0; i <= cchText; ++i)
+					vLower[i] = static_cast<TCHAR>(_totlower(vText[i]));
+				for(size_t i = 0; i <= cchFind; ++i)
+					vFindLower[i] = static_cast<TCHAR>(_totlower(vFind[i]));
+
+				for(int iCase = 0; iCase < 2; ++iCase)
+				{
+					const BOOL bCaseSensitive = ((iCase == 0) ? TRUE : FALSE);
+					LPCTSTR lpFind = ((bCaseSensitive != FALSE) ? vFind : vFindLower);
+					LPCTSTR lpRefText = ((bCaseSensitive != FALSE) ? vText : vLower);
+
+					LPCTSTR lpRef = _tcsstr(lpRefText, lpFind);
+					LPCTSTR lpExpected = ((lpRef != NULL) ? &vText[lpRef -
+						lpRefText] : NULL);
+
+					for(LONG lLevel = SU_SIMD_NONE; lLevel <= SU_SIMD_AVX2; ++lLevel)
+					{
+						if(SU_FindSubStringEx(vText, lpFind, bCaseSensitive,
+							lLevel) != lpExpected) return false;
+					}
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+#ifdef _DEBUG
+// Apply a deterministic random sequence of modifications to a database
+// (including duplicate UUIDs) and compare its indexes with the lists
+// after each one
+static bool TestPwManagerIndexes()
+{
+	CPwManager mgr;
+	UINT32 uRand = 0x5A3C9E17; // Deterministic linear congruential generator
+
+	PW_GROUP g;
+	ZeroMemory(&g, sizeof(PW_GROUP));
+	g.pszGroupName = const_cast<LPTSTR>(_T("Test"));
+	DWORD vGroupIds[3];
+	for(DWORD i = 0; i < 3; ++i)
+	{
+		if(mgr.AddGroup(&g) == FALSE) return false;
+		vGroupIds[i] = mgr.GetGroup(i)->uGroupId;
+	}
+
+	LPCTSTR vTitles[4] = { _T("b"), _T("A"), _T("c"), _T("a") };
+
+	for(int iStep = 0; iStep < 400; ++iStep)
+	{
+		UINT32 vRand[4];
+		for(size_t i = 0; i < 4; ++i)
+		{
+			uRand = uRand * 1664525 + 1013904223;
+			vRand[i] = (uRand >> 8);
+		}
+
+		const DWORD dwCount = mgr.GetNumberOfEntries();
+		const DWORD dwEntry = ((dwCount != 0) ? (vRand[1] % dwCount) : 0);
+		const DWORD dwOther = ((dwCount != 0) ? (vRand[2] % dwCount) : 0);
+		const DWORD dwGroupId = vGroupIds[vRand[3] % 3];
+		const UINT32 uVariant = ((vRand[3] >> 4) & 3);
+
+		PW_ENTRY e;
+		ZeroMemory(&e, sizeof(PW_ENTRY));
+		e.uGroupId = dwGroupId;
+		e.pszTitle = const_cast<LPTSTR>(vTitles[(vRand[3] >> 8) & 3]);
+		e.pszPassword = const_cast<LPTSTR>(vTitles[(vRand[3] >> 10) & 3]);
+		e.pszUserName = const_cast<LPTSTR>(_T(""));
+		e.pszURL = e.pszUserName;
+		e.pszAdditional = e.pszUserName;
+		e.pszBinaryDesc = e.pszUserName;
+
+		UINT32 uOp = (vRand[0] % 10);
+		if(dwCount == 0) uOp = 0;
+		else if(dwCount > 60) uOp = 6;
+
+		switch(uOp)
+		{
+		case 0: case 1: case 2: case 3: // Add, possibly with an existing UUID
+			if((dwCount != 0) && (uVariant == 0))
+				memcpy(e.uuid, mgr.GetEntry(dwOther)->uuid, 16);
+			if(mgr.AddEntry(&e) == FALSE) return false;
+			break;
+		case 4: // Set, with the same, a modified or another entry's UUID
+			memcpy(e.uuid, mgr.GetEntry((uVariant == 0) ? dwOther :
+				dwEntry)->uuid, 16);
+			if(uVariant == 1) e.uuid[(vRand[3] >> 12) & 15] ^= 0x5A;
+			if(mgr.SetEntry(dwEntry, &e) == FALSE) return false;
+			break;
+		case 5:
+			if(mgr.SetEntryGroup(dwEntry, dwGroupId) == FALSE) return false;
+			break;
+		case 6:
+			if(mgr.DeleteEntry(dwEntry) == FALSE) return false;
+			break;
+		case 7:
+		{
+			const DWORD vIndices[3] = { dwEntry, dwOther, dwEntry };
+			if(mgr.DeleteEntries(vIndices, 3) == 0) return false;
+			break;
+		}
+		case 8:
+			mgr.MoveEntry(dwGroupId, dwEntry, dwOther);
+			break;
+		default:
+			mgr.SortGroup(dwGroupId, (vRand[3] >> 16) % 10);
+			break;
+		}
+
+		if(!mgr.CheckIndexes()) return false;
+
+		// Look up some entries, which (re)builds the indexes
+		for(DWORD i = uVariant; i < mgr.GetNumberOfEntries(); i += 4)
+		{
+			const DWORD dwFound = mgr.GetEntryByUuidN(mgr.GetEntry(i)->uuid);
+			if((dwFound > i) || (memcmp(mgr.GetEntry(dwFound)->uuid,
+				mgr.GetEntry(i)->uuid, 16) != 0)) return false;
+		}
+		if(mgr.GetNumberOfItemsInGroupN(dwGroupId) > mgr.GetNumberOfEntries())
+			return false;
+
+		if(!mgr.CheckIndexes()) return false;
+	}
+
+	return true;
+}
+
+// Comparer for the paths built by TestGetPathSortOrder
+struct TestPathLess
+{
+	const std::vector<std_string>* m_pPaths;
+
+	bool operator()(DWORD dwA, DWORD dwB) const
+	{
+		return (_tcsicmp((*m_pPaths)[dwA].c_str(), (*m_pPaths)[dwB].c_str()) < 0);
+	}
+};
+
+// Reference implementation of the former SortGroupList, which sorted the
+// groups by their "Parent\n...\nName\n\nID" paths (stable, _tcsicmp).
+// If bQualifyParents is true, the parent names in the paths are followed
+// by their IDs, such that equally named siblings keep their subtrees.
+static void TestGetPathSortOrder(CPwManager& mgr, bool bQualifyParents,
+	std::vector<DWORD>& vIds, std::vector<USHORT>& vLevels)
+{
+	const DWORD dwGroups = mgr.GetNumberOfGroups();
+	std::vector<std_string> vPaths(dwGroups);
+	std::vector<std_string> vParents; // Path components, by level
+	TCHAR tszId[16];
+
+	for(DWORD i = 0; i < dwGroups; ++i)
+	{
+		const PW_GROUP *pg = mgr.GetGroup(i);
+		_ltot_s(static_cast<long>(pg->uGroupId), tszId, 10);
+
+		vParents.resize(pg->usLevel);
+		for(size_t j = 0; j < vParents.size(); ++j)
+		{
+			vPaths[i] += vParents[j];
+			vPaths[i] += _T("\n");
+		}
+		vPaths[i] += pg->pszGroupName;
+		vPaths[i] += _T("\n\n");
+		vPaths[i] += tszId;
+
+		std_string strComponent = pg->pszGroupName;
+		if(bQualifyParents) { strComponent += _T("\n\n"); strComponent += tszId; }
+		vParents.push_back(strComponent);
+	}
+
+	std::vector<DWORD> vOrder(dwGroups);
+	for(DWORD i = 0; i < dwGroups; ++i) vOrder[i] = i;
+
+	TestPathLess pl;
+	pl.m_pPaths = &vPaths;
+	std::stable_sort(vOrder.begin(), vOrder.end(), pl);
+
+	vIds.resize(dwGroups);
+	vLevels.resize(dwGroups);
+	for(DWORD i = 0; i < dwGroups; ++i)
+	{
+		vIds[i] = mgr.GetGroup(vOrder[i])->uGroupId;
+		vLevels[i] = mgr.GetGroup(vOrder[i])->usLevel;
+	}
+}
+
+// Sort deterministic random group trees and compare the result with the
+// path string sort. Trees with unique sibling names must be sorted exactly
+// as before; trees with duplicate and prefix names (in different cases)
+// must keep the subtrees attached to their parents.
+static bool TestSortGroupList()
+{
+	LPCTSTR vNames[7] = { _T("a"), _T("A"), _T("ab"), _T("Ab"), _T("b"),
+		_T("a b"), _T("B1") };
+	UINT32 uRand = 0x3B8D5A21; // Deterministic linear congruential generator
+
+	for(int iTree = 0; iTree < 24; ++iTree)
+	{
+		const bool bUniqueNames = ((iTree & 1) == 0);
+
+		CPwManager mgr;
+		uRand = uRand * 1664525 + 1013904223;
+		const DWORD dwGroups = 2 + ((uRand >> 8) % 59);
+
+		USHORT usLevel = 0;
+		for(DWORD i = 0; i < dwGroups; ++i)
+		{
+			uRand = uRand * 1664525 + 1013904223;
+			const UINT32 r = (uRand >> 8);
+
+			if(i != 0) // Build deep trees, with siblings at all levels
+			{
+				if(((r & 3) == 1) || ((r & 3) == 2))
+					usLevel = static_cast<USHORT>(min(usLevel + 1, 12));
+				else if((r & 3) == 3)
+					usLevel = static_cast<USHORT>((r >> 2) % (usLevel + 1));
+			}
+
+			TCHAR tszName[32];
+			_tcscpy_s(tszName, vNames[(r >> 4) % 7]);
+			if(bUniqueNames)
+			{
+				TCHAR tszSuffix[16];
+				_ltot_s(static_cast<long>(i), tszSuffix, 10);
+				_tcscat_s(tszName, tszSuffix);
+			}
+
+			PW_GROUP g;
+			ZeroMemory(&g, sizeof(PW_GROUP));
+			g.pszGroupName = tszName;
+			g.usLevel = usLevel;
+			g.uGroupId = (i + 1) + 64 * ((r >> 8) % 20000); // Unique, i < 63
+			if(mgr.AddGroup(&g) == FALSE) return false;
+		}
+
+		std::vector<DWORD> vIds;
+		std::vector<USHORT> vLevels;
+		TestGetPathSortOrder(mgr, !bUniqueNames, vIds, vLevels);
+
+		mgr.SortGroupList();
+
+		if(mgr.GetNumberOfGroups() != dwGroups) return false;
+		for(DWORD i = 0; i < dwGroups; ++i)
+		{
+			const PW_GROUP *pg = mgr.GetGroup(i);
+			if((pg->uGroupId != vIds[i]) || (pg->usLevel != vLevels[i]))
+				return false;
+		}
+	}
+
+	return true;
+}
+#endif
+
 UINT32 TestCryptoImpl()
 {
 	UINT32 uTestMask = TestTypeDefs();
@@ -224,6 +654,13 @@ UINT32 TestCryptoImpl()
 			uTestMask |= TI_ERR_RIJNDAEL_DECRYPT;
 	}
 
+	if(!TestRijndaelKat(false)) uTestMask |= TI_ERR_RIJNDAEL_ENCRYPT;
+	if(CRijndael::IsAesNiSupported())
+	{
+		if(!TestRijndaelKat(true) || !TestAesNiConsistency())
+			uTestMask |= TI_ERR_AESNI;
+	}
+
 	twofish.Init(g_uVectTwofishKey, 32, NULL);
 	if(twofish.PadEncrypt(g_uVectTwofishPlain, 16, aTemp) <= 0)
 		uTestMask |= TI_ERR_TWOFISH;
@@ -275,6 +712,8 @@ UINT32 TestCryptoImpl()
 		if(memcmp(aMsg, g_uVectChaCha20Cipher, g_cbVectChaCha20) != 0)
 			uTestMask |= TI_ERR_CHACHA20;
 
+		if(!TestChaCha20Consistency()) uTestMask |= TI_ERR_CHACHA20;
+
 #ifdef _DEBUG
 		CChaCha20 d(aTemp, aTemp2, true);
 		if(FAILED(d.Seek(64, SEEK_SET)))
@@ -287,6 +726,13 @@ UINT32 TestCryptoImpl()
 #endif
 	}
 
+	if(!TestFindSubStringConsistency()) uTestMask |= TI_ERR_FINDSUBSTR;
+
+#ifdef _DEBUG
+	if(!TestPwManagerIndexes()) uTestMask |= TI_ERR_INDEXES;
+	if(!TestSortGroupList()) uTestMask |= TI_ERR_GROUPSORT;
+#endif
+
 #ifdef _DEBUG
 	WCHAR* pw = _StringToUnicode("Test567890123");
 	char* pa = _StringToAnsi(pw);
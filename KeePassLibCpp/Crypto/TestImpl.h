@@ -35,6 +35,10 @@
 #define TI_ERR_UINT_TYPE       256
 #define TI_ERR_INT_TYPE        512
 #define TI_ERR_CHACHA20       1024
+#define TI_ERR_AESNI          2048
+#define TI_ERR_FINDSUBSTR     4096
+#define TI_ERR_INDEXES        8192
+#define TI_ERR_GROUPSORT     16384
 
 UINT32 TestCryptoImpl();
 UINT32 TestTypeDefs();
@@ -134,3 +134,54 @@ INT32 CTwofish::PadDecrypt(const UINT8 *pInput, INT32 nInputOctets, UINT8 *pOutB
 
 	return 16*numBlocks - padLen;
 }
+
+INT32 CTwofish::ChainDecrypt(const UINT8 *pInput, INT32 nInputOctets, UINT8 *pOutBuffer)
+{
+	int i;
+	UINT8 block[16];
+
+	ASSERT((pInput != NULL) && (pOutBuffer != NULL));
+	if((pInput == NULL) || (nInputOctets <= 0) || (pOutBuffer == NULL)) return 0;
+
+	if((nInputOctets % 16) != 0) { ASSERT(FALSE); return -1; }
+
+	for(i = nInputOctets / 16; i > 0; i--)
+	{
+		Twofish_decrypt(&m_key, (Twofish_Byte *)pInput, (Twofish_Byte *)block);
+		((UINT32*)block)[0] ^= ((UINT32*)m_pInitVector)[0];
+		((UINT32*)block)[1] ^= ((UINT32*)m_pInitVector)[1];
+		((UINT32*)block)[2] ^= ((UINT32*)m_pInitVector)[2];
+		((UINT32*)block)[3] ^= ((UINT32*)m_pInitVector)[3];
+		memcpy(m_pInitVector, pInput, 16);
+		memcpy(pOutBuffer, block, 16);
+		pInput += 16;
+		pOutBuffer += 16;
+	}
+
+	return nInputOctets;
+}
+
+INT32 CTwofish::ChainEncrypt(const UINT8 *pInput, INT32 nInputOctets, UINT8 *pOutBuffer)
+{
+	int i;
+	UINT8 block[16];
+
+	ASSERT((pInput != NULL) && (pOutBuffer != NULL));
+	if((pInput == NULL) || (nInputOctets <= 0) || (pOutBuffer == NULL)) return 0;
+
+	if((nInputOctets % 16) != 0) { ASSERT(FALSE); return -1; }
+
+	for(i = nInputOctets / 16; i > 0; i--)
+	{
+		((UINT32*)block)[0] = ((UINT32*)pInput)[0] ^ ((UINT32*)m_pInitVector)[0];
+		((UINT32*)block)[1] = ((UINT32*)pInput)[1] ^ ((UINT32*)m_pInitVector)[1];
+		((UINT32*)block)[2] = ((UINT32*)pInput)[2] ^ ((UINT32*)m_pInitVector)[2];
+		((UINT32*)block)[3] = ((UINT32*)pInput)[3] ^ ((UINT32*)m_pInitVector)[3];
+		Twofish_encrypt(&m_key, (Twofish_Byte *)block, (Twofish_Byte *)pOutBuffer);
+		memcpy(m_pInitVector, pOutBuffer, 16);
+		pInput += 16;
+		pOutBuffer += 16;
+	}
+
+	return nInputOctets;
+}
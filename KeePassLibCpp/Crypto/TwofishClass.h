@@ -37,6 +37,14 @@ public:
 	INT32 PadEncrypt(const UINT8 *pInput, INT32 nInputOctets, UINT8 *pOutBuffer);
 	INT32 PadDecrypt(const UINT8 *pInput, INT32 nInputOctets, UINT8 *pOutBuffer);
 
+	// CBC-decrypt complete blocks and keep the chaining value (for
+	// processing a long ciphertext in consecutive calls); in-place allowed
+	INT32 ChainDecrypt(const UINT8 *pInput, INT32 nInputOctets, UINT8 *pOutBuffer);
+
+	// CBC-encrypt complete blocks and keep the chaining value; the final
+	// block is processed by PadEncrypt afterwards; in-place allowed
+	INT32 ChainEncrypt(const UINT8 *pInput, INT32 nInputOctets, UINT8 *pOutBuffer);
+
 private:
 	Twofish_key m_key;
 	UINT8 m_pInitVector[16];
@@ -326,23 +326,19 @@ BOOL CPwExport::ExportGroup(const TCHAR *pszFile, DWORD dwGroupId, const PWEXPOR
 
 	if(dwGroupId != DWORD_MAX)
 	{
-		i = m_pMgr->GetGroupByIdN(dwGroupId);
-		ASSERT(i != DWORD_MAX); if(i == DWORD_MAX) return FALSE;
+		const DWORD dwFirst = m_pMgr->GetGroupByIdN(dwGroupId);
+		ASSERT(dwFirst != DWORD_MAX); if(dwFirst == DWORD_MAX) return FALSE;
 
-		usLevel = m_pMgr->GetGroup(i)->usLevel;
+		usLevel = m_pMgr->GetGroup(dwFirst)->usLevel;
 
-		while(true)
+		// The group and its subgroups are stored consecutively
+		const DWORD dwEnd = dwFirst + m_pMgr->GetGroupSubtreeSize(dwFirst);
+		for(i = dwFirst; i < dwEnd; ++i)
 		{
 			pg = m_pMgr->GetGroup(i);
 			ASSERT(pg != NULL); if(pg == NULL) break;
 
-			if((pg->uGroupId != dwGroupId) && (pg->usLevel <= usLevel)) break;
-
-			const DWORD dwToAdd = pg->uGroupId;
-			aGroupIds.push_back(dwToAdd);
-
-			++i;
-			if(i == dwNumberOfGroups) break;
+			aGroupIds.push_back(pg->uGroupId);
 		}
 	}
 	else
@@ -24,6 +24,7 @@
 #include "../Util/StrUtil.h"
 #include "../Util/PwUtil.h"
 #include "../Crypto/TwofishClass.h"
+#include "../Crypto/CbcParallel.h"
 #include "../Crypto/SHA2/SHA2.h"
 #include "../PwCompat.h"
 
@@ -142,28 +143,15 @@ BOOL CPwCompatImpl::OpenDatabaseV1(CPwManager* pMgr, const TCHAR *pszFile)
 
 	mem_erase(aMasterKeyU, 32);
 
-	if(pMgr->GetAlgorithm() == ALGO_AES)
+	if((pMgr->GetAlgorithm() == ALGO_AES) || (pMgr->GetAlgorithm() == ALGO_TWOFISH))
 	{
-		CRijndael aes;
+		CCbcParallelDecryptor dec;
 
-		// Initialize Rijndael algorithm
-		if(aes.Init(CRijndael::CBC, CRijndael::DecryptDir, uFinalKey,
-			CRijndael::Key32Bytes, hdr.aEncryptionIV) != RIJNDAEL_SUCCESS)
+		if(!dec.Init(pMgr->GetAlgorithm(), uFinalKey, hdr.aEncryptionIV))
 			{ _OPENDB_FAIL; }
 
 		// Decrypt! The first 48 bytes aren't encrypted (that's the header)
-		uEncryptedPartSize = (unsigned long)aes.PadDecrypt((UINT8 *)pVirtualFile + 48,
-			uFileSize - 48, (UINT8 *)pVirtualFile + 48);
-	}
-	else if(pMgr->GetAlgorithm() == ALGO_TWOFISH)
-	{
-		CTwofish twofish;
-
-		if(twofish.Init(uFinalKey, 32, hdr.aEncryptionIV) != true)
-			{ _OPENDB_FAIL };
-
-		uEncryptedPartSize = (unsigned long)twofish.PadDecrypt(
-			(UINT8 *)pVirtualFile + 48,
+		uEncryptedPartSize = (unsigned long)dec.PadDecrypt((UINT8 *)pVirtualFile + 48,
 			uFileSize - 48, (UINT8 *)pVirtualFile + 48);
 	}
 	else
@@ -342,27 +330,15 @@ BOOL CPwCompatImpl::OpenDatabaseV2(CPwManager* pMgr, const TCHAR *pszFile)
 	mem_erase(aMasterKeyU, 32);
 
 	ASSERT(((uFileSize - sizeof(PW_DBHEADER_V2)) % 16) == 0);
-	if(pMgr->GetAlgorithm() == ALGO_AES)
+	if((pMgr->GetAlgorithm() == ALGO_AES) || (pMgr->GetAlgorithm() == ALGO_TWOFISH))
 	{
-		CRijndael aes;
+		CCbcParallelDecryptor dec;
 
-		// Initialize Rijndael algorithm
-		if(aes.Init(CRijndael::CBC, CRijndael::DecryptDir, uFinalKey,
-			CRijndael::Key32Bytes, hdr.aEncryptionIV) != RIJNDAEL_SUCCESS)
+		if(!dec.Init(pMgr->GetAlgorithm(), uFinalKey, hdr.aEncryptionIV))
 			{ _OPENDB_FAIL; }
 
 		// Decrypt! The first bytes aren't encrypted (that's the header)
-		uEncryptedPartSize = (unsigned long)aes.PadDecrypt((UINT8 *)pVirtualFile + sizeof(PW_DBHEADER_V2),
-			uFileSize - sizeof(PW_DBHEADER_V2), (UINT8 *)pVirtualFile + sizeof(PW_DBHEADER_V2));
-	}
-	else if(pMgr->GetAlgorithm() == ALGO_TWOFISH)
-	{
-		CTwofish twofish;
-
-		if(twofish.Init(uFinalKey, 32, hdr.aEncryptionIV) != true)
-			{ _OPENDB_FAIL };
-
-		uEncryptedPartSize = (unsigned long)twofish.PadDecrypt((UINT8 *)pVirtualFile + sizeof(PW_DBHEADER_V2),
+		uEncryptedPartSize = (unsigned long)dec.PadDecrypt((UINT8 *)pVirtualFile + sizeof(PW_DBHEADER_V2),
 			uFileSize - sizeof(PW_DBHEADER_V2), (UINT8 *)pVirtualFile + sizeof(PW_DBHEADER_V2));
 	}
 	else
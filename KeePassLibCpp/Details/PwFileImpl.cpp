@@ -19,6 +19,7 @@
 
 #include "StdAfx.h"
 #include "../PwManager.h"
+#include "../Crypto/Argon2Kdf.h"
 #include "../Crypto/TwofishClass.h"
 #include "../Crypto/SHA2/SHA2.h"
 #include "../Util/AppUtil.h"
@@ -27,30 +28,26 @@
 #include "../Util/MemUtil.h"
 #include "../Util/StrUtil.h"
 #include "../Util/TranslateEx.h"
+#include "../IO/KpFileStream.h"
+#include "../IO/KpMappedFileStream.h"
+#include "../IO/KpReadAheadStream.h"
+#include "../IO/KpCbcStream.h"
+#include "../IO/KpAsyncWriteStream.h"
+#include "../IO/KpHashStream.h"
+#include "../Util/FileTransactionEx.h"
 #include "PwCompatImpl.h"
 
 #include <boost/static_assert.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #define _OPENDB_FAIL_LIGHT \
 { \
-	if(pVirtualFile != NULL) \
-	{ \
-		mem_erase(pVirtualFile, uAllocated); \
-		SAFE_DELETE_ARRAY(pVirtualFile); \
-	} \
 	m_dwKeyEncRounds = PWM_STD_KEYENCROUNDS; \
+	m_nKdf = KDF_AES; \
 }
 #define _OPENDB_FAIL \
 { \
 	_OPENDB_FAIL_LIGHT; \
-	SAFE_DELETE_ARRAY(pwGroupTemplate.pszGroupName); \
-	SAFE_DELETE_ARRAY(pwEntryTemplate.pszTitle); \
-	SAFE_DELETE_ARRAY(pwEntryTemplate.pszURL); \
-	SAFE_DELETE_ARRAY(pwEntryTemplate.pszUserName); \
-	SAFE_DELETE_ARRAY(pwEntryTemplate.pszPassword); \
-	SAFE_DELETE_ARRAY(pwEntryTemplate.pszAdditional); \
-	SAFE_DELETE_ARRAY(pwEntryTemplate.pszBinaryDesc); \
-	SAFE_DELETE_ARRAY(pwEntryTemplate.pBinaryData); \
 	return PWE_INVALID_FILESTRUCTURE; \
 }
 
@@ -75,8 +72,48 @@
 //	return this->OpenDatabaseEx(pszFile, pRepair, NULL);
 // }
 
-#define PWMOD_CHECK_AVAIL(w_Cnt_p) { if((static_cast<UINT64>(pos) + static_cast<UINT64>( \
-	w_Cnt_p)) > static_cast<UINT64>(uFileSize)) { ASSERT(FALSE); _OPENDB_FAIL; } }
+#define PWMOD_FIELD_PAD (1 + 64) // String terminating NULLs
+
+// Maximum amount of ciphertext that is read into memory while the master
+// key is being transformed (not memory-mapped files only)
+#define PWM_OPEN_READAHEAD_MAX (32 * 1024 * 1024)
+
+// Read the next field of a group/entry record. The data buffer is reused
+// across calls (grown if required) and is always followed by NULLs.
+static bool ReadRecordField(CKpCbcDecryptStream& s, USHORT *pusFieldType,
+	DWORD *pdwFieldSize, BYTE **ppbData, UINT64 *pcbAlloc)
+{
+	if(FAILED(s.Read((BYTE *)pusFieldType, 2))) return false;
+	if(FAILED(s.Read((BYTE *)pdwFieldSize, 4))) return false;
+
+	const DWORD dwFieldSize = *pdwFieldSize;
+	if(static_cast<UINT64>(dwFieldSize) > s.GetMaxRemaining()) return false;
+
+	const UINT64 cbRequired = static_cast<UINT64>(dwFieldSize) + PWMOD_FIELD_PAD;
+	if((*ppbData == NULL) || (*pcbAlloc < cbRequired))
+	{
+		if(*ppbData != NULL)
+		{
+			mem_erase(*ppbData, static_cast<size_t>(*pcbAlloc));
+			SAFE_DELETE_ARRAY(*ppbData);
+		}
+
+		const UINT64 cbNew = max(cbRequired, static_cast<UINT64>(256));
+		if(cbNew > static_cast<UINT64>(SIZE_MAX)) { *pcbAlloc = 0; return false; }
+		try { *ppbData = new BYTE[static_cast<size_t>(cbNew)]; }
+		catch(...) { *ppbData = NULL; }
+		if(*ppbData == NULL) { *pcbAlloc = 0; return false; }
+		*pcbAlloc = cbNew;
+	}
+
+	if(dwFieldSize != 0)
+	{
+		if(FAILED(s.Read(*ppbData, dwFieldSize))) return false;
+	}
+	memset(*ppbData + dwFieldSize, 0, PWMOD_FIELD_PAD);
+
+	return true;
+}
 
 // If bIgnoreCorrupted is TRUE the manager will try to ignore all database file
 // errors, i.e. try to read as much as possible instead of breaking out at the
@@ -85,51 +122,134 @@
 // To open a file in rescue mode, set it to TRUE.
 int CPwManager::OpenDatabase(const TCHAR *pszFile, _Out_opt_ PWDB_REPAIR_INFO *pRepair)
 {
-	char *pVirtualFile;
-	unsigned long uFileSize, uAllocated, uEncryptedPartSize;
-	unsigned long pos;
-	PW_DBHEADER hdr;
-	sha256_ctx sha32;
-	UINT8 uFinalKey[32];
-	char *p;
-	USHORT usFieldType;
-	DWORD dwFieldSize;
-	PW_GROUP pwGroupTemplate;
-	PW_ENTRY pwEntryTemplate;
+	ASSERT(pszFile != NULL); if(pszFile == NULL) return PWE_INVALID_PARAM;
+	ASSERT(pszFile[0] != 0); if(pszFile[0] == 0) return PWE_INVALID_PARAM; // Length != 0
+
+	if(pRepair != NULL) { ZeroMemory(pRepair, sizeof(PWDB_REPAIR_INFO)); }
+
+	CKpFileStream fs(pszFile, false);
+	if(!fs.IsOpen()) return PWE_NOFILEACCESS_READ;
+
+	UINT64 uFileSize = 0;
+	if(FAILED(fs.GetSize(&uFileSize))) return PWE_FILEERROR_READ;
 
-	BOOST_STATIC_ASSERT(sizeof(char) == 1);
+	return OpenDatabaseStream(fs, NULL, uFileSize, pszFile, pRepair);
+}
 
+// Same as OpenDatabase, but the file is mapped into memory and decrypted
+// directly from the view; the system reads the file ahead while the
+// master key is being transformed. If the file cannot be mapped (e.g.
+// not enough address space), it is read using OpenDatabase.
+int CPwManager::OpenDatabaseMapped(const TCHAR *pszFile, _Out_opt_ PWDB_REPAIR_INFO *pRepair)
+{
 	ASSERT(pszFile != NULL); if(pszFile == NULL) return PWE_INVALID_PARAM;
 	ASSERT(pszFile[0] != 0); if(pszFile[0] == 0) return PWE_INVALID_PARAM; // Length != 0
 
-	RESET_PWG_TEMPLATE(&pwGroupTemplate);
-	RESET_PWE_TEMPLATE(&pwEntryTemplate);
+	CKpMappedFileStream mfs(pszFile);
+	if(!mfs.IsOpen()) return OpenDatabase(pszFile, pRepair);
 
 	if(pRepair != NULL) { ZeroMemory(pRepair, sizeof(PWDB_REPAIR_INFO)); }
 
-	FILE *fp = NULL;
-	_tfopen_s(&fp, pszFile, _T("rb"));
-	if(fp == NULL) return PWE_NOFILEACCESS_READ;
+	return OpenDatabaseStream(mfs, &mfs, mfs.GetSize(), pszFile, pRepair);
+}
 
-	// Get file size
-	fseek(fp, 0, SEEK_END);
-	uFileSize = ftell(fp);
-	fseek(fp, 0, SEEK_SET);
+// The database (e.g. with 10 MB, 100 MB or 1 GB of attachments; the
+// latter requires a 64-bit process) is saved to lpTempFile, which is
+// deleted afterwards. The key is transformed only once, and the file is
+// in the system cache for both measurements.
+bool CPwManager::BenchmarkOpenDatabase(LPCTSTR lpTempFile, UINT64 cbData,
+	DWORD *pdwStreamMs, DWORD *pdwMappedMs)
+{
+	ASSERT(lpTempFile != NULL); if(lpTempFile == NULL) return false;
+	ASSERT((pdwStreamMs != NULL) && (pdwMappedMs != NULL));
+	if((pdwStreamMs == NULL) || (pdwMappedMs == NULL)) return false;
 
-	if(uFileSize < sizeof(PW_DBHEADER))
-		{ fclose(fp); return PWE_INVALID_FILEHEADER; }
+	*pdwStreamMs = 0;
+	*pdwMappedMs = 0;
 
-	// Allocate enough memory to hold the complete file
-	uAllocated = uFileSize + 16 + 1 + 64 + 4; // 16 = encryption buffer space, 1+64 = string terminating NULLs, 4 unused
-	pVirtualFile = new char[uAllocated];
-	if(pVirtualFile == NULL) { fclose(fp); return PWE_NO_MEM; }
-	memset(&pVirtualFile[uFileSize + 16], 0, 1 + 64);
+	const LPCTSTR lpKey = _T("Benchmark");
+	const DWORD cbMaxAttachment = 16 * 1024 * 1024;
 
-	fread(pVirtualFile, 1, uFileSize, fp);
-	fclose(fp);
+	{
+		CPwManager mgr;
+		if(mgr.SetMasterKey(lpKey, FALSE, NULL, NULL, FALSE, NULL) != PWE_SUCCESS)
+			return false;
+		mgr.SetKeyEncRounds(1);
+
+		PW_GROUP g;
+		ZeroMemory(&g, sizeof(PW_GROUP));
+		g.pszGroupName = const_cast<LPTSTR>(_T("Benchmark"));
+		if(mgr.AddGroup(&g) == FALSE) return false;
+
+		std::vector<BYTE> vData(static_cast<size_t>(min(cbData,
+			static_cast<UINT64>(cbMaxAttachment))) + 1);
+		for(size_t i = 0; i < vData.size(); ++i)
+			vData[i] = static_cast<BYTE>((i * 7) ^ (i >> 11));
+
+		UINT64 cbRemaining = cbData;
+		do
+		{
+			PW_ENTRY e;
+			ZeroMemory(&e, sizeof(PW_ENTRY));
+			e.uGroupId = mgr.GetGroup(0)->uGroupId;
+			e.pszTitle = const_cast<LPTSTR>(_T("Benchmark"));
+			e.pszUserName = const_cast<LPTSTR>(_T(""));
+			e.pszPassword = const_cast<LPTSTR>(_T(""));
+			e.pszURL = const_cast<LPTSTR>(_T(""));
+			e.pszAdditional = const_cast<LPTSTR>(_T(""));
+			e.pszBinaryDesc = const_cast<LPTSTR>(_T("Benchmark.bin"));
+			e.pBinaryData = &vData[0];
+			e.uBinaryDataLen = static_cast<DWORD>(min(cbRemaining,
+				static_cast<UINT64>(cbMaxAttachment)));
+			if(mgr.AddEntry(&e) == FALSE) return false;
+
+			cbRemaining -= e.uBinaryDataLen;
+		}
+		while(cbRemaining != 0);
 
-	// Extract header structure from memory file
-	memcpy(&hdr, pVirtualFile, sizeof(PW_DBHEADER));
+		if(mgr.SaveDatabase(lpTempFile, NULL) != PWE_SUCCESS)
+		{
+			DeleteFile(lpTempFile);
+			return false;
+		}
+	}
+
+	bool bResult = true;
+	for(int iMapped = 0; iMapped < 2; ++iMapped)
+	{
+		CPwManager mgr;
+		if(mgr.SetMasterKey(lpKey, FALSE, NULL, NULL, FALSE, NULL) != PWE_SUCCESS)
+			{ bResult = false; break; }
+
+		const DWORD dwStart = GetTickCount();
+		const int nResult = ((iMapped != 0) ? mgr.OpenDatabaseMapped(lpTempFile,
+			NULL) : mgr.OpenDatabase(lpTempFile, NULL));
+		const DWORD dwElapsed = GetTickCount() - dwStart;
+
+		if(nResult != PWE_SUCCESS) { bResult = false; break; }
+		if(iMapped != 0) *pdwMappedMs = dwElapsed;
+		else *pdwStreamMs = dwElapsed;
+	}
+
+	VERIFY(DeleteFile(lpTempFile) != FALSE);
+	return bResult;
+}
+
+// pMapped is either NULL or the same stream as s
+int CPwManager::OpenDatabaseStream(CKpStream& s, CKpMappedFileStream* pMapped,
+	UINT64 uFileSize, const TCHAR *pszFile, PWDB_REPAIR_INFO *pRepair)
+{
+	PW_DBHEADER hdr;
+	sha256_ctx sha32;
+	UINT8 uFinalKey[32];
+
+	ZeroMemory(&m_openTimings, sizeof(PWDB_OPEN_TIMINGS));
+	const DWORD dwStartTime = GetTickCount();
+
+	if(uFileSize < sizeof(PW_DBHEADER)) return PWE_INVALID_FILEHEADER;
+
+	// Only the header is read here, the rest of the file is streamed
+	if(FAILED(s.Read((BYTE *)&hdr, sizeof(PW_DBHEADER)))) return PWE_FILEERROR_READ;
 
 	// Check if it's a KDBX file created by KeePass 2.x
 	if((hdr.dwSignature1 == PWM_DBSIG_1_KDBX_P) && (hdr.dwSignature2 == PWM_DBSIG_2_KDBX_P))
@@ -145,23 +265,13 @@ int CPwManager::OpenDatabase(const TCHAR *pszFile, _Out_opt_ PWDB_REPAIR_INFO *p
 	{
 		if((hdr.dwVersion == 0x00020000) || (hdr.dwVersion == 0x00020001) || (hdr.dwVersion == 0x00020002))
 		{
-			if(pVirtualFile != NULL)
-			{
-				mem_erase(pVirtualFile, uAllocated);
-				SAFE_DELETE_ARRAY(pVirtualFile);
-			}
-
+			s.Close();
 			return ((CPwCompatImpl::OpenDatabaseV2(this, pszFile) != FALSE) ?
 				PWE_SUCCESS : PWE_UNKNOWN);
 		}
 		else if(hdr.dwVersion <= 0x00010002)
 		{
-			if(pVirtualFile != NULL)
-			{
-				mem_erase(pVirtualFile, uAllocated);
-				SAFE_DELETE_ARRAY(pVirtualFile);
-			}
-			
+			s.Close();
 			return ((CPwCompatImpl::OpenDatabaseV1(this, pszFile) != FALSE) ?
 				PWE_SUCCESS : PWE_UNKNOWN);
 		}
@@ -177,284 +287,364 @@ int CPwManager::OpenDatabase(const TCHAR *pszFile, _Out_opt_ PWDB_REPAIR_INFO *p
 
 	m_dwKeyEncRounds = hdr.dwKeyEncRounds;
 
-	// Generate m_pTransformedMasterKey from m_pMasterKey
-	if(_TransformMasterKey(hdr.aMasterSeed2) == FALSE) { ASSERT(FALSE); _OPENDB_FAIL; }
+	// The Argon2 parameters are required for deriving the key, thus they
+	// are stored unencrypted after the header (and verified in ReadExtData)
+	UINT64 uCipherOffset = sizeof(PW_DBHEADER);
+	if((hdr.dwFlags & PWM_FLAG_ARGON2) != 0)
+	{
+		if(uFileSize < (sizeof(PW_DBHEADER) + sizeof(PW_ARGON2_PARAMS)))
+			{ _OPENDB_FAIL_LIGHT; return PWE_INVALID_FILEHEADER; }
 
-	ProtectTransformedMasterKey(false);
+		PW_ARGON2_PARAMS a2;
+		if(FAILED(s.Read((BYTE *)&a2, sizeof(PW_ARGON2_PARAMS))))
+			{ _OPENDB_FAIL_LIGHT; return PWE_FILEERROR_READ; }
+		if(!CArgon2Kdf::IsValid(&a2)) { _OPENDB_FAIL_LIGHT; return PWE_INVALID_FILEHEADER; }
 
-	// Hash the master password with the salt in the file
-	sha256_begin(&sha32);
-	sha256_hash(hdr.aMasterSeed, 16, &sha32);
-	sha256_hash(m_pTransformedMasterKey, 32, &sha32);
-	sha256_end((unsigned char *)uFinalKey, &sha32);
-
-	ProtectTransformedMasterKey(true);
+		memcpy(&m_argon2, &a2, sizeof(PW_ARGON2_PARAMS));
+		m_nKdf = KDF_ARGON2;
+		uCipherOffset += sizeof(PW_ARGON2_PARAMS);
+	}
+	else m_nKdf = KDF_AES;
 
+	UINT64 uCipherSize = uFileSize - uCipherOffset;
 	if(pRepair == NULL)
 	{
-		// ASSERT(((uFileSize - sizeof(PW_DBHEADER)) % 16) == 0);
-		if(((uFileSize - sizeof(PW_DBHEADER)) % 16) != 0)
-		{
-			_OPENDB_FAIL_LIGHT;
-			return PWE_INVALID_FILESIZE;
-		}
+		if((uCipherSize % 16) != 0) { _OPENDB_FAIL_LIGHT; return PWE_INVALID_FILESIZE; }
 	}
 	else // Repair the database
 	{
-		if(((uFileSize - sizeof(PW_DBHEADER)) % 16) != 0)
-		{
-			uFileSize -= sizeof(PW_DBHEADER); ASSERT((uFileSize & 0xF) != 0);
-			uFileSize &= ~0xFUL;
-			uFileSize += sizeof(PW_DBHEADER);
-		}
-
-		ASSERT(((uFileSize - sizeof(PW_DBHEADER)) % 16) == 0);
+		uCipherSize &= ~static_cast<UINT64>(0xF);
 
 		pRepair->dwOriginalGroupCount = hdr.dwGroups;
 		pRepair->dwOriginalEntryCount = hdr.dwEntries;
 	}
 
-	if(m_nAlgorithm == ALGO_AES)
-	{
-		CRijndael aes;
+	const DWORD dwHeaderTime = GetTickCount();
+	m_openTimings.dwReadHeader = dwHeaderTime - dwStartTime;
 
-		// Initialize Rijndael algorithm
-		if(aes.Init(CRijndael::CBC, CRijndael::DecryptDir, uFinalKey,
-			CRijndael::Key32Bytes, hdr.aEncryptionIV) != RIJNDAEL_SUCCESS)
-			{ _OPENDB_FAIL_LIGHT; return PWE_CRYPT_ERROR; }
+	// Generate m_pTransformedMasterKey from m_pMasterKey on worker threads;
+	// in the meantime, this thread reads the file (the transformation
+	// only depends on the header)
+	_BeginTransformMasterKey(hdr.aMasterSeed2);
 
-		// Decrypt! The first bytes aren't encrypted (that's the header)
-		uEncryptedPartSize = (unsigned long)aes.PadDecrypt((UINT8 *)pVirtualFile + sizeof(PW_DBHEADER),
-			uFileSize - sizeof(PW_DBHEADER), (UINT8 *)pVirtualFile + sizeof(PW_DBHEADER));
-	}
-	else if(m_nAlgorithm == ALGO_TWOFISH)
+	CKpReadAheadStream ras(&s, PWM_OPEN_READAHEAD_MAX);
+	HRESULT hrReadAhead = S_OK;
+	if(pMapped != NULL)
 	{
-		CTwofish twofish;
-
-		if(twofish.Init(uFinalKey, 32, hdr.aEncryptionIV) != true)
-			{ _OPENDB_FAIL };
+		pMapped->Prefetch();
 
-		uEncryptedPartSize = (unsigned long)twofish.PadDecrypt((UINT8 *)pVirtualFile + sizeof(PW_DBHEADER),
-			uFileSize - sizeof(PW_DBHEADER), (UINT8 *)pVirtualFile + sizeof(PW_DBHEADER));
+		while((hrReadAhead == S_OK) && !_IsTransformMasterKeyDone())
+			hrReadAhead = pMapped->ReadAhead(KPCS_CHUNK_SIZE);
+		m_openTimings.qwReadAheadBytes = pMapped->GetReadAheadSize();
 	}
 	else
 	{
-		ASSERT(FALSE); _OPENDB_FAIL; // This should never happen
+		while((hrReadAhead == S_OK) && !_IsTransformMasterKeyDone())
+			hrReadAhead = ras.ReadAhead(KPCS_CHUNK_SIZE);
+		m_openTimings.qwReadAheadBytes = ras.GetBufferedSize();
 	}
+	// Read errors are reported when the data is actually needed
 
+	const DWORD dwReadAheadTime = GetTickCount();
+	m_openTimings.dwReadAhead = dwReadAheadTime - dwHeaderTime;
+
+	const BOOL bTransformed = _EndTransformMasterKey(&m_openTimings.dwTransformKey);
+	const DWORD dwKeyTime = GetTickCount();
+	m_openTimings.dwWaitForKey = dwKeyTime - dwReadAheadTime;
+	if(bTransformed == FALSE) { ASSERT(FALSE); _OPENDB_FAIL; }
+
+	ProtectTransformedMasterKey(false);
+
+	// Hash the master password with the salt in the file
+	sha256_begin(&sha32);
+	sha256_hash(hdr.aMasterSeed, 16, &sha32);
+	sha256_hash(m_pTransformedMasterKey, 32, &sha32);
+	sha256_end((unsigned char *)uFinalKey, &sha32);
+
+	ProtectTransformedMasterKey(true);
+
+	// The content is decrypted chunk by chunk while parsing it; the
+	// contents hash is computed on the fly
+	boost::scoped_ptr<CKpCbcDecryptStream> pcs((pMapped != NULL) ?
+		new CKpCbcDecryptStream(pMapped, uCipherSize) :
+		new CKpCbcDecryptStream(&ras, uCipherSize));
+	CKpCbcDecryptStream& cs = *pcs;
+	const bool bCryptInit = cs.Init(m_nAlgorithm, uFinalKey, hdr.aEncryptionIV);
 	mem_erase(uFinalKey, 32);
+	if(!bCryptInit) { _OPENDB_FAIL_LIGHT; return PWE_CRYPT_ERROR; }
+
+	// The key can only be verified after all records have been read,
+	// thus they are read into an empty database; the previous contents
+	// are kept in mgrPrevious and restored if the key is invalid
+	CPwManager mgrPrevious;
+	_SwapContents(mgrPrevious);
+
+	HashHeaderWithoutContentHash((BYTE*)&hdr, m_vHeaderHash);
+
+	const int nRecordsResult = ReadDbRecords(cs, hdr, pRepair);
 
-#if 0
-	// For debugging purposes, a file containing the plain text is created.
-	// This code of course must not be compiled into the final binary.
-#pragma message("PLAIN TEXT OUTPUT IS ENABLED!")
-#pragma message("DO NOT DISTRIBUTE THIS BINARY!")
-	// std::basic_string<TCHAR> tstrClear = pszFile;
-	// tstrClear += _T(".plaintext.bin");
-	// FILE *fpClear = NULL;
-	// _tfopen_s(&fpClear, tstrClear.c_str(), _T("wb"));
-	// fwrite(pVirtualFile, 1, uFileSize, fpClear);
-	// fclose(fpClear); fpClear = NULL;
-#endif
-
-	// Check for success (non-repair mode only)
+	// Check if key is correct (with very high probability); in case of
+	// an invalid key, the records read above are garbage
 	if(pRepair == NULL)
 	{
-		if((uEncryptedPartSize > 2147483446) || ((uEncryptedPartSize == 0) &&
-			((hdr.dwGroups != 0) || (hdr.dwEntries != 0))))
+		if(nRecordsResult == PWE_INVALID_KEY)
 		{
+			_SwapContents(mgrPrevious);
 			_OPENDB_FAIL_LIGHT;
 			return PWE_INVALID_KEY;
 		}
-	}
 
-	// Check if key is correct (with very high probability)
-	if(pRepair == NULL)
-	{
 		unsigned char vContentsHash[32];
-		sha256_begin(&sha32);
-		sha256_hash((unsigned char *)pVirtualFile + sizeof(PW_DBHEADER), uEncryptedPartSize, &sha32);
-		sha256_end(vContentsHash, &sha32);
-		if(memcmp(hdr.aContentsHash, vContentsHash, 32) != 0)
-			{ _OPENDB_FAIL_LIGHT; return PWE_INVALID_KEY; }
+		const bool bReadToEnd = SUCCEEDED(cs.Skip());
+		cs.GetPlainHash(vContentsHash);
+
+		if(!bReadToEnd || !cs.IsPaddingValid() || (memcmp(
+			hdr.aContentsHash, vContentsHash, 32) != 0))
+		{
+			_SwapContents(mgrPrevious);
+			_OPENDB_FAIL_LIGHT;
+			return (bReadToEnd ? PWE_INVALID_KEY : PWE_FILEERROR_READ);
+		}
 	}
 
-	NewDatabase(); // Create a new database and initialize internal structures
+	if(nRecordsResult != PWE_SUCCESS) { _OPENDB_FAIL_LIGHT; return nRecordsResult; }
+
+	cs.Close();
+	ras.Close();
+	s.Close();
+
+	memcpy(&m_dbLastHeader, &hdr, sizeof(PW_DBHEADER));
+
+	const DWORD dwRemovedStreams = _LoadAndRemoveAllMetaStreams(true);
+	if(pRepair != NULL) pRepair->dwRecognizedMetaStreamCount = dwRemovedStreams;
+	VERIFY(DeleteLostEntries() == 0);
+	FixGroupTree();
+	ASSERT(_CheckIndexes());
+
+	const DWORD dwEndTime = GetTickCount();
+	m_openTimings.dwDecryptParse = dwEndTime - dwKeyTime;
+	m_openTimings.dwTotal = dwEndTime - dwStartTime;
 
-	ASSERT(memcmp(&hdr, pVirtualFile, sizeof(PW_DBHEADER)) == 0);
-	HashHeaderWithoutContentHash((BYTE*)pVirtualFile, m_vHeaderHash);
+	if(m_bSearchIndex != FALSE) _RebuildTrigramIndex();
+
+	_PreDeriveSaveKey();
+	return PWE_SUCCESS;
+}
 
-	// Add groups from the memory file to the internal structures
-	pos = sizeof(PW_DBHEADER);
-	// char *pStart = &pVirtualFile[pos];
+// Read hdr.dwGroups group records followed by hdr.dwEntries entry records.
+// Only one field is held in memory at a time.
+// Returns PWE_INVALID_KEY if the first field is implausible (i.e. the
+// plaintext is garbage), in which case no record has been added.
+int CPwManager::ReadDbRecords(CKpCbcDecryptStream& s, const PW_DBHEADER& hdr,
+	PWDB_REPAIR_INFO *pRepair)
+{
+	PW_GROUP pwGroupTemplate;
+	PW_ENTRY pwEntryTemplate;
+	USHORT usFieldType;
+	DWORD dwFieldSize;
+	BYTE *pbField = NULL;
+	UINT64 cbFieldAlloc = 0;
+	bool bFirstField = true;
+	int nResult = PWE_SUCCESS;
+
+	RESET_PWG_TEMPLATE(&pwGroupTemplate);
+	RESET_PWE_TEMPLATE(&pwEntryTemplate);
+
+	// Add groups from the stream to the internal structures
 	DWORD uCurGroup = 0;
-	while(uCurGroup < hdr.dwGroups)
+	while((nResult == PWE_SUCCESS) && (uCurGroup < hdr.dwGroups))
 	{
-		p = &pVirtualFile[pos];
-
-		PWMOD_CHECK_AVAIL(2);
-		// if(pRepair != NULL) { if(IsBadReadPtr(p, 2) != FALSE) { _OPENDB_FAIL; } }
-		memcpy(&usFieldType, p, 2);
-		p += 2; pos += 2;
-		// if(pos >= uFileSize) { _OPENDB_FAIL; }
-
-		PWMOD_CHECK_AVAIL(4);
-		// if(pRepair != NULL) { if(IsBadReadPtr(p, 4) != FALSE) { _OPENDB_FAIL; } }
-		memcpy(&dwFieldSize, p, 4);
-		p += 4; pos += 4;
-		// if(pos >= (uFileSize + dwFieldSize)) { _OPENDB_FAIL; }
-
-		PWMOD_CHECK_AVAIL(dwFieldSize);
-		// if(pRepair != NULL) { if(IsBadReadPtr(p, dwFieldSize) != FALSE) { _OPENDB_FAIL; } }
-		if(!ReadGroupField(usFieldType, dwFieldSize, (BYTE *)p,
-			&pwGroupTemplate, pRepair)) { _OPENDB_FAIL; }
+		if(!ReadRecordField(s, &usFieldType, &dwFieldSize, &pbField, &cbFieldAlloc))
+			{ nResult = PWE_INVALID_FILESTRUCTURE; break; }
+
+		// The first field is either the ext data or the first group ID
+		if(bFirstField && (pRepair == NULL) && (usFieldType != 0x0000) &&
+			((usFieldType != 0x0001) || (dwFieldSize != 4)))
+			{ nResult = PWE_INVALID_KEY; break; }
+		bFirstField = false;
+
+		if(!ReadGroupField(usFieldType, dwFieldSize, pbField,
+			&pwGroupTemplate, pRepair)) { nResult = PWE_INVALID_FILESTRUCTURE; break; }
 		if(usFieldType == 0xFFFF)
 			++uCurGroup; // Now and ONLY now the counter gets increased
-
-		p += dwFieldSize;
-		// if(p < pStart) { _OPENDB_FAIL; }
-		pos += dwFieldSize;
-		// if(pos >= uFileSize) { _OPENDB_FAIL; }
 	}
 	SAFE_DELETE_ARRAY(pwGroupTemplate.pszGroupName);
 
 	// Get the entries
 	DWORD uCurEntry = 0;
-	while(uCurEntry < hdr.dwEntries)
+	while((nResult == PWE_SUCCESS) && (uCurEntry < hdr.dwEntries))
 	{
-		p = &pVirtualFile[pos];
-
-		PWMOD_CHECK_AVAIL(2);
-		// if(pRepair != NULL) { if(IsBadReadPtr(p, 2) != FALSE) { _OPENDB_FAIL; } }
-		memcpy(&usFieldType, p, 2);
-		p += 2; pos += 2;
-		// if(pos >= uFileSize) { _OPENDB_FAIL; }
-
-		PWMOD_CHECK_AVAIL(4);
-		// if(pRepair != NULL) { if(IsBadReadPtr(p, 4) != FALSE) { _OPENDB_FAIL; } }
-		memcpy(&dwFieldSize, p, 4);
-		p += 4; pos += 4;
-		// if(pos >= (uFileSize + dwFieldSize)) { _OPENDB_FAIL; }
-
-		PWMOD_CHECK_AVAIL(dwFieldSize);
-		// if(pRepair != NULL) { if(IsBadReadPtr(p, dwFieldSize) != FALSE) { _OPENDB_FAIL; } }
-		if(!ReadEntryField(usFieldType, dwFieldSize, (BYTE *)p,
-			&pwEntryTemplate, pRepair)) { _OPENDB_FAIL; }
+		if(!ReadRecordField(s, &usFieldType, &dwFieldSize, &pbField, &cbFieldAlloc))
+			{ nResult = PWE_INVALID_FILESTRUCTURE; break; }
+
+		if(!ReadEntryField(usFieldType, dwFieldSize, pbField,
+			&pwEntryTemplate, pRepair)) { nResult = PWE_INVALID_FILESTRUCTURE; break; }
 		if(usFieldType == 0xFFFF)
 			++uCurEntry; // Now and ONLY now the counter gets increased
-
-		p += dwFieldSize;
-		// if(p < pStart) { _OPENDB_FAIL; }
-		pos += dwFieldSize;
-		// if(pos >= uFileSize) { _OPENDB_FAIL; }
 	}
-	SAFE_DELETE_ARRAY(pwEntryTemplate.pszTitle);
-	SAFE_DELETE_ARRAY(pwEntryTemplate.pszURL);
-	SAFE_DELETE_ARRAY(pwEntryTemplate.pszUserName);
-	SAFE_DELETE_ARRAY(pwEntryTemplate.pszPassword);
-	SAFE_DELETE_ARRAY(pwEntryTemplate.pszAdditional);
-	SAFE_DELETE_ARRAY(pwEntryTemplate.pszBinaryDesc);
-	SAFE_DELETE_ARRAY(pwEntryTemplate.pBinaryData);
+	if(pwEntryTemplate.pszPassword != NULL)
+		mem_erase(pwEntryTemplate.pszPassword, _tcslen(pwEntryTemplate.pszPassword) * sizeof(TCHAR));
+	_FreeEntryStrings(&pwEntryTemplate);
 
-	memcpy(&m_dbLastHeader, &hdr, sizeof(PW_DBHEADER));
+	if(pbField != NULL)
+	{
+		mem_erase(pbField, static_cast<size_t>(cbFieldAlloc));
+		SAFE_DELETE_ARRAY(pbField);
+	}
 
-	// Erase and delete memory file
-	mem_erase(pVirtualFile, uAllocated);
-	SAFE_DELETE_ARRAY(pVirtualFile);
+	return nResult;
+}
 
-	const DWORD dwRemovedStreams = _LoadAndRemoveAllMetaStreams(true);
-	if(pRepair != NULL) pRepair->dwRecognizedMetaStreamCount = dwRemovedStreams;
-	VERIFY(DeleteLostEntries() == 0);
-	FixGroupTree();
+static bool WriteDbField(CKpMemoryStream& ms, USHORT usFieldType,
+	const void *pData, DWORD dwFieldSize)
+{
+	BYTE *pb = ms.Append(2 + 4 + static_cast<UINT64>(dwFieldSize));
+	if(pb == NULL) return false;
 
-	return PWE_SUCCESS;
+	memcpy(pb, &usFieldType, 2);
+	memcpy(pb + 2, &dwFieldSize, 4);
+	if(dwFieldSize != 0) memcpy(pb + 6, pData, dwFieldSize);
+	return true;
 }
 
-int CPwManager::SaveDatabase(const TCHAR *pszFile, BYTE *pWrittenDataHash32)
+// The string is encoded directly into the stream buffer
+static bool WriteStringField(CKpMemoryStream& ms, USHORT usFieldType,
+	const TCHAR *lpString)
 {
-	DWORD uEncryptedPartSize, i, pos, dwFieldSize;
-	UINT8 uFinalKey[32];
-	sha256_ctx sha32;
-	USHORT usFieldType;
-	BYTE aCompressedTime[5];
+	ASSERT(lpString != NULL); if(lpString == NULL) return false;
 
-	ASSERT(pszFile != NULL);
-	if(pszFile == NULL) return PWE_INVALID_PARAM;
-	ASSERT(pszFile[0] != 0);
-	if(pszFile[0] == 0) return PWE_INVALID_PARAM;
-
-	if(m_dwNumGroups == 0) return PWE_DB_EMPTY;
+	const DWORD cbMax = _UTF8MaxBytes(lpString);
+	const UINT64 uFieldPos = ms.GetSize();
+	BYTE *pb = ms.Append(2 + 4 + static_cast<UINT64>(cbMax));
+	if(pb == NULL) return false;
 
-	_AddAllMetaStreams();
+	const DWORD dwFieldSize = _StringToUTF8Buffer(lpString, pb + 6);
+	ASSERT((dwFieldSize != 0) && (dwFieldSize <= cbMax));
+	if(dwFieldSize == 0) return false;
 
-	UINT64 qwFileSize = sizeof(PW_DBHEADER);
-	BYTE *pbt;
+	memcpy(pb, &usFieldType, 2);
+	memcpy(pb + 2, &dwFieldSize, 4);
 
-	// Create a dummy ext data structure for computing its size
-	m_vHeaderHash.resize(32);
-	CKpMemoryStream msExtDataSize(true);
-	WriteExtData(msExtDataSize);
-	qwFileSize += 2 + 4 + msExtDataSize.GetSize();
+	ms.Truncate(uFieldPos + 2 + 4 + dwFieldSize);
+	return true;
+}
 
-	// Get the size of all groups
-	for(i = 0; i < m_dwNumGroups; ++i)
-	{
-		qwFileSize += 94; // 6+4+6+6+5+6+5+6+5+6+5+6+4+6+6+2+6+4 = 94
+static bool WriteTimeField(CKpMemoryStream& ms, USHORT usFieldType,
+	const PW_TIME *pTime)
+{
+	BYTE *pb = ms.Append(2 + 4 + 5);
+	if(pb == NULL) return false;
 
-		pbt = _StringToUTF8(m_pGroups[i].pszGroupName);
-		qwFileSize += szlen((char *)pbt) + 1;
-		SAFE_DELETE_ARRAY(pbt);
-	}
+	const DWORD dwFieldSize = 5;
+	memcpy(pb, &usFieldType, 2);
+	memcpy(pb + 2, &dwFieldSize, 4);
+	CPwUtil::PwTimeToTime(pTime, pb + 6);
+	return true;
+}
 
-	// Get the size of all entries together
-	for(i = 0; i < m_dwNumEntries; ++i)
-	{
-		ASSERT_ENTRY(&m_pEntries[i]);
+// Pass the encoded records in ms on to s and clear ms
+static bool FlushDbRecords(CKpStream& s, CKpMemoryStream& ms)
+{
+	if(ms.GetSize() == 0) return true;
 
-		UnlockEntryPassword(&m_pEntries[i]);
+	const bool bOK = SUCCEEDED(s.Write(ms.GetBuffer(), ms.GetSize()));
+	ms.Truncate(0);
+	return bOK;
+}
 
-		qwFileSize += 134; // 6+16+6+4+6+4+6+6+6+6+6+6+5+6+5+6+5+6+5+6 = 122
+// Fields that are at least as large as a chunk (attachments) are written
+// to s directly instead of being copied into ms
+static bool WriteDataField(CKpStream& s, CKpMemoryStream& ms,
+	USHORT usFieldType, const void *pData, DWORD dwFieldSize)
+{
+	if(dwFieldSize < KPCS_CHUNK_SIZE)
+		return WriteDbField(ms, usFieldType, pData, dwFieldSize);
 
-		pbt = _StringToUTF8(m_pEntries[i].pszTitle);
-		qwFileSize += szlen((char *)pbt) + 1;
-		SAFE_DELETE_ARRAY(pbt);
+	if(!WriteDbField(ms, usFieldType, NULL, 0)) return false;
+	memcpy(ms.GetBuffer() + ms.GetSize() - 4, &dwFieldSize, 4);
+	if(!FlushDbRecords(s, ms)) return false;
 
-		pbt = _StringToUTF8(m_pEntries[i].pszUserName);
-		qwFileSize += szlen((char *)pbt) + 1;
-		SAFE_DELETE_ARRAY(pbt);
+	return SUCCEEDED(s.Write(static_cast<const BYTE *>(pData), dwFieldSize));
+}
 
-		pbt = _StringToUTF8(m_pEntries[i].pszURL);
-		qwFileSize += szlen((char *)pbt) + 1;
-		SAFE_DELETE_ARRAY(pbt);
+// The records are encoded into a buffer that is passed on to s whenever
+// it has reached the chunk size, thus a pass only needs memory for about
+// one chunk, independent of the size of the database
+bool CPwManager::WriteDbRecords(CKpStream& s, const CKpMemoryStream& msExtData)
+{
+	DWORD i;
+	CKpMemoryStream ms(true);
 
-		pbt = _StringToUTF8(m_pEntries[i].pszPassword);
-		qwFileSize += szlen((char *)pbt) + 1;
-		SAFE_DELETE_ARRAY(pbt);
+	// Store the ext data as first field of the first group
+	bool bOK = WriteDataField(s, ms, 0x0000, msExtData.GetBuffer(),
+		static_cast<DWORD>(msExtData.GetSize()));
 
-		pbt = _StringToUTF8(m_pEntries[i].pszAdditional);
-		qwFileSize += szlen((char *)pbt) + 1;
-		SAFE_DELETE_ARRAY(pbt);
+	// Store all groups
+	for(i = 0; bOK && (i < m_dwNumGroups); ++i)
+	{
+		if(ms.GetSize() >= KPCS_CHUNK_SIZE) bOK &= FlushDbRecords(s, ms);
+
+		const PW_GROUP *pg = &m_pGroups[i];
+
+		bOK &= WriteDbField(ms, 0x0001, &pg->uGroupId, 4);
+		bOK &= WriteStringField(ms, 0x0002, pg->pszGroupName);
+		bOK &= WriteTimeField(ms, 0x0003, &pg->tCreation);
+		bOK &= WriteTimeField(ms, 0x0004, &pg->tLastMod);
+		bOK &= WriteTimeField(ms, 0x0005, &pg->tLastAccess);
+		bOK &= WriteTimeField(ms, 0x0006, &pg->tExpire);
+		bOK &= WriteDbField(ms, 0x0007, &pg->uImageId, 4);
+		bOK &= WriteDbField(ms, 0x0008, &pg->usLevel, 2);
+		bOK &= WriteDbField(ms, 0x0009, &pg->dwFlags, 4);
+		bOK &= WriteDbField(ms, 0xFFFF, NULL, 0);
+	}
 
-		pbt = _StringToUTF8(m_pEntries[i].pszBinaryDesc);
-		qwFileSize += szlen((char *)pbt) + 1;
-		SAFE_DELETE_ARRAY(pbt);
+	// Store all entries
+	for(i = 0; bOK && (i < m_dwNumEntries); ++i)
+	{
+		PW_ENTRY *pe = &m_pEntries[i];
+		ASSERT_ENTRY(pe);
+
+		if(ms.GetSize() >= KPCS_CHUNK_SIZE) bOK &= FlushDbRecords(s, ms);
+
+		bOK &= WriteDbField(ms, 0x0001, pe->uuid, 16);
+		bOK &= WriteDbField(ms, 0x0002, &pe->uGroupId, 4);
+		bOK &= WriteDbField(ms, 0x0003, &pe->uImageId, 4);
+		bOK &= WriteStringField(ms, 0x0004, pe->pszTitle);
+		bOK &= WriteStringField(ms, 0x0005, pe->pszURL);
+		bOK &= WriteStringField(ms, 0x0006, pe->pszUserName);
+
+		UnlockEntryPassword(pe);
+		bOK &= WriteStringField(ms, 0x0007, pe->pszPassword);
+		LockEntryPassword(pe);
+
+		bOK &= WriteStringField(ms, 0x0008, pe->pszAdditional);
+		bOK &= WriteTimeField(ms, 0x0009, &pe->tCreation);
+		bOK &= WriteTimeField(ms, 0x000A, &pe->tLastMod);
+		bOK &= WriteTimeField(ms, 0x000B, &pe->tLastAccess);
+		bOK &= WriteTimeField(ms, 0x000C, &pe->tExpire);
+		bOK &= WriteStringField(ms, 0x000D, pe->pszBinaryDesc);
+		bOK &= WriteDataField(s, ms, 0x000E, pe->pBinaryData, ((pe->pBinaryData != NULL) ?
+			pe->uBinaryDataLen : 0));
+		bOK &= WriteDbField(ms, 0xFFFF, NULL, 0);
+	}
 
-		qwFileSize += m_pEntries[i].uBinaryDataLen;
+	if(bOK) bOK = FlushDbRecords(s, ms);
+	return bOK;
+}
 
-		LockEntryPassword(&m_pEntries[i]);
-	}
+int CPwManager::SaveDatabase(const TCHAR *pszFile, BYTE *pWrittenDataHash32)
+{
+	UINT8 uFinalKey[32];
+	sha256_ctx sha32;
 
-	// Round up file size to 16-byte boundary for Rijndael/Twofish
-	qwFileSize = (qwFileSize + 16) - (qwFileSize % 16);
+	ASSERT(pszFile != NULL);
+	if(pszFile == NULL) return PWE_INVALID_PARAM;
+	ASSERT(pszFile[0] != 0);
+	if(pszFile[0] == 0) return PWE_INVALID_PARAM;
 
-	const UINT64 qwAlloc = qwFileSize + 16;
-	if(qwAlloc > 0xFFFFFFFFULL) { _LoadAndRemoveAllMetaStreams(false); return PWE_NO_MEM; }
+	if(m_dwNumGroups == 0) return PWE_DB_EMPTY;
 
-	const DWORD uAlloc = static_cast<DWORD>(qwAlloc);
-	char *pVirtualFile = NULL;
-	try { pVirtualFile = new char[uAlloc]; }
-	catch(...) { }
-	if(pVirtualFile == NULL) { _LoadAndRemoveAllMetaStreams(false); return PWE_NO_MEM; }
+	_AddAllMetaStreams();
 
 	// Build header structure
 	PW_DBHEADER hdr;
@@ -467,6 +657,8 @@ int CPwManager::SaveDatabase(const TCHAR *pszFile, BYTE *pWrittenDataHash32)
 	else if(m_nAlgorithm == ALGO_TWOFISH) hdr.dwFlags |= PWM_FLAG_TWOFISH;
 	else { ASSERT(FALSE); _LoadAndRemoveAllMetaStreams(false); return PWE_INVALID_PARAM; }
 
+	if(m_nKdf == KDF_ARGON2) hdr.dwFlags |= PWM_FLAG_ARGON2;
+
 	hdr.dwVersion = PWM_DBVER_DW;
 	hdr.dwGroups = m_dwNumGroups;
 	hdr.dwEntries = m_dwNumEntries;
@@ -475,211 +667,32 @@ int CPwManager::SaveDatabase(const TCHAR *pszFile, BYTE *pWrittenDataHash32)
 	// Make up the master key hash seed and the encryption IV
 	m_random.GetRandomBuffer(hdr.aMasterSeed, 16);
 	m_random.GetRandomBuffer((BYTE *)hdr.aEncryptionIV, 16);
-	m_random.GetRandomBuffer(hdr.aMasterSeed2, 32);
+
+	// Use the transformed master key that has been computed in the
+	// background since the last open/save, if available
+	const bool bPreDerived = _TakePreDerivedSaveKey(hdr.aMasterSeed2);
+	if(!bPreDerived) m_random.GetRandomBuffer(hdr.aMasterSeed2, 32);
 
 	// We have everything except the contents hash
 	HashHeaderWithoutContentHash((BYTE*)&hdr, m_vHeaderHash);
+
+	// The ext data contains random data, thus it is generated once and
+	// stored in both passes below
 	CKpMemoryStream msExtData(true);
 	WriteExtData(msExtData);
-	ASSERT(msExtData.GetSize() == msExtDataSize.GetSize());
 
-	// Skip the header, it will be written later
-	pos = sizeof(PW_DBHEADER);
-
-	BYTE *pb;
-
-	// Store all groups to memory file
-	for(i = 0; i < m_dwNumGroups; ++i)
-	{
-		if(i == 0)
-		{
-			usFieldType = 0x0000; dwFieldSize = static_cast<DWORD>(msExtData.GetSize());
-			memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-			memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-			memcpy(&pVirtualFile[pos], msExtData.GetBuffer(), dwFieldSize); pos += dwFieldSize;
-		}
-
-		usFieldType = 0x0001; dwFieldSize = 4;
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		memcpy(&pVirtualFile[pos], &m_pGroups[i].uGroupId, 4); pos += 4;
-
-		pb = _StringToUTF8(m_pGroups[i].pszGroupName);
-		usFieldType = 0x0002; dwFieldSize = szlen((char *)pb) + 1;
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		ASSERT((pb != NULL) && (szlen((char *)pb) == (dwFieldSize - 1)) && ((pos + dwFieldSize) <= qwAlloc));
-		szcpy(&pVirtualFile[pos], (char *)pb); pos += dwFieldSize;
-		SAFE_DELETE_ARRAY(pb);
-
-		usFieldType = 0x0003; dwFieldSize = 5;
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		CPwUtil::PwTimeToTime(&m_pGroups[i].tCreation, aCompressedTime);
-		memcpy(&pVirtualFile[pos], aCompressedTime, 5); pos += 5;
-
-		usFieldType = 0x0004; dwFieldSize = 5;
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		CPwUtil::PwTimeToTime(&m_pGroups[i].tLastMod, aCompressedTime);
-		memcpy(&pVirtualFile[pos], aCompressedTime, 5); pos += 5;
-
-		usFieldType = 0x0005; dwFieldSize = 5;
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		CPwUtil::PwTimeToTime(&m_pGroups[i].tLastAccess, aCompressedTime);
-		memcpy(&pVirtualFile[pos], aCompressedTime, 5); pos += 5;
-
-		usFieldType = 0x0006; dwFieldSize = 5;
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		CPwUtil::PwTimeToTime(&m_pGroups[i].tExpire, aCompressedTime);
-		memcpy(&pVirtualFile[pos], aCompressedTime, 5); pos += 5;
-
-		usFieldType = 0x0007; dwFieldSize = 4;
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		memcpy(&pVirtualFile[pos], &m_pGroups[i].uImageId, 4); pos += 4;
-
-		usFieldType = 0x0008; dwFieldSize = 2;
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		memcpy(&pVirtualFile[pos], &m_pGroups[i].usLevel, 2); pos += 2;
-
-		usFieldType = 0x0009; dwFieldSize = 4;
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		memcpy(&pVirtualFile[pos], &m_pGroups[i].dwFlags, 4); pos += 4;
-
-		usFieldType = 0xFFFF; dwFieldSize = 0;
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-	}
-
-	// Store all entries to memory file
-	for(i = 0; i < m_dwNumEntries; ++i)
-	{
-		UnlockEntryPassword(&m_pEntries[i]);
-
-		usFieldType = 0x0001; dwFieldSize = 16;
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		memcpy(&pVirtualFile[pos], &m_pEntries[i].uuid, 16); pos += 16;
-
-		usFieldType = 0x0002; dwFieldSize = 4;
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		memcpy(&pVirtualFile[pos], &m_pEntries[i].uGroupId, 4); pos += 4;
-
-		usFieldType = 0x0003; dwFieldSize = 4;
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		memcpy(&pVirtualFile[pos], &m_pEntries[i].uImageId, 4); pos += 4;
-
-		pb = _StringToUTF8(m_pEntries[i].pszTitle);
-		usFieldType = 0x0004;
-		dwFieldSize = szlen((char *)pb) + 1; // Add terminating NULL character space
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		ASSERT((pb != NULL) && (szlen((char *)pb) == (dwFieldSize - 1)) && ((pos + dwFieldSize) <= qwAlloc));
-		szcpy(&pVirtualFile[pos], (char *)pb); pos += dwFieldSize;
-		SAFE_DELETE_ARRAY(pb);
-
-		pb = _StringToUTF8(m_pEntries[i].pszURL);
-		usFieldType = 0x0005;
-		dwFieldSize = szlen((char *)pb) + 1; // Add terminating NULL character space
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		ASSERT((pb != NULL) && (szlen((char *)pb) == (dwFieldSize - 1)) && ((pos + dwFieldSize) <= qwAlloc));
-		szcpy(&pVirtualFile[pos], (char *)pb); pos += dwFieldSize;
-		SAFE_DELETE_ARRAY(pb);
-
-		pb = _StringToUTF8(m_pEntries[i].pszUserName);
-		usFieldType = 0x0006;
-		dwFieldSize = szlen((char *)pb) + 1; // Add terminating NULL character space
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		ASSERT((pb != NULL) && (szlen((char *)pb) == (dwFieldSize - 1)) && ((pos + dwFieldSize) <= qwAlloc));
-		szcpy(&pVirtualFile[pos], (char *)pb); pos += dwFieldSize;
-		SAFE_DELETE_ARRAY(pb);
-
-		pb = _StringToUTF8(m_pEntries[i].pszPassword);
-		usFieldType = 0x0007;
-		dwFieldSize = szlen((char *)pb) + 1; // Add terminating NULL character space
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		ASSERT((pb != NULL) && (szlen((char *)pb) == (dwFieldSize - 1)) && ((pos + dwFieldSize) <= qwAlloc));
-		szcpy(&pVirtualFile[pos], (char *)pb); pos += dwFieldSize;
-		if(pb != NULL) mem_erase(pb, szlen((char *)pb));
-		SAFE_DELETE_ARRAY(pb);
-
-		pb = _StringToUTF8(m_pEntries[i].pszAdditional);
-		usFieldType = 0x0008;
-		dwFieldSize = szlen((char *)pb) + 1; // Add terminating NULL character space
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		ASSERT((pb != NULL) && (szlen((char *)pb) == (dwFieldSize - 1)) && ((pos + dwFieldSize) <= qwAlloc));
-		szcpy(&pVirtualFile[pos], (char *)pb); pos += dwFieldSize;
-		SAFE_DELETE_ARRAY(pb);
-
-		usFieldType = 0x0009; dwFieldSize = 5;
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		CPwUtil::PwTimeToTime(&m_pEntries[i].tCreation, aCompressedTime);
-		memcpy(&pVirtualFile[pos], aCompressedTime, 5); pos += 5;
-
-		usFieldType = 0x000A; dwFieldSize = 5;
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		CPwUtil::PwTimeToTime(&m_pEntries[i].tLastMod, aCompressedTime);
-		memcpy(&pVirtualFile[pos], aCompressedTime, 5); pos += 5;
-
-		usFieldType = 0x000B; dwFieldSize = 5;
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		CPwUtil::PwTimeToTime(&m_pEntries[i].tLastAccess, aCompressedTime);
-		memcpy(&pVirtualFile[pos], aCompressedTime, 5); pos += 5;
-
-		usFieldType = 0x000C; dwFieldSize = 5;
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		CPwUtil::PwTimeToTime(&m_pEntries[i].tExpire, aCompressedTime);
-		memcpy(&pVirtualFile[pos], aCompressedTime, 5); pos += 5;
-
-		pb = _StringToUTF8(m_pEntries[i].pszBinaryDesc);
-		usFieldType = 0x000D;
-		dwFieldSize = szlen((char *)pb) + 1;
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		ASSERT((pb != NULL) && (szlen((char *)pb) == (dwFieldSize - 1)) && ((pos + dwFieldSize) <= qwAlloc));
-		szcpy(&pVirtualFile[pos], (char *)pb); pos += dwFieldSize;
-		SAFE_DELETE_ARRAY(pb);
-
-		usFieldType = 0x000E; dwFieldSize = m_pEntries[i].uBinaryDataLen;
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-		if((m_pEntries[i].pBinaryData != NULL) && (dwFieldSize != 0))
-			memcpy(&pVirtualFile[pos], m_pEntries[i].pBinaryData, dwFieldSize);
-		pos += dwFieldSize;
-
-		usFieldType = 0xFFFF; dwFieldSize = 0;
-		memcpy(&pVirtualFile[pos], &usFieldType, 2); pos += 2;
-		memcpy(&pVirtualFile[pos], &dwFieldSize, 4); pos += 4;
-
-		LockEntryPassword(&m_pEntries[i]);
-	}
-	ASSERT((pos <= qwFileSize) && ((pos + 33) > qwAlloc));
-
-	sha256_begin(&sha32);
-	sha256_hash((unsigned char *)pVirtualFile + sizeof(PW_DBHEADER), pos - sizeof(PW_DBHEADER), &sha32);
-	sha256_end((unsigned char *)hdr.aContentsHash, &sha32);
-
-	// Copy the completed header
-	memcpy(pVirtualFile, &hdr, sizeof(PW_DBHEADER));
+	// The contents hash is part of the header, which precedes the
+	// encrypted data; the records are therefore serialized twice: the
+	// first pass only hashes them, the second one encrypts and writes
+	// them. Both passes only need memory for about one chunk.
+	CKpHashStream hs;
+	if(!WriteDbRecords(hs, msExtData)) { _LoadAndRemoveAllMetaStreams(false); return PWE_NO_MEM; }
+	if(hs.GetSize() > 2147483446ULL) { ASSERT(FALSE); _LoadAndRemoveAllMetaStreams(false); return PWE_NO_MEM; }
+	hs.GetHash(hdr.aContentsHash);
 
 	// Generate m_pTransformedMasterKey from m_pMasterKey
-	if(_TransformMasterKey(hdr.aMasterSeed2) == FALSE)
-		{ ASSERT(FALSE); SAFE_DELETE_ARRAY(pVirtualFile); _LoadAndRemoveAllMetaStreams(false); return PWE_CRYPT_ERROR; }
+	if(!bPreDerived && (_TransformMasterKey(hdr.aMasterSeed2) == FALSE))
+		{ ASSERT(FALSE); _LoadAndRemoveAllMetaStreams(false); return PWE_CRYPT_ERROR; }
 
 	ProtectTransformedMasterKey(false);
 
@@ -691,94 +704,71 @@ int CPwManager::SaveDatabase(const TCHAR *pszFile, BYTE *pWrittenDataHash32)
 
 	ProtectTransformedMasterKey(true);
 
-#if 0
-	// For debugging purposes, a file containing the plain text is created.
-	// This code of course must not be compiled into the final binary.
-#pragma message("PLAIN TEXT OUTPUT IS ENABLED!")
-#pragma message("DO NOT DISTRIBUTE THIS BINARY!")
-	// std::basic_string<TCHAR> tstrClear = pszFile;
-	// tstrClear += _T(".plaintext.bin");
-	// FILE *fpClear = NULL;
-	// _tfopen_s(&fpClear, tstrClear.c_str(), _T("wb"));
-	// fwrite(pVirtualFile, 1, static_cast<size_t>(qwFileSize), fpClear);
-	// fclose(fpClear); fpClear = NULL;
-#endif
-
-	if(m_nAlgorithm == ALGO_AES)
+	CFileTransactionEx ft(pszFile, (m_bUseTransactedFileWrites != FALSE));
+	std_string strBufFile;
+	if(!ft.OpenWrite(strBufFile))
 	{
-		CRijndael aes;
-		if(aes.Init(CRijndael::CBC, CRijndael::EncryptDir, uFinalKey,
-			CRijndael::Key32Bytes, hdr.aEncryptionIV) != RIJNDAEL_SUCCESS)
-		{
-			SAFE_DELETE_ARRAY(pVirtualFile);
-			_LoadAndRemoveAllMetaStreams(false);
-			return PWE_CRYPT_ERROR;
-		}
-
-		uEncryptedPartSize = static_cast<unsigned long>(aes.PadEncrypt(
-			(UINT8 *)pVirtualFile + sizeof(PW_DBHEADER), pos - sizeof(PW_DBHEADER),
-			(UINT8 *)pVirtualFile + sizeof(PW_DBHEADER)));
+		mem_erase(uFinalKey, 32);
+		_LoadAndRemoveAllMetaStreams(false);
+		return PWE_GETLASTERROR;
 	}
-	else if(m_nAlgorithm == ALGO_TWOFISH)
+
+	int nResult = PWE_SUCCESS;
+	BYTE vWrittenHash[32];
 	{
-		CTwofish twofish;
-		if(twofish.Init(uFinalKey, 32, hdr.aEncryptionIV) == false)
+		CKpFileStream fs(strBufFile.c_str(), true);
+		if(!fs.IsOpen())
 		{
-			SAFE_DELETE_ARRAY(pVirtualFile);
+			mem_erase(uFinalKey, 32);
+			ft.AbortWrite();
 			_LoadAndRemoveAllMetaStreams(false);
-			return PWE_CRYPT_ERROR;
+			return PWE_NOFILEACCESS_WRITE;
 		}
 
-		uEncryptedPartSize = static_cast<unsigned long>(twofish.PadEncrypt(
-			(UINT8 *)pVirtualFile + sizeof(PW_DBHEADER),
-			pos - sizeof(PW_DBHEADER), (UINT8 *)pVirtualFile + sizeof(PW_DBHEADER)));
-	}
-	else
-	{
-		ASSERT(FALSE);
-		SAFE_DELETE_ARRAY(pVirtualFile);
-		_LoadAndRemoveAllMetaStreams(false);
-		return PWE_INVALID_PARAM;
+		// Pipeline: this thread serializes and encrypts the records, the
+		// ciphertext is written to the file and hashed by a background thread
+		CKpAsyncWriteStream ws(&fs, KPCS_CHUNK_SIZE);
+		CKpCbcEncryptStream cs(&ws);
+		const bool bInit = (ws.Start() && cs.Init(m_nAlgorithm, uFinalKey,
+			hdr.aEncryptionIV));
+		mem_erase(uFinalKey, 32);
+
+		if(!bInit) nResult = PWE_CRYPT_ERROR;
+		else if(FAILED(ws.Write((const BYTE *)&hdr, sizeof(PW_DBHEADER))))
+			nResult = PWE_FILEERROR_WRITE;
+		else if((m_nKdf == KDF_ARGON2) && FAILED(ws.Write((const BYTE *)&m_argon2,
+			sizeof(PW_ARGON2_PARAMS))))
+			nResult = PWE_FILEERROR_WRITE;
+		else if(!WriteDbRecords(cs, msExtData) || FAILED(cs.Finish()))
+			nResult = PWE_FILEERROR_WRITE;
+
+		if(FAILED(ws.Finish())) nResult = PWE_FILEERROR_WRITE;
+		else if(nResult == PWE_SUCCESS) ws.GetWrittenHash(&vWrittenHash[0]);
+
+		VERIFY(SUCCEEDED(cs.Close()));
+		VERIFY(SUCCEEDED(ws.Close()));
+		VERIFY(SUCCEEDED(fs.Close()));
 	}
 
-	mem_erase(uFinalKey, 32);
-
-	// Check if all went correct
-	ASSERT((uEncryptedPartSize % 16) == 0);
-	if((uEncryptedPartSize > 2147483446) || ((uEncryptedPartSize == 0) &&
-		(this->GetNumberOfGroups() != 0)))
+	// On errors, the buffer file is discarded instead of being committed,
+	// i.e. a transacted write leaves the original file unchanged
+	if(nResult != PWE_SUCCESS)
 	{
-		ASSERT(FALSE);
-		SAFE_DELETE_ARRAY(pVirtualFile);
+		ft.AbortWrite();
 		_LoadAndRemoveAllMetaStreams(false);
-		return PWE_CRYPT_ERROR;
+		return nResult;
 	}
 
-	const DWORD dwToWrite = uEncryptedPartSize + sizeof(PW_DBHEADER);
-	const int nWriteRes = AU_WriteBigFile(pszFile, (BYTE *)pVirtualFile, dwToWrite,
-		m_bUseTransactedFileWrites);
-	if(nWriteRes != PWE_SUCCESS)
-	{
-		mem_erase(pVirtualFile, uAlloc);
-		SAFE_DELETE_ARRAY(pVirtualFile);
-		_LoadAndRemoveAllMetaStreams(false);
-		return nWriteRes;
-	}
+	if(!ft.CommitWrite()) { _LoadAndRemoveAllMetaStreams(false); return PWE_GETLASTERROR; }
 
-	if(pWrittenDataHash32 != NULL) // Caller requests hash of written data
-	{
-		sha256_ctx shaWritten;
-		sha256_begin(&shaWritten);
-		sha256_hash((unsigned char *)pVirtualFile, dwToWrite, &shaWritten);
-		sha256_end(pWrittenDataHash32, &shaWritten);
-	}
+	// Caller requests hash of written data
+	if(pWrittenDataHash32 != NULL) memcpy(pWrittenDataHash32, &vWrittenHash[0], 32);
 
 	memcpy(&m_dbLastHeader, &hdr, sizeof(PW_DBHEADER)); // Backup last database header
 
-	mem_erase(pVirtualFile, uAlloc);
-	SAFE_DELETE_ARRAY(pVirtualFile);
 	_LoadAndRemoveAllMetaStreams(false);
 
+	_PreDeriveSaveKey();
 	return PWE_SUCCESS;
 }
 
@@ -849,6 +839,21 @@ bool CPwManager::ReadGroupField(USHORT usFieldType, DWORD dwFieldSize,
 	return true;
 }
 
+// Decode a UTF-8 string field into the arena; the field data is followed
+// by NULLs (see ReadRecordField), i.e. it always is terminated
+LPTSTR CPwManager::_UTF8ToArenaString(const BYTE *pData, DWORD dwFieldSize)
+{
+	const DWORD cchMax = dwFieldSize + 1;
+	LPTSTR lp = m_arena.Alloc(cchMax);
+	if(lp == NULL) return _UTF8ToString((const UTF8_BYTE *)pData);
+
+	DWORD cch = _UTF8ToStringBuffer((const UTF8_BYTE *)pData, lp, cchMax);
+	if(cch == 0) { ASSERT(FALSE); lp[0] = 0; cch = 1; }
+
+	m_arena.Shrink(lp, cch);
+	return lp;
+}
+
 bool CPwManager::ReadEntryField(USHORT usFieldType, DWORD dwFieldSize,
 	const BYTE *pData, PW_ENTRY *pEntry, PWDB_REPAIR_INFO *pRepair)
 {
@@ -873,18 +878,18 @@ bool CPwManager::ReadEntryField(USHORT usFieldType, DWORD dwFieldSize,
 		break;
 	case 0x0004:
 		ASSERT(dwFieldSize != 0);
-		SAFE_DELETE_ARRAY(pEntry->pszTitle);
-		pEntry->pszTitle = _UTF8ToString((UTF8_BYTE *)pData);
+		_FreeEntryString(pEntry->pszTitle);
+		pEntry->pszTitle = _UTF8ToArenaString(pData, dwFieldSize);
 		break;
 	case 0x0005:
 		ASSERT(dwFieldSize != 0);
-		SAFE_DELETE_ARRAY(pEntry->pszURL);
-		pEntry->pszURL = _UTF8ToString((UTF8_BYTE *)pData);
+		_FreeEntryString(pEntry->pszURL);
+		pEntry->pszURL = _UTF8ToArenaString(pData, dwFieldSize);
 		break;
 	case 0x0006:
 		ASSERT(dwFieldSize != 0);
-		SAFE_DELETE_ARRAY(pEntry->pszUserName);
-		pEntry->pszUserName = _UTF8ToString((UTF8_BYTE *)pData);
+		_FreeEntryString(pEntry->pszUserName);
+		pEntry->pszUserName = _UTF8ToArenaString(pData, dwFieldSize);
 		break;
 	case 0x0007:
 		ASSERT(dwFieldSize != 0);
@@ -895,8 +900,8 @@ bool CPwManager::ReadEntryField(USHORT usFieldType, DWORD dwFieldSize,
 		break;
 	case 0x0008:
 		ASSERT(dwFieldSize != 0);
-		SAFE_DELETE_ARRAY(pEntry->pszAdditional);
-		pEntry->pszAdditional = _UTF8ToString((UTF8_BYTE *)pData);
+		_FreeEntryString(pEntry->pszAdditional);
+		pEntry->pszAdditional = _UTF8ToArenaString(pData, dwFieldSize);
 		break;
 	case 0x0009:
 		PWMRF_CHECK_AVAIL(5);
@@ -920,8 +925,8 @@ bool CPwManager::ReadEntryField(USHORT usFieldType, DWORD dwFieldSize,
 		break;
 	case 0x000D:
 		ASSERT(dwFieldSize != 0);
-		SAFE_DELETE_ARRAY(pEntry->pszBinaryDesc);
-		pEntry->pszBinaryDesc = _UTF8ToString((UTF8_BYTE *)pData);
+		_FreeEntryString(pEntry->pszBinaryDesc);
+		pEntry->pszBinaryDesc = _UTF8ToArenaString(pData, dwFieldSize);
 		break;
 	case 0x000E:
 		SAFE_DELETE_ARRAY(pEntry->pBinaryData);
@@ -934,15 +939,23 @@ bool CPwManager::ReadEntryField(USHORT usFieldType, DWORD dwFieldSize,
 		break;
 	case 0xFFFF:
 		ASSERT(dwFieldSize == 0);
-		AddEntry(pEntry);
-		SAFE_DELETE_ARRAY(pEntry->pszTitle);
-		SAFE_DELETE_ARRAY(pEntry->pszURL);
-		SAFE_DELETE_ARRAY(pEntry->pszUserName);
+		{
+			m_bAdoptArenaStrings = true;
+			const BOOL bAdded = AddEntry(pEntry);
+			m_bAdoptArenaStrings = false;
+
+			// The arena strings of the template now belong to the new entry
+			LPTSTR *vStrings[5] = { &pEntry->pszTitle, &pEntry->pszURL,
+				&pEntry->pszUserName, &pEntry->pszAdditional, &pEntry->pszBinaryDesc };
+			for(size_t i = 0; i < 5; ++i)
+			{
+				if((bAdded == TRUE) && m_arena.Contains(*vStrings[i])) *vStrings[i] = NULL;
+				else _FreeEntryString(*vStrings[i]);
+			}
+		}
 		if(pEntry->pszPassword != NULL)
 			mem_erase(pEntry->pszPassword, _tcslen(pEntry->pszPassword) * sizeof(TCHAR));
 		SAFE_DELETE_ARRAY(pEntry->pszPassword);
-		SAFE_DELETE_ARRAY(pEntry->pszAdditional);
-		SAFE_DELETE_ARRAY(pEntry->pszBinaryDesc);
 		SAFE_DELETE_ARRAY(pEntry->pBinaryData);
 		RESET_PWE_TEMPLATE(pEntry);
 		break;
@@ -997,6 +1010,14 @@ bool CPwManager::ReadExtData(const BYTE* pData, DWORD dwDataSize, PW_GROUP* pg,
 		case 0x0002:
 			// Ignore random data
 			break;
+		case 0x0003:
+			// Copy of the Argon2 parameters that follow the header
+			if((m_nKdf != KDF_ARGON2) || (dwFieldSize != sizeof(PW_ARGON2_PARAMS)) ||
+				(memcmp(&m_argon2, &vFieldData[0], dwFieldSize) != 0))
+			{
+				if(pRepair == NULL) bResult = false;
+			}
+			break;
 		case 0xFFFF:
 			bEos = true;
 			break;
@@ -1021,6 +1042,10 @@ void CPwManager::WriteExtData(CKpMemoryStream& ms)
 	m_random.GetRandomBuffer(&vRandom[0], 32);
 	WriteExtDataField(ms, 0x0002, &vRandom[0], 32);
 
+	if(m_nKdf == KDF_ARGON2)
+		WriteExtDataField(ms, 0x0003, (const BYTE*)&m_argon2,
+			sizeof(PW_ARGON2_PARAMS));
+
 	WriteExtDataField(ms, 0xFFFF, NULL, 0);
 }
 
@@ -22,12 +22,646 @@
 #include "../Util/StrUtil.h"
 #include "../Util/TranslateEx.h"
 #include <algorithm>
+#include <iterator>
+#include <boost/shared_ptr.hpp>
 
-using boost::scoped_ptr;
+// Number of compiled regular expressions that are kept for the next
+// searches (e.g. FindEx calling Find for each match)
+#define PWM_REGEX_CACHE_SIZE 8
+
+// A compiled regular expression and the literals that each of its matches
+// contains; fields that don't contain all literals are skipped without
+// running the regular expression
+struct PwmFindRegex
+{
+	std_string strPattern;
+	BOOL bCaseSensitive;
+	boost::shared_ptr<boost::basic_regex<TCHAR> > spRegex;
+	std::vector<std_string> vLiterals; // Lowercase if !bCaseSensitive
+};
+
+typedef boost::shared_ptr<PwmFindRegex> PwmFindRegexPtr;
 
 static std_string g_strFindCachedString;
 static std::vector<std_string> g_vFindCachedSplitted;
 
+static std::vector<PwmFindRegexPtr> g_vRegexCache; // Least recently used first
+
+static bool Priv_EntryMatches(CPwManager& mgr, DWORD dwIndex, LPCTSTR lpSearch,
+	BOOL bCaseSensitive, DWORD searchFlags, const PwmFindRegex* pRegex,
+	const PWM_SEARCH_SHADOW* pShadow, std::vector<BYTE>* pvGroupMatch);
+
+// Character by character, like CString::MakeLower in StrMatchText
+static TCHAR Priv_FoldChar(TCHAR tch)
+{
+	return static_cast<TCHAR>(_totlower(tch));
+}
+
+static UINT64 Priv_LowerChar(TCHAR tch)
+{
+	return static_cast<UINT64>(static_cast<TBYTE>(Priv_FoldChar(tch)));
+}
+
+// Append the trigrams of the lowercase version of lpText; each trigram
+// is packed into the lower 48 bits
+static void Priv_AppendTrigrams(LPCTSTR lpText, std::vector<UINT64>& vTrigrams)
+{
+	if((lpText == NULL) || (lpText[0] == 0) || (lpText[1] == 0)) return;
+
+	UINT64 u = (Priv_LowerChar(lpText[0]) << 16) | Priv_LowerChar(lpText[1]);
+	for(LPCTSTR lp = &lpText[2]; *lp != 0; ++lp)
+	{
+		u = ((u << 16) | Priv_LowerChar(*lp)) & 0xFFFFFFFFFFFFULL;
+		vTrigrams.push_back(u);
+	}
+}
+
+static bool Priv_IsLowerHex(LPCTSTR lp)
+{
+	for(; *lp != 0; ++lp)
+	{
+		if(((*lp < _T('0')) || (*lp > _T('9'))) &&
+			((*lp < _T('a')) || (*lp > _T('f'))))
+			return false;
+	}
+
+	return true;
+}
+
+// Returns the position after the bracket expression at lp or NULL if it
+// isn't terminated
+static LPCTSTR Priv_SkipRegexSet(LPCTSTR lp)
+{
+	ASSERT(*lp == _T('['));
+	++lp;
+	if(*lp == _T('^')) ++lp;
+	if(*lp == _T(']')) ++lp; // Literal
+
+	while(*lp != 0)
+	{
+		if(*lp == _T(']')) return (lp + 1);
+
+		if(*lp == _T('\\'))
+		{
+			++lp;
+			if(*lp == 0) return NULL;
+		}
+		else if((*lp == _T('[')) && ((lp[1] == _T(':')) || (lp[1] == _T('=')) ||
+			(lp[1] == _T('.'))))
+		{
+			const TCHAR tchEnd = lp[1];
+			lp += 2;
+			while((*lp != 0) && ((*lp != tchEnd) || (lp[1] != _T(']')))) ++lp;
+			if(*lp == 0) return NULL;
+			++lp;
+		}
+
+		++lp;
+	}
+
+	return NULL;
+}
+
+// Returns the position after the group at lp or NULL if it isn't closed
+static LPCTSTR Priv_SkipRegexGroup(LPCTSTR lp)
+{
+	ASSERT(*lp == _T('('));
+
+	int nDepth = 0;
+	while(*lp != 0)
+	{
+		if(*lp == _T('\\'))
+		{
+			++lp;
+			if(*lp == 0) return NULL;
+		}
+		else if(*lp == _T('['))
+		{
+			lp = Priv_SkipRegexSet(lp);
+			if(lp == NULL) return NULL;
+			continue;
+		}
+		else if(*lp == _T('(')) ++nDepth;
+		else if(*lp == _T(')'))
+		{
+			--nDepth;
+			if(nDepth == 0) return (lp + 1);
+		}
+
+		++lp;
+	}
+
+	return NULL;
+}
+
+// Returns the position after the quantifier at lp (lp if there is none)
+// or NULL if it is malformed; bOptional is set if it allows zero
+// repetitions
+static LPCTSTR Priv_SkipRegexQuantifier(LPCTSTR lp, bool& bOptional)
+{
+	bOptional = false;
+
+	if((*lp == _T('*')) || (*lp == _T('?'))) { bOptional = true; ++lp; }
+	else if(*lp == _T('+')) ++lp;
+	else if(*lp == _T('{'))
+	{
+		++lp;
+		if((*lp < _T('0')) || (*lp > _T('9'))) return NULL;
+
+		bOptional = true;
+		while((*lp >= _T('0')) && (*lp <= _T('9')))
+		{
+			if(*lp != _T('0')) bOptional = false;
+			++lp;
+		}
+
+		if(*lp == _T(','))
+		{
+			++lp;
+			while((*lp >= _T('0')) && (*lp <= _T('9'))) ++lp;
+		}
+
+		if(*lp != _T('}')) return NULL;
+		++lp;
+	}
+	else return lp;
+
+	if((*lp == _T('?')) || (*lp == _T('+'))) ++lp; // Lazy or possessive
+	return lp;
+}
+
+static void Priv_AddRegexLiteral(std_string& strRun, std::vector<std_string>& vLiterals)
+{
+	if(strRun.empty()) return;
+
+	if(std::find(vLiterals.begin(), vLiterals.end(), strRun) == vLiterals.end())
+		vLiterals.push_back(strRun);
+	strRun.clear();
+}
+
+// Get the runs of literal characters in the top-level sequence of the
+// pattern, i.e. the strings that every match contains. Patterns using
+// alternatives, inline modifiers or uncommon escapes are not analyzed
+// (no literals); groups, sets, escaped character classes and optional
+// characters end a run.
+static void Priv_GetRegexLiterals(LPCTSTR lpPattern, BOOL bCaseSensitive,
+	std::vector<std_string>& vLiterals)
+{
+	vLiterals.clear();
+	ASSERT(lpPattern != NULL); if(lpPattern == NULL) return;
+
+	std::vector<std_string> v;
+	std_string strRun;
+	bool bLastInRun = false; // Last atom is the last character of strRun
+
+	LPCTSTR lp = lpPattern;
+	while(*lp != 0)
+	{
+		const TCHAR tch = *lp;
+
+		if((tch == _T('*')) || (tch == _T('+')) || (tch == _T('?')) ||
+			(tch == _T('{')))
+		{
+			bool bOptional = false;
+			lp = Priv_SkipRegexQuantifier(lp, bOptional);
+			if(lp == NULL) return;
+
+			if(bLastInRun && bOptional) strRun.erase(strRun.size() - 1);
+			Priv_AddRegexLiteral(strRun, v);
+			bLastInRun = false;
+			continue;
+		}
+
+		bLastInRun = false;
+
+		if(tch == _T('|')) return; // No common literals
+		else if(tch == _T('['))
+		{
+			lp = Priv_SkipRegexSet(lp);
+			if(lp == NULL) return;
+			Priv_AddRegexLiteral(strRun, v);
+		}
+		else if(tch == _T('('))
+		{
+			if(lp[1] == _T('?')) return; // Modifiers, assertions, etc.
+
+			lp = Priv_SkipRegexGroup(lp);
+			if(lp == NULL) return;
+			Priv_AddRegexLiteral(strRun, v);
+		}
+		else if(tch == _T('\\'))
+		{
+			const TCHAR tchEsc = lp[1];
+			if(tchEsc == 0) return;
+
+			if(_tcschr(_T(".^$|()[]{}*+?\\/-"), tchEsc) != NULL)
+			{
+				strRun += tchEsc;
+				bLastInRun = true;
+			}
+			else if(_tcschr(_T("dDwWsSbBAzZG<>`'"), tchEsc) != NULL)
+				Priv_AddRegexLiteral(strRun, v);
+			else return; // Back-reference, character code, etc.
+
+			lp += 2;
+		}
+		else if((tch == _T(')')) || (tch == _T(']')) || (tch == _T('}')) ||
+			(tch == _T('.')) || (tch == _T('^')) || (tch == _T('$')))
+		{
+			Priv_AddRegexLiteral(strRun, v);
+			++lp;
+		}
+		else
+		{
+			strRun += tch;
+			bLastInRun = true;
+			++lp;
+		}
+	}
+
+	Priv_AddRegexLiteral(strRun, v);
+
+	// Like Find, case-insensitive searches fold characters using _totlower.
+	// The regex engine folds non-ASCII characters differently (locale),
+	// thus literals containing such characters are dropped; otherwise the
+	// prefilter and the trigram candidates could exclude actual matches.
+	if(bCaseSensitive == FALSE)
+	{
+		std::vector<std_string> vAscii;
+		for(size_t i = 0; i < v.size(); ++i)
+		{
+			std_string& str = v[i];
+			bool bAscii = true;
+			for(size_t j = 0; j < str.size(); ++j)
+			{
+				if(static_cast<TBYTE>(str[j]) >= 0x80) { bAscii = false; break; }
+				str[j] = Priv_FoldChar(str[j]);
+			}
+
+			if(bAscii) vAscii.push_back(str);
+		}
+
+		v.swap(vAscii);
+	}
+
+	vLiterals.swap(v);
+}
+
+// Returns the compiled expression from the cache or compiles it; returns
+// an empty pointer and sets the error message if the expression is invalid
+static PwmFindRegexPtr Priv_GetRegex(LPCTSTR lpPattern, BOOL bCaseSensitive,
+	std_string* pError)
+{
+	ASSERT(lpPattern != NULL); if(lpPattern == NULL) return PwmFindRegexPtr();
+
+	for(size_t i = g_vRegexCache.size(); i > 0; --i)
+	{
+		PwmFindRegexPtr sp = g_vRegexCache[i - 1];
+		if(((sp->bCaseSensitive != FALSE) == (bCaseSensitive != FALSE)) &&
+			(sp->strPattern == lpPattern))
+		{
+			g_vRegexCache.erase(g_vRegexCache.begin() + (i - 1));
+			g_vRegexCache.push_back(sp);
+			return sp;
+		}
+	}
+
+	PwmFindRegexPtr sp(new PwmFindRegex());
+
+	// #ifndef _WIN64
+	try
+	{
+		if(bCaseSensitive == FALSE)
+			sp->spRegex.reset(new boost::basic_regex<TCHAR>(lpPattern,
+				boost::regex_constants::icase));
+		else sp->spRegex.reset(new boost::basic_regex<TCHAR>(lpPattern));
+	}
+	catch(...)
+	{
+		if(pError != NULL)
+		{
+			*pError = lpPattern;
+			*pError += _T("\r\n\r\n");
+			*pError += TRL("The regular expression is invalid.");
+		}
+
+		return PwmFindRegexPtr();
+	}
+	// #else
+	// #pragma message("No regular expression support in x64 library.")
+	// #endif
+
+	sp->strPattern = lpPattern;
+	sp->bCaseSensitive = bCaseSensitive;
+	Priv_GetRegexLiterals(lpPattern, bCaseSensitive, sp->vLiterals);
+
+	if(g_vRegexCache.size() >= PWM_REGEX_CACHE_SIZE)
+		g_vRegexCache.erase(g_vRegexCache.begin());
+	g_vRegexCache.push_back(sp);
+	return sp;
+}
+
+// tszHex must be able to hold 33 characters
+static void Priv_UuidToHex(const BYTE *pbUuid, TCHAR *tszHex)
+{
+	const TCHAR *pHex = _T("0123456789abcdef");
+
+	for(int i = 0; i < 16; ++i)
+	{
+		tszHex[i << 1] = pHex[pbUuid[i] >> 4];
+		tszHex[(i << 1) + 1] = pHex[pbUuid[i] & 0x0F];
+	}
+
+	tszHex[32] = 0;
+}
+
+void CPwManager::SetSearchIndex(BOOL bEnable, BOOL bIndexPasswords)
+{
+	if((bEnable == m_bSearchIndex) && (bIndexPasswords == m_bSearchIndexPasswords))
+		return;
+
+	m_bSearchIndex = bEnable;
+	m_bSearchIndexPasswords = bIndexPasswords;
+
+	m_mTrigrams.clear();
+	_InvalidateTrigramIndex();
+}
+
+// Sorted distinct trigrams of the indexed fields of an entry
+void CPwManager::_GetEntryTrigrams(DWORD dwIndex, std::vector<UINT64>& vTrigrams)
+{
+	vTrigrams.clear();
+	ASSERT(dwIndex < m_dwNumEntries); if(dwIndex >= m_dwNumEntries) return;
+
+	PW_ENTRY *p = &m_pEntries[dwIndex];
+	Priv_AppendTrigrams(p->pszTitle, vTrigrams);
+	Priv_AppendTrigrams(p->pszUserName, vTrigrams);
+	Priv_AppendTrigrams(p->pszURL, vTrigrams);
+	Priv_AppendTrigrams(p->pszAdditional, vTrigrams);
+
+	// A freshly appended entry (AddEntry) has no password yet
+	if((m_bSearchIndexPasswords != FALSE) && (p->pszPassword != NULL))
+	{
+		UnlockEntryPassword(p);
+		Priv_AppendTrigrams(p->pszPassword, vTrigrams);
+		LockEntryPassword(p);
+	}
+
+	std::sort(vTrigrams.begin(), vTrigrams.end());
+	vTrigrams.erase(std::unique(vTrigrams.begin(), vTrigrams.end()), vTrigrams.end());
+}
+
+void CPwManager::_RebuildTrigramIndex()
+{
+	m_mTrigrams.clear();
+	_InvalidateFindCache();
+
+	std::vector<UINT64> vTrigrams;
+	for(DWORD i = 0; i < m_dwNumEntries; ++i)
+	{
+		_GetEntryTrigrams(i, vTrigrams);
+
+		for(size_t j = 0; j < vTrigrams.size(); ++j)
+			m_mTrigrams[vTrigrams[j]].push_back(i); // Ascending
+	}
+
+	m_bTrigramIndexValid = true;
+}
+
+// Must be called after the entry at dwIndex has been modified or appended
+void CPwManager::_AddToTrigramIndex(DWORD dwIndex)
+{
+	_InvalidateFindCache();
+	if((m_bSearchIndex == FALSE) || !m_bTrigramIndexValid) return;
+
+	std::vector<UINT64> vTrigrams;
+	_GetEntryTrigrams(dwIndex, vTrigrams);
+
+	for(size_t i = 0; i < vTrigrams.size(); ++i)
+	{
+		std::vector<DWORD>& v = m_mTrigrams[vTrigrams[i]];
+
+		if(v.empty() || (v.back() < dwIndex)) v.push_back(dwIndex);
+		else
+		{
+			std::vector<DWORD>::iterator it = std::lower_bound(v.begin(),
+				v.end(), dwIndex);
+			if(*it != dwIndex) v.insert(it, dwIndex);
+		}
+	}
+}
+
+// Must be called before the entry at dwIndex is modified; removing an
+// entry would require shifting the indices in all lists, thus the index
+// is invalidated instead (see DeleteEntry)
+void CPwManager::_RemoveFromTrigramIndex(DWORD dwIndex)
+{
+	_InvalidateFindCache();
+	if((m_bSearchIndex == FALSE) || !m_bTrigramIndexValid) return;
+
+	std::vector<UINT64> vTrigrams;
+	_GetEntryTrigrams(dwIndex, vTrigrams);
+
+	for(size_t i = 0; i < vTrigrams.size(); ++i)
+	{
+		PwmTrigramIndex::iterator itList = m_mTrigrams.find(vTrigrams[i]);
+		if(itList == m_mTrigrams.end()) { ASSERT(FALSE); continue; }
+
+		std::vector<DWORD>& v = itList->second;
+		std::vector<DWORD>::iterator it = std::lower_bound(v.begin(),
+			v.end(), dwIndex);
+		if((it != v.end()) && (*it == dwIndex)) v.erase(it);
+
+		if(v.empty()) m_mTrigrams.erase(itList);
+	}
+}
+
+// Returns the ascending indices of all entries that might match lpSearch
+// (a superset of the entries matched by Find), or NULL if the index can't
+// be used for this search and all entries need to be examined
+const std::vector<DWORD> *CPwManager::_GetFindCandidates(LPCTSTR lpSearch,
+	BOOL bCaseSensitive, DWORD searchFlags)
+{
+	ASSERT(lpSearch != NULL); if(lpSearch == NULL) return NULL;
+	if(m_bSearchIndex == FALSE) return NULL;
+	if(((searchFlags & PWMF_PASSWORD) != 0) && (m_bSearchIndexPasswords == FALSE))
+		return NULL;
+
+	std::vector<UINT64> vQuery;
+	Priv_AppendTrigrams(lpSearch, vQuery);
+	if(vQuery.empty()) return NULL; // Less than 3 characters
+
+	if(!m_bTrigramIndexValid) _RebuildTrigramIndex();
+
+	for(size_t i = 0; i < m_vFindCache.size(); ++i)
+	{
+		const PWM_FIND_CACHE_ITEM& c = m_vFindCache[i];
+		if((c.dwFlags == searchFlags) && (c.bCaseSensitive == bCaseSensitive) &&
+			(c.strSearch == lpSearch))
+			return &c.vEntries;
+	}
+
+	if(m_vFindCache.size() >= PWM_FIND_CACHE_SIZE)
+		m_vFindCache.erase(m_vFindCache.begin());
+	m_vFindCache.push_back(PWM_FIND_CACHE_ITEM());
+
+	PWM_FIND_CACHE_ITEM& c = m_vFindCache.back();
+	c.strSearch = lpSearch;
+	c.dwFlags = searchFlags;
+	c.bCaseSensitive = bCaseSensitive;
+	std::vector<DWORD>& vResult = c.vEntries;
+
+	if((searchFlags & (PWMF_TITLE | PWMF_USER | PWMF_URL | PWMF_PASSWORD |
+		PWMF_ADDITIONAL)) != 0)
+	{
+		std::sort(vQuery.begin(), vQuery.end());
+		vQuery.erase(std::unique(vQuery.begin(), vQuery.end()), vQuery.end());
+
+		std::vector<std::pair<size_t, const std::vector<DWORD>*> > vLists;
+		for(size_t i = 0; i < vQuery.size(); ++i)
+		{
+			PwmTrigramIndex::const_iterator it = m_mTrigrams.find(vQuery[i]);
+			if(it == m_mTrigrams.end()) { vLists.clear(); break; }
+
+			vLists.push_back(std::make_pair(it->second.size(), &it->second));
+		}
+
+		if(!vLists.empty())
+		{
+			// Intersect the smallest posting lists first
+			std::sort(vLists.begin(), vLists.end());
+
+			vResult = *vLists[0].second;
+			std::vector<DWORD> vTemp;
+			for(size_t i = 1; (i < vLists.size()) && !vResult.empty(); ++i)
+			{
+				vTemp.clear();
+				std::set_intersection(vResult.begin(), vResult.end(),
+					vLists[i].second->begin(), vLists[i].second->end(),
+					std::back_inserter(vTemp));
+				vResult.swap(vTemp);
+			}
+		}
+	}
+
+	const size_t cEntryMatches = vResult.size();
+
+	if((searchFlags & PWMF_GROUPNAME) != 0)
+	{
+		// The group list is short, thus group names aren't indexed
+		for(DWORD i = 0; i < m_dwNumGroups; ++i)
+		{
+			if(!StrMatchText(m_pGroups[i].pszGroupName, lpSearch, bCaseSensitive, NULL))
+				continue;
+
+			const std::vector<DWORD> *pv = _GetGroupEntries(m_pGroups[i].uGroupId);
+			if(pv != NULL) vResult.insert(vResult.end(), pv->begin(), pv->end());
+		}
+	}
+
+	// Find compares UUIDs case-insensitively with their lowercase hex form
+	if(((searchFlags & PWMF_UUID) != 0) && (_tcslen(lpSearch) <= 32) &&
+		Priv_IsLowerHex(lpSearch))
+	{
+		TCHAR tszUuid[33];
+		for(DWORD i = 0; i < m_dwNumEntries; ++i)
+		{
+			Priv_UuidToHex(m_pEntries[i].uuid, tszUuid);
+			if(_tcsstr(tszUuid, lpSearch) != NULL) vResult.push_back(i);
+		}
+	}
+
+	if(vResult.size() != cEntryMatches)
+	{
+		std::sort(vResult.begin(), vResult.end());
+		vResult.erase(std::unique(vResult.begin(), vResult.end()), vResult.end());
+	}
+
+	return &vResult;
+}
+
+// Returns NULL if the shadows are disabled or can't be used
+const PWM_SEARCH_SHADOW *CPwManager::_GetSearchShadows(BOOL bCaseSensitive)
+{
+	if((bCaseSensitive != FALSE) || (m_bSearchShadows == FALSE)) return NULL;
+
+	if(!m_bShadowsValid) _RebuildSearchShadows();
+	if(!m_bShadowsValid || m_vShadows.empty() || (m_vShadows.size() !=
+		m_dwNumEntries))
+		return NULL;
+
+	return &m_vShadows[0];
+}
+
+void CPwManager::SetSearchShadows(BOOL bEnable)
+{
+	if(bEnable == m_bSearchShadows) return;
+
+	m_bSearchShadows = bEnable;
+	_InvalidateSearchShadows(); // Built by the next Find
+}
+
+// Returns NULL if lpText is lowercase already, lpOldShadow if it is still
+// up-to-date, and a new arena string otherwise
+LPTSTR CPwManager::_FoldSearchShadow(LPCTSTR lpText, LPTSTR lpOldShadow)
+{
+	if(lpText == NULL) return NULL;
+
+	LPCTSTR lp = lpText;
+	while((*lp != 0) && (Priv_FoldChar(*lp) == *lp)) ++lp;
+	if(*lp == 0) return NULL;
+
+	size_t cch = 0;
+	if(lpOldShadow != NULL)
+	{
+		while((lpText[cch] != 0) && (Priv_FoldChar(lpText[cch]) == lpOldShadow[cch]))
+			++cch;
+		if((lpText[cch] == 0) && (lpOldShadow[cch] == 0)) return lpOldShadow;
+	}
+
+	cch += _tcslen(&lpText[cch]);
+
+	// Replaced shadows remain in the arena until the database is closed
+	LPTSTR lpShadow = m_arena.Alloc(cch + 1);
+	if(lpShadow == NULL) return NULL;
+
+	for(size_t i = 0; i < cch; ++i) lpShadow[i] = Priv_FoldChar(lpText[i]);
+	lpShadow[cch] = 0;
+	return lpShadow;
+}
+
+// Must be called after the entry at dwIndex has been modified or appended
+void CPwManager::_UpdateSearchShadow(DWORD dwIndex)
+{
+	if((m_bSearchShadows == FALSE) || !m_bShadowsValid) return;
+	ASSERT(dwIndex < m_dwNumEntries); if(dwIndex >= m_dwNumEntries) return;
+
+	if(dwIndex == m_vShadows.size())
+	{
+		PWM_SEARCH_SHADOW s;
+		ZeroMemory(&s, sizeof(PWM_SEARCH_SHADOW));
+		m_vShadows.push_back(s);
+	}
+	else if(dwIndex > m_vShadows.size()) { ASSERT(FALSE); _InvalidateSearchShadows(); return; }
+
+	const PW_ENTRY *p = &m_pEntries[dwIndex];
+	PWM_SEARCH_SHADOW& s = m_vShadows[dwIndex];
+
+	s.pszTitle = _FoldSearchShadow(p->pszTitle, s.pszTitle);
+	s.pszUserName = _FoldSearchShadow(p->pszUserName, s.pszUserName);
+	s.pszURL = _FoldSearchShadow(p->pszURL, s.pszURL);
+	s.pszAdditional = _FoldSearchShadow(p->pszAdditional, s.pszAdditional);
+}
+
+void CPwManager::_RebuildSearchShadows()
+{
+	m_vShadows.clear();
+	m_vShadows.reserve(m_dwNumEntries);
+	m_bShadowsValid = true;
+
+	for(DWORD i = 0; i < m_dwNumEntries; ++i) _UpdateSearchShadow(i);
+}
+
 // DWORD CPwManager::Find(const TCHAR *pszFindString, BOOL bCaseSensitive,
 //	DWORD searchFlags, DWORD nStart)
 // {
@@ -47,33 +681,12 @@ DWORD CPwManager::Find(const TCHAR *pszFindString, BOOL bCaseSensitive,
 	CString strFind = pszFindString;
 	if((strFind.GetLength() == 0) || (strFind == _T("*"))) return nStart;
 
-	scoped_ptr<boost::basic_regex<TCHAR> > spRegex;
-	// #ifndef _WIN64
+	PwmFindRegexPtr spRegex;
 	if((searchFlags & PWMS_REGEX) != 0)
 	{
-		try
-		{
-			if(bCaseSensitive == FALSE)
-				spRegex.reset(new boost::basic_regex<TCHAR>((LPCTSTR)strFind,
-					boost::regex_constants::icase));
-			else
-				spRegex.reset(new boost::basic_regex<TCHAR>((LPCTSTR)strFind));
-		}
-		catch(...)
-		{
-			if(pError != NULL)
-			{
-				*pError = (LPCTSTR)strFind;
-				*pError += _T("\r\n\r\n");
-				*pError += TRL("The regular expression is invalid.");
-			}
-
-			return DWORD_MAX;
-		}
+		spRegex = Priv_GetRegex(strFind, bCaseSensitive, pError);
+		if(spRegex.get() == NULL) return DWORD_MAX;
 	}
-	// #else
-	// #pragma message("No regular expression support in x64 library.")
-	// #endif
 
 	LPCTSTR lpSearch = strFind;
 	if(bCaseSensitive == FALSE)
@@ -82,64 +695,205 @@ DWORD CPwManager::Find(const TCHAR *pszFindString, BOOL bCaseSensitive,
 		lpSearch = strFind;
 	}
 
-	for(DWORD i = nStart; i < nEndExcl; ++i)
+	// Case-insensitive searches compare the lowercase query (or the
+	// literals of the regular expression) with the search shadows and
+	// match each group name at most once
+	const PWM_SEARCH_SHADOW *pShadows = _GetSearchShadows(bCaseSensitive);
+	std::vector<BYTE> vGroupMatch;
+	std::vector<BYTE> *pvGroupMatch = ((pShadows != NULL) ? &vGroupMatch : NULL);
+
+	const std::vector<DWORD> *pvCandidates = NULL;
+	if(spRegex.get() == NULL)
+		pvCandidates = _GetFindCandidates(lpSearch, bCaseSensitive, searchFlags);
+	else
 	{
-		if((searchFlags & PWMF_TITLE) != 0)
+		// Each match contains all literals; use the shortest candidate list
+		LPCTSTR lpBest = NULL;
+		size_t cBest = 0;
+		for(size_t i = 0; i < spRegex->vLiterals.size(); ++i)
 		{
-			if(StrMatchText(m_pEntries[i].pszTitle, lpSearch, bCaseSensitive, spRegex.get()))
-				return i;
-		}
+			LPCTSTR lpLiteral = spRegex->vLiterals[i].c_str();
+			const std::vector<DWORD> *pv = _GetFindCandidates(lpLiteral,
+				bCaseSensitive, searchFlags);
+			if(pv == NULL) continue;
 
-		if((searchFlags & PWMF_USER) != 0)
-		{
-			if(StrMatchText(m_pEntries[i].pszUserName, lpSearch, bCaseSensitive, spRegex.get()))
-				return i;
+			if((lpBest == NULL) || (pv->size() < cBest))
+			{
+				lpBest = lpLiteral;
+				cBest = pv->size();
+			}
 		}
 
-		if((searchFlags & PWMF_URL) != 0)
+		// The lookups may have replaced the cached list
+		if(lpBest != NULL)
+			pvCandidates = _GetFindCandidates(lpBest, bCaseSensitive, searchFlags);
+	}
+
+	if(pvCandidates != NULL)
+	{
+		for(std::vector<DWORD>::const_iterator it = std::lower_bound(
+			pvCandidates->begin(), pvCandidates->end(), nStart);
+			it != pvCandidates->end(); ++it)
 		{
-			if(StrMatchText(m_pEntries[i].pszURL, lpSearch, bCaseSensitive, spRegex.get()))
+			const DWORD i = *it;
+			if(i >= nEndExcl) break;
+
+			if(Priv_EntryMatches(*this, i, lpSearch, bCaseSensitive, searchFlags,
+				spRegex.get(), ((pShadows != NULL) ? &pShadows[i] : NULL), pvGroupMatch))
 				return i;
 		}
 
-		if((searchFlags & PWMF_PASSWORD) != 0)
-		{
-			UnlockEntryPassword(&m_pEntries[i]);
-			const bool bMatch = StrMatchText(m_pEntries[i].pszPassword, lpSearch,
-				bCaseSensitive, spRegex.get());
-			LockEntryPassword(&m_pEntries[i]);
+		return DWORD_MAX;
+	}
 
-			if(bMatch) return i;
-		}
+	for(DWORD i = nStart; i < nEndExcl; ++i)
+	{
+		if(Priv_EntryMatches(*this, i, lpSearch, bCaseSensitive, searchFlags,
+			spRegex.get(), ((pShadows != NULL) ? &pShadows[i] : NULL), pvGroupMatch))
+			return i;
+	}
+
+	return DWORD_MAX;
+}
 
-		if((searchFlags & PWMF_ADDITIONAL) != 0)
+// lpFolded is the search shadow of lpText (NULL if lpText is lowercase)
+static bool Priv_MatchFolded(LPCTSTR lpText, LPCTSTR lpFolded, LPCTSTR lpSearch)
+{
+	LPCTSTR lp = ((lpFolded != NULL) ? lpFolded : lpText);
+	ASSERT(lp != NULL); if((lp == NULL) || (lp[0] == 0)) return false;
+
+	return (SU_FindSubString(lp, lpSearch, TRUE) != NULL);
+}
+
+// lpLower is the lowercase version of lpText or NULL if it isn't known
+static bool Priv_HasRegexLiterals(LPCTSTR lpText, LPCTSTR lpLower,
+	const PwmFindRegex& r)
+{
+	for(size_t i = 0; i < r.vLiterals.size(); ++i)
+	{
+		LPCTSTR lpLiteral = r.vLiterals[i].c_str();
+
+		if(r.bCaseSensitive != FALSE)
 		{
-			if(StrMatchText(m_pEntries[i].pszAdditional, lpSearch, bCaseSensitive, spRegex.get()))
-				return i;
+			if(SU_FindSubString(lpText, lpLiteral, TRUE) == NULL) return false;
+		}
+		else if(lpLower != NULL)
+		{
+			if(SU_FindSubString(lpLower, lpLiteral, TRUE) == NULL) return false;
 		}
+		else if(SU_FindSubString(lpText, lpLiteral, FALSE) == NULL) return false;
+	}
+
+	return true;
+}
+
+// If pShadow is not NULL, lpFolded is the search shadow of lpText (see
+// Priv_MatchFolded); with a regular expression, it is only used to check
+// the literals
+static bool Priv_MatchField(LPCTSTR lpText, const PWM_SEARCH_SHADOW* pShadow,
+	LPCTSTR lpFolded, LPCTSTR lpSearch, BOOL bCaseSensitive, const PwmFindRegex* pRegex)
+{
+	if(pRegex != NULL)
+	{
+		ASSERT(lpText != NULL); if((lpText == NULL) || (lpText[0] == 0)) return false;
+
+		LPCTSTR lpLower = ((pShadow != NULL) ? ((lpFolded != NULL) ? lpFolded :
+			lpText) : NULL);
+		if(!Priv_HasRegexLiterals(lpText, lpLower, *pRegex)) return false;
+
+		return StrMatchText(lpText, lpSearch, bCaseSensitive, pRegex->spRegex.get());
+	}
+
+	if(pShadow != NULL) return Priv_MatchFolded(lpText, lpFolded, lpSearch);
+	return StrMatchText(lpText, lpSearch, bCaseSensitive, NULL);
+}
+
+// If pShadow is not NULL, lpSearch is lowercase and the fields are
+// compared using their search shadows; pvGroupMatch then caches which
+// groups have a matching name (0 = unknown, 1 = no, 2 = yes)
+static bool Priv_EntryMatches(CPwManager& mgr, DWORD dwIndex, LPCTSTR lpSearch,
+	BOOL bCaseSensitive, DWORD searchFlags, const PwmFindRegex* pRegex,
+	const PWM_SEARCH_SHADOW* pShadow, std::vector<BYTE>* pvGroupMatch)
+{
+	PW_ENTRY *p = mgr.GetEntry(dwIndex);
+	ASSERT(p != NULL); if(p == NULL) return false;
+
+	if((searchFlags & PWMF_TITLE) != 0)
+	{
+		if(Priv_MatchField(p->pszTitle, pShadow, ((pShadow != NULL) ?
+			pShadow->pszTitle : NULL), lpSearch, bCaseSensitive, pRegex))
+			return true;
+	}
+
+	if((searchFlags & PWMF_USER) != 0)
+	{
+		if(Priv_MatchField(p->pszUserName, pShadow, ((pShadow != NULL) ?
+			pShadow->pszUserName : NULL), lpSearch, bCaseSensitive, pRegex))
+			return true;
+	}
+
+	if((searchFlags & PWMF_URL) != 0)
+	{
+		if(Priv_MatchField(p->pszURL, pShadow, ((pShadow != NULL) ?
+			pShadow->pszURL : NULL), lpSearch, bCaseSensitive, pRegex))
+			return true;
+	}
+
+	if((searchFlags & PWMF_PASSWORD) != 0)
+	{
+		mgr.UnlockEntryPassword(p);
+		const bool bMatch = Priv_MatchField(p->pszPassword, NULL, NULL,
+			lpSearch, bCaseSensitive, pRegex);
+		mgr.LockEntryPassword(p);
+
+		if(bMatch) return true;
+	}
+
+	if((searchFlags & PWMF_ADDITIONAL) != 0)
+	{
+		if(Priv_MatchField(p->pszAdditional, pShadow, ((pShadow != NULL) ?
+			pShadow->pszAdditional : NULL), lpSearch, bCaseSensitive, pRegex))
+			return true;
+	}
 
-		if((searchFlags & PWMF_GROUPNAME) != 0)
+	if((searchFlags & PWMF_GROUPNAME) != 0)
+	{
+		const DWORD dwGroupIndex = mgr.GetGroupByIdN(p->uGroupId);
+		ASSERT(dwGroupIndex != DWORD_MAX);
+		if(dwGroupIndex == DWORD_MAX) return false;
+
+		if(pvGroupMatch != NULL)
 		{
-			const DWORD dwGroupIndex = GetGroupByIdN(m_pEntries[i].uGroupId);
-			ASSERT(dwGroupIndex != DWORD_MAX);
-			if(dwGroupIndex == DWORD_MAX) continue;
+			if(pvGroupMatch->empty()) pvGroupMatch->resize(mgr.GetNumberOfGroups(), 0);
 
-			if(StrMatchText(GetGroup(dwGroupIndex)->pszGroupName, lpSearch,
-				bCaseSensitive, spRegex.get()))
-				return i;
+			BYTE& bMatch = (*pvGroupMatch)[dwGroupIndex];
+			if(bMatch == 0)
+				bMatch = (Priv_MatchField(mgr.GetGroup(dwGroupIndex)->pszGroupName,
+					NULL, NULL, lpSearch, FALSE, pRegex) ? 2 : 1);
+			if(bMatch == 2) return true;
 		}
+		else if(Priv_MatchField(mgr.GetGroup(dwGroupIndex)->pszGroupName, NULL,
+			NULL, lpSearch, bCaseSensitive, pRegex))
+			return true;
+	}
 
-		if((searchFlags & PWMF_UUID) != 0)
-		{
-			CString strUuid;
-			_UuidToString(m_pEntries[i].uuid, &strUuid);
+	if((searchFlags & PWMF_UUID) != 0)
+	{
+		// The hex form is lowercase, thus a plain substring search is
+		// sufficient unless using a regular expression
+		TCHAR tszUuid[33];
+		Priv_UuidToHex(p->uuid, tszUuid);
 
-			if(StrMatchText(strUuid, lpSearch, FALSE, spRegex.get()))
-				return i;
+		if(pRegex == NULL)
+		{
+			if(_tcsstr(tszUuid, lpSearch) != NULL) return true;
 		}
+		else if(Priv_HasRegexLiterals(tszUuid, tszUuid, *pRegex) &&
+			StrMatchText(tszUuid, lpSearch, FALSE, pRegex->spRegex.get()))
+			return true;
 	}
 
-	return DWORD_MAX;
+	return false;
 }
 
 DWORD CPwManager::FindEx(const TCHAR *pszFindString, BOOL bCaseSensitive,
@@ -185,3 +939,340 @@ DWORD CPwManager::FindEx(const TCHAR *pszFindString, BOOL bCaseSensitive,
 
 	return dwIndex;
 }
+
+// Minimum number of entries per FindAll thread
+#define PWM_FIND_MIN_THREAD_RANGE 4096
+#define PWM_FIND_MAX_THREADS      8
+
+// The cancellation flag is checked after this number of entries
+#define PWM_FIND_CANCEL_INTERVAL 256
+
+// A term of a FindAll search string; all terms must match
+struct PwmFindTerm
+{
+	std_string strSearch; // Lowercase if the search is case-insensitive
+	bool bMatchAll;
+};
+
+// A range of entries searched by one FindAll thread; the threads only
+// read the entry and group lists, the shadows and the group ID index
+struct PwmFindJob
+{
+	CPwManager *pMgr;
+	const std::vector<PwmFindTerm> *pvTerms;
+	BOOL bCaseSensitive;
+	DWORD dwFlags;
+	const PwmFindRegex *pRegex;
+	const PWM_SEARCH_SHADOW *pShadows; // Parallel to the entry list or NULL
+
+	const DWORD *pIndices; // Entries to examine or NULL for all
+	DWORD dwFirst; // Range in pIndices or in the entry list
+	DWORD dwEnd;
+
+	DWORD dwGroupFirst;
+	DWORD dwGroupLast;
+	const volatile LONG *plCancel;
+
+	std::vector<DWORD> vHits;
+	bool bCancelled;
+};
+
+static void Priv_RunFindJob(PwmFindJob *p)
+{
+	ASSERT(p != NULL); if(p == NULL) return;
+
+	const std::vector<PwmFindTerm>& vTerms = *p->pvTerms;
+	std::vector<std::vector<BYTE> > vGroupMatch(vTerms.size());
+
+	for(DWORD j = p->dwFirst; j < p->dwEnd; ++j)
+	{
+		if((p->plCancel != NULL) && (((j - p->dwFirst) %
+			PWM_FIND_CANCEL_INTERVAL) == 0) && (*p->plCancel != 0))
+		{
+			p->bCancelled = true;
+			return;
+		}
+
+		const DWORD i = ((p->pIndices != NULL) ? p->pIndices[j] : j);
+
+		if(p->dwGroupFirst != DWORD_MAX)
+		{
+			const DWORD dwGroup = p->pMgr->GetGroupByIdN(p->pMgr->GetEntry(i)->uGroupId);
+			if((dwGroup < p->dwGroupFirst) || (dwGroup > p->dwGroupLast)) continue;
+		}
+
+		const PWM_SEARCH_SHADOW *pShadow = ((p->pShadows != NULL) ?
+			&p->pShadows[i] : NULL);
+
+		bool bMatch = true;
+		for(size_t t = 0; t < vTerms.size(); ++t)
+		{
+			if(vTerms[t].bMatchAll) continue;
+
+			if(!Priv_EntryMatches(*p->pMgr, i, vTerms[t].strSearch.c_str(),
+				p->bCaseSensitive, p->dwFlags, p->pRegex, pShadow,
+				((pShadow != NULL) ? &vGroupMatch[t] : NULL)))
+			{
+				bMatch = false;
+				break;
+			}
+		}
+
+		if(bMatch) p->vHits.push_back(i);
+	}
+}
+
+// A thread of the FindAll pool; it runs one job each time hStart is
+// signaled and signals hDone afterwards
+struct PWM_FIND_WORKER
+{
+	HANDLE hThread;
+	HANDLE hStart; // Auto-reset
+	HANDLE hDone; // Auto-reset
+	PwmFindJob *pJob; // NULL ends the thread
+};
+
+struct _PWM_FIND_POOL
+{
+	PWM_FIND_WORKER aWorkers[PWM_FIND_MAX_THREADS - 1]; // Addresses must not change
+	DWORD dwWorkers;
+};
+
+static DWORD WINAPI Priv_FindWorkerProc(LPVOID lpParameter)
+{
+	PWM_FIND_WORKER *p = static_cast<PWM_FIND_WORKER *>(lpParameter);
+	ASSERT(p != NULL); if(p == NULL) return 0;
+
+	while(WaitForSingleObject(p->hStart, INFINITE) == WAIT_OBJECT_0)
+	{
+		if(p->pJob == NULL) break;
+
+		Priv_RunFindJob(p->pJob);
+		VERIFY(SetEvent(p->hDone) != FALSE);
+	}
+
+	return 0;
+}
+
+// Returns the number of pool threads that can be used (at most dwCount);
+// missing threads are created
+DWORD CPwManager::_GetFindWorkers(DWORD dwCount)
+{
+	if(m_pFindPool == NULL)
+	{
+		try { m_pFindPool = new PWM_FIND_POOL; }
+		catch(...) { m_pFindPool = NULL; }
+		if(m_pFindPool == NULL) { ASSERT(FALSE); return 0; }
+
+		m_pFindPool->dwWorkers = 0;
+	}
+
+	PWM_FIND_POOL *p = m_pFindPool;
+	const DWORD dwMax = min(dwCount, static_cast<DWORD>(PWM_FIND_MAX_THREADS - 1));
+	while(p->dwWorkers < dwMax)
+	{
+		PWM_FIND_WORKER& w = p->aWorkers[p->dwWorkers];
+		w.pJob = NULL;
+		w.hThread = NULL;
+		w.hStart = CreateEvent(NULL, FALSE, FALSE, NULL);
+		w.hDone = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+		if((w.hStart != NULL) && (w.hDone != NULL))
+		{
+			DWORD dwThreadId = 0; // Pointer may not be NULL on Windows 9x/Me
+			w.hThread = CreateThread(NULL, 0, Priv_FindWorkerProc, &w, 0,
+				&dwThreadId);
+		}
+
+		if(w.hThread == NULL)
+		{
+			ASSERT(FALSE);
+			if(w.hStart != NULL) VERIFY(CloseHandle(w.hStart) != FALSE);
+			if(w.hDone != NULL) VERIFY(CloseHandle(w.hDone) != FALSE);
+			break;
+		}
+
+		++p->dwWorkers;
+	}
+
+	return min(dwMax, p->dwWorkers);
+}
+
+void CPwManager::_DeleteFindPool()
+{
+	PWM_FIND_POOL *p = m_pFindPool;
+	if(p == NULL) return;
+
+	for(DWORD i = 0; i < p->dwWorkers; ++i)
+	{
+		p->aWorkers[i].pJob = NULL;
+		VERIFY(SetEvent(p->aWorkers[i].hStart) != FALSE);
+	}
+
+	for(DWORD i = 0; i < p->dwWorkers; ++i)
+	{
+		PWM_FIND_WORKER& w = p->aWorkers[i];
+		VERIFY(WaitForSingleObject(w.hThread, INFINITE) == WAIT_OBJECT_0);
+		VERIFY(CloseHandle(w.hThread) != FALSE);
+		VERIFY(CloseHandle(w.hStart) != FALSE);
+		VERIFY(CloseHandle(w.hDone) != FALSE);
+	}
+
+	SAFE_DELETE(m_pFindPool);
+}
+
+BOOL CPwManager::FindAll(const TCHAR *pszFindString, BOOL bCaseSensitive,
+	DWORD searchFlags, DWORD dwGroupFirst, DWORD dwGroupLast,
+	const std::vector<DWORD> *pvWithin, std::vector<DWORD>& vResults,
+	std_string* pError, const volatile LONG *plCancel)
+{
+	vResults.clear();
+	if(pError != NULL) pError->clear();
+
+	ASSERT((dwGroupFirst == DWORD_MAX) || (dwGroupFirst <= dwGroupLast));
+
+	// Split the search string like FindEx; a regular expression is
+	// a single term
+	std::vector<PwmFindTerm> vTerms;
+	PwmFindRegexPtr spRegex;
+	const std_string strText = ((pszFindString != NULL) ? pszFindString : _T(""));
+	if(((searchFlags & PWMS_REGEX) != 0) || strText.empty())
+	{
+		PwmFindTerm t;
+		t.strSearch = strText;
+		t.bMatchAll = (strText.empty() || (strText == _T("*")));
+		vTerms.push_back(t);
+
+		if(!t.bMatchAll && ((searchFlags & PWMS_REGEX) != 0))
+		{
+			spRegex = Priv_GetRegex(strText.c_str(), bCaseSensitive, pError);
+			if(spRegex.get() == NULL) return FALSE;
+		}
+	}
+	else
+	{
+		const std::vector<std_string> vSplitted = SU_SplitSearchTerms(strText.c_str());
+		for(size_t i = 0; i < vSplitted.size(); ++i)
+		{
+			PwmFindTerm t;
+			t.strSearch = vSplitted[i];
+			t.bMatchAll = (t.strSearch.empty() || (t.strSearch == _T("*")));
+			vTerms.push_back(t);
+		}
+	}
+
+	// Lowercase like Find and intersect the index candidates of the terms
+	// or of the literals of the regular expression (unless the entries to
+	// examine are given); the candidate lists are copied, because the
+	// next lookup may replace them in the cache
+	std::vector<DWORD> vCandidates, vTemp;
+	bool bCandidates = false;
+	if(pvWithin != NULL)
+	{
+		ASSERT(pvWithin->empty() || (pvWithin->back() < m_dwNumEntries));
+		if(!pvWithin->empty() && (pvWithin->back() >= m_dwNumEntries)) return FALSE;
+	}
+
+	for(size_t i = 0; i < vTerms.size(); ++i)
+	{
+		PwmFindTerm& t = vTerms[i];
+		if(t.bMatchAll) continue;
+
+		if(bCaseSensitive == FALSE)
+		{
+			CString str = t.strSearch.c_str();
+			str.MakeLower();
+			t.strSearch = (LPCTSTR)str;
+		}
+
+		if(pvWithin != NULL) continue;
+
+		std::vector<std_string> vKeys;
+		if(spRegex.get() != NULL) vKeys = spRegex->vLiterals;
+		else vKeys.push_back(t.strSearch);
+
+		for(size_t k = 0; k < vKeys.size(); ++k)
+		{
+			const std::vector<DWORD> *pv = _GetFindCandidates(vKeys[k].c_str(),
+				bCaseSensitive, searchFlags);
+			if(pv == NULL) continue;
+
+			if(!bCandidates) { vCandidates = *pv; bCandidates = true; }
+			else
+			{
+				vTemp.clear();
+				std::set_intersection(vCandidates.begin(), vCandidates.end(),
+					pv->begin(), pv->end(), std::back_inserter(vTemp));
+				vCandidates.swap(vTemp);
+			}
+		}
+	}
+
+	const std::vector<DWORD> *pvIndices = ((pvWithin != NULL) ? pvWithin :
+		(bCandidates ? &vCandidates : NULL));
+	const DWORD dwCount = ((pvIndices != NULL) ? static_cast<DWORD>(
+		pvIndices->size()) : m_dwNumEntries);
+	if(dwCount == 0) return TRUE;
+
+	// The worker threads must not rebuild any index
+	const PWM_SEARCH_SHADOW *pShadows = _GetSearchShadows(bCaseSensitive);
+	if(!m_bGroupIndexValid) _RebuildGroupIndex();
+
+	DWORD dwThreads = 1;
+	if((searchFlags & PWMS_PARALLEL) != 0)
+	{
+		dwThreads = min(_GetProcessorCount(), static_cast<DWORD>(
+			PWM_FIND_MAX_THREADS));
+		dwThreads = min(dwThreads, dwCount / PWM_FIND_MIN_THREAD_RANGE);
+		if(dwThreads > 1) dwThreads = 1 + _GetFindWorkers(dwThreads - 1);
+		else dwThreads = 1;
+	}
+
+	std::vector<PwmFindJob> vJobs(dwThreads);
+	for(DWORD i = 0; i < dwThreads; ++i)
+	{
+		PwmFindJob& job = vJobs[i];
+		job.pMgr = this;
+		job.pvTerms = &vTerms;
+		job.bCaseSensitive = bCaseSensitive;
+		job.dwFlags = searchFlags;
+		job.pRegex = spRegex.get();
+		job.pShadows = pShadows;
+		job.pIndices = ((pvIndices != NULL) ? &(*pvIndices)[0] : NULL);
+		job.dwFirst = static_cast<DWORD>((static_cast<UINT64>(dwCount) * i) /
+			dwThreads);
+		job.dwEnd = static_cast<DWORD>((static_cast<UINT64>(dwCount) * (i + 1)) /
+			dwThreads);
+		job.dwGroupFirst = dwGroupFirst;
+		job.dwGroupLast = dwGroupLast;
+		job.plCancel = plCancel;
+		job.bCancelled = false;
+	}
+
+	// This thread runs the first job, the pool threads the others
+	for(DWORD i = 1; i < dwThreads; ++i)
+	{
+		PWM_FIND_WORKER& w = m_pFindPool->aWorkers[i - 1];
+		w.pJob = &vJobs[i];
+		VERIFY(SetEvent(w.hStart) != FALSE);
+	}
+	Priv_RunFindJob(&vJobs[0]);
+
+	for(DWORD i = 1; i < dwThreads; ++i)
+		VERIFY(WaitForSingleObject(m_pFindPool->aWorkers[i - 1].hDone,
+			INFINITE) == WAIT_OBJECT_0);
+
+	// The ranges are ascending, thus concatenating keeps the order
+	size_t cHits = 0;
+	for(DWORD i = 0; i < dwThreads; ++i)
+	{
+		if(vJobs[i].bCancelled) return FALSE;
+		cHits += vJobs[i].vHits.size();
+	}
+
+	vResults.reserve(cHits);
+	for(DWORD i = 0; i < dwThreads; ++i)
+		vResults.insert(vResults.end(), vJobs[i].vHits.begin(), vJobs[i].vHits.end());
+
+	return TRUE;
+}
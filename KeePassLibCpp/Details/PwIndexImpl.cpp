@@ -0,0 +1,512 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "StdAfx.h"
+#include "../PwManager.h"
+#include <algorithm>
+
+void CPwManager::_ResetIndexes()
+{
+	m_mEntryIndex.clear();
+	m_bEntryIndexValid = (m_dwNumEntries == 0);
+	m_mGroupIndex.clear();
+	m_bGroupIndexValid = (m_dwNumGroups == 0);
+	m_mGroupEntries.clear();
+	m_bGroupEntriesValid = (m_dwNumEntries == 0);
+	m_vGroupTree.clear();
+	m_bGroupTreeValid = (m_dwNumGroups == 0);
+	m_mTrigrams.clear();
+	m_bTrigramIndexValid = false; // Built by OpenDatabase or the next Find
+	_InvalidateFindCache();
+	m_vShadows.clear(); // The arena has been cleared
+	m_bShadowsValid = (m_dwNumEntries == 0);
+}
+
+void CPwManager::_RebuildEntryIndex() const
+{
+	m_mEntryIndex.clear();
+	m_mEntryIndex.rehash(static_cast<size_t>(m_dwNumEntries));
+
+	PWM_UUID_KEY k;
+	for(DWORD i = 0; i < m_dwNumEntries; ++i)
+	{
+		memcpy(k.aUuid, m_pEntries[i].uuid, 16);
+		m_mEntryIndex.insert(std::make_pair(k, i)); // Keeps the first one
+	}
+
+	m_bEntryIndexValid = true;
+}
+
+void CPwManager::_RebuildGroupIndex() const
+{
+	m_mGroupIndex.clear();
+	m_mGroupIndex.rehash(static_cast<size_t>(m_dwNumGroups));
+
+	for(DWORD i = 0; i < m_dwNumGroups; ++i)
+		m_mGroupIndex.insert(std::make_pair(m_pGroups[i].uGroupId, i));
+
+	m_bGroupIndexValid = true;
+}
+
+// Must be called after the entry at dwIndex has been assigned a new UUID
+// (pbOldUuid) or after it has been appended to the list
+void CPwManager::_UpdateEntryIndex(DWORD dwIndex, const BYTE *pbOldUuid)
+{
+	ASSERT(dwIndex < m_dwNumEntries); if(dwIndex >= m_dwNumEntries) return;
+	ASSERT(pbOldUuid != NULL); if(pbOldUuid == NULL) return;
+	if(!m_bEntryIndexValid) return;
+
+	PWM_UUID_KEY k;
+	memcpy(k.aUuid, pbOldUuid, 16);
+
+	PwmUuidIndex::iterator it = m_mEntryIndex.find(k);
+	if((it != m_mEntryIndex.end()) && (it->second == dwIndex) &&
+		(memcmp(pbOldUuid, m_pEntries[dwIndex].uuid, 16) != 0))
+	{
+		// Another entry might have the same old UUID
+		_InvalidateEntryIndex();
+		return;
+	}
+
+	memcpy(k.aUuid, m_pEntries[dwIndex].uuid, 16);
+
+	std::pair<PwmUuidIndex::iterator, bool> r = m_mEntryIndex.insert(
+		std::make_pair(k, dwIndex));
+	if(!r.second && (r.first->second > dwIndex)) r.first->second = dwIndex;
+}
+
+// Must be called before the entry at dwIndex is removed from the list
+void CPwManager::_RemoveFromEntryIndex(DWORD dwIndex)
+{
+	ASSERT(dwIndex < m_dwNumEntries); if(dwIndex >= m_dwNumEntries) return;
+	if(!m_bEntryIndexValid) return;
+
+	PWM_UUID_KEY k;
+	memcpy(k.aUuid, m_pEntries[dwIndex].uuid, 16);
+
+	PwmUuidIndex::iterator it = m_mEntryIndex.find(k);
+	if((it == m_mEntryIndex.end()) || (it->second > dwIndex))
+	{
+		ASSERT(FALSE); // UUID has been modified without using SetEntry
+		_InvalidateEntryIndex();
+		return;
+	}
+
+	if(it->second == dwIndex)
+	{
+		// The next entry having the same UUID (if any) becomes the first one
+		DWORD i = dwIndex + 1;
+		while((i < m_dwNumEntries) && (memcmp(m_pEntries[i].uuid, k.aUuid, 16) != 0))
+			++i;
+
+		if(i < m_dwNumEntries) it->second = i; // Shifted below
+		else m_mEntryIndex.erase(it);
+	}
+
+	if(dwIndex == (m_dwNumEntries - 1)) return;
+
+	// All following entries move up by one
+	for(it = m_mEntryIndex.begin(); it != m_mEntryIndex.end(); ++it)
+	{
+		if(it->second > dwIndex) --it->second;
+	}
+}
+
+void CPwManager::_UpdateGroupIndex(DWORD dwIndex, DWORD dwOldId)
+{
+	ASSERT(dwIndex < m_dwNumGroups); if(dwIndex >= m_dwNumGroups) return;
+	_InvalidateFindCache(); // The group name may have changed
+	if(!m_bGroupIndexValid) return;
+
+	const DWORD dwNewId = m_pGroups[dwIndex].uGroupId;
+
+	PwmGroupIdIndex::iterator it = m_mGroupIndex.find(dwOldId);
+	if((it != m_mGroupIndex.end()) && (it->second == dwIndex) &&
+		(dwOldId != dwNewId))
+	{
+		_InvalidateGroupIndex();
+		return;
+	}
+
+	std::pair<PwmGroupIdIndex::iterator, bool> r = m_mGroupIndex.insert(
+		std::make_pair(dwNewId, dwIndex));
+	if(!r.second && (r.first->second > dwIndex)) r.first->second = dwIndex;
+}
+
+void CPwManager::_RebuildGroupEntriesIndex() const
+{
+	m_mGroupEntries.clear();
+
+	for(DWORD i = 0; i < m_dwNumEntries; ++i)
+		m_mGroupEntries[m_pEntries[i].uGroupId].push_back(i);
+
+	m_bGroupEntriesValid = true;
+}
+
+// Returns NULL if the group doesn't contain any entries
+const std::vector<DWORD> *CPwManager::_GetGroupEntries(DWORD idGroup) const
+{
+	if(!m_bGroupEntriesValid) _RebuildGroupEntriesIndex();
+
+	PwmGroupEntriesIndex::const_iterator it = m_mGroupEntries.find(idGroup);
+	if(it == m_mGroupEntries.end()) return NULL;
+
+	ASSERT(!it->second.empty());
+	return &it->second;
+}
+
+// Must be called after the entry at dwIndex has been moved from the group
+// dwOldGroupId to another one or after it has been appended to the list
+void CPwManager::_UpdateGroupEntriesIndex(DWORD dwIndex, DWORD dwOldGroupId)
+{
+	ASSERT(dwIndex < m_dwNumEntries); if(dwIndex >= m_dwNumEntries) return;
+	_InvalidateFindCache();
+	if(!m_bGroupEntriesValid) return;
+
+	const DWORD dwNewGroupId = m_pEntries[dwIndex].uGroupId;
+
+	PwmGroupEntriesIndex::iterator it = m_mGroupEntries.find(dwOldGroupId);
+	if(it != m_mGroupEntries.end())
+	{
+		std::vector<DWORD>& vOld = it->second;
+		std::vector<DWORD>::iterator itPos = std::lower_bound(vOld.begin(),
+			vOld.end(), dwIndex);
+		if((itPos != vOld.end()) && (*itPos == dwIndex))
+		{
+			if(dwOldGroupId == dwNewGroupId) return; // Nothing to do
+
+			vOld.erase(itPos);
+			if(vOld.empty()) m_mGroupEntries.erase(it);
+		}
+	}
+
+	std::vector<DWORD>& vNew = m_mGroupEntries[dwNewGroupId];
+	if(vNew.empty() || (vNew.back() < dwIndex)) vNew.push_back(dwIndex);
+	else
+	{
+		std::vector<DWORD>::iterator itPos = std::lower_bound(vNew.begin(),
+			vNew.end(), dwIndex);
+		if((itPos == vNew.end()) || (*itPos != dwIndex))
+			vNew.insert(itPos, dwIndex);
+	}
+}
+
+// Must be called before the entry at dwIndex is removed from the list
+void CPwManager::_RemoveFromGroupEntriesIndex(DWORD dwIndex)
+{
+	ASSERT(dwIndex < m_dwNumEntries); if(dwIndex >= m_dwNumEntries) return;
+	if(!m_bGroupEntriesValid) return;
+
+	PwmGroupEntriesIndex::iterator it = m_mGroupEntries.find(
+		m_pEntries[dwIndex].uGroupId);
+	if(it == m_mGroupEntries.end()) { ASSERT(FALSE); m_bGroupEntriesValid = false; return; }
+
+	std::vector<DWORD>& v = it->second;
+	std::vector<DWORD>::iterator itPos = std::lower_bound(v.begin(), v.end(), dwIndex);
+	if((itPos == v.end()) || (*itPos != dwIndex))
+	{
+		ASSERT(FALSE); // Group ID has been modified without using SetEntry
+		m_bGroupEntriesValid = false;
+		return;
+	}
+
+	v.erase(itPos);
+	if(v.empty()) m_mGroupEntries.erase(it);
+
+	// All following entries move up by one
+	for(it = m_mGroupEntries.begin(); it != m_mGroupEntries.end(); ++it)
+	{
+		std::vector<DWORD>& vShift = it->second;
+		for(std::vector<DWORD>::iterator itShift = std::upper_bound(vShift.begin(),
+			vShift.end(), dwIndex); itShift != vShift.end(); ++itShift)
+			--(*itShift);
+	}
+}
+
+// Must be called after the entries in the range [dwFirst, dwLast] have been
+// reordered (without changing the set of entries in the range)
+void CPwManager::_ResyncGroupEntriesIndex(DWORD dwFirst, DWORD dwLast)
+{
+	ASSERT((dwFirst <= dwLast) && (dwLast < m_dwNumEntries));
+	if((dwFirst > dwLast) || (dwLast >= m_dwNumEntries)) return;
+	if(!m_bGroupEntriesValid) return;
+
+	// Position of the next index to be overwritten, for each group
+	boost::unordered_map<DWORD, size_t> mPos;
+
+	for(DWORD i = dwFirst; i <= dwLast; ++i)
+	{
+		const DWORD dwGroupId = m_pEntries[i].uGroupId;
+
+		PwmGroupEntriesIndex::iterator it = m_mGroupEntries.find(dwGroupId);
+		if(it == m_mGroupEntries.end()) { ASSERT(FALSE); m_bGroupEntriesValid = false; return; }
+		std::vector<DWORD>& v = it->second;
+
+		boost::unordered_map<DWORD, size_t>::iterator itPos = mPos.find(dwGroupId);
+		if(itPos == mPos.end())
+			itPos = mPos.insert(std::make_pair(dwGroupId, static_cast<size_t>(
+				std::lower_bound(v.begin(), v.end(), dwFirst) - v.begin()))).first;
+
+		if(itPos->second >= v.size()) { ASSERT(FALSE); m_bGroupEntriesValid = false; return; }
+		v[itPos->second] = i;
+		++itPos->second;
+	}
+}
+
+DWORD CPwManager::GetEntryByUuidN(const BYTE *pUuid) const
+{
+	ASSERT(pUuid != NULL); if(pUuid == NULL) return DWORD_MAX;
+
+	if(!m_bEntryIndexValid) _RebuildEntryIndex();
+
+	PWM_UUID_KEY k;
+	memcpy(k.aUuid, pUuid, 16);
+
+	PwmUuidIndex::const_iterator it = m_mEntryIndex.find(k);
+	if(it == m_mEntryIndex.end()) return DWORD_MAX; // Don't ASSERT here
+
+	if((it->second >= m_dwNumEntries) || (memcmp(m_pEntries[it->second].uuid,
+		pUuid, 16) != 0))
+	{
+		ASSERT(FALSE); // Entry has been modified without using SetEntry
+		_RebuildEntryIndex();
+
+		it = m_mEntryIndex.find(k);
+		if(it == m_mEntryIndex.end()) return DWORD_MAX;
+	}
+
+	return it->second;
+}
+
+// Read-only look-up in the valid UUID index, which is neither rebuilt nor
+// repaired; thus it can be used by multiple threads concurrently (see
+// _DecideMergeEntries)
+DWORD CPwManager::_LookupEntryIndex(const BYTE *pUuid) const
+{
+	ASSERT(m_bEntryIndexValid);
+	ASSERT(pUuid != NULL); if(pUuid == NULL) return DWORD_MAX;
+
+	PWM_UUID_KEY k;
+	memcpy(k.aUuid, pUuid, 16);
+
+	PwmUuidIndex::const_iterator it = m_mEntryIndex.find(k);
+	if(it == m_mEntryIndex.end()) return DWORD_MAX;
+
+	ASSERT((it->second < m_dwNumEntries) && (memcmp(m_pEntries[
+		it->second].uuid, pUuid, 16) == 0));
+	return it->second;
+}
+
+DWORD CPwManager::GetGroupByIdN(DWORD idGroup) const
+{
+	if(!m_bGroupIndexValid) _RebuildGroupIndex();
+
+	PwmGroupIdIndex::const_iterator it = m_mGroupIndex.find(idGroup);
+	if(it == m_mGroupIndex.end()) return DWORD_MAX;
+
+	if((it->second >= m_dwNumGroups) || (m_pGroups[it->second].uGroupId !=
+		idGroup))
+	{
+		ASSERT(FALSE); // Group has been modified without using SetGroup
+		_RebuildGroupIndex();
+
+		it = m_mGroupIndex.find(idGroup);
+		if(it == m_mGroupIndex.end()) return DWORD_MAX;
+	}
+
+	return it->second;
+}
+
+// The parent of a group is the nearest preceding group with a lower level,
+// like in GetLastChildGroup and CPwUtil::GroupsToTree
+void CPwManager::_RebuildGroupTreeIndex() const
+{
+	m_vGroupTree.resize(m_dwNumGroups);
+
+	std::vector<DWORD> vPath; // Open groups from a top-level group downwards
+	std::vector<DWORD> vLastChild; // Last child of each open group so far
+	DWORD dwLastTopLevel = DWORD_MAX;
+
+	for(DWORD i = 0; i < m_dwNumGroups; ++i)
+	{
+		const USHORT usLevel = m_pGroups[i].usLevel;
+		while(!vPath.empty() && (m_pGroups[vPath.back()].usLevel >= usLevel))
+		{
+			m_vGroupTree[vPath.back()].dwSubtreeSize = i - vPath.back();
+			vPath.pop_back();
+			vLastChild.pop_back();
+		}
+
+		PWM_GROUP_NODE& n = m_vGroupTree[i];
+		n.dwParent = (vPath.empty() ? DWORD_MAX : vPath.back());
+		n.dwFirstChild = DWORD_MAX;
+		n.dwNextSibling = DWORD_MAX;
+		n.dwSubtreeSize = 1;
+
+		DWORD& dwPrev = (vPath.empty() ? dwLastTopLevel : vLastChild.back());
+		if(dwPrev != DWORD_MAX) m_vGroupTree[dwPrev].dwNextSibling = i;
+		else if(!vPath.empty()) m_vGroupTree[vPath.back()].dwFirstChild = i;
+		dwPrev = i;
+
+		vPath.push_back(i);
+		vLastChild.push_back(DWORD_MAX);
+	}
+
+	while(!vPath.empty())
+	{
+		m_vGroupTree[vPath.back()].dwSubtreeSize = m_dwNumGroups - vPath.back();
+		vPath.pop_back();
+	}
+
+	m_bGroupTreeValid = true;
+}
+
+const PWM_GROUP_NODE *CPwManager::_GetGroupNode(DWORD dwGroupIndex) const
+{
+	if(dwGroupIndex >= m_dwNumGroups) return NULL;
+
+	// Groups appended by AddGroup are picked up by the size check
+	if(!m_bGroupTreeValid || (m_vGroupTree.size() != m_dwNumGroups))
+		_RebuildGroupTreeIndex();
+
+	return &m_vGroupTree[dwGroupIndex];
+}
+
+DWORD CPwManager::GetParentGroup(DWORD dwGroupIndex) const
+{
+	const PWM_GROUP_NODE *p = _GetGroupNode(dwGroupIndex);
+	ASSERT(p != NULL); if(p == NULL) return DWORD_MAX;
+	return p->dwParent;
+}
+
+DWORD CPwManager::GetFirstChildGroup(DWORD dwGroupIndex) const
+{
+	const PWM_GROUP_NODE *p = _GetGroupNode(dwGroupIndex);
+	ASSERT(p != NULL); if(p == NULL) return DWORD_MAX;
+	return p->dwFirstChild;
+}
+
+DWORD CPwManager::GetNextSiblingGroup(DWORD dwGroupIndex) const
+{
+	const PWM_GROUP_NODE *p = _GetGroupNode(dwGroupIndex);
+	ASSERT(p != NULL); if(p == NULL) return DWORD_MAX;
+	return p->dwNextSibling;
+}
+
+DWORD CPwManager::GetGroupSubtreeSize(DWORD dwGroupIndex) const
+{
+	const PWM_GROUP_NODE *p = _GetGroupNode(dwGroupIndex);
+	ASSERT(p != NULL); if(p == NULL) return 0;
+	return p->dwSubtreeSize;
+}
+
+#ifdef _DEBUG
+bool CPwManager::_CheckIndexes() const
+{
+	// Each entry must be mapped to the first entry having its UUID;
+	// the index must not contain any other keys
+	if(m_bEntryIndexValid)
+	{
+		PWM_UUID_KEY k;
+		size_t nFirst = 0;
+		for(DWORD i = 0; i < m_dwNumEntries; ++i)
+		{
+			memcpy(k.aUuid, m_pEntries[i].uuid, 16);
+
+			PwmUuidIndex::const_iterator it = m_mEntryIndex.find(k);
+			if(it == m_mEntryIndex.end()) return false;
+			if(it->second > i) return false;
+			if(memcmp(m_pEntries[it->second].uuid, k.aUuid, 16) != 0) return false;
+			if(it->second == i) ++nFirst;
+		}
+
+		if(nFirst != m_mEntryIndex.size()) return false;
+	}
+
+	if(m_bGroupIndexValid)
+	{
+		size_t nFirst = 0;
+		for(DWORD i = 0; i < m_dwNumGroups; ++i)
+		{
+			const DWORD dwId = m_pGroups[i].uGroupId;
+
+			PwmGroupIdIndex::const_iterator it = m_mGroupIndex.find(dwId);
+			if(it == m_mGroupIndex.end()) return false;
+			if(it->second > i) return false;
+			if(m_pGroups[it->second].uGroupId != dwId) return false;
+			if(it->second == i) ++nFirst;
+		}
+
+		if(nFirst != m_mGroupIndex.size()) return false;
+	}
+
+	// Each group's list must be ascending and contain exactly its entries
+	if(m_bGroupEntriesValid)
+	{
+		size_t nTotal = 0;
+		for(PwmGroupEntriesIndex::const_iterator it = m_mGroupEntries.begin();
+			it != m_mGroupEntries.end(); ++it)
+		{
+			const std::vector<DWORD>& v = it->second;
+			if(v.empty()) return false;
+
+			for(size_t i = 0; i < v.size(); ++i)
+			{
+				if(v[i] >= m_dwNumEntries) return false;
+				if(m_pEntries[v[i]].uGroupId != it->first) return false;
+				if((i > 0) && (v[i - 1] >= v[i])) return false;
+			}
+
+			nTotal += v.size();
+		}
+
+		if(nTotal != static_cast<size_t>(m_dwNumEntries)) return false;
+	}
+
+	if(m_bGroupTreeValid && (m_vGroupTree.size() == m_dwNumGroups))
+	{
+		for(DWORD i = 0; i < m_dwNumGroups; ++i)
+		{
+			const PWM_GROUP_NODE& n = m_vGroupTree[i];
+			const USHORT usLevel = m_pGroups[i].usLevel;
+			const DWORD dwEnd = i + n.dwSubtreeSize;
+
+			if((n.dwSubtreeSize == 0) || (dwEnd > m_dwNumGroups)) return false;
+			if((dwEnd < m_dwNumGroups) && (m_pGroups[dwEnd].usLevel > usLevel)) return false;
+			if((n.dwSubtreeSize > 1) && ((n.dwFirstChild != (i + 1)) ||
+				(m_pGroups[i + 1].usLevel <= usLevel))) return false;
+			if((n.dwSubtreeSize == 1) && (n.dwFirstChild != DWORD_MAX)) return false;
+
+			DWORD dwParentEnd = m_dwNumGroups;
+			if(n.dwParent != DWORD_MAX)
+			{
+				if(n.dwParent >= i) return false;
+				if(m_pGroups[n.dwParent].usLevel >= usLevel) return false;
+				dwParentEnd = n.dwParent + m_vGroupTree[n.dwParent].dwSubtreeSize;
+				if(dwEnd > dwParentEnd) return false;
+			}
+
+			const DWORD dwNext = ((dwEnd < dwParentEnd) ? dwEnd : DWORD_MAX);
+			if(n.dwNextSibling != dwNext) return false;
+		}
+	}
+
+	return true;
+}
+#endif
@@ -0,0 +1,201 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "StdAfx.h"
+#include "KpAsyncWriteStream.h"
+
+#include <algorithm>
+
+CKpAsyncWriteStream::CKpAsyncWriteStream(CKpStream* pBase, size_t cbBuffer) :
+	CKpStream(), m_pBase(pBase), m_cbBuffer(cbBuffer), m_pbFill(NULL),
+	m_cbFill(0), m_pbWrite(NULL), m_cbWrite(0), m_hThread(NULL),
+	m_hWork(NULL), m_hIdle(NULL), m_bExit(false), m_hrWrite(S_OK)
+{
+	ASSERT(pBase != NULL);
+	ASSERT(cbBuffer != 0);
+
+	sha256_begin(&m_sha);
+}
+
+bool CKpAsyncWriteStream::Start()
+{
+	if((m_pbFill != NULL) || (m_cbBuffer == 0)) { ASSERT(FALSE); return false; }
+
+	try
+	{
+		m_pbFill = new BYTE[m_cbBuffer];
+		m_pbWrite = new BYTE[m_cbBuffer];
+	}
+	catch(...) { }
+	if((m_pbFill == NULL) || (m_pbWrite == NULL))
+	{
+		SAFE_DELETE_ARRAY(m_pbFill);
+		SAFE_DELETE_ARRAY(m_pbWrite);
+		return false;
+	}
+
+	// No multi-threading support for _WIN32_WCE builds
+#ifndef _WIN32_WCE
+	m_hWork = CreateEvent(NULL, FALSE, FALSE, NULL);
+	m_hIdle = CreateEvent(NULL, FALSE, TRUE, NULL);
+	if((m_hWork != NULL) && (m_hIdle != NULL))
+	{
+		DWORD dwThreadId = 0; // Pointer may not be NULL on Windows 9x/Me
+		m_hThread = CreateThread(NULL, 0, CKpAsyncWriteStream::WriterThreadProc,
+			this, 0, &dwThreadId);
+	}
+
+	if(m_hThread == NULL)
+	{
+		ASSERT(FALSE);
+		if(m_hWork != NULL) { VERIFY(CloseHandle(m_hWork)); m_hWork = NULL; }
+		if(m_hIdle != NULL) { VERIFY(CloseHandle(m_hIdle)); m_hIdle = NULL; }
+	}
+#endif
+
+	return true;
+}
+
+DWORD WINAPI CKpAsyncWriteStream::WriterThreadProc(LPVOID lpParameter)
+{
+	CKpAsyncWriteStream* p = (CKpAsyncWriteStream*)lpParameter;
+	if(p == NULL) { ASSERT(FALSE); return 0; }
+
+	while(true)
+	{
+		if(WaitForSingleObject(p->m_hWork, INFINITE) != WAIT_OBJECT_0)
+			{ ASSERT(FALSE); break; }
+		if(p->m_bExit) break;
+
+		p->WriteBlock();
+
+		VERIFY(SetEvent(p->m_hIdle));
+	}
+
+	return 0;
+}
+
+void CKpAsyncWriteStream::WriteBlock()
+{
+	if(FAILED(m_hrWrite) || (m_cbWrite == 0)) return;
+
+	m_hrWrite = m_pBase->Write(m_pbWrite, m_cbWrite);
+	if(SUCCEEDED(m_hrWrite))
+		sha256_hash(m_pbWrite, static_cast<unsigned long>(m_cbWrite), &m_sha);
+
+	m_cbWrite = 0;
+}
+
+HRESULT CKpAsyncWriteStream::Submit()
+{
+	if(m_hThread == NULL) // Synchronous mode
+	{
+		std::swap(m_pbFill, m_pbWrite);
+		m_cbWrite = m_cbFill;
+		m_cbFill = 0;
+
+		WriteBlock();
+		return m_hrWrite;
+	}
+
+	// Wait until the writer thread has finished the previous block
+	if(WaitForSingleObject(m_hIdle, INFINITE) != WAIT_OBJECT_0)
+		{ ASSERT(FALSE); return E_FAIL; }
+	if(FAILED(m_hrWrite)) { VERIFY(SetEvent(m_hIdle)); return m_hrWrite; }
+
+	std::swap(m_pbFill, m_pbWrite);
+	m_cbWrite = m_cbFill;
+	m_cbFill = 0;
+
+	VERIFY(SetEvent(m_hWork));
+	return S_OK;
+}
+
+#define CKPAWS_W_FAIL(r) { ASSERT(FALSE); if(puWritten != NULL) *puWritten = 0; return (r); }
+
+HRESULT CKpAsyncWriteStream::WritePartial(const BYTE* pbBuffer, UINT64 uCount,
+	UINT64* puWritten)
+{
+	if(m_pbFill == NULL) CKPAWS_W_FAIL(E_UNEXPECTED);
+	if(pbBuffer == NULL) CKPAWS_W_FAIL(E_POINTER);
+
+	if(m_cbFill == m_cbBuffer)
+	{
+		const HRESULT hr = Submit();
+		if(FAILED(hr)) { if(puWritten != NULL) *puWritten = 0; return hr; }
+	}
+
+	const size_t cbCopy = static_cast<size_t>(min(uCount, static_cast<UINT64>(
+		m_cbBuffer - m_cbFill)));
+	if(cbCopy != 0) memcpy(&m_pbFill[m_cbFill], pbBuffer, cbCopy);
+	m_cbFill += cbCopy;
+
+	if(puWritten != NULL) *puWritten = cbCopy;
+	return S_OK;
+}
+
+void CKpAsyncWriteStream::StopThread()
+{
+	if(m_hThread == NULL) return;
+
+	// Wait for the current block, then let the thread exit
+	VERIFY(WaitForSingleObject(m_hIdle, INFINITE) == WAIT_OBJECT_0);
+	m_bExit = true;
+	VERIFY(SetEvent(m_hWork));
+
+	VERIFY(WaitForSingleObject(m_hThread, INFINITE) == WAIT_OBJECT_0);
+	VERIFY(CloseHandle(m_hThread));
+	m_hThread = NULL;
+
+	VERIFY(CloseHandle(m_hWork)); m_hWork = NULL;
+	VERIFY(CloseHandle(m_hIdle)); m_hIdle = NULL;
+}
+
+HRESULT CKpAsyncWriteStream::Finish()
+{
+	if(m_pbFill == NULL) { ASSERT(FALSE); return E_UNEXPECTED; }
+
+	HRESULT hr = S_OK;
+	if(m_cbFill != 0) hr = Submit();
+
+	StopThread();
+
+	if(SUCCEEDED(hr)) hr = m_hrWrite;
+	return hr;
+}
+
+HRESULT CKpAsyncWriteStream::Close()
+{
+	StopThread();
+
+	SAFE_DELETE_ARRAY(m_pbFill);
+	SAFE_DELETE_ARRAY(m_pbWrite);
+	m_cbFill = 0;
+	m_cbWrite = 0;
+	return S_OK;
+}
+
+void CKpAsyncWriteStream::GetWrittenHash(BYTE* pbHash32)
+{
+	ASSERT(m_hThread == NULL);
+	if(pbHash32 == NULL) { ASSERT(FALSE); return; }
+
+	sha256_end(pbHash32, &m_sha);
+	sha256_begin(&m_sha);
+}
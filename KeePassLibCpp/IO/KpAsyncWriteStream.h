@@ -0,0 +1,75 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ___KP_ASYNC_WRITE_STREAM_H___
+#define ___KP_ASYNC_WRITE_STREAM_H___
+
+#include "KpStream.h"
+#include "../Crypto/SHA2/SHA2.h"
+#include <boost/utility.hpp>
+
+// Double-buffered write stream: data is collected in one buffer while
+// the other one is written to the base stream by a background thread.
+// The SHA-256 hash of all data that has been written successfully is
+// computed by the writer thread, too.
+class CKpAsyncWriteStream : public CKpStream, boost::noncopyable
+{
+public:
+	CKpAsyncWriteStream(CKpStream* pBase, size_t cbBuffer);
+	virtual ~CKpAsyncWriteStream() { Close(); }
+
+	// Allocates the buffers and starts the writer thread. If no thread
+	// can be created, the stream writes synchronously.
+	bool Start();
+
+	virtual HRESULT Close();
+	virtual HRESULT WritePartial(const BYTE* pbBuffer, UINT64 uCount, UINT64* puWritten);
+
+	// Writes all pending data and stops the writer thread; returns the
+	// first error that occurred (if any)
+	HRESULT Finish();
+
+	// Only valid after Finish succeeded
+	void GetWrittenHash(BYTE* pbHash32);
+
+private:
+	HRESULT Submit();
+	void WriteBlock();
+	void StopThread();
+
+	static DWORD WINAPI WriterThreadProc(LPVOID lpParameter);
+
+	CKpStream* m_pBase;
+	size_t m_cbBuffer;
+
+	BYTE* m_pbFill; // Owned by the caller's thread
+	size_t m_cbFill;
+	BYTE* m_pbWrite; // Owned by the writer thread while it is busy
+	size_t m_cbWrite;
+
+	HANDLE m_hThread;
+	HANDLE m_hWork;
+	HANDLE m_hIdle;
+	volatile bool m_bExit;
+
+	HRESULT m_hrWrite;
+	sha256_ctx m_sha;
+};
+
+#endif // ___KP_ASYNC_WRITE_STREAM_H___
@@ -0,0 +1,307 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "StdAfx.h"
+#include "KpCbcStream.h"
+#include "KpMappedFileStream.h"
+#include "../PwManager.h"
+#include "../Util/MemUtil.h"
+
+#include <boost/static_assert.hpp>
+
+BOOST_STATIC_ASSERT((KPCS_CHUNK_SIZE % 16) == 0);
+BOOST_STATIC_ASSERT((KPCS_PARALLEL_CHUNK_SIZE % 16) == 0);
+
+static size_t Priv_GetDecryptChunkSize(UINT64 uCipherSize)
+{
+	if(uCipherSize < (2 * KPCS_PARALLEL_CHUNK_SIZE)) return KPCS_CHUNK_SIZE;
+	if(CCbcParallelDecryptor::GetMaxThreads() <= 1) return KPCS_CHUNK_SIZE;
+
+	return KPCS_PARALLEL_CHUNK_SIZE;
+}
+
+CKpCbcDecryptStream::CKpCbcDecryptStream(CKpStream* pBase, UINT64 uCipherSize) :
+	CKpStream(), m_pBase(pBase), m_pMapped(NULL), m_uCipherRemaining(uCipherSize),
+	m_nAlgorithm(-1), m_pbBuf(NULL), m_cbBuf(Priv_GetDecryptChunkSize(uCipherSize)),
+	m_uBufPos(0), m_uBufAvail(0), m_bPaddingValid(false)
+{
+	ASSERT(pBase != NULL);
+	ASSERT((uCipherSize % 16) == 0);
+	m_uCipherRemaining &= ~static_cast<UINT64>(0xF);
+
+	sha256_begin(&m_sha);
+}
+
+CKpCbcDecryptStream::CKpCbcDecryptStream(CKpMappedFileStream* pBase,
+	UINT64 uCipherSize) : CKpStream(), m_pBase(pBase), m_pMapped(pBase),
+	m_uCipherRemaining(uCipherSize), m_nAlgorithm(-1), m_pbBuf(NULL),
+	m_cbBuf(Priv_GetDecryptChunkSize(uCipherSize)), m_uBufPos(0),
+	m_uBufAvail(0), m_bPaddingValid(false)
+{
+	ASSERT(pBase != NULL);
+	ASSERT((uCipherSize % 16) == 0);
+	m_uCipherRemaining &= ~static_cast<UINT64>(0xF);
+
+	sha256_begin(&m_sha);
+}
+
+bool CKpCbcDecryptStream::Init(int nAlgorithm, const BYTE* pbKey32,
+	const BYTE* pbIV16)
+{
+	if((pbKey32 == NULL) || (pbIV16 == NULL)) { ASSERT(FALSE); return false; }
+
+	if(!m_dec.Init(nAlgorithm, pbKey32, pbIV16)) return false;
+
+	if(m_pbBuf == NULL)
+	{
+		m_pbBuf = static_cast<BYTE*>(mem_alloc_locked(m_cbBuf));
+		if(m_pbBuf == NULL) return false;
+	}
+
+	m_nAlgorithm = nAlgorithm;
+	return true;
+}
+
+HRESULT CKpCbcDecryptStream::Close()
+{
+	if(m_pbBuf != NULL)
+	{
+		mem_free_locked(m_pbBuf, m_cbBuf);
+		m_pbBuf = NULL;
+	}
+
+	m_uBufPos = 0;
+	m_uBufAvail = 0;
+	m_uCipherRemaining = 0;
+	return S_OK;
+}
+
+HRESULT CKpCbcDecryptStream::Refill()
+{
+	ASSERT(m_uBufPos == m_uBufAvail);
+	m_uBufPos = 0;
+	m_uBufAvail = 0;
+	if(m_uCipherRemaining == 0) return S_OK;
+
+	const size_t cbChunk = static_cast<size_t>(min(m_uCipherRemaining,
+		static_cast<UINT64>(m_cbBuf)));
+
+	int nDec = -1;
+	if(m_pMapped != NULL)
+	{
+		const BYTE* pbCipher = m_pMapped->ReadDirect(cbChunk);
+		if(pbCipher == NULL) return STG_E_INCOMPLETE;
+		m_uCipherRemaining -= cbChunk;
+
+		// I/O errors while accessing the view are caught by m_dec
+		nDec = m_dec.ChainDecrypt(pbCipher, static_cast<int>(cbChunk), m_pbBuf);
+		if(nDec == CBCPD_IN_PAGE_ERROR) return STG_E_READFAULT;
+	}
+	else
+	{
+		const HRESULT hr = m_pBase->Read(m_pbBuf, cbChunk);
+		if(FAILED(hr)) return hr;
+		m_uCipherRemaining -= cbChunk;
+
+		nDec = m_dec.ChainDecrypt(m_pbBuf, static_cast<int>(cbChunk), m_pbBuf);
+	}
+	if(nDec != static_cast<int>(cbChunk)) { ASSERT(FALSE); return E_FAIL; }
+
+	size_t cbPlain = cbChunk;
+	if(m_uCipherRemaining == 0) // Last block contains the padding
+	{
+		const BYTE bPad = m_pbBuf[cbChunk - 1];
+		m_bPaddingValid = ((bPad > 0) && (bPad <= 16));
+		for(size_t i = cbChunk - bPad; m_bPaddingValid && (i < cbChunk); ++i)
+		{
+			if(m_pbBuf[i] != bPad) m_bPaddingValid = false;
+		}
+
+		cbPlain -= (m_bPaddingValid ? bPad : 16);
+	}
+
+	sha256_hash(m_pbBuf, static_cast<unsigned long>(cbPlain), &m_sha);
+	m_uBufAvail = cbPlain;
+	return S_OK;
+}
+
+#define CKPCDS_R_FAIL(r) { ASSERT(FALSE); if(puRead != NULL) *puRead = 0; return (r); }
+
+HRESULT CKpCbcDecryptStream::ReadPartial(BYTE* pbBuffer, UINT64 uCount,
+	UINT64* puRead)
+{
+	if(m_pbBuf == NULL) CKPCDS_R_FAIL(E_UNEXPECTED);
+	if(pbBuffer == NULL) CKPCDS_R_FAIL(E_POINTER);
+
+	while((m_uBufPos == m_uBufAvail) && (m_uCipherRemaining != 0))
+	{
+		const HRESULT hr = Refill();
+		if(FAILED(hr)) { if(puRead != NULL) *puRead = 0; return hr; }
+	}
+
+	const size_t cbCopy = static_cast<size_t>(min(uCount, static_cast<UINT64>(
+		m_uBufAvail - m_uBufPos)));
+	if(cbCopy != 0) memcpy(pbBuffer, &m_pbBuf[m_uBufPos], cbCopy);
+	m_uBufPos += cbCopy;
+
+	if(puRead != NULL) *puRead = cbCopy;
+	return S_OK;
+}
+
+UINT64 CKpCbcDecryptStream::GetMaxRemaining() const
+{
+	return (m_uCipherRemaining + static_cast<UINT64>(m_uBufAvail - m_uBufPos));
+}
+
+HRESULT CKpCbcDecryptStream::Skip()
+{
+	if(m_pbBuf == NULL) { ASSERT(FALSE); return E_UNEXPECTED; }
+
+	m_uBufPos = m_uBufAvail;
+	while(m_uCipherRemaining != 0)
+	{
+		const HRESULT hr = Refill();
+		if(FAILED(hr)) return hr;
+		m_uBufPos = m_uBufAvail;
+	}
+
+	return S_OK;
+}
+
+void CKpCbcDecryptStream::GetPlainHash(BYTE* pbHash32)
+{
+	ASSERT(m_uCipherRemaining == 0);
+	if(pbHash32 == NULL) { ASSERT(FALSE); return; }
+
+	sha256_end(pbHash32, &m_sha);
+	sha256_begin(&m_sha);
+}
+
+CKpCbcEncryptStream::CKpCbcEncryptStream(CKpStream* pBase) : CKpStream(),
+	m_pBase(pBase), m_uCipherWritten(0), m_nAlgorithm(-1), m_pbBuf(NULL),
+	m_uBufUsed(0), m_bFinished(false)
+{
+	ASSERT(pBase != NULL);
+}
+
+bool CKpCbcEncryptStream::Init(int nAlgorithm, const BYTE* pbKey32,
+	const BYTE* pbIV16)
+{
+	if((pbKey32 == NULL) || (pbIV16 == NULL)) { ASSERT(FALSE); return false; }
+
+	if(nAlgorithm == ALGO_AES)
+	{
+		if(m_aes.Init(CRijndael::CBC, CRijndael::EncryptDir, pbKey32,
+			CRijndael::Key32Bytes, pbIV16) != RIJNDAEL_SUCCESS) return false;
+	}
+	else if(nAlgorithm == ALGO_TWOFISH)
+	{
+		if(!m_twofish.Init(pbKey32, 32, pbIV16)) return false;
+	}
+	else { ASSERT(FALSE); return false; }
+
+	if(m_pbBuf == NULL)
+	{
+		try { m_pbBuf = new BYTE[KPCS_CHUNK_SIZE + 16]; }
+		catch(...) { m_pbBuf = NULL; }
+		if(m_pbBuf == NULL) return false;
+	}
+
+	m_nAlgorithm = nAlgorithm;
+	return true;
+}
+
+HRESULT CKpCbcEncryptStream::Close()
+{
+	if(m_pbBuf != NULL)
+	{
+		mem_erase(m_pbBuf, KPCS_CHUNK_SIZE + 16);
+		delete[] m_pbBuf;
+		m_pbBuf = NULL;
+	}
+
+	m_uBufUsed = 0;
+	return S_OK;
+}
+
+HRESULT CKpCbcEncryptStream::FlushChunk()
+{
+	ASSERT(m_uBufUsed == KPCS_CHUNK_SIZE);
+
+	int nEnc = -1;
+	if(m_nAlgorithm == ALGO_AES)
+		nEnc = m_aes.ChainEncrypt(m_pbBuf, KPCS_CHUNK_SIZE, m_pbBuf);
+	else if(m_nAlgorithm == ALGO_TWOFISH)
+		nEnc = m_twofish.ChainEncrypt(m_pbBuf, KPCS_CHUNK_SIZE, m_pbBuf);
+	if(nEnc != KPCS_CHUNK_SIZE) { ASSERT(FALSE); return E_FAIL; }
+
+	const HRESULT hr = m_pBase->Write(m_pbBuf, KPCS_CHUNK_SIZE);
+	if(FAILED(hr)) return hr;
+
+	m_uCipherWritten += KPCS_CHUNK_SIZE;
+	m_uBufUsed = 0;
+	return S_OK;
+}
+
+#define CKPCES_W_FAIL(r) { ASSERT(FALSE); if(puWritten != NULL) *puWritten = 0; return (r); }
+
+HRESULT CKpCbcEncryptStream::WritePartial(const BYTE* pbBuffer, UINT64 uCount,
+	UINT64* puWritten)
+{
+	if((m_pbBuf == NULL) || m_bFinished) CKPCES_W_FAIL(E_UNEXPECTED);
+	if(pbBuffer == NULL) CKPCES_W_FAIL(E_POINTER);
+
+	// A full chunk is only encrypted when more data follows, such that
+	// Finish always has at least one byte to pad
+	if((m_uBufUsed == KPCS_CHUNK_SIZE) && (uCount != 0))
+	{
+		const HRESULT hr = FlushChunk();
+		if(FAILED(hr)) { if(puWritten != NULL) *puWritten = 0; return hr; }
+	}
+
+	const size_t cbCopy = static_cast<size_t>(min(uCount, static_cast<UINT64>(
+		KPCS_CHUNK_SIZE - m_uBufUsed)));
+	if(cbCopy != 0) memcpy(&m_pbBuf[m_uBufUsed], pbBuffer, cbCopy);
+	m_uBufUsed += cbCopy;
+
+	if(puWritten != NULL) *puWritten = cbCopy;
+	return S_OK;
+}
+
+HRESULT CKpCbcEncryptStream::Finish()
+{
+	if((m_pbBuf == NULL) || m_bFinished) { ASSERT(FALSE); return E_UNEXPECTED; }
+	if(m_uBufUsed == 0) { ASSERT(FALSE); return E_UNEXPECTED; } // Nothing written
+
+	int nEnc = -1;
+	if(m_nAlgorithm == ALGO_AES)
+		nEnc = m_aes.PadEncrypt(m_pbBuf, static_cast<int>(m_uBufUsed), m_pbBuf);
+	else if(m_nAlgorithm == ALGO_TWOFISH)
+		nEnc = m_twofish.PadEncrypt(m_pbBuf, static_cast<INT32>(m_uBufUsed), m_pbBuf);
+	if((nEnc <= 0) || ((nEnc % 16) != 0)) { ASSERT(FALSE); return E_FAIL; }
+
+	m_bFinished = true;
+
+	const HRESULT hr = m_pBase->Write(m_pbBuf, static_cast<UINT64>(nEnc));
+	if(FAILED(hr)) return hr;
+
+	m_uCipherWritten += static_cast<UINT64>(nEnc);
+	m_uBufUsed = 0;
+	return S_OK;
+}
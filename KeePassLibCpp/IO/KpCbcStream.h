@@ -0,0 +1,123 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ___KP_CBC_STREAM_H___
+#define ___KP_CBC_STREAM_H___
+
+#include "KpStream.h"
+#include "../Crypto/Rijndael.h"
+#include "../Crypto/TwofishClass.h"
+#include "../Crypto/CbcParallel.h"
+#include "../Crypto/SHA2/SHA2.h"
+#include <boost/utility.hpp>
+
+class CKpMappedFileStream;
+
+// Size of the ciphertext blocks that are read and decrypted at once;
+// must be a multiple of 16
+#define KPCS_CHUNK_SIZE 65536
+
+// Larger chunks are decrypted by multiple threads (CCbcParallelDecryptor)
+#define KPCS_PARALLEL_CHUNK_SIZE (512 * 1024)
+
+// Reads a CBC-encrypted (PKCS #7 padded) ciphertext of known length from
+// a base stream chunk by chunk and returns the plaintext. The SHA-256 hash
+// of the returned plaintext is computed on the fly. The plaintext chunk
+// buffer is locked into physical memory and erased when being freed.
+// Long ciphertexts are decrypted in larger chunks using multiple threads.
+class CKpCbcDecryptStream : public CKpStream, boost::noncopyable
+{
+public:
+	CKpCbcDecryptStream(CKpStream* pBase, UINT64 uCipherSize);
+
+	// The ciphertext is decrypted directly from the mapped view
+	CKpCbcDecryptStream(CKpMappedFileStream* pBase, UINT64 uCipherSize);
+	virtual ~CKpCbcDecryptStream() { Close(); }
+
+	// nAlgorithm is ALGO_AES or ALGO_TWOFISH
+	bool Init(int nAlgorithm, const BYTE* pbKey32, const BYTE* pbIV16);
+
+	virtual HRESULT Close();
+	virtual HRESULT ReadPartial(BYTE* pbBuffer, UINT64 uCount, UINT64* puRead);
+
+	// Upper bound for the number of plaintext bytes that can still be read
+	UINT64 GetMaxRemaining() const;
+
+	// Read and hash the remaining plaintext without returning it
+	HRESULT Skip();
+
+	// Only valid after the end of the stream has been reached
+	bool IsPaddingValid() const { return m_bPaddingValid; }
+	void GetPlainHash(BYTE* pbHash32);
+
+private:
+	HRESULT Refill();
+
+	CKpStream* m_pBase;
+	CKpMappedFileStream* m_pMapped; // NULL if not reading from a view
+	UINT64 m_uCipherRemaining;
+
+	int m_nAlgorithm;
+	CCbcParallelDecryptor m_dec;
+
+	BYTE* m_pbBuf;
+	size_t m_cbBuf; // KPCS_CHUNK_SIZE or KPCS_PARALLEL_CHUNK_SIZE
+	size_t m_uBufPos;
+	size_t m_uBufAvail;
+
+	bool m_bPaddingValid;
+	sha256_ctx m_sha;
+};
+
+// Buffers plaintext, CBC-encrypts it chunk by chunk and writes the
+// ciphertext to a base stream. Finish pads (PKCS #7) and encrypts the
+// last block; no more data may be written afterwards.
+class CKpCbcEncryptStream : public CKpStream, boost::noncopyable
+{
+public:
+	CKpCbcEncryptStream(CKpStream* pBase);
+	virtual ~CKpCbcEncryptStream() { Close(); }
+
+	// nAlgorithm is ALGO_AES or ALGO_TWOFISH
+	bool Init(int nAlgorithm, const BYTE* pbKey32, const BYTE* pbIV16);
+
+	virtual HRESULT Close();
+	virtual HRESULT WritePartial(const BYTE* pbBuffer, UINT64 uCount, UINT64* puWritten);
+
+	HRESULT Finish();
+
+	// Number of ciphertext bytes written to the base stream so far
+	UINT64 GetCipherSize() const { return m_uCipherWritten; }
+
+private:
+	HRESULT FlushChunk();
+
+	CKpStream* m_pBase;
+	UINT64 m_uCipherWritten;
+
+	int m_nAlgorithm;
+	CRijndael m_aes;
+	CTwofish m_twofish;
+
+	BYTE* m_pbBuf; // KPCS_CHUNK_SIZE plus one block for the padding
+	size_t m_uBufUsed;
+	bool m_bFinished;
+};
+
+#endif // ___KP_CBC_STREAM_H___
@@ -0,0 +1,100 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "StdAfx.h"
+#include "KpFileStream.h"
+#include "../Util/AppUtil.h"
+
+CKpFileStream::CKpFileStream(LPCTSTR lpFile, bool bWrite) : CKpStream(),
+	m_hFile(INVALID_HANDLE_VALUE), m_bWrite(bWrite)
+{
+	if(lpFile == NULL) { ASSERT(FALSE); return; }
+
+	if(bWrite)
+		m_hFile = CreateFile(lpFile, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_NORMAL, NULL);
+	else // Do not block other applications (e.g. synchronization tools)
+		m_hFile = CreateFile(lpFile, GENERIC_READ, FILE_SHARE_READ |
+			FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+			FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+}
+
+HRESULT CKpFileStream::Close()
+{
+	if(m_hFile != INVALID_HANDLE_VALUE)
+	{
+		if(m_bWrite) { VERIFY(FlushFileBuffers(m_hFile)); }
+		VERIFY(CloseHandle(m_hFile));
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+
+	return S_OK;
+}
+
+HRESULT CKpFileStream::GetSize(UINT64* puSize) const
+{
+	if(puSize == NULL) { ASSERT(FALSE); return E_POINTER; }
+	*puSize = 0;
+	if(m_hFile == INVALID_HANDLE_VALUE) return STG_E_INVALIDHANDLE;
+
+	LARGE_INTEGER li;
+	li.QuadPart = 0;
+	if(GetFileSizeEx(m_hFile, &li) == FALSE) return STG_E_ACCESSDENIED;
+
+	*puSize = static_cast<UINT64>(li.QuadPart);
+	return S_OK;
+}
+
+#define CKPFS_R_FAIL(r) { ASSERT(FALSE); if(puRead != NULL) *puRead = 0; return (r); }
+
+HRESULT CKpFileStream::ReadPartial(BYTE* pbBuffer, UINT64 uCount, UINT64* puRead)
+{
+	if(m_hFile == INVALID_HANDLE_VALUE) { if(puRead != NULL) *puRead = 0; return STG_E_INVALIDHANDLE; }
+	if(m_bWrite) CKPFS_R_FAIL(E_UNEXPECTED);
+	if(pbBuffer == NULL) CKPFS_R_FAIL(E_POINTER);
+	if(uCount > static_cast<UINT64>(DWORD_MAX)) CKPFS_R_FAIL(E_INVALIDARG);
+
+	DWORD dwRead = 0;
+	if(ReadFile(m_hFile, pbBuffer, static_cast<DWORD>(uCount), &dwRead,
+		NULL) == FALSE) CKPFS_R_FAIL(STG_E_READFAULT);
+
+	if(puRead != NULL) *puRead = dwRead;
+	return S_OK;
+}
+
+#define CKPFS_W_FAIL(r) { ASSERT(FALSE); if(puWritten != NULL) *puWritten = 0; return (r); }
+
+HRESULT CKpFileStream::WritePartial(const BYTE* pbBuffer, UINT64 uCount,
+	UINT64* puWritten)
+{
+	if(m_hFile == INVALID_HANDLE_VALUE) { if(puWritten != NULL) *puWritten = 0; return STG_E_INVALIDHANDLE; }
+	if(!m_bWrite) CKPFS_W_FAIL(STG_E_CANTSAVE);
+	if(pbBuffer == NULL) CKPFS_W_FAIL(E_POINTER);
+
+	// Same block size limit as AU_WriteBigFile (network shares)
+	const DWORD dwToWrite = static_cast<DWORD>(min(uCount, static_cast<UINT64>(
+		AU_MAX_WRITE_BLOCK)));
+
+	DWORD dwWritten = 0;
+	if(WriteFile(m_hFile, pbBuffer, dwToWrite, &dwWritten, NULL) == FALSE)
+		CKPFS_W_FAIL(STG_E_WRITEFAULT);
+
+	if(puWritten != NULL) *puWritten = dwWritten;
+	return S_OK;
+}
@@ -0,0 +1,44 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ___KP_FILE_STREAM_H___
+#define ___KP_FILE_STREAM_H___
+
+#include "KpStream.h"
+
+class CKpFileStream : public CKpStream
+{
+public:
+	CKpFileStream(LPCTSTR lpFile, bool bWrite);
+	virtual ~CKpFileStream() { Close(); }
+
+	bool IsOpen() const { return (m_hFile != INVALID_HANDLE_VALUE); }
+	HRESULT GetSize(UINT64* puSize) const;
+
+	virtual HRESULT Close();
+
+	virtual HRESULT ReadPartial(BYTE* pbBuffer, UINT64 uCount, UINT64* puRead);
+	virtual HRESULT WritePartial(const BYTE* pbBuffer, UINT64 uCount, UINT64* puWritten);
+
+private:
+	HANDLE m_hFile;
+	bool m_bWrite;
+};
+
+#endif // ___KP_FILE_STREAM_H___
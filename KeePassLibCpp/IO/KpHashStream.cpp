@@ -0,0 +1,49 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "StdAfx.h"
+#include "KpHashStream.h"
+
+CKpHashStream::CKpHashStream() : CKpStream(), m_uSize(0)
+{
+	sha256_begin(&m_sha);
+}
+
+HRESULT CKpHashStream::WritePartial(const BYTE* pbBuffer, UINT64 uCount,
+	UINT64* puWritten)
+{
+	if(pbBuffer == NULL) { ASSERT(FALSE); if(puWritten != NULL) *puWritten = 0; return E_POINTER; }
+
+	// sha256_hash takes an unsigned long length
+	const UINT64 uHash = min(uCount, static_cast<UINT64>(0x7FFFFFFF));
+	sha256_hash(pbBuffer, static_cast<unsigned long>(uHash), &m_sha);
+	m_uSize += uHash;
+
+	if(puWritten != NULL) *puWritten = uHash;
+	return S_OK;
+}
+
+void CKpHashStream::GetHash(BYTE* pbHash32)
+{
+	if(pbHash32 == NULL) { ASSERT(FALSE); return; }
+
+	sha256_end(pbHash32, &m_sha);
+	sha256_begin(&m_sha);
+	m_uSize = 0;
+}
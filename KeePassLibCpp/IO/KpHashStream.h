@@ -0,0 +1,45 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ___KP_HASH_STREAM_H___
+#define ___KP_HASH_STREAM_H___
+
+#include "KpStream.h"
+#include "../Crypto/SHA2/SHA2.h"
+
+// Write-only stream that does not store any data; it only computes the
+// SHA-256 hash and the length of everything written to it
+class CKpHashStream : public CKpStream
+{
+public:
+	CKpHashStream();
+
+	virtual HRESULT WritePartial(const BYTE* pbBuffer, UINT64 uCount, UINT64* puWritten);
+
+	UINT64 GetSize() const { return m_uSize; }
+
+	// Finalizes the hash and restarts the stream
+	void GetHash(BYTE* pbHash32);
+
+private:
+	sha256_ctx m_sha;
+	UINT64 m_uSize;
+};
+
+#endif // ___KP_HASH_STREAM_H___
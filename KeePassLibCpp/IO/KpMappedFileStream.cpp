@@ -0,0 +1,197 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "StdAfx.h"
+#include "KpMappedFileStream.h"
+
+typedef struct _KP_WIN32_MEMORY_RANGE_ENTRY
+{
+	PVOID VirtualAddress;
+	SIZE_T NumberOfBytes;
+} KP_WIN32_MEMORY_RANGE_ENTRY;
+
+typedef BOOL(WINAPI *LPPREFETCHVIRTUALMEMORY)(HANDLE hProcess,
+	ULONG_PTR NumberOfEntries, KP_WIN32_MEMORY_RANGE_ENTRY* VirtualAddresses,
+	ULONG Flags);
+
+// I/O errors while accessing the view are raised as EXCEPTION_IN_PAGE_ERROR;
+// no C++ objects must be used within this function (SEH)
+static bool Priv_CopyFromView(BYTE* pbDest, const BYTE* pbView, size_t cb)
+{
+#if defined(_MSC_VER) && !defined(_WIN32_WCE)
+	__try { memcpy(pbDest, pbView, cb); }
+	__except((GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR) ?
+		EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+	{
+		return false;
+	}
+#else
+	memcpy(pbDest, pbView, cb);
+#endif
+
+	return true;
+}
+
+// Access one byte per page (no C++ objects, SEH)
+static bool Priv_TouchView(const BYTE* pbView, size_t cb)
+{
+	const size_t cbPage = 4096;
+	volatile BYTE bSink = 0;
+
+#if defined(_MSC_VER) && !defined(_WIN32_WCE)
+	__try
+	{
+#endif
+		for(size_t i = 0; i < cb; i += cbPage) bSink ^= pbView[i];
+		if(cb != 0) bSink ^= pbView[cb - 1];
+#if defined(_MSC_VER) && !defined(_WIN32_WCE)
+	}
+	__except((GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR) ?
+		EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+	{
+		return false;
+	}
+#endif
+
+	UNREFERENCED_PARAMETER(bSink);
+	return true;
+}
+
+CKpMappedFileStream::CKpMappedFileStream(LPCTSTR lpFile) : CKpStream(),
+	m_hFile(INVALID_HANDLE_VALUE), m_hMapping(NULL), m_pbView(NULL),
+	m_uSize(0), m_uPosition(0), m_uReadAhead(0)
+{
+	if(lpFile == NULL) { ASSERT(FALSE); return; }
+
+	// Do not block other applications (e.g. synchronization tools); while
+	// the view exists, Windows does not allow truncating the file
+	m_hFile = CreateFile(lpFile, GENERIC_READ, FILE_SHARE_READ |
+		FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(m_hFile == INVALID_HANDLE_VALUE) return;
+
+	LARGE_INTEGER li;
+	li.QuadPart = 0;
+	if((GetFileSizeEx(m_hFile, &li) == FALSE) || (li.QuadPart <= 0) ||
+		(static_cast<UINT64>(li.QuadPart) > static_cast<UINT64>(SIZE_MAX)))
+	{
+		Close();
+		return;
+	}
+
+	m_hMapping = CreateFileMapping(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(m_hMapping == NULL) { Close(); return; }
+
+	// May fail for large files in 32-bit processes (address space)
+	m_pbView = static_cast<const BYTE*>(MapViewOfFile(m_hMapping,
+		FILE_MAP_READ, 0, 0, 0));
+	if(m_pbView == NULL) { Close(); return; }
+
+	m_uSize = static_cast<UINT64>(li.QuadPart);
+}
+
+HRESULT CKpMappedFileStream::Close()
+{
+	if(m_pbView != NULL)
+	{
+		VERIFY(UnmapViewOfFile(m_pbView));
+		m_pbView = NULL;
+	}
+	if(m_hMapping != NULL)
+	{
+		VERIFY(CloseHandle(m_hMapping));
+		m_hMapping = NULL;
+	}
+	if(m_hFile != INVALID_HANDLE_VALUE)
+	{
+		VERIFY(CloseHandle(m_hFile));
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+
+	m_uSize = 0;
+	m_uPosition = 0;
+	m_uReadAhead = 0;
+	return S_OK;
+}
+
+const BYTE* CKpMappedFileStream::ReadDirect(UINT64 uCount)
+{
+	if(m_pbView == NULL) { ASSERT(FALSE); return NULL; }
+	if(uCount > (m_uSize - m_uPosition)) return NULL;
+
+	const BYTE* pb = &m_pbView[static_cast<size_t>(m_uPosition)];
+	m_uPosition += uCount;
+	return pb;
+}
+
+HRESULT CKpMappedFileStream::ReadPartial(BYTE* pbBuffer, UINT64 uCount,
+	UINT64* puRead)
+{
+	if(puRead != NULL) *puRead = 0;
+	if(m_pbView == NULL) return STG_E_INVALIDHANDLE;
+	if(pbBuffer == NULL) { ASSERT(FALSE); return E_POINTER; }
+
+	const UINT64 uCopy = min(uCount, m_uSize - m_uPosition);
+	const BYTE* pb = ReadDirect(uCopy);
+	if(pb == NULL) { ASSERT(FALSE); return E_UNEXPECTED; }
+
+	if(uCopy != 0)
+	{
+		if(!Priv_CopyFromView(pbBuffer, pb, static_cast<size_t>(uCopy)))
+			return STG_E_READFAULT;
+	}
+
+	if(puRead != NULL) *puRead = uCopy;
+	return S_OK;
+}
+
+void CKpMappedFileStream::Prefetch()
+{
+	if((m_pbView == NULL) || (m_uPosition >= m_uSize)) return;
+
+#ifndef _WIN32_WCE
+	HMODULE hKernel32 = GetModuleHandle(_T("Kernel32.dll"));
+	if(hKernel32 == NULL) { ASSERT(FALSE); return; }
+
+	LPPREFETCHVIRTUALMEMORY lpPrefetch = (LPPREFETCHVIRTUALMEMORY)GetProcAddress(
+		hKernel32, "PrefetchVirtualMemory");
+	if(lpPrefetch == NULL) return; // Windows 7 and earlier
+
+	KP_WIN32_MEMORY_RANGE_ENTRY r;
+	r.VirtualAddress = const_cast<BYTE*>(&m_pbView[static_cast<size_t>(m_uPosition)]);
+	r.NumberOfBytes = static_cast<SIZE_T>(m_uSize - m_uPosition);
+
+	lpPrefetch(GetCurrentProcess(), 1, &r, 0); // Only a hint, ignore errors
+#endif
+}
+
+HRESULT CKpMappedFileStream::ReadAhead(UINT64 uCount)
+{
+	if(m_pbView == NULL) { ASSERT(FALSE); return E_UNEXPECTED; }
+
+	m_uReadAhead = max(m_uReadAhead, m_uPosition); // Skip data already read
+	const UINT64 uTouch = min(uCount, m_uSize - m_uReadAhead);
+	if(uTouch == 0) return S_FALSE;
+
+	if(!Priv_TouchView(&m_pbView[static_cast<size_t>(m_uReadAhead)],
+		static_cast<size_t>(uTouch))) return STG_E_READFAULT;
+
+	m_uReadAhead += uTouch;
+	return S_OK;
+}
@@ -0,0 +1,65 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ___KP_MAPPED_FILE_STREAM_H___
+#define ___KP_MAPPED_FILE_STREAM_H___
+
+#include "KpStream.h"
+#include <boost/utility.hpp>
+
+// Read-only stream on a memory-mapped file. In addition to the usual
+// stream interface, the data can be accessed directly in the view,
+// avoiding any intermediate copy.
+class CKpMappedFileStream : public CKpStream, boost::noncopyable
+{
+public:
+	CKpMappedFileStream(LPCTSTR lpFile);
+	virtual ~CKpMappedFileStream() { Close(); }
+
+	bool IsOpen() const { return (m_pbView != NULL); }
+	UINT64 GetSize() const { return m_uSize; }
+
+	virtual HRESULT Close();
+	virtual HRESULT ReadPartial(BYTE* pbBuffer, UINT64 uCount, UINT64* puRead);
+
+	// Returns a pointer to the next uCount bytes in the view and advances
+	// the position, or NULL if less data is available. Accessing the
+	// memory may raise EXCEPTION_IN_PAGE_ERROR when the file cannot be read.
+	const BYTE* ReadDirect(UINT64 uCount);
+
+	// Asks the system to read the remaining data of the file into the
+	// cache asynchronously (Windows 8 and higher, otherwise no-op)
+	void Prefetch();
+
+	// Reads the next uCount bytes of the file that have not been read ahead
+	// yet into memory (by accessing the pages), such that later accesses
+	// do not block. Returns S_FALSE when the end of the file has been reached.
+	HRESULT ReadAhead(UINT64 uCount);
+	UINT64 GetReadAheadSize() const { return m_uReadAhead; }
+
+private:
+	HANDLE m_hFile;
+	HANDLE m_hMapping;
+	const BYTE* m_pbView;
+	UINT64 m_uSize;
+	UINT64 m_uPosition;
+	UINT64 m_uReadAhead;
+};
+
+#endif // ___KP_MAPPED_FILE_STREAM_H___
@@ -77,6 +77,29 @@ HRESULT CKpMemoryStream::WritePartial(const BYTE* pbBuffer, UINT64 uCount, UINT6
 	return S_OK;
 }
 
+BYTE* CKpMemoryStream::Append(UINT64 uCount)
+{
+	if(m_bReading) { ASSERT(FALSE); return NULL; }
+	if(m_pbData == NULL) { ASSERT(FALSE); return NULL; }
+	if(uCount > static_cast<UINT64>(UINT32_MAX)) { ASSERT(FALSE); return NULL; }
+
+	if(FAILED(EnsureCapacity(m_uSize + uCount))) return NULL;
+
+	BYTE* pb = &m_pbData[m_uSize];
+	m_uSize += uCount;
+	return pb;
+}
+
+void CKpMemoryStream::Truncate(UINT64 uSize)
+{
+	if(m_bReading || (m_pbData == NULL)) { ASSERT(FALSE); return; }
+	if(uSize > m_uSize) { ASSERT(FALSE); return; }
+
+	if(m_bClearMemory)
+		mem_erase(&m_pbData[uSize], static_cast<size_t>(m_uSize - uSize));
+	m_uSize = uSize;
+}
+
 HRESULT CKpMemoryStream::EnsureCapacity(UINT64 uMinSize)
 {
 	if(m_bReading) { ASSERT(FALSE); return E_UNEXPECTED; }
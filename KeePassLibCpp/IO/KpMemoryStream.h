@@ -53,6 +53,14 @@ public:
 
 	UINT64 GetSize() const { return m_uSize; }
 
+	// Append uCount bytes to the stream and return a pointer to them;
+	// the caller must fill them. Returns NULL on failure. The pointer
+	// is valid until the next write operation.
+	BYTE* Append(UINT64 uCount);
+
+	// Shrink the stream to uSize bytes (uSize <= GetSize())
+	void Truncate(UINT64 uSize);
+
 private:
 	bool m_bReading;
 	BYTE* m_pbData;
@@ -0,0 +1,86 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "StdAfx.h"
+#include "KpReadAheadStream.h"
+
+CKpReadAheadStream::CKpReadAheadStream(CKpStream* pBase, UINT64 uMaxBuffered) :
+	CKpStream(), m_pBase(pBase), m_uMaxBuffered(uMaxBuffered), m_uBufPos(0),
+	m_bBaseEnded(false)
+{
+	ASSERT(pBase != NULL);
+}
+
+HRESULT CKpReadAheadStream::Close()
+{
+	std::vector<BYTE>().swap(m_vBuf);
+	m_uBufPos = 0;
+	return S_OK;
+}
+
+HRESULT CKpReadAheadStream::ReadAhead(UINT64 uCount)
+{
+	if(m_bBaseEnded) return S_FALSE;
+
+	const UINT64 uBuffered = static_cast<UINT64>(m_vBuf.size());
+	if(uBuffered >= m_uMaxBuffered) return S_FALSE;
+
+	const size_t cbRead = static_cast<size_t>(min(uCount, m_uMaxBuffered - uBuffered));
+	if(cbRead == 0) return S_FALSE;
+
+	try
+	{
+		if(m_vBuf.capacity() < (m_vBuf.size() + cbRead))
+			m_vBuf.reserve(max(m_vBuf.size() * 2, m_vBuf.size() + cbRead));
+		m_vBuf.resize(m_vBuf.size() + cbRead);
+	}
+	catch(...) { return E_OUTOFMEMORY; }
+
+	UINT64 uRead = 0;
+	const HRESULT hr = m_pBase->ReadPartial(&m_vBuf[static_cast<size_t>(uBuffered)],
+		cbRead, &uRead);
+	m_vBuf.resize(static_cast<size_t>(uBuffered + (SUCCEEDED(hr) ? uRead : 0)));
+	if(FAILED(hr)) return hr;
+
+	if(uRead == 0) { m_bBaseEnded = true; return S_FALSE; }
+	return S_OK;
+}
+
+HRESULT CKpReadAheadStream::ReadPartial(BYTE* pbBuffer, UINT64 uCount,
+	UINT64* puRead)
+{
+	if(pbBuffer == NULL) { ASSERT(FALSE); if(puRead != NULL) *puRead = 0; return E_POINTER; }
+
+	if(m_uBufPos < m_vBuf.size())
+	{
+		const size_t cbCopy = static_cast<size_t>(min(uCount, static_cast<UINT64>(
+			m_vBuf.size() - m_uBufPos)));
+		memcpy(pbBuffer, &m_vBuf[m_uBufPos], cbCopy);
+		m_uBufPos += cbCopy;
+
+		// Release the memory as soon as all buffered data has been read
+		if(m_uBufPos == m_vBuf.size()) Close();
+
+		if(puRead != NULL) *puRead = cbCopy;
+		return S_OK;
+	}
+
+	if(m_bBaseEnded) { if(puRead != NULL) *puRead = 0; return S_OK; }
+	return m_pBase->ReadPartial(pbBuffer, uCount, puRead);
+}
@@ -0,0 +1,54 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ___KP_READ_AHEAD_STREAM_H___
+#define ___KP_READ_AHEAD_STREAM_H___
+
+#include "KpStream.h"
+#include <vector>
+#include <boost/utility.hpp>
+
+// Reads data from a base stream in advance (e.g. while the CPU is busy
+// with something else). Subsequent reads first return the buffered data,
+// then continue reading from the base stream.
+class CKpReadAheadStream : public CKpStream, boost::noncopyable
+{
+public:
+	CKpReadAheadStream(CKpStream* pBase, UINT64 uMaxBuffered);
+	virtual ~CKpReadAheadStream() { Close(); }
+
+	virtual HRESULT Close();
+	virtual HRESULT ReadPartial(BYTE* pbBuffer, UINT64 uCount, UINT64* puRead);
+
+	// Read up to uCount more bytes into the buffer. Returns S_FALSE if the
+	// base stream has ended or the buffer is full.
+	HRESULT ReadAhead(UINT64 uCount);
+
+	UINT64 GetBufferedSize() const { return static_cast<UINT64>(m_vBuf.size()); }
+
+private:
+	CKpStream* m_pBase;
+	UINT64 m_uMaxBuffered;
+
+	std::vector<BYTE> m_vBuf;
+	size_t m_uBufPos;
+	bool m_bBaseEnded;
+};
+
+#endif // ___KP_READ_AHEAD_STREAM_H___
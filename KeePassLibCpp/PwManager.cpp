@@ -19,6 +19,7 @@
 
 #include "StdAfx.h"
 #include "PwManager.h"
+#include "Crypto/Argon2Kdf.h"
 #include "Crypto/ChaCha20.h"
 #include "Crypto/KeyTransform.h"
 #include "Crypto/MemoryProtectionEx.h"
@@ -30,6 +31,7 @@
 #include "Util/ComUtil.h"
 
 #include <boost/static_assert.hpp>
+#include <algorithm>
 
 static PW_TIME g_pwTimeNever = { 2999, 12, 28, 23, 59, 59 };
 static char g_pNullString[4] = { 0, 0, 0, 0 };
@@ -46,9 +48,18 @@ CPwManager::CPwManager()
 	m_dwNumGroups = 0;
 	m_dwMaxGroups = 0;
 
+	m_bSearchIndex = FALSE;
+	m_bSearchIndexPasswords = FALSE;
+	m_bSearchShadows = FALSE;
+	m_dwSearchGeneration = 0;
+	_ResetIndexes();
+
 	m_pLastEditedEntry = NULL;
+	m_bAdoptArenaStrings = false;
 	m_nAlgorithm = ALGO_AES;
 	m_dwKeyEncRounds = PWM_STD_KEYENCROUNDS;
+	m_nKdf = KDF_AES;
+	CArgon2Kdf::GetDefaultParams(&m_argon2);
 
 	m_random.GetRandomBuffer(m_pSessionKey, PWM_SESSION_KEY_SIZE);
 
@@ -58,6 +69,17 @@ CPwManager::CPwManager()
 
 	m_bUseTransactedFileWrites = FALSE;
 
+	m_hTransformThread = NULL;
+	m_bTransformResult = FALSE;
+	m_dwTransformTime = 0;
+	ZeroMemory(&m_openTimings, sizeof(PWDB_OPEN_TIMINGS));
+
+	m_bPreDeriveSaveKey = FALSE;
+	m_pSaveKeyJob = NULL;
+	m_hSaveKeyThread = NULL;
+
+	m_pFindPool = NULL;
+
 	m_clr = DWORD_MAX;
 
 	_DetMetaInfo();
@@ -68,6 +90,11 @@ CPwManager::CPwManager()
 
 CPwManager::~CPwManager()
 {
+	ASSERT(m_hTransformThread == NULL);
+	if(m_hTransformThread != NULL) _EndTransformMasterKey(NULL);
+
+	_DiscardPreDerivedSaveKey();
+	_DeleteFindPool();
 	this->CleanUp();
 }
 
@@ -86,6 +113,8 @@ void CPwManager::InitPrimaryInstance()
 
 void CPwManager::CleanUp()
 {
+	_DiscardPreDerivedSaveKey();
+
 	_DeleteEntryList(TRUE);
 	m_dwNumEntries = 0;
 	m_dwMaxEntries = 0;
@@ -94,6 +123,8 @@ void CPwManager::CleanUp()
 	m_dwNumGroups = 0;
 	m_dwMaxGroups = 0;
 
+	_ResetIndexes();
+
 	m_pLastEditedEntry = NULL;
 
 	mem_erase(m_pMasterKey, 32);
@@ -140,6 +171,8 @@ int CPwManager::SetMasterKey(const TCHAR *pszMasterKey, BOOL bDiskDrive,
 
 	ASSERT(pszMasterKey != NULL); if(pszMasterKey == NULL) return PWE_INVALID_PARAM;
 
+	_DiscardPreDerivedSaveKey();
+
 #ifdef _UNICODE
 	BOOST_STATIC_ASSERT(sizeof(TCHAR) >= 2);
 	paKey = _StringToAnsi(pszMasterKey);
@@ -473,6 +506,7 @@ void CPwManager::NewDatabase()
 {
 	_DeleteEntryList(TRUE); // Delete really everything, the strings too
 	_DeleteGroupList(TRUE);
+	_ResetIndexes();
 
 	m_pLastEditedEntry = NULL;
 
@@ -492,6 +526,42 @@ void CPwManager::NewDatabase()
 	m_clr = DWORD_MAX;
 }
 
+void CPwManager::_SwapContents(CPwManager& other)
+{
+	std::swap(m_pEntries, other.m_pEntries);
+	std::swap(m_dwMaxEntries, other.m_dwMaxEntries);
+	std::swap(m_dwNumEntries, other.m_dwNumEntries);
+	std::swap(m_pGroups, other.m_pGroups);
+	std::swap(m_dwMaxGroups, other.m_dwMaxGroups);
+	std::swap(m_dwNumGroups, other.m_dwNumGroups);
+	std::swap(m_pLastEditedEntry, other.m_pLastEditedEntry);
+	m_arena.Swap(other.m_arena);
+	m_vHeaderHash.swap(other.m_vHeaderHash);
+
+	m_strDefaultUserName.swap(other.m_strDefaultUserName);
+	m_vSearchHistory.swap(other.m_vSearchHistory);
+	m_vCustomKVPs.swap(other.m_vCustomKVPs);
+	m_vUnknownMetaStreams.swap(other.m_vUnknownMetaStreams);
+	std::swap(m_clr, other.m_clr);
+
+	// The indexes and search shadows belong to the contents
+	m_mEntryIndex.swap(other.m_mEntryIndex);
+	std::swap(m_bEntryIndexValid, other.m_bEntryIndexValid);
+	m_mGroupIndex.swap(other.m_mGroupIndex);
+	std::swap(m_bGroupIndexValid, other.m_bGroupIndexValid);
+	m_mGroupEntries.swap(other.m_mGroupEntries);
+	std::swap(m_bGroupEntriesValid, other.m_bGroupEntriesValid);
+	m_vGroupTree.swap(other.m_vGroupTree);
+	std::swap(m_bGroupTreeValid, other.m_bGroupTreeValid);
+	m_mTrigrams.swap(other.m_mTrigrams);
+	std::swap(m_bTrigramIndexValid, other.m_bTrigramIndexValid);
+	m_vShadows.swap(other.m_vShadows);
+	std::swap(m_bShadowsValid, other.m_bShadowsValid);
+
+	_InvalidateFindCache();
+	other._InvalidateFindCache();
+}
+
 int CPwManager::GetAlgorithm() const
 {
 	return m_nAlgorithm;
@@ -502,10 +572,44 @@ BOOL CPwManager::SetAlgorithm(int nAlgorithm)
 	ASSERT((nAlgorithm == ALGO_AES) || (nAlgorithm == ALGO_TWOFISH));
 	if((nAlgorithm != ALGO_AES) && (nAlgorithm != ALGO_TWOFISH)) return FALSE;
 
+	if(nAlgorithm != m_nAlgorithm) _DiscardPreDerivedSaveKey();
+
 	m_nAlgorithm = nAlgorithm;
 	return TRUE;
 }
 
+// New capacity of a list that must hold at least dwRequired items;
+// grows geometrically, such that adding items is amortized O(1)
+static DWORD Priv_GetGrownCapacity(DWORD dwCurrent, DWORD dwRequired,
+	DWORD dwMinStep)
+{
+	UINT64 uNew = static_cast<UINT64>(dwCurrent) + static_cast<UINT64>(
+		max(dwCurrent / 2, dwMinStep));
+	if(uNew < static_cast<UINT64>(dwRequired)) uNew = dwRequired;
+	if(uNew > static_cast<UINT64>(DWORD_MAX - 1)) uNew = DWORD_MAX - 1;
+	return static_cast<DWORD>(uNew);
+}
+
+BOOL CPwManager::ReserveEntries(DWORD dwCount)
+{
+	if(dwCount <= m_dwMaxEntries) return TRUE;
+	if((dwCount == DWORD_MAX) || (static_cast<UINT64>(dwCount) > static_cast<UINT64>(
+		SIZE_MAX / sizeof(PW_ENTRY)))) { ASSERT(FALSE); return FALSE; }
+
+	_AllocEntries(dwCount);
+	return ((dwCount <= m_dwMaxEntries) ? TRUE : FALSE);
+}
+
+BOOL CPwManager::ReserveGroups(DWORD dwCount)
+{
+	if(dwCount <= m_dwMaxGroups) return TRUE;
+	if((dwCount == DWORD_MAX) || (static_cast<UINT64>(dwCount) > static_cast<UINT64>(
+		SIZE_MAX / sizeof(PW_GROUP)))) { ASSERT(FALSE); return FALSE; }
+
+	_AllocGroups(dwCount);
+	return ((dwCount <= m_dwMaxGroups) ? TRUE : FALSE);
+}
+
 void CPwManager::_AllocEntries(DWORD uEntries)
 {
 	ASSERT((uEntries != 0) && (uEntries != DWORD_MAX));
@@ -564,14 +668,19 @@ void CPwManager::_DeleteEntryList(BOOL bFreeStrings)
 	{
 		for(DWORD uCurrentEntry = 0; uCurrentEntry < m_dwNumEntries; ++uCurrentEntry)
 		{
-			SAFE_DELETE_ARRAY(m_pEntries[uCurrentEntry].pszTitle);
-			SAFE_DELETE_ARRAY(m_pEntries[uCurrentEntry].pszURL);
-			SAFE_DELETE_ARRAY(m_pEntries[uCurrentEntry].pszUserName);
-			SAFE_DELETE_ARRAY(m_pEntries[uCurrentEntry].pszPassword);
-			SAFE_DELETE_ARRAY(m_pEntries[uCurrentEntry].pszAdditional);
-			SAFE_DELETE_ARRAY(m_pEntries[uCurrentEntry].pszBinaryDesc);
-			SAFE_DELETE_ARRAY(m_pEntries[uCurrentEntry].pBinaryData);
+			PW_ENTRY *p = &m_pEntries[uCurrentEntry];
+
+			// Arena strings are erased and freed at once below
+			if(!m_arena.Contains(p->pszTitle)) SAFE_DELETE_ARRAY(p->pszTitle);
+			if(!m_arena.Contains(p->pszURL)) SAFE_DELETE_ARRAY(p->pszURL);
+			if(!m_arena.Contains(p->pszUserName)) SAFE_DELETE_ARRAY(p->pszUserName);
+			SAFE_DELETE_ARRAY(p->pszPassword);
+			if(!m_arena.Contains(p->pszAdditional)) SAFE_DELETE_ARRAY(p->pszAdditional);
+			if(!m_arena.Contains(p->pszBinaryDesc)) SAFE_DELETE_ARRAY(p->pszBinaryDesc);
+			SAFE_DELETE_ARRAY(p->pBinaryData);
 		}
+
+		m_arena.Clear();
 	}
 
 	if(m_dwNumEntries != 0)
@@ -643,17 +752,18 @@ DWORD CPwManager::GetEntryByGroupN(DWORD idGroup, DWORD dwIndex) const
 	ASSERT(dwIndex < m_dwNumEntries);
 	if(dwIndex >= m_dwNumEntries) return DWORD_MAX;
 
-	DWORD uEntryInGroupCounter = 0;
-	for(DWORD uCurrentEntry = 0; uCurrentEntry < m_dwNumEntries; ++uCurrentEntry)
+	const std::vector<DWORD> *pv = _GetGroupEntries(idGroup);
+	if((pv == NULL) || (dwIndex >= pv->size())) return DWORD_MAX;
+
+	const DWORD dwEntry = (*pv)[dwIndex];
+	if(m_pEntries[dwEntry].uGroupId != idGroup)
 	{
-		if(m_pEntries[uCurrentEntry].uGroupId == idGroup)
-		{
-			if(dwIndex == uEntryInGroupCounter) return uCurrentEntry;
-			++uEntryInGroupCounter;
-		}
+		ASSERT(FALSE); // Group ID has been modified without using SetEntry
+		_RebuildGroupEntriesIndex();
+		return GetEntryByGroupN(idGroup, dwIndex);
 	}
 
-	return DWORD_MAX;
+	return dwEntry;
 }
 
 PW_ENTRY *CPwManager::GetEntryByUuid(const BYTE *pUuid)
@@ -668,36 +778,52 @@ PW_ENTRY *CPwManager::GetEntryByUuid(const BYTE *pUuid)
 	return &m_pEntries[dwEntryIndex];
 }
 
-DWORD CPwManager::GetEntryByUuidN(const BYTE *pUuid) const
+DWORD CPwManager::GetEntryPosInGroup(_In_ const PW_ENTRY *pEntry) const
 {
-	ASSERT(pUuid != NULL); if(pUuid == NULL) return DWORD_MAX;
+	ASSERT(pEntry != NULL); if(pEntry == NULL) return DWORD_MAX;
 
-	for(DWORD dw = 0; dw < m_dwNumEntries; ++dw)
+	const std::vector<DWORD> *pv = _GetGroupEntries(pEntry->uGroupId);
+	if(pv == NULL) return DWORD_MAX;
+
+	const DWORD dwIndex = GetEntryByUuidN(pEntry->uuid);
+	if((dwIndex != DWORD_MAX) && (m_pEntries[dwIndex].uGroupId == pEntry->uGroupId))
+	{
+		std::vector<DWORD>::const_iterator it = std::lower_bound(pv->begin(),
+			pv->end(), dwIndex);
+		if((it != pv->end()) && (*it == dwIndex))
+			return static_cast<DWORD>(it - pv->begin());
+	}
+
+	// The first entry with this UUID is in another group
+	for(size_t i = 0; i < pv->size(); ++i)
 	{
-		if(memcmp(m_pEntries[dw].uuid, pUuid, 16) == 0) return dw;
+		if(memcmp(m_pEntries[(*pv)[i]].uuid, pEntry->uuid, 16) == 0)
+			return static_cast<DWORD>(i);
 	}
 
-	// Don't ASSERT here, just return DWORD_MAX
 	return DWORD_MAX;
 }
 
-DWORD CPwManager::GetEntryPosInGroup(_In_ const PW_ENTRY *pEntry) const
+DWORD CPwManager::GetEntryIndicesInGroup(DWORD idGroup, const DWORD **ppIndices) const
 {
-	ASSERT(pEntry != NULL); if(pEntry == NULL) return DWORD_MAX;
+	ASSERT(ppIndices != NULL); if(ppIndices == NULL) return 0;
+	*ppIndices = NULL;
 
-	DWORD dwPos = 0;
-	for(DWORD uCurrentEntry = 0; uCurrentEntry < m_dwNumEntries; ++uCurrentEntry)
+	const std::vector<DWORD> *pv = _GetGroupEntries(idGroup);
+	if(pv == NULL) return 0;
+
+	for(size_t i = 0; i < pv->size(); ++i)
 	{
-		if(m_pEntries[uCurrentEntry].uGroupId == pEntry->uGroupId)
+		if(m_pEntries[(*pv)[i]].uGroupId != idGroup)
 		{
-			if(memcmp(m_pEntries[uCurrentEntry].uuid, pEntry->uuid, 16) == 0)
-				return dwPos;
-
-			++dwPos;
+			ASSERT(FALSE); // Group ID has been modified without using SetEntry
+			_RebuildGroupEntriesIndex();
+			return GetEntryIndicesInGroup(idGroup, ppIndices);
 		}
 	}
 
-	return DWORD_MAX;
+	*ppIndices = &(*pv)[0];
+	return static_cast<DWORD>(pv->size());
 }
 
 PW_ENTRY *CPwManager::GetLastEditedEntry()
@@ -719,17 +845,6 @@ PW_GROUP *CPwManager::GetGroupById(DWORD idGroup)
 	return &m_pGroups[dwIndex];
 }
 
-DWORD CPwManager::GetGroupByIdN(DWORD idGroup) const
-{
-	for(DWORD uCurrentEntry = 0; uCurrentEntry < m_dwNumGroups; ++uCurrentEntry)
-	{
-		if(m_pGroups[uCurrentEntry].uGroupId == idGroup)
-			return uCurrentEntry;
-	}
-
-	return DWORD_MAX;
-}
-
 DWORD CPwManager::GetGroupId(const TCHAR *pszGroupName) const
 {
 	ASSERT(pszGroupName != NULL); if(pszGroupName == NULL) return DWORD_MAX;
@@ -760,13 +875,8 @@ DWORD CPwManager::GetNumberOfItemsInGroupN(DWORD idGroup) const
 	ASSERT(idGroup != DWORD_MAX);
 	if(idGroup == DWORD_MAX) return 0;
 
-	DWORD n = 0;
-	for(DWORD i = 0; i < m_dwNumEntries; ++i)
-	{
-		if(m_pEntries[i].uGroupId == idGroup) ++n;
-	}
-
-	return n;
+	const std::vector<DWORD> *pv = _GetGroupEntries(idGroup);
+	return ((pv != NULL) ? static_cast<DWORD>(pv->size()) : 0);
 }
 
 BOOL CPwManager::AddEntry(_In_ const PW_ENTRY *pTemplate)
@@ -776,9 +886,12 @@ BOOL CPwManager::AddEntry(_In_ const PW_ENTRY *pTemplate)
 	ASSERT((pTemplate->uGroupId != 0) && (pTemplate->uGroupId != DWORD_MAX));
 	if((pTemplate->uGroupId == 0) || (pTemplate->uGroupId == DWORD_MAX)) return FALSE;
 
-	// If we don't have enough allocated entries, allocate 32 more
+	// If we don't have enough allocated entries, grow the list
 	if(m_dwNumEntries == m_dwMaxEntries)
-		_AllocEntries(m_dwMaxEntries + 32);
+	{
+		if(ReserveEntries(Priv_GetGrownCapacity(m_dwMaxEntries,
+			m_dwNumEntries + 1, 32)) == FALSE) return FALSE;
+	}
 
 	PW_ENTRY pT = *pTemplate; // Copy parameter to local temporary variable
 
@@ -800,6 +913,56 @@ BOOL CPwManager::AddEntry(_In_ const PW_ENTRY *pTemplate)
 	return SetEntry(m_dwNumEntries - 1, &pT);
 }
 
+BOOL CPwManager::AddEntries(_In_ const PW_ENTRY *pTemplates, DWORD dwCount)
+{
+	ASSERT(pTemplates != NULL); if(pTemplates == NULL) return FALSE;
+	if(dwCount == 0) return TRUE;
+
+	DWORD i, dwNewUuids = 0;
+	for(i = 0; i < dwCount; ++i)
+	{
+		const DWORD dwGroupId = pTemplates[i].uGroupId;
+		ASSERT((dwGroupId != 0) && (dwGroupId != DWORD_MAX));
+		if((dwGroupId == 0) || (dwGroupId == DWORD_MAX)) return FALSE;
+
+		if(CPwUtil::IsZeroUUID(pTemplates[i].uuid) == TRUE) ++dwNewUuids;
+	}
+
+	if(dwCount > (DWORD_MAX - 1 - m_dwNumEntries)) { ASSERT(FALSE); return FALSE; }
+	if((m_dwNumEntries + dwCount) > m_dwMaxEntries)
+	{
+		if(ReserveEntries(Priv_GetGrownCapacity(m_dwMaxEntries, m_dwNumEntries +
+			dwCount, 32)) == FALSE) return FALSE;
+	}
+
+	std::vector<BYTE> vUuids(static_cast<size_t>(dwNewUuids) * 16);
+	if(dwNewUuids != 0) randCreateUUIDs(&vUuids[0], dwNewUuids, &m_random);
+
+	DWORD dwUuid = 0;
+	for(i = 0; i < dwCount; ++i)
+	{
+		PW_ENTRY pT = pTemplates[i];
+
+		if(CPwUtil::IsZeroUUID(pT.uuid) == TRUE)
+		{
+			memcpy(pT.uuid, &vUuids[dwUuid * 16], 16);
+			++dwUuid;
+		}
+
+		if(pT.pszTitle == NULL) pT.pszTitle = (TCHAR *)g_pNullString;
+		if(pT.pszUserName == NULL) pT.pszUserName = (TCHAR *)g_pNullString;
+		if(pT.pszURL == NULL) pT.pszURL = (TCHAR *)g_pNullString;
+		if(pT.pszPassword == NULL) pT.pszPassword = (TCHAR *)g_pNullString;
+		if(pT.pszAdditional == NULL) pT.pszAdditional = (TCHAR *)g_pNullString;
+		if(pT.pszBinaryDesc == NULL) pT.pszBinaryDesc = (TCHAR *)g_pNullString;
+
+		++m_dwNumEntries;
+		VERIFY(SetEntry(m_dwNumEntries - 1, &pT));
+	}
+
+	return TRUE;
+}
+
 BOOL CPwManager::AddGroup(_In_ const PW_GROUP *pTemplate)
 {
 	DWORD t = 0;
@@ -812,15 +975,9 @@ BOOL CPwManager::AddGroup(_In_ const PW_GROUP *pTemplate)
 	{
 		while(true) // Generate a new group ID that doesn't exist already
 		{
-			bool bExists = false;
 			t = randXorShift();
 			if((t == 0) || (t == DWORD_MAX)) continue;
-			for(DWORD i = 0; i < m_dwNumGroups; ++i)
-			{
-				if(m_pGroups[i].uGroupId == t) bExists = true;
-			}
-
-			if(bExists == false) break;
+			if(GetGroupByIdN(t) == DWORD_MAX) break;
 		}
 	}
 	else t = pT.uGroupId;
@@ -828,7 +985,10 @@ BOOL CPwManager::AddGroup(_In_ const PW_GROUP *pTemplate)
 	pT.uGroupId = t;
 
 	if(m_dwNumGroups == m_dwMaxGroups)
-		_AllocGroups(m_dwMaxGroups + 8);
+	{
+		if(ReserveGroups(Priv_GetGrownCapacity(m_dwMaxGroups,
+			m_dwNumGroups + 1, 8)) == FALSE) return FALSE;
+	}
 
 	++m_dwNumGroups;
 
@@ -845,8 +1005,11 @@ BOOL CPwManager::SetGroup(DWORD dwIndex, _In_ const PW_GROUP *pTemplate)
 	SAFE_DELETE_ARRAY(m_pGroups[dwIndex].pszGroupName);
 	m_pGroups[dwIndex].pszGroupName = _TcsSafeDupAlloc(pTemplate->pszGroupName);
 
+	const DWORD dwOldId = m_pGroups[dwIndex].uGroupId;
 	m_pGroups[dwIndex].uGroupId = pTemplate->uGroupId;
+	_UpdateGroupIndex(dwIndex, dwOldId);
 	m_pGroups[dwIndex].uImageId = pTemplate->uImageId;
+	if(m_pGroups[dwIndex].usLevel != pTemplate->usLevel) _InvalidateGroupTreeIndex();
 	m_pGroups[dwIndex].usLevel = pTemplate->usLevel;
 	m_pGroups[dwIndex].dwFlags = pTemplate->dwFlags;
 
@@ -863,13 +1026,12 @@ BOOL CPwManager::DeleteEntry(DWORD dwIndex)
 	ASSERT(dwIndex < m_dwNumEntries); if(dwIndex >= m_dwNumEntries) return FALSE;
 	ASSERT_ENTRY(&m_pEntries[dwIndex]);
 
-	SAFE_DELETE_ARRAY(m_pEntries[dwIndex].pszTitle);
-	SAFE_DELETE_ARRAY(m_pEntries[dwIndex].pszURL);
-	SAFE_DELETE_ARRAY(m_pEntries[dwIndex].pszUserName);
-	SAFE_DELETE_ARRAY(m_pEntries[dwIndex].pszPassword);
-	SAFE_DELETE_ARRAY(m_pEntries[dwIndex].pszAdditional);
-	SAFE_DELETE_ARRAY(m_pEntries[dwIndex].pszBinaryDesc);
-	SAFE_DELETE_ARRAY(m_pEntries[dwIndex].pBinaryData);
+	_InvalidateTrigramIndex(); // Like DeleteEntries
+	_FreeEntryStrings(&m_pEntries[dwIndex]);
+
+	_RemoveFromEntryIndex(dwIndex);
+	_RemoveFromGroupEntriesIndex(dwIndex);
+	if(dwIndex < m_vShadows.size()) m_vShadows.erase(m_vShadows.begin() + dwIndex);
 
 	if(dwIndex != (m_dwNumEntries - 1))
 	{
@@ -882,6 +1044,75 @@ BOOL CPwManager::DeleteEntry(DWORD dwIndex)
 	return TRUE;
 }
 
+DWORD CPwManager::DeleteEntries(const DWORD *pIndices, DWORD dwCount)
+{
+	if(dwCount == 0) return 0;
+	ASSERT(pIndices != NULL); if(pIndices == NULL) return 0;
+
+	std::vector<bool> vDelete(m_dwNumEntries, false);
+	for(DWORD i = 0; i < dwCount; ++i)
+	{
+		const DWORD dwIndex = pIndices[i];
+		ASSERT(dwIndex < m_dwNumEntries); if(dwIndex >= m_dwNumEntries) return 0;
+		vDelete[dwIndex] = true;
+	}
+
+	return _DeleteMarkedEntries(vDelete);
+}
+
+DWORD CPwManager::DeleteEntries(LPPWENTRYPREDICATE lpPredicate, void *pContext)
+{
+	ASSERT(lpPredicate != NULL); if(lpPredicate == NULL) return 0;
+
+	std::vector<bool> vDelete(m_dwNumEntries, false);
+	for(DWORD i = 0; i < m_dwNumEntries; ++i)
+		vDelete[i] = lpPredicate(&m_pEntries[i], pContext);
+
+	return _DeleteMarkedEntries(vDelete);
+}
+
+// Free the marked entries and close the gaps in a single pass; the
+// indexes are rebuilt once by the next lookup
+DWORD CPwManager::_DeleteMarkedEntries(const std::vector<bool>& vDelete)
+{
+	ASSERT(vDelete.size() == m_dwNumEntries);
+	if(vDelete.size() != m_dwNumEntries) return 0;
+
+	const bool bShadows = !m_vShadows.empty();
+	ASSERT(!bShadows || (m_vShadows.size() == m_dwNumEntries));
+
+	DWORD dwWrite = 0;
+	for(DWORD i = 0; i < m_dwNumEntries; ++i)
+	{
+		if(vDelete[i])
+		{
+			ASSERT_ENTRY(&m_pEntries[i]);
+			_FreeEntryStrings(&m_pEntries[i]);
+		}
+		else
+		{
+			if(dwWrite != i)
+			{
+				m_pEntries[dwWrite] = m_pEntries[i];
+				if(bShadows) m_vShadows[dwWrite] = m_vShadows[i];
+			}
+			++dwWrite;
+		}
+	}
+
+	const DWORD dwDeleted = m_dwNumEntries - dwWrite;
+	if(dwDeleted == 0) return 0;
+
+	if(bShadows) m_vShadows.resize(dwWrite);
+
+	mem_erase(&m_pEntries[dwWrite], dwDeleted * sizeof(PW_ENTRY));
+	m_dwNumEntries = dwWrite;
+	_InvalidateEntryIndex();
+	_InvalidateGroupEntriesIndex();
+	_InvalidateTrigramIndex();
+	return dwDeleted;
+}
+
 BOOL CPwManager::DeleteGroupById(DWORD uGroupId, BOOL bCreateBackupEntries)
 {
 	ASSERT(GetGroupById(uGroupId) != NULL);
@@ -889,46 +1120,91 @@ BOOL CPwManager::DeleteGroupById(DWORD uGroupId, BOOL bCreateBackupEntries)
 	const DWORD dwInvGroup1 = this->GetGroupId(PWS_BACKUPGROUP);
 	const DWORD dwInvGroup2 = this->GetGroupId(PWS_BACKUPGROUP_SRC);
 
-	DWORD i = 0;
-	if(m_dwNumEntries > 0)
+	// Copy the indices, creating backups modifies the group entries index
+	const DWORD *pIndices = NULL;
+	const DWORD dwInGroup = GetEntryIndicesInGroup(uGroupId, &pIndices);
+	std::vector<DWORD> vDelete;
+	if(dwInGroup != 0) vDelete.assign(pIndices, pIndices + dwInGroup);
+
+	if((bCreateBackupEntries != FALSE) && (uGroupId != dwInvGroup1) &&
+		(uGroupId != dwInvGroup2))
 	{
-		while(1) // Remove all items in that group
+		// Backups are appended, thus the indices remain valid; the list
+		// may be reallocated though
+		for(size_t j = 0; j < vDelete.size(); ++j)
 		{
-			PW_ENTRY* p = &m_pEntries[i];
-			if(p->uGroupId == uGroupId)
-			{
-				if((bCreateBackupEntries != FALSE) && (p->uGroupId != dwInvGroup1) &&
-					(p->uGroupId != dwInvGroup2))
-				{
-					this->UnlockEntryPassword(p);
-					VERIFY(this->BackupEntry(p, NULL) == TRUE);
-					this->LockEntryPassword(p);
-				}
-
-				VERIFY(this->DeleteEntry(i));
-				--i;
-			}
-
-			if(++i >= m_dwNumEntries) break;
+			PW_ENTRY* p = &m_pEntries[vDelete[j]];
+			this->UnlockEntryPassword(p);
+			VERIFY(this->BackupEntry(p, NULL) == TRUE);
+			this->LockEntryPassword(&m_pEntries[vDelete[j]]);
 		}
 	}
 
+	if(!vDelete.empty())
+	{
+		VERIFY(DeleteEntries(&vDelete[0], static_cast<DWORD>(vDelete.size())) ==
+			static_cast<DWORD>(vDelete.size()));
+	}
+
 	const DWORD inx = GetGroupByIdN(uGroupId);
 	SAFE_DELETE_ARRAY(m_pGroups[inx].pszGroupName);
 
 	if(inx != (m_dwNumGroups - 1))
 	{
-		for(i = inx; i < (m_dwNumGroups - 1); ++i)
+		for(DWORD i = inx; i < (m_dwNumGroups - 1); ++i)
 			m_pGroups[i] = m_pGroups[i + 1];
 	}
 
 	mem_erase(&m_pGroups[m_dwNumGroups - 1], sizeof(PW_GROUP));
 	--m_dwNumGroups;
+	_InvalidateGroupIndex();
 
 	FixGroupTree();
 	return TRUE;
 }
 
+// Replace a string of an entry by a copy of lpNew. While a file is being
+// read, the strings of the template already are in the arena and are taken
+// over instead of being copied. The old string is freed (or erased if it
+// is in the arena), i.e. arena strings are never written in place.
+void CPwManager::_SetEntryString(LPTSTR& lpField, LPCTSTR lpNew)
+{
+	if(lpField == lpNew) return;
+
+	LPTSTR lpCopy;
+	if(m_bAdoptArenaStrings && m_arena.Contains(lpNew))
+		lpCopy = const_cast<LPTSTR>(lpNew);
+	else lpCopy = _TcsSafeDupAlloc(lpNew);
+
+	_FreeEntryString(lpField);
+	lpField = lpCopy;
+}
+
+void CPwManager::_FreeEntryString(LPTSTR& lpField)
+{
+	if(lpField == NULL) return;
+
+	if(m_arena.Contains(lpField))
+	{
+		mem_erase(lpField, _tcslen(lpField) * sizeof(TCHAR));
+		lpField = NULL;
+	}
+	else SAFE_DELETE_ARRAY(lpField);
+}
+
+void CPwManager::_FreeEntryStrings(PW_ENTRY *pEntry)
+{
+	ASSERT(pEntry != NULL); if(pEntry == NULL) return;
+
+	_FreeEntryString(pEntry->pszTitle);
+	_FreeEntryString(pEntry->pszURL);
+	_FreeEntryString(pEntry->pszUserName);
+	SAFE_DELETE_ARRAY(pEntry->pszPassword);
+	_FreeEntryString(pEntry->pszAdditional);
+	_FreeEntryString(pEntry->pszBinaryDesc);
+	SAFE_DELETE_ARRAY(pEntry->pBinaryData);
+}
+
 BOOL CPwManager::SetEntry(DWORD dwIndex, _In_ const PW_ENTRY *pTemplate)
 {
 	ASSERT(dwIndex < m_dwNumEntries);
@@ -946,29 +1222,29 @@ BOOL CPwManager::SetEntry(DWORD dwIndex, _In_ const PW_ENTRY *pTemplate)
 	if(pTemplate->pszPassword == NULL) return FALSE;
 	if(pTemplate->pszAdditional == NULL) return FALSE;
 
+	_RemoveFromTrigramIndex(dwIndex);
+
+	BYTE aOldUuid[16];
+	memcpy(aOldUuid, m_pEntries[dwIndex].uuid, 16);
 	memcpy(m_pEntries[dwIndex].uuid, pTemplate->uuid, 16);
+	_UpdateEntryIndex(dwIndex, aOldUuid);
+	const DWORD dwOldGroupId = m_pEntries[dwIndex].uGroupId;
 	m_pEntries[dwIndex].uGroupId = pTemplate->uGroupId;
+	_UpdateGroupEntriesIndex(dwIndex, dwOldGroupId);
 	m_pEntries[dwIndex].uImageId = pTemplate->uImageId;
 
-	SAFE_DELETE_ARRAY(m_pEntries[dwIndex].pszTitle);
-	m_pEntries[dwIndex].pszTitle = _TcsSafeDupAlloc(pTemplate->pszTitle);
-
-	SAFE_DELETE_ARRAY(m_pEntries[dwIndex].pszUserName);
-	m_pEntries[dwIndex].pszUserName = _TcsSafeDupAlloc(pTemplate->pszUserName);
-
-	SAFE_DELETE_ARRAY(m_pEntries[dwIndex].pszURL);
-	m_pEntries[dwIndex].pszURL = _TcsSafeDupAlloc(pTemplate->pszURL);
+	_SetEntryString(m_pEntries[dwIndex].pszTitle, pTemplate->pszTitle);
+	_SetEntryString(m_pEntries[dwIndex].pszUserName, pTemplate->pszUserName);
+	_SetEntryString(m_pEntries[dwIndex].pszURL, pTemplate->pszURL);
 
 	SAFE_DELETE_ARRAY(m_pEntries[dwIndex].pszPassword);
 	m_pEntries[dwIndex].pszPassword = _TcsCryptDupAlloc(pTemplate->pszPassword);
 
-	SAFE_DELETE_ARRAY(m_pEntries[dwIndex].pszAdditional);
-	m_pEntries[dwIndex].pszAdditional = _TcsSafeDupAlloc(pTemplate->pszAdditional);
+	_SetEntryString(m_pEntries[dwIndex].pszAdditional, pTemplate->pszAdditional);
 
 	if(!((m_pEntries[dwIndex].pBinaryData == pTemplate->pBinaryData) && (m_pEntries[dwIndex].pszBinaryDesc == pTemplate->pszBinaryDesc)))
 	{
-		SAFE_DELETE_ARRAY(m_pEntries[dwIndex].pszBinaryDesc);
-		m_pEntries[dwIndex].pszBinaryDesc = _TcsSafeDupAlloc(pTemplate->pszBinaryDesc);
+		_SetEntryString(m_pEntries[dwIndex].pszBinaryDesc, pTemplate->pszBinaryDesc);
 
 		SAFE_DELETE_ARRAY(m_pEntries[dwIndex].pBinaryData);
 		const DWORD slen = pTemplate->uBinaryDataLen;
@@ -999,10 +1275,26 @@ BOOL CPwManager::SetEntry(DWORD dwIndex, _In_ const PW_ENTRY *pTemplate)
 	}
 
 	ASSERT_ENTRY(&m_pEntries[dwIndex]);
+	_AddToTrigramIndex(dwIndex);
+	_UpdateSearchShadow(dwIndex);
 	m_pLastEditedEntry = &m_pEntries[dwIndex];
 	return TRUE;
 }
 
+BOOL CPwManager::SetEntryGroup(DWORD dwIndex, DWORD idGroup)
+{
+	ASSERT(dwIndex < m_dwNumEntries);
+	if(dwIndex >= m_dwNumEntries) return FALSE;
+
+	ASSERT((idGroup != 0) && (idGroup != DWORD_MAX));
+	if((idGroup == 0) || (idGroup == DWORD_MAX)) return FALSE;
+
+	const DWORD dwOldGroupId = m_pEntries[dwIndex].uGroupId;
+	m_pEntries[dwIndex].uGroupId = idGroup;
+	_UpdateGroupEntriesIndex(dwIndex, dwOldGroupId);
+	return TRUE;
+}
+
 void CPwManager::LockEntryPassword(_Inout_ PW_ENTRY *pEntry)
 {
 	ASSERT_ENTRY(pEntry); if(pEntry == NULL) return;
@@ -1090,6 +1382,17 @@ void CPwManager::MoveInternal(DWORD dwFrom, DWORD dwTo)
 
 		i += lDir;
 	}
+
+	if(!m_vShadows.empty())
+	{
+		std::vector<PWM_SEARCH_SHADOW>::iterator it = m_vShadows.begin();
+		if(lDir > 0) std::rotate(it + dwFrom, it + dwFrom + 1, it + dwTo + 1);
+		else std::rotate(it + dwTo, it + dwFrom, it + dwFrom + 1);
+	}
+
+	_InvalidateEntryIndex();
+	_InvalidateTrigramIndex();
+	_ResyncGroupEntriesIndex(min(dwFrom, dwTo), max(dwFrom, dwTo));
 }
 
 BOOL CPwManager::MoveGroup(DWORD dwFrom, DWORD dwTo)
@@ -1113,6 +1416,8 @@ BOOL CPwManager::MoveGroup(DWORD dwFrom, DWORD dwTo)
 		i += lDir;
 	}
 
+	_InvalidateGroupIndex();
+
 	FixGroupTree();
 	return TRUE;
 }
@@ -1125,27 +1430,37 @@ BOOL CPwManager::MoveGroupEx(DWORD dwFromId, DWORD dwToId)
 	if((dwFromId == 0) || (dwToId == 0)) return FALSE;
 	if(dwFromId == dwToId) return TRUE;
 
-	PW_GROUP* pgFrom = GetGroupById(dwFromId);
-	PW_GROUP* pgTo = GetGroupById(dwToId);
-	if((pgFrom == NULL) || (pgTo == NULL)) { ASSERT(FALSE); return FALSE; }
+	const DWORD dwFrom = GetGroupByIdN(dwFromId);
+	const DWORD dwTo = GetGroupByIdN(dwToId);
+	if((dwFrom == DWORD_MAX) || (dwTo == DWORD_MAX)) { ASSERT(FALSE); return FALSE; }
 
-	PG_TREENODE tnRoot = CPwUtil::GroupsToTree(this);
+	// The target must not be in the subtree of the moved group
+	const DWORD dwFromEnd = dwFrom + GetGroupSubtreeSize(dwFrom);
+	if((dwTo >= dwFrom) && (dwTo < dwFromEnd)) return FALSE;
 
-	boost::shared_ptr<PG_TREENODE> pFrom = CPwUtil::FindGroupInTree(&tnRoot,
-		dwFromId, false, 0);
-	boost::shared_ptr<PG_TREENODE> pTo = CPwUtil::FindGroupInTree(&tnRoot,
-		dwToId, false, 0);
-	if((pFrom.get() == NULL) || (pTo.get() == NULL)) { ASSERT(FALSE); return FALSE; }
+	// Make the group the last child of the target group
+	const DWORD dwToEnd = dwTo + GetGroupSubtreeSize(dwTo);
+	const int nLevelDelta = static_cast<int>(m_pGroups[dwTo].usLevel) + 1 -
+		static_cast<int>(m_pGroups[dwFrom].usLevel);
 
-	boost::shared_ptr<PG_TREENODE> pIsSub = CPwUtil::FindGroupInTree(pFrom.get(),
-		dwToId, false, 0);
-	if(pIsSub.get() != NULL) return FALSE;
+	DWORD dwNewPos;
+	if(dwFrom < dwToEnd) // Before the target or already in its subtree
+	{
+		std::rotate(m_pGroups + dwFrom, m_pGroups + dwFromEnd, m_pGroups + dwToEnd);
+		dwNewPos = dwToEnd - (dwFromEnd - dwFrom);
+	}
+	else
+	{
+		std::rotate(m_pGroups + dwToEnd, m_pGroups + dwFrom, m_pGroups + dwFromEnd);
+		dwNewPos = dwToEnd;
+	}
 
-	// Now move
-	pFrom = CPwUtil::FindGroupInTree(&tnRoot, dwFromId, true, 0); // Unlink
-	pTo->vChildNodes.push_back(pFrom);
+	for(DWORD i = dwNewPos; i < (dwNewPos + (dwFromEnd - dwFrom)); ++i)
+		m_pGroups[i].usLevel = static_cast<USHORT>(static_cast<int>(
+			m_pGroups[i].usLevel) + nLevelDelta);
 
-	CPwUtil::FlattenGroupTree(m_pGroups, &tnRoot, m_dwNumGroups);
+	_InvalidateGroupIndex();
+	FixGroupTree();
 #ifdef _DEBUG
 	CPwUtil::CheckGroupList(this);
 #endif
@@ -1157,13 +1472,38 @@ BOOL CPwManager::MoveGroupExDir(DWORD dwGroupId, INT iDirection)
 	ASSERT((dwGroupId != 0) && (dwGroupId != DWORD_MAX));
 	if((dwGroupId == 0) || (dwGroupId == DWORD_MAX)) return FALSE;
 
-	PG_TREENODE tnRoot = CPwUtil::GroupsToTree(this);
+	const DWORD dwGroup = GetGroupByIdN(dwGroupId);
+	if(dwGroup == DWORD_MAX) { ASSERT(FALSE); return FALSE; }
+	const DWORD dwGroupEnd = dwGroup + GetGroupSubtreeSize(dwGroup);
 
-	boost::shared_ptr<PG_TREENODE> p = CPwUtil::FindGroupInTree(&tnRoot,
-		dwGroupId, false, iDirection);
-	if(p.get() == NULL) { ASSERT(FALSE); return FALSE; }
+	// Find the first and the previous sibling
+	const DWORD dwParent = GetParentGroup(dwGroup);
+	DWORD dwFirst = ((dwParent == DWORD_MAX) ? 0 : GetFirstChildGroup(dwParent));
+	DWORD dwPrev = DWORD_MAX;
+	for(DWORD i = dwFirst; i != dwGroup; i = GetNextSiblingGroup(i))
+	{
+		ASSERT(i != DWORD_MAX); if(i == DWORD_MAX) return FALSE;
+		dwPrev = i;
+	}
 
-	CPwUtil::FlattenGroupTree(m_pGroups, &tnRoot, m_dwNumGroups);
+	const DWORD dwNext = GetNextSiblingGroup(dwGroup);
+	const DWORD dwParentEnd = ((dwParent == DWORD_MAX) ? m_dwNumGroups :
+		(dwParent + GetGroupSubtreeSize(dwParent)));
+
+	// Siblings are moved together with their subtrees
+	if((iDirection == -2) && (dwPrev != DWORD_MAX))
+		std::rotate(m_pGroups + dwFirst, m_pGroups + dwGroup, m_pGroups + dwGroupEnd);
+	else if((iDirection == 2) && (dwNext != DWORD_MAX))
+		std::rotate(m_pGroups + dwGroup, m_pGroups + dwGroupEnd, m_pGroups + dwParentEnd);
+	else if((iDirection == -1) && (dwPrev != DWORD_MAX))
+		std::rotate(m_pGroups + dwPrev, m_pGroups + dwGroup, m_pGroups + dwGroupEnd);
+	else if((iDirection == 1) && (dwNext != DWORD_MAX))
+		std::rotate(m_pGroups + dwGroup, m_pGroups + dwGroupEnd, m_pGroups + dwNext +
+			GetGroupSubtreeSize(dwNext));
+	else return TRUE; // Nothing to move
+
+	_InvalidateGroupIndex();
+	FixGroupTree();
 #ifdef _DEBUG
 	CPwUtil::CheckGroupList(this);
 #endif
@@ -1192,233 +1532,228 @@ BOOL CPwManager::GetGroupTree(DWORD idGroup, DWORD *pGroupIndexes) const
 	ASSERT(dwGroupPos != DWORD_MAX); if(dwGroupPos == DWORD_MAX) return FALSE;
 
 	DWORD i = dwGroupPos;
-	USHORT usLevel = static_cast<USHORT>(m_pGroups[i].usLevel + 1);
+	USHORT usLevel = m_pGroups[i].usLevel;
 	while(true)
 	{
-		if(m_pGroups[i].usLevel == (usLevel - 1))
-		{
-			--usLevel;
-			pGroupIndexes[usLevel] = i;
-			if(usLevel == 0) break;
-		}
+		pGroupIndexes[usLevel] = i;
+		if(usLevel == 0) break;
 
-		if(i == 0) { ASSERT(FALSE); return FALSE; }
-		--i;
+		i = GetParentGroup(i);
+		if((i == DWORD_MAX) || (m_pGroups[i].usLevel != (usLevel - 1)))
+			{ ASSERT(FALSE); return FALSE; }
+		--usLevel;
 	}
 
 	return TRUE;
 }
 
-void CPwManager::SortGroupList()
+// Compares two sibling group names in the same way as the former
+// SortGroupList implementation, which sorted "Name\n...\n\nID" paths
+// using _tcsicmp; a name that is a prefix of another one is sorted first
+// and equal names are ordered by the decimal group IDs
+static int Priv_CompareGroupNames(const PW_GROUP *pA, size_t cchA,
+	const PW_GROUP *pB, size_t cchB)
 {
-	DWORD i, j;
-	LPTSTR *pList = NULL;
-	LPTSTR lpTemp = NULL;
-	LPTSTR lp = NULL;
-	DWORD dwMaxString = 0;
-	USHORT usMaxLevel = 0;
-	TCHAR tszTemp[16];
-	DWORD dw;
-	PW_GROUP pwt;
-
-	if(m_dwNumGroups <= 1) return; // Nothing to sort
+	LPCTSTR lpA = pA->pszGroupName, lpB = pB->pszGroupName;
+	const int r = _tcsicmp(lpA, lpB);
 
-	// Search list for longest group name and maximum level
-	for(i = 0; i < m_dwNumGroups; ++i)
+	if(r == 0)
 	{
-		j = static_cast<DWORD>(_tcslen(m_pGroups[i].pszGroupName));
-		if(j > dwMaxString) dwMaxString = j;
-
-		if(m_pGroups[i].usLevel > usMaxLevel) usMaxLevel = m_pGroups[i].usLevel;
+		TCHAR tszA[16], tszB[16];
+		_ltot_s(static_cast<long>(pA->uGroupId), tszA, 10);
+		_ltot_s(static_cast<long>(pB->uGroupId), tszB, 10);
+		return _tcsicmp(tszA, tszB);
 	}
 
-	// Allocate pointer list to parent items
-	LPTSTR* pParents = new LPTSTR[usMaxLevel + 2];
-	ASSERT(pParents != NULL); if(pParents == NULL) return;
+	if(cchA == cchB) return r;
+	const size_t cchMin = min(cchA, cchB);
+	if(_tcsnicmp(lpA, lpB, cchMin) != 0) return r;
 
-	// Calculate maximum length of the biggest FQGN (fully qualified group name)
-	// (numchars(base10(0xFFFFFFFF)) = 10) + char(NULL) + char(/n) + char(/n) = 13
-	dwMaxString = ((dwMaxString + 1) * (usMaxLevel + 1) + 13);
+	// The shorter name was terminated by '\n' in the path
+	const TBYTE tch = static_cast<TBYTE>((cchA < cchB) ? lpB[cchMin] : lpA[cchMin]);
+	const int rShorter = ((tch < static_cast<TBYTE>(_T('\n'))) ? 1 : -1);
+	return ((cchA < cchB) ? rShorter : -rShorter);
+}
 
-	pList = new LPTSTR[m_dwNumGroups]; // Allocate FQGN list (array of pointers)
-	ASSERT(pList != NULL);
-	lpTemp = new TCHAR[dwMaxString];
-	ASSERT(lpTemp != NULL);
+struct PwmGroupSiblingLess
+{
+	const PW_GROUP *m_pGroups;
+	const std::vector<size_t> *m_pNameLengths;
 
-	// Build FQGN list
-	for(i = 0; i < m_dwNumGroups; ++i)
+	bool operator()(DWORD dwA, DWORD dwB) const
 	{
-		pList[i] = new TCHAR[dwMaxString];
-		ASSERT(pList[i] != NULL);
-		if(pList[i] == NULL)
-		{
-			for(j = 0; j < i; j++) SAFE_DELETE_ARRAY(pList[j]);
-			SAFE_DELETE_ARRAY(pList); SAFE_DELETE_ARRAY(pParents); SAFE_DELETE_ARRAY(lpTemp);
-			return; // Failed, too few memory available
-		}
-		*pList[i] = 0;
-
-		PW_GROUP* pg = &m_pGroups[i]; ASSERT(pg != NULL);
-		if(pg->usLevel != 0)
-		{
-			for(j = 0; j < pg->usLevel; ++j)
-			{
-				_tcscat_s(pList[i], dwMaxString, pParents[j]);
-				_tcscat_s(pList[i], dwMaxString, _T("\n"));
-			}
-		}
-		pParents[pg->usLevel] = pg->pszGroupName;
-		_tcscat_s(pList[i], dwMaxString, pg->pszGroupName);
-		_tcscat_s(pList[i], dwMaxString, _T("\n\n"));
+		return (Priv_CompareGroupNames(&m_pGroups[dwA], (*m_pNameLengths)[dwA],
+			&m_pGroups[dwB], (*m_pNameLengths)[dwB]) < 0);
+	}
+};
 
-		_ltot_s(static_cast<long>(pg->uGroupId), tszTemp, 10);
-		_tcscat_s(pList[i], dwMaxString, tszTemp);
+void CPwManager::SortGroupList()
+{
+	if(m_dwNumGroups <= 1) return; // Nothing to sort
 
-		ASSERT(_tcslen(pList[i]) < dwMaxString);
-	}
+	FixGroupTree();
 
-	BOOL bSwapped = TRUE;
-	while(bSwapped == TRUE) // Stable bubble-sort on the group list
+	// Build the child lists; the children of the virtual root are
+	// stored at index m_dwNumGroups
+	std::vector<std::vector<DWORD> > vChildren(m_dwNumGroups + 1);
+	std::vector<DWORD> vPath; // Current path, indexed by level
+	std::vector<size_t> vNameLengths(m_dwNumGroups);
+	for(DWORD i = 0; i < m_dwNumGroups; ++i)
 	{
-		bSwapped = FALSE;
-
-		for(i = 0; i < (m_dwNumGroups - 1); i++)
-		{
-			if(_tcsicmp(pList[i], pList[i+1]) > 0)
-			{
-				_tcscpy_s(lpTemp, dwMaxString, pList[i]); // Swap strings
-				_tcscpy_s(pList[i], dwMaxString, pList[i+1]);
-				_tcscpy_s(pList[i+1], dwMaxString, lpTemp);
+		const USHORT usLevel = m_pGroups[i].usLevel;
+		vPath.resize(usLevel);
+		vChildren[(usLevel == 0) ? m_dwNumGroups : vPath[usLevel - 1]].push_back(i);
+		vPath.push_back(i);
 
-				bSwapped = TRUE;
-			}
-		}
+		vNameLengths[i] = _tcslen(m_pGroups[i].pszGroupName);
 	}
 
-	for(i = 0; i < (m_dwNumGroups - 1); ++i)
+	PwmGroupSiblingLess pred;
+	pred.m_pGroups = m_pGroups;
+	pred.m_pNameLengths = &vNameLengths;
+	for(size_t i = 0; i < vChildren.size(); ++i)
 	{
-		lp = &pList[i][_tcslen(pList[i]) - 1];
-		while(1)
-		{
-			if(*lp == _T('\n')) break;
-			--lp;
-		}
-		++lp;
+		if(vChildren[i].size() >= 2)
+			std::stable_sort(vChildren[i].begin(), vChildren[i].end(), pred);
+	}
 
-		dw = static_cast<DWORD>(_ttol(lp));
-		ASSERT(GetGroupById(dw) != NULL);
+	// Flatten the tree (pre-order)
+	std::vector<PW_GROUP> vSorted;
+	vSorted.reserve(m_dwNumGroups);
+	std::vector<std::pair<DWORD, size_t> > vStack; // Parent, next child
+	vStack.push_back(std::make_pair(m_dwNumGroups, static_cast<size_t>(0)));
+	while(!vStack.empty())
+	{
+		std::pair<DWORD, size_t>& t = vStack.back();
+		const std::vector<DWORD>& vSiblings = vChildren[t.first];
+		if(t.second == vSiblings.size()) { vStack.pop_back(); continue; }
 
-		for(j = i; j < m_dwNumGroups; j++)
-		{
-			if(m_pGroups[j].uGroupId == dw) break;
-		}
+		const DWORD dwGroup = vSiblings[t.second];
+		++t.second;
 
-		pwt = m_pGroups[i];
-		m_pGroups[i] = m_pGroups[j];
-		m_pGroups[j] = pwt;
+		vSorted.push_back(m_pGroups[dwGroup]);
+		vStack.push_back(std::make_pair(dwGroup, static_cast<size_t>(0)));
 	}
+	ASSERT(vSorted.size() == m_dwNumGroups);
 
-	for(i = 0; i < m_dwNumGroups; ++i) SAFE_DELETE_ARRAY(pList[i]);
-
-	SAFE_DELETE_ARRAY(pList);
-	SAFE_DELETE_ARRAY(pParents);
-	SAFE_DELETE_ARRAY(lpTemp);
+	for(DWORD i = 0; i < m_dwNumGroups; ++i) m_pGroups[i] = vSorted[i];
+	_InvalidateGroupIndex();
 
 	FixGroupTree();
 }
 
-void CPwManager::SortGroup(DWORD idGroup, DWORD dwSortByField)
+// Sort key of an entry, computed once per entry by SortGroup
+struct PwmEntrySortKey
 {
-	DWORD i, n = 0, t;
+	DWORD dwEntry; // Index in the entry list
+	LPCTSTR lpString;
+	UINT64 uTime; // Packed by _pwtimepack
+};
 
-	if(m_dwNumEntries <= 1) return; // Nothing to sort
+struct PwmEntrySortLess
+{
+	enum { KeyString = 0, KeyTime, KeyUuid };
 
-	PPW_ENTRY *p = new PPW_ENTRY[m_dwNumEntries];
-	if(p == NULL) return;
+	int m_nKey;
+	LPCTSTRCMPEX m_lpCmp;
+	const PW_ENTRY *m_pEntries;
 
-	// Build pointer array that contains pointers to the elements to sort
-	for(i = 0; i < m_dwNumEntries; ++i)
+	bool operator()(const PwmEntrySortKey& a, const PwmEntrySortKey& b) const
 	{
-		if(m_pEntries[i].uGroupId == idGroup)
-		{
-			p[n] = &m_pEntries[i];
-			++n;
-		}
+		if(m_nKey == KeyString) return (m_lpCmp(a.lpString, b.lpString) < 0);
+		if(m_nKey == KeyTime) return (a.uTime > b.uTime); // Newest first
+
+		return (memcmp(m_pEntries[a.dwEntry].uuid, m_pEntries[b.dwEntry].uuid, 16) < 0);
 	}
-	if(n <= 1) { SAFE_DELETE_ARRAY(p); return; } // Something to sort?
+};
 
-	LPCTSTRCMPEX lpCmp = StrCmpGetNaturalMethodOrFallback();
+void CPwManager::SortGroup(DWORD idGroup, DWORD dwSortByField)
+{
+	if(m_dwNumEntries <= 1) return; // Nothing to sort
+
+	// The set of list positions used by the group doesn't change,
+	// thus the group entries index remains valid
+	const DWORD *pIndices = NULL;
+	const DWORD n = GetEntryIndicesInGroup(idGroup, &pIndices);
+	if(n <= 1) return; // Something to sort?
+
+	if(dwSortByField > 9) { ASSERT(FALSE); dwSortByField = 0; }
+
+	PwmEntrySortLess pred;
+	if(dwSortByField <= 4) pred.m_nKey = PwmEntrySortLess::KeyString;
+	else if(dwSortByField <= 8) pred.m_nKey = PwmEntrySortLess::KeyTime;
+	else pred.m_nKey = PwmEntrySortLess::KeyUuid;
+	pred.m_lpCmp = StrCmpGetNaturalMethodOrFallback();
+	pred.m_pEntries = m_pEntries;
+
+	// Passwords are decrypted only once into this buffer, which is
+	// erased after sorting
+	std::vector<TCHAR> vPasswords;
+	if(dwSortByField == 3)
+	{
+		size_t cchPasswords = 0;
+		for(DWORD i = 0; i < n; ++i)
+			cchPasswords += m_pEntries[pIndices[i]].uPasswordLen + 1;
+		vPasswords.resize(cchPasswords, 0);
+	}
 
-	// Sort the array, using a simple selection sort
-	for(i = 0; i < (n - 1); ++i)
+	std::vector<PwmEntrySortKey> vKeys(n);
+	size_t iPassword = 0;
+	for(DWORD i = 0; i < n; ++i)
 	{
-		DWORD dwMin = i;
+		PW_ENTRY *pe = &m_pEntries[pIndices[i]];
+		PwmEntrySortKey& k = vKeys[i];
+		k.dwEntry = pIndices[i];
+		k.lpString = NULL;
+		k.uTime = 0;
 
-		for(DWORD j = i + 1; j < n; ++j)
+		switch(dwSortByField)
 		{
-			switch(dwSortByField)
-			{
-			case 0:
-				if(lpCmp(p[j]->pszTitle, p[dwMin]->pszTitle) < 0)
-					dwMin = j;
-				break;
-			case 1:
-				if(lpCmp(p[j]->pszUserName, p[dwMin]->pszUserName) < 0)
-					dwMin = j;
-				break;
-			case 2:
-				if(lpCmp(p[j]->pszURL, p[dwMin]->pszURL) < 0)
-					dwMin = j;
-				break;
-			case 3:
-				t = dwMin;
-				UnlockEntryPassword(p[j]); UnlockEntryPassword(p[t]);
-				if(lpCmp(p[j]->pszPassword, p[dwMin]->pszPassword) < 0)
-					dwMin = j;
-				LockEntryPassword(p[j]); LockEntryPassword(p[t]);
-				break;
-			case 4:
-				if(lpCmp(p[j]->pszAdditional, p[dwMin]->pszAdditional) < 0)
-					dwMin = j;
-				break;
-			case 5:
-				if(_pwtimecmp(&p[j]->tCreation, &p[dwMin]->tCreation) > 0)
-					dwMin = j;
-				break;
-			case 6:
-				if(_pwtimecmp(&p[j]->tLastMod, &p[dwMin]->tLastMod) > 0)
-					dwMin = j;
-				break;
-			case 7:
-				if(_pwtimecmp(&p[j]->tLastAccess, &p[dwMin]->tLastAccess) > 0)
-					dwMin = j;
-				break;
-			case 8:
-				if(_pwtimecmp(&p[j]->tExpire, &p[dwMin]->tExpire) > 0)
-					dwMin = j;
-				break;
-			case 9:
-				if(memcmp(&p[j]->uuid[0], &p[dwMin]->uuid[0], 16) < 0)
-					dwMin = j;
-				break;
-			default:
-				ASSERT(FALSE);
-				if(lpCmp(p[j]->pszTitle, p[dwMin]->pszTitle) < 0)
-					dwMin = j;
-				break;
-			}
+		case 0: k.lpString = pe->pszTitle; break;
+		case 1: k.lpString = pe->pszUserName; break;
+		case 2: k.lpString = pe->pszURL; break;
+		case 3:
+			UnlockEntryPassword(pe);
+			memcpy(&vPasswords[iPassword], pe->pszPassword, pe->uPasswordLen *
+				sizeof(TCHAR));
+			LockEntryPassword(pe);
+			k.lpString = &vPasswords[iPassword];
+			iPassword += pe->uPasswordLen + 1;
+			break;
+		case 4: k.lpString = pe->pszAdditional; break;
+		case 5: k.uTime = _pwtimepack(&pe->tCreation); break;
+		case 6: k.uTime = _pwtimepack(&pe->tLastMod); break;
+		case 7: k.uTime = _pwtimepack(&pe->tLastAccess); break;
+		case 8: k.uTime = _pwtimepack(&pe->tExpire); break;
+		default: break; // UUID
 		}
+	}
+
+	std::stable_sort(vKeys.begin(), vKeys.end(), pred);
+
+	if(!vPasswords.empty())
+		mem_erase(&vPasswords[0], vPasswords.size() * sizeof(TCHAR));
+
+	// Apply the permutation to the list positions of the group
+	std::vector<PW_ENTRY> vSorted(n);
+	for(DWORD i = 0; i < n; ++i) vSorted[i] = m_pEntries[vKeys[i].dwEntry];
+	for(DWORD i = 0; i < n; ++i) m_pEntries[pIndices[i]] = vSorted[i];
 
-		PW_ENTRY v = *p[dwMin];
-		*p[dwMin] = *p[i];
-		*p[i] = v;
+	if(!m_vShadows.empty())
+	{
+		std::vector<PWM_SEARCH_SHADOW> vShadows(n);
+		for(DWORD i = 0; i < n; ++i) vShadows[i] = m_vShadows[vKeys[i].dwEntry];
+		for(DWORD i = 0; i < n; ++i) m_vShadows[pIndices[i]] = vShadows[i];
 	}
 
-	SAFE_DELETE_ARRAY(p);
+	_InvalidateEntryIndex();
+	_InvalidateTrigramIndex();
 }
 
 void CPwManager::FixGroupTree()
 {
+	_InvalidateGroupTreeIndex(); // Levels may have been changed directly
+
 	m_pGroups[0].usLevel = 0; // First group must be root
 
 	USHORT usLastLevel = 0;
@@ -1438,19 +1773,12 @@ DWORD CPwManager::GetLastChildGroup(DWORD dwParentGroupIndex) const
 	if(dwParentGroupIndex == (m_dwNumGroups - 1)) return m_dwNumGroups - 1;
 	else if(dwParentGroupIndex > static_cast<DWORD>(m_dwNumGroups - 1)) return DWORD_MAX;
 
-	const USHORT usParentLevel = m_pGroups[dwParentGroupIndex].usLevel;
-
-	DWORD i = dwParentGroupIndex + 1;
-	while(true)
-	{
-		const USHORT usLevel = m_pGroups[i].usLevel;
-		if(usLevel <= usParentLevel) return (i - 1);
-
-		++i;
-		if(i >= m_dwNumGroups) break;
-	}
+	const DWORD dwLast = dwParentGroupIndex + GetGroupSubtreeSize(
+		dwParentGroupIndex) - 1;
 
-	return DWORD_MAX;
+	// A subtree that ends at the end of the list is reported as DWORD_MAX
+	if(dwLast == (m_dwNumGroups - 1)) return DWORD_MAX;
+	return dwLast;
 }
 
 void CPwManager::SubstEntryGroupIds(DWORD dwExistingId, DWORD dwNewId)
@@ -1458,15 +1786,69 @@ void CPwManager::SubstEntryGroupIds(DWORD dwExistingId, DWORD dwNewId)
 	ASSERT(dwExistingId != DWORD_MAX); ASSERT(dwNewId != DWORD_MAX);
 	if(dwExistingId == dwNewId) return; // Nothing to do?
 
-	for(DWORD i = 0; i < m_dwNumEntries; ++i)
+	_InvalidateFindCache();
+	const std::vector<DWORD> *pv = _GetGroupEntries(dwExistingId);
+	if(pv == NULL) return;
+
+	for(size_t i = 0; i < pv->size(); ++i)
 	{
-		if(m_pEntries[i].uGroupId == dwExistingId)
-			m_pEntries[i].uGroupId = dwNewId;
+		ASSERT(m_pEntries[(*pv)[i]].uGroupId == dwExistingId);
+		m_pEntries[(*pv)[i]].uGroupId = dwNewId;
 	}
+
+	// Merge the index lists of both groups
+	PwmGroupEntriesIndex::iterator it = m_mGroupEntries.find(dwExistingId);
+	std::vector<DWORD> vMoved;
+	vMoved.swap(it->second);
+	m_mGroupEntries.erase(it);
+
+	std::vector<DWORD>& vNew = m_mGroupEntries[dwNewId];
+	const size_t uOldSize = vNew.size();
+	vNew.insert(vNew.end(), vMoved.begin(), vMoved.end());
+	std::inplace_merge(vNew.begin(), vNew.begin() + uOldSize, vNew.end());
 }
 
 // Encrypt the master key a few times to make brute-force key-search harder
 BOOL CPwManager::_TransformMasterKey(const BYTE *pKeySeed)
+{
+	ASSERT(pKeySeed != NULL); if(pKeySeed == NULL) return FALSE;
+
+	ProtectMasterKey(false);
+	memcpy(m_pTransformedMasterKey, m_pMasterKey, 32);
+	ProtectMasterKey(true);
+
+	if(_TransformKey(m_pTransformedMasterKey, pKeySeed, m_nKdf, m_dwKeyEncRounds,
+		&m_argon2) == FALSE)
+	{
+		mem_erase(m_pTransformedMasterKey, 32);
+		return FALSE;
+	}
+
+	ProtectTransformedMasterKey(true);
+	return TRUE;
+}
+
+// Transform the unprotected key pbKey32 in-place using the specified
+// key derivation function; does not access any member variables (thread-safe).
+// Fails early when *plCancel (if not NULL) becomes nonzero.
+BOOL CPwManager::_TransformKey(BYTE *pbKey32, const BYTE *pKeySeed, int nKdf,
+	DWORD dwRounds, const PW_ARGON2_PARAMS *pArgon2, const volatile LONG *plCancel)
+{
+	ASSERT(pbKey32 != NULL); if(pbKey32 == NULL) return FALSE;
+	ASSERT(pKeySeed != NULL); if(pKeySeed == NULL) return FALSE;
+
+	if(nKdf == KDF_AES) return _TransformKeyAes(pbKey32, pKeySeed, dwRounds, plCancel);
+
+	if(nKdf == KDF_ARGON2)
+		return (CArgon2Kdf::Transform(pArgon2, pbKey32, pKeySeed,
+			plCancel) ? TRUE : FALSE);
+
+	ASSERT(FALSE);
+	return FALSE;
+}
+
+BOOL CPwManager::_TransformKeyAes(BYTE *pbKey32, const BYTE *pKeySeed, DWORD dwRounds,
+	const volatile LONG *plCancel)
 {
 	const UINT8 aRef[16] = { // Expected ciphertext
 		0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf,
@@ -1474,6 +1856,7 @@ BOOL CPwManager::_TransformMasterKey(const BYTE *pKeySeed)
 	};
 	DWORD i;
 
+	ASSERT(pbKey32 != NULL); if(pbKey32 == NULL) return FALSE;
 	ASSERT(pKeySeed != NULL); if(pKeySeed == NULL) return FALSE;
 
 	CRijndael rijndael;
@@ -1483,16 +1866,24 @@ BOOL CPwManager::_TransformMasterKey(const BYTE *pKeySeed)
 		return FALSE;
 	}
 
-	ProtectMasterKey(false);
-	memcpy(m_pTransformedMasterKey, m_pMasterKey, 32);
-	ProtectMasterKey(true);
-
-	if(CKeyTransform::Transform256(m_dwKeyEncRounds, m_pTransformedMasterKey,
-		pKeySeed) == false)
+	// The rounds are applied to both halves independently, thus they can
+	// be split into blocks; a cancellable transformation is checked
+	// between blocks
+	const DWORD dwBlockMax = ((plCancel != NULL) ? PWM_KDF_CANCEL_ROUNDS : DWORD_MAX);
+	DWORD dwDone = 0;
+	while(dwDone < dwRounds)
 	{
-		ASSERT(FALSE);
-		for(i = 0; i < m_dwKeyEncRounds; ++i)
-			rijndael.BlockEncrypt((const UINT8 *)m_pTransformedMasterKey, 256, (UINT8 *)m_pTransformedMasterKey);
+		if((plCancel != NULL) && (*plCancel != 0)) return FALSE;
+
+		const DWORD dwBlock = min(dwRounds - dwDone, dwBlockMax);
+		if(CKeyTransform::Transform256(dwBlock, pbKey32, pKeySeed) == false)
+		{
+			ASSERT(FALSE);
+			for(i = 0; i < dwBlock; ++i)
+				rijndael.BlockEncrypt((const UINT8 *)pbKey32, 256, (UINT8 *)pbKey32);
+		}
+
+		dwDone += dwBlock;
 	}
 
 	// Do a quick test if the Rijndael class worked correctly
@@ -1508,13 +1899,202 @@ BOOL CPwManager::_TransformMasterKey(const BYTE *pKeySeed)
 	// Hash once with SHA-256
 	sha256_ctx sha2;
 	sha256_begin(&sha2);
-	sha256_hash(m_pTransformedMasterKey, 32, &sha2);
-	sha256_end(m_pTransformedMasterKey, &sha2);
+	sha256_hash(pbKey32, 32, &sha2);
+	sha256_end(pbKey32, &sha2);
 
-	ProtectTransformedMasterKey(true);
 	return TRUE;
 }
 
+DWORD WINAPI CPwManager::_TransformMasterKeyThreadProc(LPVOID lpParameter)
+{
+	CPwManager* p = (CPwManager*)lpParameter;
+	if(p == NULL) { ASSERT(FALSE); return 0; }
+
+	const DWORD dwStart = GetTickCount();
+	p->m_bTransformResult = p->_TransformMasterKey(&p->m_aTransformSeed[0]);
+	p->m_dwTransformTime = GetTickCount() - dwStart;
+	return 0;
+}
+
+void CPwManager::_BeginTransformMasterKey(const BYTE *pKeySeed)
+{
+	ASSERT(m_hTransformThread == NULL);
+	ASSERT(pKeySeed != NULL); if(pKeySeed == NULL) return;
+
+	memcpy(&m_aTransformSeed[0], pKeySeed, 32);
+	m_bTransformResult = FALSE;
+	m_dwTransformTime = 0;
+
+	// No multi-threading support for _WIN32_WCE builds
+#ifndef _WIN32_WCE
+	DWORD dwThreadId = 0; // Pointer may not be NULL on Windows 9x/Me
+	m_hTransformThread = CreateThread(NULL, 0, _TransformMasterKeyThreadProc,
+		this, 0, &dwThreadId);
+	if(m_hTransformThread != NULL) return;
+	ASSERT(FALSE);
+#endif
+
+	_TransformMasterKeyThreadProc(this); // Synchronous fallback
+}
+
+bool CPwManager::_IsTransformMasterKeyDone() const
+{
+	if(m_hTransformThread == NULL) return true;
+	return (WaitForSingleObject(m_hTransformThread, 0) == WAIT_OBJECT_0);
+}
+
+BOOL CPwManager::_EndTransformMasterKey(DWORD *pdwTime)
+{
+	if(m_hTransformThread != NULL)
+	{
+		VERIFY(WaitForSingleObject(m_hTransformThread, INFINITE) == WAIT_OBJECT_0);
+		VERIFY(CloseHandle(m_hTransformThread));
+		m_hTransformThread = NULL;
+	}
+
+	if(pdwTime != NULL) *pdwTime = m_dwTransformTime;
+	return m_bTransformResult;
+}
+
+// Pre-derived transformed master key for the next save; owned by the
+// manager, which waits for the background thread computing it before
+// releasing it (setting lCancel makes the thread stop early)
+struct _PWM_SAVE_KEY_JOB
+{
+	BYTE aKey[32]; // Raw master key, then protected transformed key
+	BYTE aMasterSeed2[32];
+	BYTE aSessionKey[PWM_SESSION_KEY_SIZE];
+	int nKdf;
+	DWORD dwKeyEncRounds;
+	PW_ARGON2_PARAMS argon2;
+	BOOL bResult;
+	volatile LONG lCancel;
+};
+
+static void Priv_ProtectSaveKey(PWM_SAVE_KEY_JOB *p, bool bProtectKey)
+{
+	if(bProtectKey)
+	{
+		if(SUCCEEDED(CMemoryProtectionEx::EncryptMemory(p->aKey, 32))) return;
+	}
+	else // Unprotect
+	{
+		if(SUCCEEDED(CMemoryProtectionEx::DecryptMemory(p->aKey, 32))) return;
+	}
+
+	CChaCha20::Crypt(p->aKey, 32, p->aSessionKey);
+}
+
+DWORD WINAPI CPwManager::_PreDeriveSaveKeyThreadProc(LPVOID lpParameter)
+{
+	PWM_SAVE_KEY_JOB *p = (PWM_SAVE_KEY_JOB *)lpParameter;
+	if(p == NULL) { ASSERT(FALSE); return 0; }
+
+	p->bResult = _TransformKey(p->aKey, p->aMasterSeed2, p->nKdf,
+		p->dwKeyEncRounds, &p->argon2, &p->lCancel);
+	if(p->bResult != FALSE) Priv_ProtectSaveKey(p, true);
+	else mem_erase(p->aKey, 32);
+
+	return 0;
+}
+
+void CPwManager::SetPreDeriveSaveKey(BOOL bEnable)
+{
+	m_bPreDeriveSaveKey = bEnable;
+	if(bEnable == FALSE) _DiscardPreDerivedSaveKey();
+}
+
+// Start computing the transformed master key for the next save (with a
+// new random seed) on a low-priority thread, if enabled
+void CPwManager::_PreDeriveSaveKey()
+{
+	_DiscardPreDerivedSaveKey();
+	if(m_bPreDeriveSaveKey == FALSE) return;
+
+	// No multi-threading support for _WIN32_WCE builds
+#ifndef _WIN32_WCE
+	PWM_SAVE_KEY_JOB *p = NULL;
+	try { p = new PWM_SAVE_KEY_JOB; }
+	catch(...) { p = NULL; }
+	if(p == NULL) { ASSERT(FALSE); return; }
+
+	ProtectMasterKey(false);
+	memcpy(p->aKey, m_pMasterKey, 32);
+	ProtectMasterKey(true);
+
+	m_random.GetRandomBuffer(p->aMasterSeed2, 32);
+	memcpy(p->aSessionKey, m_pSessionKey, PWM_SESSION_KEY_SIZE);
+	p->nKdf = m_nKdf;
+	p->dwKeyEncRounds = m_dwKeyEncRounds;
+	memcpy(&p->argon2, &m_argon2, sizeof(PW_ARGON2_PARAMS));
+	p->bResult = FALSE;
+	p->lCancel = 0;
+
+	DWORD dwThreadId = 0; // Pointer may not be NULL on Windows 9x/Me
+	HANDLE h = CreateThread(NULL, 0, _PreDeriveSaveKeyThreadProc, p,
+		CREATE_SUSPENDED, &dwThreadId);
+	if(h == NULL)
+	{
+		ASSERT(FALSE);
+		mem_erase(p, sizeof(PWM_SAVE_KEY_JOB));
+		delete p;
+		return;
+	}
+
+	VERIFY(SetThreadPriority(h, THREAD_PRIORITY_LOWEST));
+	VERIFY(ResumeThread(h) != static_cast<DWORD>(-1));
+
+	m_pSaveKeyJob = p;
+	m_hSaveKeyThread = h;
+#endif
+}
+
+// Use the pre-derived key (if any): m_pTransformedMasterKey is set and
+// the seed it was computed with is returned in pMasterSeed2. The
+// pre-derived key is consumed in any case.
+bool CPwManager::_TakePreDerivedSaveKey(BYTE *pMasterSeed2)
+{
+	if((m_pSaveKeyJob == NULL) || (pMasterSeed2 == NULL)) return false;
+
+	// If the thread is still running, it is ahead of a new transformation
+	VERIFY(SetThreadPriority(m_hSaveKeyThread, THREAD_PRIORITY_NORMAL));
+	VERIFY(WaitForSingleObject(m_hSaveKeyThread, INFINITE) == WAIT_OBJECT_0);
+
+	PWM_SAVE_KEY_JOB *p = m_pSaveKeyJob;
+	const bool bUsable = ((p->bResult != FALSE) && (p->nKdf == m_nKdf) &&
+		(p->dwKeyEncRounds == m_dwKeyEncRounds) && (memcmp(&p->argon2,
+		&m_argon2, sizeof(PW_ARGON2_PARAMS)) == 0));
+	if(bUsable)
+	{
+		Priv_ProtectSaveKey(p, false);
+		memcpy(m_pTransformedMasterKey, p->aKey, 32);
+		ProtectTransformedMasterKey(true);
+
+		memcpy(pMasterSeed2, p->aMasterSeed2, 32);
+	}
+
+	_DiscardPreDerivedSaveKey();
+	return bUsable;
+}
+
+// Drop the pre-derived key (e.g. because the master key changed); a
+// running thread is cancelled and waited for, such that no copy of the
+// key survives this call
+void CPwManager::_DiscardPreDerivedSaveKey()
+{
+	if(m_pSaveKeyJob == NULL) return;
+
+	InterlockedExchange(&m_pSaveKeyJob->lCancel, 1);
+	VERIFY(SetThreadPriority(m_hSaveKeyThread, THREAD_PRIORITY_NORMAL));
+	VERIFY(WaitForSingleObject(m_hSaveKeyThread, INFINITE) == WAIT_OBJECT_0);
+	VERIFY(CloseHandle(m_hSaveKeyThread));
+	m_hSaveKeyThread = NULL;
+
+	mem_erase(m_pSaveKeyJob, sizeof(PWM_SAVE_KEY_JOB));
+	delete m_pSaveKeyJob;
+	m_pSaveKeyJob = NULL;
+}
+
 DWORD CPwManager::GetKeyEncRounds() const
 {
 	return m_dwKeyEncRounds;
@@ -1523,40 +2103,57 @@ DWORD CPwManager::GetKeyEncRounds() const
 void CPwManager::SetKeyEncRounds(DWORD dwRounds)
 {
 	// All allowed except DWORD_MAX
-	if(dwRounds == DWORD_MAX) m_dwKeyEncRounds = DWORD_MAX - 1;
-	else m_dwKeyEncRounds = dwRounds;
+	if(dwRounds == DWORD_MAX) dwRounds = DWORD_MAX - 1;
+
+	if(dwRounds != m_dwKeyEncRounds) _DiscardPreDerivedSaveKey();
+	m_dwKeyEncRounds = dwRounds;
 }
 
-DWORD CPwManager::DeleteLostEntries()
+int CPwManager::GetKdf() const
 {
-	DWORD dwEntryCount = GetNumberOfEntries();
-	if(dwEntryCount == 0) return 0;
+	return m_nKdf;
+}
 
-	DWORD dwDeletedCount = 0;
+BOOL CPwManager::SetKdf(int nKdf)
+{
+	ASSERT((nKdf == KDF_AES) || (nKdf == KDF_ARGON2));
+	if((nKdf != KDF_AES) && (nKdf != KDF_ARGON2)) return FALSE;
 
-	bool bFixed = true;
-	while(bFixed)
-	{
-		bFixed = false;
+	if(nKdf != m_nKdf) _DiscardPreDerivedSaveKey();
 
-		for(DWORD i = 0; i < dwEntryCount; ++i)
-		{
-			PW_ENTRY *pe = GetEntry(i);
-			ASSERT(pe != NULL); if(pe == NULL) break;
+	m_nKdf = nKdf;
+	return TRUE;
+}
 
-			PW_GROUP *pg = GetGroupById(pe->uGroupId);
-			if(pg == NULL)
-			{
-				DeleteEntry(i);
-				--dwEntryCount;
-				bFixed = true;
-				++dwDeletedCount;
-				break;
-			}
-		}
-	}
+void CPwManager::GetArgon2Params(PW_ARGON2_PARAMS *pParams) const
+{
+	ASSERT(pParams != NULL); if(pParams == NULL) return;
+	memcpy(pParams, &m_argon2, sizeof(PW_ARGON2_PARAMS));
+}
+
+BOOL CPwManager::SetArgon2Params(const PW_ARGON2_PARAMS *pParams)
+{
+	ASSERT(pParams != NULL); if(pParams == NULL) return FALSE;
+	if(!CArgon2Kdf::IsValid(pParams)) return FALSE;
+
+	if(memcmp(pParams, &m_argon2, sizeof(PW_ARGON2_PARAMS)) != 0)
+		_DiscardPreDerivedSaveKey();
 
-	return dwDeletedCount;
+	memcpy(&m_argon2, pParams, sizeof(PW_ARGON2_PARAMS));
+	return TRUE;
+}
+
+static bool Priv_IsLostEntry(const PW_ENTRY *pe, void *pContext)
+{
+	const CPwManager *pMgr = static_cast<const CPwManager *>(pContext);
+	return (pMgr->GetGroupByIdN(pe->uGroupId) == DWORD_MAX);
+}
+
+DWORD CPwManager::DeleteLostEntries()
+{
+	if(GetNumberOfEntries() == 0) return 0;
+
+	return DeleteEntries(Priv_IsLostEntry, this);
 }
 
 BOOL CPwManager::BackupEntry(_In_ const PW_ENTRY *pe,
@@ -1644,33 +2241,27 @@ DWORD CPwManager::_LoadAndRemoveAllMetaStreams(bool bAcceptUnknown)
 	m_vSearchHistory.clear();
 	m_vCustomKVPs.clear();
 
-	DWORD dwMetaStreamCount = 0;
-
-	bool bChange = true;
-	while(bChange)
+	// Parse from the last to the first meta stream (the order in which
+	// they have always been processed), then remove all of them at once
+	std::vector<DWORD> vMetaStreams;
+	DWORD i = GetNumberOfEntries() - 1;
+	while(1)
 	{
-		bChange = false;
-		const DWORD dwEntryCount = GetNumberOfEntries();
-		if(dwEntryCount == 0) break;
-
-		DWORD i = dwEntryCount - 1;
-		while(1)
+		PW_ENTRY *p = GetEntry(i);
+		if(_IsMetaStream(p) == TRUE)
 		{
-			PW_ENTRY *p = GetEntry(i);
-			if(_IsMetaStream(p) == TRUE)
-			{
-				_ParseMetaStream(p, bAcceptUnknown);
-				VERIFY(DeleteEntry(i));
-				++dwMetaStreamCount;
-				bChange = true;
-				break;
-			}
-
-			if(i == 0) break;
-			--i;
+			_ParseMetaStream(p, bAcceptUnknown);
+			vMetaStreams.push_back(i);
 		}
+
+		if(i == 0) break;
+		--i;
 	}
 
+	if(vMetaStreams.empty()) return 0;
+
+	const DWORD dwMetaStreamCount = static_cast<DWORD>(vMetaStreams.size());
+	VERIFY(DeleteEntries(&vMetaStreams[0], dwMetaStreamCount) == dwMetaStreamCount);
 	return dwMetaStreamCount;
 }
 
@@ -1810,12 +2401,132 @@ BOOL CPwManager::_CanIgnoreUnknownMetaStream(const PWDB_META_STREAM& msUnknown)
 	return TRUE;
 }
 
+// What MergeIn does with a source entry
+#define PWM_MERGE_SKIP    0 // Meta stream or not newer than the existing entry
+#define PWM_MERGE_ADD     1
+#define PWM_MERGE_REPLACE 2
+
+// Minimum number of source entries per decision thread
+#define PWM_MERGE_MIN_THREAD_RANGE 8192
+#define PWM_MERGE_MAX_THREADS      8
+
+// Number of source entries that are unlocked and added at once (when
+// creating new UUIDs)
+#define PWM_MERGE_ADD_BLOCK 256
+
+// A range of source entries for which the merge decisions are computed
+// against the unmodified target; the decision pass only reads the entry
+// lists and the UUID index of the target
+struct _PWM_MERGE_JOB
+{
+	const CPwManager *pTarget;
+	const CPwManager *pSource;
+	DWORD dwFirst;
+	DWORD dwEnd;
+	BOOL bCompareTimes;
+	BYTE *pActions; // One PWM_MERGE_* per source entry
+	DWORD *pTargets; // Entry index in the target, for PWM_MERGE_REPLACE
+};
+
+DWORD CPwManager::_GetProcessorCount()
+{
+	// No multi-threading support for _WIN32_WCE builds
+#ifdef _WIN32_WCE
+	return 1;
+#else
+	SYSTEM_INFO si;
+	ZeroMemory(&si, sizeof(SYSTEM_INFO));
+	GetSystemInfo(&si);
+
+	return ((si.dwNumberOfProcessors != 0) ? si.dwNumberOfProcessors : 1);
+#endif
+}
+
+void CPwManager::_DecideMergeEntries(PWM_MERGE_JOB *p) const
+{
+	ASSERT(p != NULL); if(p == NULL) return;
+	ASSERT(m_bEntryIndexValid);
+
+	for(DWORD i = p->dwFirst; i < p->dwEnd; ++i)
+	{
+		const PW_ENTRY *peSource = &p->pSource->m_pEntries[i];
+		BYTE bAction = PWM_MERGE_ADD;
+		DWORD dwTarget = DWORD_MAX;
+
+		if(_IsMetaStream(peSource) == TRUE) bAction = PWM_MERGE_SKIP;
+		else
+		{
+			dwTarget = _LookupEntryIndex(peSource->uuid);
+			if(dwTarget != DWORD_MAX)
+			{
+				bAction = PWM_MERGE_REPLACE;
+				if(p->bCompareTimes == TRUE)
+					if(_pwtimecmp(&m_pEntries[dwTarget].tLastMod, &peSource->tLastMod) >= 0)
+						bAction = PWM_MERGE_SKIP;
+			}
+		}
+
+		p->pActions[i] = bAction;
+		p->pTargets[i] = dwTarget;
+	}
+}
+
+DWORD WINAPI CPwManager::_MergeDecisionThreadProc(LPVOID lpParameter)
+{
+	PWM_MERGE_JOB *p = (PWM_MERGE_JOB *)lpParameter;
+	ASSERT(p != NULL); if(p == NULL) return 0;
+
+	p->pTarget->_DecideMergeEntries(p);
+	return 0;
+}
+
+// Appends copies of the given source entries with new UUIDs and mapped
+// group IDs, and clears vSourceIndices
+void CPwManager::_MergeAddEntries(CPwManager *pSource,
+	std::vector<DWORD>& vSourceIndices,
+	const boost::unordered_map<DWORD, DWORD>& mGroupIds)
+{
+	ASSERT(pSource != NULL); if(pSource == NULL) return;
+	if(vSourceIndices.empty()) return;
+
+	const size_t uCount = vSourceIndices.size();
+	std::vector<PW_ENTRY> vTemplates(uCount);
+	size_t i;
+
+	for(i = 0; i < uCount; ++i)
+	{
+		PW_ENTRY *peSource = pSource->GetEntry(vSourceIndices[i]);
+		pSource->UnlockEntryPassword(peSource);
+
+		PW_ENTRY& pT = vTemplates[i];
+		pT = *peSource;
+
+		memset(pT.uuid, 0, 16); // Create new UUID
+
+		boost::unordered_map<DWORD, DWORD>::const_iterator it =
+			mGroupIds.find(pT.uGroupId);
+		if(it != mGroupIds.end()) pT.uGroupId = it->second;
+	}
+
+	if(AddEntries(&vTemplates[0], static_cast<DWORD>(uCount)) == FALSE)
+	{
+		// Add the valid ones, like single AddEntry calls would do
+		for(i = 0; i < uCount; ++i) AddEntry(&vTemplates[i]);
+	}
+
+	for(i = 0; i < uCount; ++i)
+		pSource->LockEntryPassword(pSource->GetEntry(vSourceIndices[i]));
+
+	vSourceIndices.clear();
+}
+
 void CPwManager::MergeIn(_Inout_ CPwManager *pDataSource,
 	BOOL bCreateNewUUIDs, BOOL bCompareTimes)
 {
 	ASSERT(pDataSource != NULL); if(pDataSource == NULL) return;
+	ASSERT(pDataSource != this); if(pDataSource == this) return;
 
-	DWORD i, dwModifyIndex, dwOldId, dwNewId;
+	DWORD i, dwModifyIndex;
 	PW_GROUP *pgThis;
 	PW_ENTRY *peThis;
 	BOOL bDoReplace;
@@ -1823,6 +2534,13 @@ void CPwManager::MergeIn(_Inout_ CPwManager *pDataSource,
 	PW_TIME tNow;
 	_GetCurrentPwTime(&tNow);
 
+	// Allocate the space for all new items at once
+	ReserveGroups(m_dwNumGroups + pDataSource->GetNumberOfGroups());
+	ReserveEntries(m_dwNumEntries + pDataSource->GetNumberOfEntries());
+
+	// Source group ID -> new group ID (bCreateNewUUIDs only)
+	boost::unordered_map<DWORD, DWORD> mNewGroupIds;
+
 	for(i = 0; i < pDataSource->GetNumberOfGroups(); ++i)
 	{
 		PW_GROUP *pgSource = pDataSource->GetGroup(i);
@@ -1830,23 +2548,21 @@ void CPwManager::MergeIn(_Inout_ CPwManager *pDataSource,
 
 		if(bCreateNewUUIDs == TRUE)
 		{
-			while(1)
+			DWORD dwNewId;
+			while(true) // ID that exists neither here nor in the source
 			{
-				dwOldId = pgSource->uGroupId;
-				pgSource->uGroupId = 0; // Create new ID
-				VERIFY(AddGroup(pgSource) == TRUE);
+				dwNewId = randXorShift();
+				if((dwNewId == 0) || (dwNewId == DWORD_MAX)) continue;
+				if((GetGroupByIdN(dwNewId) == DWORD_MAX) &&
+					(pDataSource->GetGroupByIdN(dwNewId) == DWORD_MAX)) break;
+			}
 
-				dwNewId = GetGroup(GetNumberOfGroups() - 1)->uGroupId;
+			// Entries belong to the first group with their ID
+			mNewGroupIds.insert(std::make_pair(pgSource->uGroupId, dwNewId));
 
-				if(pDataSource->GetGroupById(dwNewId) == NULL)
-				{
-					pDataSource->SubstEntryGroupIds(dwOldId, dwNewId);
-					break;
-				}
-
-				pgSource->uGroupId = dwOldId;
-				VERIFY(DeleteGroupById(dwNewId, FALSE) == TRUE);
-			}
+			PW_GROUP pgNew = *pgSource;
+			pgNew.uGroupId = dwNewId;
+			VERIFY(AddGroup(&pgNew) == TRUE);
 		}
 		else // bCreateNewUUIDs == FALSE
 		{
@@ -1875,49 +2591,119 @@ void CPwManager::MergeIn(_Inout_ CPwManager *pDataSource,
 
 	FixGroupTree();
 
-	for(i = 0; i < pDataSource->GetNumberOfEntries(); ++i)
+	const DWORD dwSourceEntries = pDataSource->GetNumberOfEntries();
+
+	if(bCreateNewUUIDs == TRUE)
 	{
-		PW_ENTRY *peSource = pDataSource->GetEntry(i);
-		ASSERT(peSource != NULL); if(peSource == NULL) continue;
+		std::vector<DWORD> vAdd; // Source entries to be appended
+		vAdd.reserve(PWM_MERGE_ADD_BLOCK);
 
-		// Don't import meta streams
-		if(_IsMetaStream(peSource) == TRUE) continue;
+		for(i = 0; i < dwSourceEntries; ++i)
+		{
+			// Don't import meta streams
+			if(_IsMetaStream(pDataSource->GetEntry(i)) == TRUE) continue;
 
-		pDataSource->UnlockEntryPassword(peSource);
+			vAdd.push_back(i);
+			if(vAdd.size() == PWM_MERGE_ADD_BLOCK)
+				_MergeAddEntries(pDataSource, vAdd, mNewGroupIds);
+		}
+		_MergeAddEntries(pDataSource, vAdd, mNewGroupIds);
 
-		if(bCreateNewUUIDs == TRUE)
+		VERIFY(DeleteLostEntries() == 0);
+		ASSERT(_CheckIndexes());
+		return;
+	}
+
+	// Decision pass: join the source entries with the entries of this
+	// database by UUID; independent ranges are processed concurrently
+	std::vector<BYTE> vActions(dwSourceEntries);
+	std::vector<DWORD> vTargets(dwSourceEntries);
+	if(!m_bEntryIndexValid) _RebuildEntryIndex(); // Workers only read it
+
+	DWORD dwThreads = min(_GetProcessorCount(), static_cast<DWORD>(
+		PWM_MERGE_MAX_THREADS));
+	dwThreads = min(dwThreads, dwSourceEntries / PWM_MERGE_MIN_THREAD_RANGE);
+	if(dwThreads == 0) dwThreads = 1;
+
+	std::vector<PWM_MERGE_JOB> vJobs(dwThreads);
+	for(i = 0; i < dwThreads; ++i)
+	{
+		PWM_MERGE_JOB& job = vJobs[i];
+		job.pTarget = this;
+		job.pSource = pDataSource;
+		job.dwFirst = static_cast<DWORD>((static_cast<UINT64>(dwSourceEntries) *
+			i) / dwThreads);
+		job.dwEnd = static_cast<DWORD>((static_cast<UINT64>(dwSourceEntries) *
+			(i + 1)) / dwThreads);
+		job.bCompareTimes = bCompareTimes;
+		job.pActions = ((dwSourceEntries != 0) ? &vActions[0] : NULL);
+		job.pTargets = ((dwSourceEntries != 0) ? &vTargets[0] : NULL);
+	}
+
+	std::vector<HANDLE> vThreads;
+	for(i = 1; i < dwThreads; ++i)
+	{
+		DWORD dwThreadId = 0; // Pointer may not be NULL on Windows 9x/Me
+		HANDLE h = CreateThread(NULL, 0, _MergeDecisionThreadProc, &vJobs[i],
+			0, &dwThreadId);
+		if(h != NULL) vThreads.push_back(h);
+		else { ASSERT(FALSE); _DecideMergeEntries(&vJobs[i]); }
+	}
+	_DecideMergeEntries(&vJobs[0]);
+
+	for(i = 0; i < static_cast<DWORD>(vThreads.size()); ++i)
+	{
+		VERIFY(WaitForSingleObject(vThreads[i], INFINITE) == WAIT_OBJECT_0);
+		VERIFY(CloseHandle(vThreads[i]) != FALSE);
+	}
+
+	// Apply pass, in source order. A decision is only revised if an
+	// earlier source entry with the same UUID has changed the target
+	// (replaced it or added it); then it's made like before the join.
+	std::vector<bool> vReplaced(m_dwNumEntries, false);
+	for(i = 0; i < dwSourceEntries; ++i)
+	{
+		BYTE bAction = vActions[i];
+		if(bAction == PWM_MERGE_SKIP)
 		{
-			memset(peSource->uuid, 0, 16);
-			VERIFY(AddEntry(peSource) == TRUE);
+			dwModifyIndex = vTargets[i];
+			if((dwModifyIndex == DWORD_MAX) || !vReplaced[dwModifyIndex]) continue;
 		}
-		else
-		{
+
+		PW_ENTRY *peSource = pDataSource->GetEntry(i);
+		if(bAction == PWM_MERGE_ADD)
 			dwModifyIndex = GetEntryByUuidN(peSource->uuid);
-			if(dwModifyIndex != DWORD_MAX) peThis = GetEntry(dwModifyIndex);
-			else peThis = NULL;
+		else dwModifyIndex = vTargets[i];
 
-			if(peThis == NULL) AddEntry(peSource); // Entry doesn't exist already
-			else
-			{
-				bDoReplace = TRUE;
-				if(bCompareTimes == TRUE)
-					if(_pwtimecmp(&peThis->tLastMod, &peSource->tLastMod) >= 0)
-						bDoReplace = FALSE;
+		if(dwModifyIndex == DWORD_MAX) bAction = PWM_MERGE_ADD;
+		else if((bAction != PWM_MERGE_REPLACE) || ((dwModifyIndex <
+			vReplaced.size()) && vReplaced[dwModifyIndex]))
+		{
+			bAction = PWM_MERGE_REPLACE;
+			if(bCompareTimes == TRUE)
+				if(_pwtimecmp(&m_pEntries[dwModifyIndex].tLastMod,
+					&peSource->tLastMod) >= 0)
+					bAction = PWM_MERGE_SKIP;
+		}
+		if(bAction == PWM_MERGE_SKIP) continue;
 
-				if(bDoReplace == TRUE)
-				{
-					VERIFY(SetEntry(dwModifyIndex, peSource));
+		pDataSource->UnlockEntryPassword(peSource);
 
-					peThis = GetEntry(dwModifyIndex);
-					if(peThis != NULL) peThis->tLastAccess = tNow;
-				}
-			}
+		if(bAction == PWM_MERGE_ADD) AddEntry(peSource); // Entry doesn't exist already
+		else
+		{
+			VERIFY(SetEntry(dwModifyIndex, peSource));
+
+			peThis = GetEntry(dwModifyIndex);
+			if(peThis != NULL) peThis->tLastAccess = tNow;
+			if(dwModifyIndex < vReplaced.size()) vReplaced[dwModifyIndex] = true;
 		}
 
 		pDataSource->LockEntryPassword(peSource);
 	}
 
 	VERIFY(DeleteLostEntries() == 0);
+	ASSERT(_CheckIndexes());
 }
 
 /* DWORD CPwManager::MakeGroupTree(LPCTSTR lpTreeString, TCHAR tchSeparator)
@@ -1972,6 +2758,8 @@ void CPwManager::GetRawMasterKey(_Out_bytecap_c_(32) BYTE *pStorage)
 
 void CPwManager::SetRawMasterKey(_In_bytecount_c_(32) const BYTE *pNewKey)
 {
+	_DiscardPreDerivedSaveKey();
+
 	if(pNewKey != NULL)
 	{
 		memcpy(m_pMasterKey, pNewKey, 32);
@@ -1982,7 +2770,7 @@ void CPwManager::SetRawMasterKey(_In_bytecount_c_(32) const BYTE *pNewKey)
 
 void CPwManager::ClearMasterKey(BOOL bClearKey, BOOL bClearTransformedKey)
 {
-	if(bClearKey == TRUE) mem_erase(m_pMasterKey, 32);
+	if(bClearKey == TRUE) { _DiscardPreDerivedSaveKey(); mem_erase(m_pMasterKey, 32); }
 	if(bClearTransformedKey == TRUE) mem_erase(m_pTransformedMasterKey, 32);
 }
 
@@ -26,12 +26,24 @@
 #include <string>
 #include <vector>
 #include <boost/utility.hpp>
+#include <boost/unordered_map.hpp>
 
 #include "Util/NewRandom.h"
+#include "Util/StringArena.h"
 #include "Crypto/Rijndael.h"
 #include "IO/KpMemoryStream.h"
 #include "PwStructs.h"
 
+class CKpCbcDecryptStream;
+class CKpMappedFileStream;
+
+struct _PWM_SAVE_KEY_JOB;
+typedef struct _PWM_SAVE_KEY_JOB PWM_SAVE_KEY_JOB;
+struct _PWM_MERGE_JOB;
+typedef struct _PWM_MERGE_JOB PWM_MERGE_JOB;
+struct _PWM_FIND_POOL;
+typedef struct _PWM_FIND_POOL PWM_FIND_POOL;
+
 // General product information
 #define PWM_PRODUCT_NAME       _T("KeePass Password Safe")
 #define PWM_PRODUCT_NAME_SHORT _T("KeePass")
@@ -249,11 +261,15 @@
 #define PWM_FLAG_RIJNDAEL        2
 #define PWM_FLAG_ARCFOUR         4
 #define PWM_FLAG_TWOFISH         8
+#define PWM_FLAG_ARGON2         16
 
 #define PWM_SESSION_KEY_SIZE     32
 
 #define PWM_STD_KEYENCROUNDS     600000
 
+// Rounds between two cancellation checks of a cancellable AES-KDF
+#define PWM_KDF_CANCEL_ROUNDS    (1 << 20)
+
 #define PWM_STD_ICON_GROUP       48
 #define PWM_STD_ICON_GROUP_OPEN  49
 #define PWM_STD_ICON_GROUP_PKG   50
@@ -280,6 +296,7 @@
 // Search flags
 // These flags must be disjoint to PWMF_* flags
 #define PWMS_REGEX       0x10000000
+#define PWMS_PARALLEL    0x20000000 // FindAll only
 
 // Group flags (dwFlags field of PW_GROUP)
 #define PWGF_EXPANDED    1
@@ -289,6 +306,10 @@
 #define ALGO_AES         0
 #define ALGO_TWOFISH     1
 
+// Key derivation functions
+#define KDF_AES          0
+#define KDF_ARGON2       1
+
 // Error codes
 #define PWE_UNKNOWN                 0
 #define PWE_SUCCESS                 1
@@ -387,6 +408,89 @@ typedef struct _PWDB_META_STREAM
 typedef std::basic_string<TCHAR> std_string;
 typedef std::pair<std::basic_string<TCHAR>, std::basic_string<TCHAR> > CustomKvp;
 
+typedef struct _PWM_UUID_KEY
+{
+	BYTE aUuid[16];
+} PWM_UUID_KEY;
+
+struct PwmUuidHash
+{
+	size_t operator()(const PWM_UUID_KEY& k) const
+	{
+		size_t h = 0xC17962B7U;
+		for(size_t i = 0; i < 16; i += 4)
+		{
+			DWORD dw;
+			memcpy(&dw, &k.aUuid[i], 4);
+
+			h += static_cast<size_t>(dw);
+#if (SIZE_MAX == 0xFFFFFFFFU)
+			h = _rotl(h * 0x5FC34C67U, 13);
+#elif (SIZE_MAX == 0xFFFFFFFFFFFFFFFFUL)
+			h = _rotl64(h * 0x54724D3EA2860CBBULL, 29);
+#else
+#error Unknown SIZE_MAX!
+#endif
+		}
+
+		return h;
+	}
+};
+
+struct PwmUuidPred
+{
+	bool operator()(const PWM_UUID_KEY& a, const PWM_UUID_KEY& b) const
+	{
+		return (memcmp(a.aUuid, b.aUuid, 16) == 0);
+	}
+};
+
+// Entry UUID -> index in the entry list, group ID -> index in the group list
+typedef boost::unordered_map<PWM_UUID_KEY, DWORD, PwmUuidHash, PwmUuidPred> PwmUuidIndex;
+typedef boost::unordered_map<DWORD, DWORD> PwmGroupIdIndex;
+
+// Group ID -> ascending indices of the entries in the group
+typedef boost::unordered_map<DWORD, std::vector<DWORD> > PwmGroupEntriesIndex;
+
+// Lowercase trigram (three characters packed into 48 bits) -> ascending
+// indices of the entries containing it (see CPwManager::SetSearchIndex)
+typedef boost::unordered_map<UINT64, std::vector<DWORD> > PwmTrigramIndex;
+
+// Candidate entries of an indexed Find; FindEx alternates between the
+// terms of the search string, thus a few of them are cached
+#define PWM_FIND_CACHE_SIZE 8
+typedef struct _PWM_FIND_CACHE_ITEM
+{
+	std_string strSearch;
+	DWORD dwFlags;
+	BOOL bCaseSensitive;
+	std::vector<DWORD> vEntries; // Ascending
+} PWM_FIND_CACHE_ITEM;
+
+// Lowercase copies of the searchable fields of an entry, used by
+// case-insensitive searches; NULL if the field is lowercase already
+typedef struct _PWM_SEARCH_SHADOW
+{
+	LPTSTR pszTitle;
+	LPTSTR pszUserName;
+	LPTSTR pszURL;
+	LPTSTR pszAdditional;
+} PWM_SEARCH_SHADOW;
+
+// Node of the group tree index. The subtree of a group (the group itself
+// and all of its descendants) is stored at the list indices
+// [index, index + dwSubtreeSize).
+typedef struct _PWM_GROUP_NODE
+{
+	DWORD dwParent; // DWORD_MAX for top-level groups
+	DWORD dwFirstChild; // DWORD_MAX if the group has no children
+	DWORD dwNextSibling; // DWORD_MAX for the last child
+	DWORD dwSubtreeSize;
+} PWM_GROUP_NODE;
+
+// Selects the entries to be removed by CPwManager::DeleteEntries
+typedef bool(*LPPWENTRYPREDICATE)(const PW_ENTRY *pe, void *pContext);
+
 #ifdef _DEBUG
 #define ASSERT_ENTRY(pp) ASSERT((pp) != NULL); ASSERT((pp)->pszTitle != NULL); \
 	ASSERT((pp)->pszUserName != NULL); ASSERT((pp)->pszURL != NULL); \
@@ -415,6 +519,10 @@ public:
 	DWORD GetNumberOfEntries() const; // Returns number of entries in database
 	DWORD GetNumberOfGroups() const; // Returns number of groups in database
 
+	// Allocate space for at least dwCount entries/groups in total
+	BOOL ReserveEntries(DWORD dwCount);
+	BOOL ReserveGroups(DWORD dwCount);
+
 	// Count items in groups
 	DWORD GetNumberOfItemsInGroup(const TCHAR *pszGroup) const;
 	DWORD GetNumberOfItemsInGroupN(DWORD idGroup) const;
@@ -428,6 +536,12 @@ public:
 	DWORD GetEntryPosInGroup(_In_ const PW_ENTRY *pEntry) const;
 	PW_ENTRY *GetLastEditedEntry();
 
+	// Get the indices of all entries in a group, in list order; returns
+	// the number of entries. The array is valid until the entry list is
+	// modified. Entries must be moved to other groups using SetEntry or
+	// SetEntryGroup, not by changing uGroupId directly.
+	DWORD GetEntryIndicesInGroup(DWORD idGroup, const DWORD **ppIndices) const;
+
 	// Access group information
 	PW_GROUP *GetGroup(DWORD dwIndex);
 	PW_GROUP *GetGroupById(DWORD idGroup);
@@ -435,20 +549,36 @@ public:
 	DWORD GetGroupId(const TCHAR *pszGroupName) const;
 	DWORD GetGroupIdByIndex(DWORD uGroupIndex) const;
 	DWORD GetLastChildGroup(DWORD dwParentGroupIndex) const;
+	// Group tree navigation by list index, DWORD_MAX if there is no such
+	// group; code that changes usLevel through a GetGroup pointer must
+	// call FixGroupTree afterwards
+	DWORD GetParentGroup(DWORD dwGroupIndex) const;
+	DWORD GetFirstChildGroup(DWORD dwGroupIndex) const;
+	DWORD GetNextSiblingGroup(DWORD dwGroupIndex) const;
+	// Number of groups in the subtree, including the group itself
+	DWORD GetGroupSubtreeSize(DWORD dwGroupIndex) const;
 	BOOL GetGroupTree(DWORD idGroup, DWORD *pGroupIndexes) const;
 
 	// Add entries and groups
 	BOOL AddGroup(_In_ const PW_GROUP *pTemplate);
 	BOOL AddEntry(_In_ const PW_ENTRY *pTemplate);
+	// Add multiple entries at once; the templates must not point into the
+	// entry list of this manager
+	BOOL AddEntries(_In_ const PW_ENTRY *pTemplates, DWORD dwCount);
 	BOOL BackupEntry(_In_ const PW_ENTRY *pe, _Out_opt_
 		BOOL *pbGroupCreated); // pe must be unlocked already
 
 	// Delete entries and groups
 	BOOL DeleteEntry(DWORD dwIndex);
 	BOOL DeleteGroupById(DWORD uGroupId, BOOL bCreateBackupEntries);
+	// Delete multiple entries in one pass; the indices may be unsorted and
+	// may contain duplicates. Both return the number of deleted entries.
+	DWORD DeleteEntries(const DWORD *pIndices, DWORD dwCount);
+	DWORD DeleteEntries(LPPWENTRYPREDICATE lpPredicate, void *pContext);
 
 	BOOL SetGroup(DWORD dwIndex, _In_ const PW_GROUP *pTemplate);
 	BOOL SetEntry(DWORD dwIndex, _In_ const PW_ENTRY *pTemplate);
+	BOOL SetEntryGroup(DWORD dwIndex, DWORD idGroup); // Move entry to group
 	// DWORD MakeGroupTree(LPCTSTR lpTreeString, TCHAR tchSeparator);
 
 	// Use these functions to make passwords in PW_ENTRY structures readable
@@ -457,10 +587,16 @@ public:
 
 	void NewDatabase();
 	int OpenDatabase(const TCHAR *pszFile, _Out_opt_ PWDB_REPAIR_INFO *pRepair);
+	int OpenDatabaseMapped(const TCHAR *pszFile, _Out_opt_ PWDB_REPAIR_INFO *pRepair);
 	// int OpenDatabaseEx(const TCHAR *pszFile, _Out_opt_ PWDB_REPAIR_INFO *pRepair,
 	//	CPwErrorInfo *pErrorInfo);
 	int SaveDatabase(const TCHAR *pszFile, BYTE *pWrittenDataHash32);
 
+	// Measure OpenDatabase and OpenDatabaseMapped (in milliseconds) for a
+	// database containing about cbData bytes of attachments
+	static bool BenchmarkOpenDatabase(LPCTSTR lpTempFile, UINT64 cbData,
+		DWORD *pdwStreamMs, DWORD *pdwMappedMs);
+
 	// Move entries and groups
 	void MoveEntry(DWORD idGroup, DWORD dwFrom, DWORD dwTo);
 	BOOL MoveGroup(DWORD dwFrom, DWORD dwTo);
@@ -482,6 +618,41 @@ public:
 	DWORD FindEx(const TCHAR *pszFindString, BOOL bCaseSensitive,
 		DWORD searchFlags, DWORD nStart, std_string* pError);
 
+	// Find all entries that FindEx would return, in a single pass over the
+	// entry list; the search string is split and the regular expression
+	// is compiled only once. If dwGroupFirst is not DWORD_MAX, only
+	// entries in the groups with indices dwGroupFirst to dwGroupLast
+	// (inclusive) are returned. With PWMS_PARALLEL, the entry list is
+	// partitioned and searched by the threads of a pool that is kept
+	// until the manager is destroyed. The search is aborted
+	// as soon as *plCancel (optional) is non-zero. Returns FALSE if the
+	// search has been cancelled or the regular expression is invalid.
+	// If pvWithin is not NULL, only the entries with these (ascending)
+	// indices are examined (see CPwFindSession).
+	BOOL FindAll(const TCHAR *pszFindString, BOOL bCaseSensitive,
+		DWORD searchFlags, DWORD dwGroupFirst, DWORD dwGroupLast,
+		const std::vector<DWORD> *pvWithin, std::vector<DWORD>& vResults,
+		std_string* pError, const volatile LONG *plCancel);
+
+	// Changes whenever entries or groups are modified in a way that might
+	// change the results of a search (or the entry indices)
+	DWORD GetSearchGeneration() const { return m_dwSearchGeneration; }
+
+	// If enabled, Find only examines the entries that contain all trigrams
+	// of the search string in their title, user name, URL or notes (or
+	// whose group name or UUID matches). Passwords are only indexed if
+	// bIndexPasswords is TRUE; otherwise searches in passwords scan all
+	// entries. The index is built when opening a database (or by the
+	// first Find) and is updated by SetEntry, AddEntry and DeleteEntry.
+	void SetSearchIndex(BOOL bEnable, BOOL bIndexPasswords);
+	BOOL GetSearchIndex() const { return m_bSearchIndex; }
+
+	// If enabled, lowercase copies of the title, user name, URL and notes
+	// of all entries are kept, such that case-insensitive non-regex
+	// searches don't need to lowercase the fields of each entry
+	void SetSearchShadows(BOOL bEnable);
+	BOOL GetSearchShadows() const { return m_bSearchShadows; }
+
 	// Get and set the algorithm used to encrypt the database
 	int GetAlgorithm() const;
 	BOOL SetAlgorithm(int nAlgorithm);
@@ -489,6 +660,14 @@ public:
 	DWORD GetKeyEncRounds() const;
 	void SetKeyEncRounds(DWORD dwRounds);
 
+	// Get and set the key derivation function (KDF_AES uses the key
+	// encryption rounds, KDF_ARGON2 the Argon2 parameters)
+	int GetKdf() const;
+	BOOL SetKdf(int nKdf);
+
+	void GetArgon2Params(PW_ARGON2_PARAMS *pParams) const;
+	BOOL SetArgon2Params(const PW_ARGON2_PARAMS *pParams);
+
 	// Checks and corrects the group tree (level order, etc.)
 	void FixGroupTree();
 
@@ -511,9 +690,21 @@ public:
 
 	void SetTransactedFileWrites(BOOL bTransacted) { m_bUseTransactedFileWrites = bTransacted; }
 
+	// Phase durations of the last successful OpenDatabase call
+	const PWDB_OPEN_TIMINGS& GetLastOpenTimings() const { return m_openTimings; }
+
+	// If enabled, the transformed master key for the next save is computed
+	// in the background (low priority) after opening/saving a database
+	void SetPreDeriveSaveKey(BOOL bEnable);
+	BOOL GetPreDeriveSaveKey() const { return m_bPreDeriveSaveKey; }
+
 	COLORREF GetColor() const;
 	void SetColor(COLORREF clr);
 
+#ifdef _DEBUG
+	bool CheckIndexes() const { return _CheckIndexes(); } // For self-tests
+#endif
+
 	DWORD m_dwLastSelectedGroupId;
 	DWORD m_dwLastTopVisibleGroupId;
 	BYTE m_aLastSelectedEntryUuid[16];
@@ -528,13 +719,78 @@ private:
 	void _DeleteEntryList(BOOL bFreeStrings);
 	void _AllocGroups(DWORD uGroups);
 	void _DeleteGroupList(BOOL bFreeStrings);
+	DWORD _DeleteMarkedEntries(const std::vector<bool>& vDelete);
+
+	// Exchange the database contents (groups, entries, meta data and their
+	// indexes) with another manager; the passwords stay encrypted with the session key
+	// of this manager, thus the other one must not access them
+	void _SwapContents(CPwManager& other);
+
+	// Entry strings (except passwords) may live in m_arena; these replace
+	// and free them without deleting arena memory
+	void _SetEntryString(LPTSTR& lpField, LPCTSTR lpNew);
+	void _FreeEntryString(LPTSTR& lpField);
+	void _FreeEntryStrings(PW_ENTRY *pEntry);
+	LPTSTR _UTF8ToArenaString(const BYTE *pData, DWORD dwFieldSize);
+
+	// The UUID and group ID indexes are updated by SetEntry/SetGroup;
+	// operations that reorder the lists invalidate them and they are
+	// rebuilt by the next lookup (see Details/PwIndexImpl.cpp)
+	void _ResetIndexes();
+	void _InvalidateEntryIndex() { m_bEntryIndexValid = false; }
+	void _InvalidateGroupIndex() { m_bGroupIndexValid = false; m_bGroupTreeValid = false; _InvalidateFindCache(); }
+	void _InvalidateGroupTreeIndex() { m_bGroupTreeValid = false; }
+	void _InvalidateGroupEntriesIndex() { m_bGroupEntriesValid = false; _InvalidateFindCache(); }
+	void _RebuildEntryIndex() const;
+	DWORD _LookupEntryIndex(const BYTE *pUuid) const;
+	void _RebuildGroupIndex() const;
+	void _UpdateEntryIndex(DWORD dwIndex, const BYTE *pbOldUuid);
+	void _RemoveFromEntryIndex(DWORD dwIndex);
+	void _UpdateGroupIndex(DWORD dwIndex, DWORD dwOldId);
+	void _RebuildGroupEntriesIndex() const;
+	const std::vector<DWORD> *_GetGroupEntries(DWORD idGroup) const;
+	void _UpdateGroupEntriesIndex(DWORD dwIndex, DWORD dwOldGroupId);
+	void _RemoveFromGroupEntriesIndex(DWORD dwIndex);
+	void _ResyncGroupEntriesIndex(DWORD dwFirst, DWORD dwLast);
+	void _RebuildGroupTreeIndex() const;
+	const PWM_GROUP_NODE *_GetGroupNode(DWORD dwGroupIndex) const;
+
+	// Trigram index and candidate cache of Find (see Details/PwFindImpl.cpp)
+	void _InvalidateTrigramIndex() { m_bTrigramIndexValid = false; _InvalidateFindCache(); }
+	void _InvalidateFindCache() { ++m_dwSearchGeneration; if(!m_vFindCache.empty()) m_vFindCache.clear(); }
+	void _RebuildTrigramIndex();
+	void _GetEntryTrigrams(DWORD dwIndex, std::vector<UINT64>& vTrigrams);
+	void _AddToTrigramIndex(DWORD dwIndex);
+	void _RemoveFromTrigramIndex(DWORD dwIndex);
+	const std::vector<DWORD> *_GetFindCandidates(LPCTSTR lpSearch,
+		BOOL bCaseSensitive, DWORD searchFlags);
+
+	// Worker threads of FindAll (PWMS_PARALLEL), created on demand
+	DWORD _GetFindWorkers(DWORD dwCount);
+	void _DeleteFindPool();
+
+	// Search shadows, parallel to the entry list and allocated in m_arena
+	// (see Details/PwFindImpl.cpp)
+	void _InvalidateSearchShadows() { m_vShadows.clear(); m_bShadowsValid = false; }
+	const PWM_SEARCH_SHADOW *_GetSearchShadows(BOOL bCaseSensitive);
+	void _RebuildSearchShadows();
+	void _UpdateSearchShadow(DWORD dwIndex);
+	LPTSTR _FoldSearchShadow(LPCTSTR lpText, LPTSTR lpOldShadow);
+#ifdef _DEBUG
+	bool _CheckIndexes() const; // Compare the indexes with the lists
+#endif
 
+	int OpenDatabaseStream(CKpStream& s, CKpMappedFileStream* pMapped,
+		UINT64 uFileSize, const TCHAR *pszFile, PWDB_REPAIR_INFO *pRepair);
+	int ReadDbRecords(CKpCbcDecryptStream& s, const PW_DBHEADER& hdr,
+		PWDB_REPAIR_INFO *pRepair);
 	bool ReadGroupField(USHORT usFieldType, DWORD dwFieldSize,
 		const BYTE *pData, PW_GROUP *pGroup, PWDB_REPAIR_INFO *pRepair);
 	bool ReadEntryField(USHORT usFieldType, DWORD dwFieldSize,
 		const BYTE *pData, PW_ENTRY *pEntry, PWDB_REPAIR_INFO *pRepair);
 	bool ReadExtData(const BYTE* pData, DWORD dwDataSize, PW_GROUP* pg,
 		PW_ENTRY* pe, PWDB_REPAIR_INFO* pRepair);
+	bool WriteDbRecords(CKpStream& s, const CKpMemoryStream& msExtData);
 	void WriteExtData(CKpMemoryStream& ms);
 	static void WriteExtDataField(CKpMemoryStream& ms, USHORT usFieldType,
 		const BYTE* pData, DWORD dwFieldSize);
@@ -548,12 +804,37 @@ private:
 
 	// Encrypt the master key a few times to make brute-force key-search harder
 	BOOL _TransformMasterKey(const BYTE *pKeySeed);
+	static BOOL _TransformKey(BYTE *pbKey32, const BYTE *pKeySeed, int nKdf,
+		DWORD dwRounds, const PW_ARGON2_PARAMS *pArgon2,
+		const volatile LONG *plCancel = NULL);
+	static BOOL _TransformKeyAes(BYTE *pbKey32, const BYTE *pKeySeed, DWORD dwRounds,
+		const volatile LONG *plCancel = NULL);
+
+	// Run _TransformMasterKey on a worker thread; until _EndTransformMasterKey
+	// has been called, the master keys must not be accessed
+	void _BeginTransformMasterKey(const BYTE *pKeySeed);
+	bool _IsTransformMasterKeyDone() const;
+	BOOL _EndTransformMasterKey(DWORD *pdwTime);
+	static DWORD WINAPI _TransformMasterKeyThreadProc(LPVOID lpParameter);
+
+	void _PreDeriveSaveKey();
+	bool _TakePreDerivedSaveKey(BYTE *pMasterSeed2);
+	void _DiscardPreDerivedSaveKey();
+	static DWORD WINAPI _PreDeriveSaveKeyThreadProc(LPVOID lpParameter);
 
 	static void HashHeaderWithoutContentHash(const BYTE* pbHeader,
 		std::vector<BYTE>& vHash);
 
 	DWORD DeleteLostEntries();
 
+	// Helpers of MergeIn
+	void _DecideMergeEntries(PWM_MERGE_JOB *p) const;
+	static DWORD WINAPI _MergeDecisionThreadProc(LPVOID lpParameter);
+	void _MergeAddEntries(CPwManager *pSource, std::vector<DWORD>& vSourceIndices,
+		const boost::unordered_map<DWORD, DWORD>& mGroupIds);
+
+	static DWORD _GetProcessorCount();
+
 	void MoveInternal(DWORD dwFrom, DWORD dwTo);
 
 	static BYTE* SerializeCustomKvp(const CustomKvp& kvp);
@@ -570,8 +851,31 @@ private:
 	DWORD m_dwMaxGroups; // Maximum number of groups that can be stored in the list
 	DWORD m_dwNumGroups; // Current number of groups stored in the list
 
+	mutable PwmUuidIndex m_mEntryIndex; // First entry with a UUID
+	mutable bool m_bEntryIndexValid;
+	mutable PwmGroupIdIndex m_mGroupIndex; // First group with an ID
+	mutable bool m_bGroupIndexValid;
+	mutable PwmGroupEntriesIndex m_mGroupEntries;
+	mutable bool m_bGroupEntriesValid;
+	mutable std::vector<PWM_GROUP_NODE> m_vGroupTree; // Parallel to m_pGroups
+	mutable bool m_bGroupTreeValid;
+
+	BOOL m_bSearchIndex;
+	BOOL m_bSearchIndexPasswords;
+	PwmTrigramIndex m_mTrigrams;
+	bool m_bTrigramIndexValid;
+	std::vector<PWM_FIND_CACHE_ITEM> m_vFindCache; // Oldest first
+	DWORD m_dwSearchGeneration;
+
+	BOOL m_bSearchShadows;
+	std::vector<PWM_SEARCH_SHADOW> m_vShadows;
+	bool m_bShadowsValid;
+
 	PW_DBHEADER m_dbLastHeader;
 	PW_ENTRY *m_pLastEditedEntry; // Last modified entry, use GetLastEditedEntry() to get it
+
+	CStringArena m_arena; // Entry strings read from the file, freed on close
+	bool m_bAdoptArenaStrings; // SetEntry takes over arena strings of the template
 	std::vector<BYTE> m_vHeaderHash;
 
 	CNewRandom m_random; // Pseudo-random number generator
@@ -581,6 +885,8 @@ private:
 	BYTE m_pTransformedMasterKey[32]; // Master key encrypted several times
 	int m_nAlgorithm; // Algorithm used to encrypt the database
 	DWORD m_dwKeyEncRounds;
+	int m_nKdf; // Key derivation function
+	PW_ARGON2_PARAMS m_argon2; // Only used if m_nKdf is KDF_ARGON2
 	std::basic_string<TCHAR> m_strKeySource;
 
 	std::basic_string<TCHAR> m_strDefaultUserName;
@@ -591,6 +897,18 @@ private:
 
 	BOOL m_bUseTransactedFileWrites;
 
+	HANDLE m_hTransformThread;
+	BYTE m_aTransformSeed[32];
+	BOOL m_bTransformResult;
+	DWORD m_dwTransformTime;
+	PWDB_OPEN_TIMINGS m_openTimings;
+
+	BOOL m_bPreDeriveSaveKey;
+	PWM_SAVE_KEY_JOB *m_pSaveKeyJob; // NULL if no key is being pre-derived
+	HANDLE m_hSaveKeyThread;
+
+	PWM_FIND_POOL *m_pFindPool; // NULL if no parallel search has been run
+
 	COLORREF m_clr;
 };
 
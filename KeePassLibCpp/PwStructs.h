@@ -73,6 +73,17 @@ typedef struct _PW_DBHEADER
 	DWORD dwKeyEncRounds; ///< Number of master key transformations.
 } PW_DBHEADER, *PPW_DBHEADER;
 
+/// Argon2 key derivation parameters. If the PWM_FLAG_ARGON2 flag is set,
+/// this structure directly follows the database header (unencrypted).
+typedef struct _PW_ARGON2_PARAMS
+{
+	DWORD dwType; ///< ARGON2_TYPE_D or ARGON2_TYPE_ID.
+	DWORD dwVersion; ///< Argon2 version, 0x13.
+	DWORD dwIterations; ///< Number of passes over the memory.
+	DWORD dwMemoryKB; ///< Memory in KB.
+	DWORD dwParallelism; ///< Number of lanes (processed by multiple threads).
+} PW_ARGON2_PARAMS, *PPW_ARGON2_PARAMS;
+
 /// Group structure, containing information about one group.
 typedef struct _PW_GROUP
 {
@@ -134,6 +145,20 @@ typedef struct _PWDB_REPAIR_INFO
 	DWORD dwRecognizedMetaStreamCount;
 } PWDB_REPAIR_INFO, *PPWDB_REPAIR_INFO;
 
+/// Structure containing the durations (in milliseconds) of the phases of
+/// the last database opening process. The key transformation runs
+/// concurrently to the read-ahead phase.
+typedef struct _PWDB_OPEN_TIMINGS
+{
+	DWORD dwReadHeader; ///< Reading and checking the header.
+	DWORD dwTransformKey; ///< Transforming the master key (worker threads).
+	DWORD dwReadAhead; ///< Reading the file while the key is being transformed.
+	DWORD dwWaitForKey; ///< Waiting for the key transformation after the read-ahead.
+	DWORD dwDecryptParse; ///< Decrypting, verifying and parsing the content.
+	DWORD dwTotal; ///< Total time (time to unlock).
+	UINT64 qwReadAheadBytes; ///< Number of bytes read during the read-ahead phase.
+} PWDB_OPEN_TIMINGS, *PPWDB_OPEN_TIMINGS;
+
 /// Structure containing information about one main menu item provided by a plugin.
 typedef struct
 {
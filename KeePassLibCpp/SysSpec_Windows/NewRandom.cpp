@@ -295,22 +295,14 @@ unsigned long randXorShift()
 	return g_xorW;
 }
 
-void randCreateUUID(BYTE *pUUID16, CNewRandom *pRandomSource)
+static void randBuildUUID(BYTE *pUUID16, const SYSTEMTIME& st,
+	const BYTE *pbRandom8)
 {
 	BYTE *p = pUUID16;
 	DWORD *pdw1 = (DWORD *)pUUID16, *pdw2 = (DWORD *)&pUUID16[4],
 		*pdw3 = (DWORD *)&pUUID16[8], *pdw4 = (DWORD *)&pUUID16[12];
 	DWORD dw1, dw2, dw3, dw4;
 
-	ASSERT(pRandomSource != NULL); if(pRandomSource == NULL) return;
-
-	ASSERT((sizeof(DWORD) == 4) && (sizeof(USHORT) == 2) && (pUUID16 != NULL));
-	if(pUUID16 == NULL) return;
-
-	SYSTEMTIME st;
-	ZeroMemory(&st, sizeof(SYSTEMTIME));
-	GetSystemTime(&st);
-
 	_PackTimeToStruct(p, st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond);
 	p += 5; // +5 => 5 bytes filled
 	*p = (BYTE)((st.wMilliseconds >> 2) & 0xFF); // Store milliseconds
@@ -321,7 +313,7 @@ void randCreateUUID(BYTE *pUUID16, CNewRandom *pRandomSource)
 	memcpy(p, &dwPseudoCounter, 2); // Use only 2/4 bytes
 	p += 2; // +2 => 8 bytes filled
 
-	pRandomSource->GetRandomBuffer(p, 8); // +8 => 16 bytes filled
+	memcpy(p, pbRandom8, 8); // +8 => 16 bytes filled
 
 	dw1 = *pdw1; dw2 = *pdw2; dw3 = *pdw3; dw4 = *pdw4; // Load to local
 
@@ -336,4 +328,46 @@ void randCreateUUID(BYTE *pUUID16, CNewRandom *pRandomSource)
 	*pdw1 = dw1; *pdw2 = dw2; *pdw3 = dw3; *pdw4 = dw4; // Save
 }
 
+void randCreateUUID(BYTE *pUUID16, CNewRandom *pRandomSource)
+{
+	ASSERT(pRandomSource != NULL); if(pRandomSource == NULL) return;
+
+	ASSERT((sizeof(DWORD) == 4) && (sizeof(USHORT) == 2) && (pUUID16 != NULL));
+	if(pUUID16 == NULL) return;
+
+	SYSTEMTIME st;
+	ZeroMemory(&st, sizeof(SYSTEMTIME));
+	GetSystemTime(&st);
+
+	BYTE aRandom[8];
+	pRandomSource->GetRandomBuffer(aRandom, 8);
+
+	randBuildUUID(pUUID16, st, aRandom);
+}
+
+// Same as calling randCreateUUID dwCount times, but the random bytes
+// for multiple UUIDs are generated at once
+void randCreateUUIDs(BYTE *pUUIDs, DWORD dwCount, CNewRandom *pRandomSource)
+{
+	ASSERT(pRandomSource != NULL); if(pRandomSource == NULL) return;
+	ASSERT(pUUIDs != NULL); if(pUUIDs == NULL) return;
+
+	SYSTEMTIME st;
+	ZeroMemory(&st, sizeof(SYSTEMTIME));
+	GetSystemTime(&st);
+
+	BYTE aRandom[8 * 32];
+	DWORD i = 0;
+	while(i < dwCount)
+	{
+		const DWORD dwBlock = min(dwCount - i, static_cast<DWORD>(32));
+		pRandomSource->GetRandomBuffer(aRandom, dwBlock * 8);
+
+		for(DWORD j = 0; j < dwBlock; ++j)
+			randBuildUUID(&pUUIDs[(i + j) * 16], st, &aRandom[j * 8]);
+
+		i += dwBlock;
+	}
+}
+
 #endif // (defined(_WIN32) || defined(_WIN64))
@@ -82,6 +82,37 @@ std::basic_string<WCHAR> _StringToUnicodeStl(const TCHAR* pszString)
 	return strW;
 }
 
+// Encode dwLength UCS-2 characters to UTF-8; returns the number of bytes
+// stored in p (at most 3 * dwLength)
+static DWORD Priv_UniToUTF8(const WCHAR *pUni, DWORD dwLength, BYTE *p)
+{
+	DWORD j = 0;
+	for(DWORD i = 0; i < dwLength; ++i)
+	{
+		const WCHAR ut = pUni[i];
+
+		// if(ut == 0) break;
+
+		if(ut < 0x80) // 7-bit character, store as it is
+		{
+			p[j] = (BYTE)ut; j++;
+		}
+		else if(ut < 0x800) // Are 2 bytes enough?
+		{
+			p[j] = (BYTE)(0xC0 | (ut >> 6)); j++;
+			p[j] = (BYTE)(0x80 | (ut & 0x3F)); j++;
+		}
+		else // Maximum bytes needed for UCS-2 is 3 bytes in UTF-8
+		{
+			p[j] = (BYTE)(0xE0 | (ut >> 12)); j++;
+			p[j] = (BYTE)(0x80 | ((ut >> 6) & 0x3F)); j++;
+			p[j] = (BYTE)(0x80 | (ut & 0x3F)); j++;
+		}
+	}
+
+	return j;
+}
+
 UTF8_BYTE *_StringToUTF8(const TCHAR *pszSourceString)
 {
 	DWORD i, j = 0;
@@ -127,29 +158,7 @@ UTF8_BYTE *_StringToUTF8(const TCHAR *pszSourceString)
 	p = new BYTE[dwBytesNeeded + 2];
 	ASSERT(p != NULL); if(p == NULL) return NULL;
 
-	j = 0;
-	for(i = 0; i < dwLength; ++i)
-	{
-		ut = pUni[i];
-
-		// if(ut == 0) break;
-
-		if(ut < 0x80) // 7-bit character, store as it is
-		{
-			p[j] = (BYTE)ut; j++;
-		}
-		else if(ut < 0x800) // Are 2 bytes enough?
-		{
-			p[j] = (BYTE)(0xC0 | (ut >> 6)); j++;
-			p[j] = (BYTE)(0x80 | (ut & 0x3F)); j++;
-		}
-		else // Maximum bytes needed for UCS-2 is 3 bytes in UTF-8
-		{
-			p[j] = (BYTE)(0xE0 | (ut >> 12)); j++;
-			p[j] = (BYTE)(0x80 | ((ut >> 6) & 0x3F)); j++;
-			p[j] = (BYTE)(0x80 | (ut & 0x3F)); j++;
-		}
-	}
+	j = Priv_UniToUTF8(pUni, dwLength, p);
 	p[j] = 0; // Terminate string
 	ASSERT(j == (dwBytesNeeded + 1));
 
@@ -161,6 +170,37 @@ UTF8_BYTE *_StringToUTF8(const TCHAR *pszSourceString)
 	return p;
 }
 
+DWORD _UTF8MaxBytes(const TCHAR *pszString)
+{
+	ASSERT(pszString != NULL); if(pszString == NULL) return 0;
+
+	// Each TCHAR results in at most one UCS-2 character
+	return ((static_cast<DWORD>(_tcslen(pszString)) * 3) + 1);
+}
+
+DWORD _StringToUTF8Buffer(const TCHAR *pszSourceString, UTF8_BYTE *pDest)
+{
+	ASSERT(pszSourceString != NULL); if(pszSourceString == NULL) return 0;
+	ASSERT(pDest != NULL); if(pDest == NULL) return 0;
+
+#ifdef _UNICODE
+	// Including the terminating zero
+	return Priv_UniToUTF8(pszSourceString, static_cast<DWORD>(
+		_tcslen(pszSourceString)) + 1, pDest);
+#else
+	UTF8_BYTE *pb = _StringToUTF8(pszSourceString);
+	if(pb == NULL) return 0;
+
+	const DWORD cb = szlen((char *)pb) + 1;
+	ASSERT(cb <= _UTF8MaxBytes(pszSourceString));
+	memcpy(pDest, pb, cb);
+
+	mem_erase(pb, cb);
+	SAFE_DELETE_ARRAY(pb);
+	return cb;
+#endif
+}
+
 DWORD _UTF8NumChars(const UTF8_BYTE *pUTF8String)
 {
 	DWORD i = 0, dwLength = 0;
@@ -312,6 +352,57 @@ TCHAR *_UTF8ToString(const UTF8_BYTE *pUTF8String)
 #endif
 }
 
+DWORD _UTF8ToStringBuffer(const UTF8_BYTE *pUTF8String, TCHAR *pDest, DWORD cchDest)
+{
+	ASSERT(pUTF8String != NULL); if(pUTF8String == NULL) return 0;
+	ASSERT(pDest != NULL); if(pDest == NULL) return 0;
+	ASSERT(cchDest != 0); if(cchDest == 0) return 0;
+
+#ifdef _UNICODE
+	// Same decoding as _UTF8ToString; each byte yields at most one character
+	DWORD i = 0, j = 0;
+	while(j < (cchDest - 1))
+	{
+		const BYTE b0 = pUTF8String[i]; ++i;
+		if(b0 == 0) break;
+
+		if(b0 < 0x80) { pDest[j] = (WCHAR)b0; ++j; continue; }
+
+		const BYTE b1 = pUTF8String[i]; ++i;
+		ASSERT((b1 & 0xC0) == 0x80);
+		if((b1 & 0xC0) != 0x80) break;
+
+		if((b0 & 0xE0) == 0xC0)
+		{
+			pDest[j] = (WCHAR)(((b0 & 0x1F) << 6) | (b1 & 0x3F)); ++j;
+			continue;
+		}
+
+		const BYTE b2 = pUTF8String[i]; ++i;
+		ASSERT((b2 & 0xC0) == 0x80);
+		if((b2 & 0xC0) != 0x80) break;
+
+		pDest[j] = (WCHAR)(((b0 & 0xF) << 12) | ((b1 & 0x3F) << 6) | (b2 & 0x3F)); ++j;
+	}
+
+	pDest[j] = 0;
+	return (j + 1);
+#else
+	TCHAR *p = _UTF8ToString(pUTF8String);
+	if(p == NULL) { pDest[0] = 0; return 0; }
+
+	const DWORD cch = static_cast<DWORD>(_tcslen(p)) + 1;
+	ASSERT(cch <= cchDest);
+	const DWORD cchCopy = min(cch, cchDest);
+	memcpy(pDest, p, (cchCopy - 1) * sizeof(TCHAR));
+	pDest[cchCopy - 1] = 0;
+
+	mem_erase(p, cch * sizeof(TCHAR));
+	SAFE_DELETE_ARRAY(p);
+	return cchCopy;
+#endif
+}
+
 BOOL _IsUTF8String(const UTF8_BYTE *pUTF8String)
 {
 	DWORD i = 0;
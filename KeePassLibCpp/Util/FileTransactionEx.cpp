@@ -155,6 +155,27 @@ bool CFileTransactionEx::CommitWrite()
 	return r;
 }
 
+// Discard the buffer file (unless it is the base file itself, i.e.
+// the write is not transacted)
+void CFileTransactionEx::AbortWrite()
+{
+	if(m_strBase.size() == 0) { ASSERT(FALSE); return; }
+
+	const DWORD dwError = GetLastError();
+
+	if(!m_bTransacted)
+	{
+		if(m_bMadeUnhidden) CPwUtil::HideFile(m_strTemp.c_str(), true);
+	}
+	else if(GetFileAttributes(m_strTemp.c_str()) != INVALID_FILE_ATTRIBUTES)
+	{
+		VERIFY(DeleteFile(m_strTemp.c_str()));
+	}
+
+	m_strBase = _T(""); // Dispose
+	SetLastError(dwError);
+}
+
 bool CFileTransactionEx::CommitWriteTransaction()
 {
 	const bool bMadeUnhidden = CPwUtil::UnhideFile(m_strBase.c_str());
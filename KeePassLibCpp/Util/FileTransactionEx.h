@@ -44,6 +44,7 @@ public:
 
 	bool OpenWrite(std_string& strOutBufferFile);
 	bool CommitWrite();
+	void AbortWrite();
 
 private:
 	bool CommitWriteTransaction();
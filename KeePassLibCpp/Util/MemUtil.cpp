@@ -47,6 +47,38 @@ void mem_erase(void *p, size_t cb)
 #endif
 }
 
+void *mem_alloc_locked(size_t cb)
+{
+	if(cb == 0) { ASSERT(FALSE); return NULL; }
+
+#if defined(_WIN32) && !defined(_WIN32_WCE)
+	void *p = VirtualAlloc(NULL, cb, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if(p == NULL) return NULL;
+
+	// Fails if the working set is too small; the memory is usable anyway
+	VirtualLock(p, cb);
+	return p;
+#else
+	try { return new BYTE[cb]; }
+	catch(...) { }
+	return NULL;
+#endif
+}
+
+void mem_free_locked(void *p, size_t cb)
+{
+	if(p == NULL) return;
+
+	mem_erase(p, cb);
+
+#if defined(_WIN32) && !defined(_WIN32_WCE)
+	VirtualUnlock(p, cb);
+	VERIFY(VirtualFree(p, 0, MEM_RELEASE));
+#else
+	delete[] static_cast<BYTE *>(p);
+#endif
+}
+
 // Pack time to 5 byte structure:
 // Byte bits: 11111111 22222222 33333333 44444444 55555555
 // Contents : 00YYYYYY YYYYYYMM MMDDDDDH HHHHMMMM MMSSSSSS
@@ -120,6 +152,16 @@ int _pwtimecmp(const PW_TIME *pt1, const PW_TIME *pt2)
 	return 0; // They are exactly the same
 }
 
+UINT64 _pwtimepack(const PW_TIME *pt)
+{
+	return ((static_cast<UINT64>(pt->shYear) << 40) |
+		(static_cast<UINT64>(pt->btMonth) << 32) |
+		(static_cast<UINT64>(pt->btDay) << 24) |
+		(static_cast<UINT64>(pt->btHour) << 16) |
+		(static_cast<UINT64>(pt->btMinute) << 8) |
+		static_cast<UINT64>(pt->btSecond));
+}
+
 // Fast arithmetic time addition, possibly incorrect calendar-day
 void _pwtimeadd(PW_TIME *pTime, const PW_TIME *pTimeAdd)
 {
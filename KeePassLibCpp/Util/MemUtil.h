@@ -27,6 +27,12 @@
 // Securely erase memory
 void mem_erase(void *p, size_t cb);
 
+// Allocate memory that is locked into physical memory (if possible, i.e.
+// it is not written to the page file); free it using mem_free_locked,
+// which erases the memory
+void *mem_alloc_locked(size_t cb);
+void mem_free_locked(void *p, size_t cb);
+
 // Time conversion functions
 void _PackTimeToStruct(BYTE *pBytes, DWORD dwYear, DWORD dwMonth, DWORD dwDay, DWORD dwHour, DWORD dwMinute, DWORD dwSecond);
 void _UnpackStructToTime(const BYTE *pBytes, DWORD *pdwYear, DWORD *pdwMonth, DWORD *pdwDay, DWORD *pdwHour, DWORD *pdwMinute, DWORD *pdwSecond);
@@ -38,6 +44,9 @@ void _GetCurrentPwTime(PW_TIME *p);
 // returns 0 if pt1=pt2
 int _pwtimecmp(const PW_TIME *pt1, const PW_TIME *pt2);
 
+// Pack a PW_TIME structure into an integer that orders like _pwtimecmp
+UINT64 _pwtimepack(const PW_TIME *pt);
+
 // Fast arithmetic time addition, possibly incorrect calendar-day
 void _pwtimeadd(PW_TIME *pTime, const PW_TIME *pTimeAdd);
 
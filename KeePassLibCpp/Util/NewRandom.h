@@ -64,4 +64,7 @@ unsigned long randXorShift();
 // Must be able to hold at least 16 bytes
 void randCreateUUID(BYTE *pUUID16, CNewRandom *pRandomSource);
 
+// pUUIDs must be able to hold at least dwCount * 16 bytes
+void randCreateUUIDs(BYTE *pUUIDs, DWORD dwCount, CNewRandom *pRandomSource);
+
 #endif
@@ -0,0 +1,119 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "StdAfx.h"
+#include "PwFindSession.h"
+#include "StrUtil.h"
+
+CPwFindSession::CPwFindSession()
+{
+	m_bRefined = FALSE;
+	Reset();
+}
+
+void CPwFindSession::Reset()
+{
+	m_pMgr = NULL;
+	m_dwGeneration = 0;
+	m_strSearch.clear();
+	m_bCaseSensitive = FALSE;
+	m_dwFlags = 0;
+	m_vResults.clear();
+}
+
+// The terms as FindAll matches them; "*" matches all entries
+std::vector<std_string> CPwFindSession::GetTerms(LPCTSTR lpSearch,
+	BOOL bCaseSensitive)
+{
+	std::vector<std_string> v = SU_SplitSearchTerms(lpSearch);
+
+	for(size_t i = 0; i < v.size(); ++i)
+	{
+		if(bCaseSensitive != FALSE) continue;
+
+		CString str = v[i].c_str();
+		str.MakeLower();
+		v[i] = (LPCTSTR)str;
+	}
+
+	return v;
+}
+
+// An entry matches a term if one of its fields contains the term, thus
+// it can only match the new search string if it matched the previous one,
+// when each previous term is contained in one of the new terms
+bool CPwFindSession::IsRefinement(const CPwManager* pMgr, LPCTSTR lpSearch,
+	BOOL bCaseSensitive, DWORD searchFlags) const
+{
+	if((m_pMgr == NULL) || (pMgr != m_pMgr)) return false;
+	if(pMgr->GetSearchGeneration() != m_dwGeneration) return false;
+	if(bCaseSensitive != m_bCaseSensitive) return false;
+	if(m_vResults.size() >= pMgr->GetNumberOfEntries()) return false; // No gain
+
+	const DWORD dwFlagsMask = ~static_cast<DWORD>(PWMS_PARALLEL);
+	if((searchFlags & dwFlagsMask) != (m_dwFlags & dwFlagsMask)) return false;
+	if((searchFlags & PWMS_REGEX) != 0) return false;
+
+	const std::vector<std_string> vOld = GetTerms(m_strSearch.c_str(), bCaseSensitive);
+	const std::vector<std_string> vNew = GetTerms(lpSearch, bCaseSensitive);
+
+	for(size_t i = 0; i < vOld.size(); ++i)
+	{
+		if(vOld[i] == _T("*")) continue;
+
+		bool bContained = false;
+		for(size_t j = 0; j < vNew.size(); ++j)
+		{
+			if(vNew[j] == _T("*")) continue;
+			if(vNew[j].find(vOld[i]) != std_string::npos) { bContained = true; break; }
+		}
+
+		if(!bContained) return false;
+	}
+
+	return true;
+}
+
+BOOL CPwFindSession::Find(CPwManager* pMgr, LPCTSTR lpSearch,
+	BOOL bCaseSensitive, DWORD searchFlags, std::vector<DWORD>& vResults,
+	std_string* pError, const volatile LONG* plCancel)
+{
+	vResults.clear();
+	ASSERT(pMgr != NULL); if(pMgr == NULL) return FALSE;
+	if(lpSearch == NULL) lpSearch = _T("");
+
+	m_bRefined = (IsRefinement(pMgr, lpSearch, bCaseSensitive, searchFlags) ?
+		TRUE : FALSE);
+
+	if(pMgr->FindAll(lpSearch, bCaseSensitive, searchFlags, DWORD_MAX,
+		DWORD_MAX, ((m_bRefined != FALSE) ? &m_vResults : NULL), vResults,
+		pError, plCancel) == FALSE)
+	{
+		Reset();
+		return FALSE;
+	}
+
+	m_pMgr = pMgr;
+	m_dwGeneration = pMgr->GetSearchGeneration(); // FindAll may build indexes
+	m_strSearch = lpSearch;
+	m_bCaseSensitive = bCaseSensitive;
+	m_dwFlags = searchFlags;
+	m_vResults = vResults;
+	return TRUE;
+}
@@ -0,0 +1,65 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ___PW_FIND_SESSION_H___
+#define ___PW_FIND_SESSION_H___
+
+#pragma once
+
+#include "../PwManager.h"
+
+// Remembers the results of the last search of a quick find field. If the
+// next search string only extends the terms of the previous one (e.g. the
+// user has typed another character) and the database hasn't been modified
+// in the meantime, only the previous results are searched again; otherwise
+// CPwManager::FindAll searches all entries.
+class CPwFindSession : boost::noncopyable
+{
+public:
+	CPwFindSession();
+
+	// Same as CPwManager::FindAll (for all groups)
+	BOOL Find(CPwManager* pMgr, LPCTSTR lpSearch, BOOL bCaseSensitive,
+		DWORD searchFlags, std::vector<DWORD>& vResults, std_string* pError,
+		const volatile LONG* plCancel);
+
+	// Forget the previous results
+	void Reset();
+
+	// TRUE if the last Find only searched the previous results
+	BOOL WasRefined() const { return m_bRefined; }
+
+private:
+	bool IsRefinement(const CPwManager* pMgr, LPCTSTR lpSearch,
+		BOOL bCaseSensitive, DWORD searchFlags) const;
+
+	static std::vector<std_string> GetTerms(LPCTSTR lpSearch,
+		BOOL bCaseSensitive);
+
+	const CPwManager* m_pMgr; // NULL if there are no previous results
+	DWORD m_dwGeneration;
+	std_string m_strSearch;
+	BOOL m_bCaseSensitive;
+	DWORD m_dwFlags;
+	std::vector<DWORD> m_vResults;
+
+	BOOL m_bRefined;
+};
+
+#endif // ___PW_FIND_SESSION_H___
@@ -24,6 +24,7 @@
 #include "PwUtil.h"
 #include "MemUtil.h"
 #include "StrUtil.h"
+#include "StringArena.h"
 #include "TranslateEx.h"
 
 static const BYTE g_uuidZero[16] = { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 };
@@ -465,7 +466,7 @@ int CPwUtil::AttachFileAsBinaryData(_Inout_ PW_ENTRY *pEntry,
 	try
 	{
 		// CPwUtil::RemoveBinaryData(pEntry); // Doesn't free desc.
-		SAFE_DELETE_ARRAY(pEntry->pszBinaryDesc);
+		CStringArena::FreeString(pEntry->pszBinaryDesc);
 		SAFE_DELETE_ARRAY(pEntry->pBinaryData);
 
 		const size_t dwPathLen = _tcslen(lpBinaryDesc);
@@ -510,7 +511,7 @@ BOOL CPwUtil::RemoveBinaryData(_Inout_ PW_ENTRY *pEntry)
 	ASSERT_ENTRY(pEntry); if(pEntry == NULL) return FALSE;
 
 	SAFE_DELETE_ARRAY(pEntry->pBinaryData);
-	SAFE_DELETE_ARRAY(pEntry->pszBinaryDesc);
+	CStringArena::FreeString(pEntry->pszBinaryDesc);
 	pEntry->pszBinaryDesc = new TCHAR[1];
 	pEntry->pszBinaryDesc[0] = _T('\0');
 	pEntry->uBinaryDataLen = 0;
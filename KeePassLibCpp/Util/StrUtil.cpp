@@ -18,6 +18,8 @@
 */
 
 #include "StdAfx.h"
+#include <mmsystem.h>
+#include <vector>
 #include "StrUtil.h"
 
 #include "AppUtil.h"
@@ -31,6 +33,38 @@
 #pragma warning(pop)
 #endif
 
+// The SIMD substring search compares 16-bit characters, i.e. it is only
+// available in Unicode builds; the AVX2 intrinsics require Visual
+// Studio 2012
+#if defined(_UNICODE) && !defined(_WIN32_WCE) && (defined(_M_IX86) || \
+	defined(_M_X64)) && defined(_MSC_VER)
+#define SU_SSE2_AVAILABLE
+#define SU_SSE2_TARGET
+#if (_MSC_VER >= 1700)
+#define SU_AVX2_AVAILABLE
+#define SU_AVX2_TARGET
+#endif
+#elif defined(_UNICODE) && defined(__GNUC__) && (defined(__i386__) || \
+	defined(__x86_64__))
+#define SU_SSE2_AVAILABLE
+#define SU_SSE2_TARGET __attribute__((target("sse2")))
+#define SU_AVX2_AVAILABLE
+#define SU_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+#ifdef SU_SSE2_AVAILABLE
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <emmintrin.h>
+#endif
+
+#ifdef SU_AVX2_AVAILABLE
+#include <immintrin.h>
+#endif
+
 static std::vector<WCHAR> g_vNormHyphen;
 
 // Securely erase a CString object
@@ -433,32 +467,32 @@ void _StringToUuid(const TCHAR *ptszSource, BYTE *pUuid)
 
 CString CsRemoveMeta(CString *psString)
 {
-	CString str = _T(""), strLower;
+	CString str = _T("");
 	LPCTSTR lpRemove = NULL;
 
 	ASSERT(psString != NULL); if(psString == NULL) return str;
 
 	str = *psString;
-	strLower = str; strLower = strLower.MakeLower();
 
 	for(int i = 0; i < 2; ++i)
 	{
 		if(i == 0) lpRemove = _T("auto-type:");
 		else if(i == 1) lpRemove = _T("auto-type-window:");
 
-		int nPos = strLower.Find(lpRemove, 0);
-		if(nPos != -1)
+		LPCTSTR lpStr = str;
+		LPCTSTR lpFound = SU_FindSubString(lpStr, lpRemove, FALSE);
+		if(lpFound != NULL)
 		{
+			int nPos = static_cast<int>(lpFound - lpStr);
 			if(nPos != 0)
-				if(strLower.GetAt(nPos - 1) == _T('\n')) nPos -= 1;
+				if(str.GetAt(nPos - 1) == _T('\n')) nPos -= 1;
 			if(nPos != 0)
-				if(strLower.GetAt(nPos - 1) == _T('\r')) nPos -= 1;
+				if(str.GetAt(nPos - 1) == _T('\r')) nPos -= 1;
 
-			int nCount = strLower.Find(_T('\n'), (int)(nPos + _tcslen(lpRemove) - 1));
-			if(nCount == -1) nCount = strLower.GetLength() - nPos;
+			int nCount = str.Find(_T('\n'), (int)(nPos + _tcslen(lpRemove) - 1));
+			if(nCount == -1) nCount = str.GetLength() - nPos;
 			else nCount -= nPos - 1;
 
-			strLower.Delete(nPos, nCount);
 			str.Delete(nPos, nCount);
 		}
 	}
@@ -642,18 +676,20 @@ CString ExtractParameterFromString(LPCTSTR lpstr, LPCTSTR lpStart,
 
 	ASSERT(lpstr != NULL); if(lpstr == NULL) return str; // _T("")
 
-	CString strSource = lpstr;
-	strSource = strSource.MakeLower();
 	TCHAR *lp = const_cast<TCHAR *>(lpstr);
 
 	int nPos = -1, nSearchFrom = 0;
 
-	// nPos = strSource.Find(lpStart, 0);
+	// lpStart is lower-case, the source is folded while searching
 	while(dwInstance != DWORD_MAX)
 	{
-		nPos = strSource.Find(lpStart, nSearchFrom);
+		LPCTSTR lpFound = SU_FindSubString(&lpstr[nSearchFrom], lpStart, FALSE);
 
-		if(nPos != -1) nSearchFrom = nPos + 1;
+		if(lpFound != NULL)
+		{
+			nPos = static_cast<int>(lpFound - lpstr);
+			nSearchFrom = nPos + 1;
+		}
 		else return str; // _T("")
 
 		--dwInstance;
@@ -779,6 +815,353 @@ CString RemoveAcceleratorTipEx(LPCTSTR lpString)
 	return str;
 }
 
+// Characters are folded like CString::MakeLower; ASCII characters are
+// folded directly
+static TCHAR SU_FoldChar(TCHAR tch)
+{
+	if(static_cast<TBYTE>(tch) < 0x80)
+	{
+		if((tch >= _T('A')) && (tch <= _T('Z'))) return (tch + (_T('a') - _T('A')));
+		return tch;
+	}
+
+	return static_cast<TCHAR>(_totlower(tch));
+}
+
+// Compare cchFind characters at lpText with lpFind
+static bool SU_MatchAt(LPCTSTR lpText, LPCTSTR lpFind, size_t cchFind,
+	BOOL bCaseSensitive)
+{
+	if(bCaseSensitive != FALSE)
+		return (memcmp(lpText, lpFind, cchFind * sizeof(TCHAR)) == 0);
+
+	for(size_t i = 0; i < cchFind; ++i)
+	{
+		if(SU_FoldChar(lpText[i]) != lpFind[i]) return false;
+	}
+
+	return true;
+}
+
+static LPCTSTR SU_FindSubStringScalar(LPCTSTR lpText, size_t cchText,
+	LPCTSTR lpFind, size_t cchFind, BOOL bCaseSensitive)
+{
+	if(cchFind > cchText) return NULL;
+
+	const TCHAR tchFirst = lpFind[0];
+	const size_t cchLast = cchText - cchFind;
+	for(size_t i = 0; i <= cchLast; ++i)
+	{
+		const TCHAR tch = ((bCaseSensitive != FALSE) ? lpText[i] :
+			SU_FoldChar(lpText[i]));
+		if(tch != tchFirst) continue;
+
+		if(SU_MatchAt(&lpText[i + 1], &lpFind[1], cchFind - 1, bCaseSensitive))
+			return &lpText[i];
+	}
+
+	return NULL;
+}
+
+#ifdef SU_SSE2_AVAILABLE
+
+static volatile LONG g_lSuSimdLevel = -1;
+
+#ifdef SU_AVX2_AVAILABLE
+static bool SU_QueryAvx2(UINT32 uEcx1)
+{
+	// The OS must save the YMM registers (OSXSAVE, AVX, XCR0 bits 1 and 2)
+	if((uEcx1 & ((1U << 27) | (1U << 28))) != ((1U << 27) | (1U << 28)))
+		return false;
+
+#ifdef _MSC_VER
+	if((_xgetbv(0) & 6) != 6) return false;
+
+	int vInfo[4] = { 0, 0, 0, 0 };
+	__cpuid(vInfo, 0);
+	if(vInfo[0] < 7) return false;
+
+	__cpuidex(vInfo, 7, 0);
+	const UINT32 uEbx7 = static_cast<UINT32>(vInfo[1]);
+#else
+	UINT32 uXcrLow = 0, uXcrHigh = 0;
+	__asm__ __volatile__("xgetbv" : "=a"(uXcrLow), "=d"(uXcrHigh) : "c"(0));
+	if((uXcrLow & 6) != 6) return false;
+
+	if(__get_cpuid_max(0, NULL) < 7) return false;
+
+	unsigned int a = 0, b = 0, c = 0, d = 0;
+	__cpuid_count(7, 0, a, b, c, d);
+	const UINT32 uEbx7 = b;
+#endif
+
+	return ((uEbx7 & (1U << 5)) != 0);
+}
+#endif
+
+// 2 (AVX2), 1 (SSE2) or 0 (no SIMD support)
+static LONG SU_QuerySimdLevel()
+{
+	UINT32 uEcx = 0, uEdx = 0;
+
+#ifdef _MSC_VER
+	int vInfo[4] = { 0, 0, 0, 0 };
+	__cpuid(vInfo, 0);
+	if(vInfo[0] < 1) return 0;
+
+	__cpuid(vInfo, 1);
+	uEcx = static_cast<UINT32>(vInfo[2]);
+	uEdx = static_cast<UINT32>(vInfo[3]);
+#else
+	unsigned int a = 0, b = 0, c = 0, d = 0;
+	if(__get_cpuid(1, &a, &b, &c, &d) == 0) return 0;
+	uEcx = c;
+	uEdx = d;
+#endif
+
+	if((uEdx & (1U << 26)) == 0) return 0; // No SSE2
+
+#ifdef SU_AVX2_AVAILABLE
+	if(SU_QueryAvx2(uEcx)) return 2;
+#else
+	UNREFERENCED_PARAMETER(uEcx);
+#endif
+
+	return 1;
+}
+
+static LONG SU_GetSimdLevel()
+{
+	if(g_lSuSimdLevel < 0) // Result is the same for all threads
+		g_lSuSimdLevel = SU_QuerySimdLevel();
+
+	return g_lSuSimdLevel;
+}
+
+static unsigned int SU_LowestBit(UINT32 uMask)
+{
+	ASSERT(uMask != 0);
+#ifdef _MSC_VER
+	unsigned long uIndex = 0;
+	_BitScanForward(&uIndex, uMask);
+	return static_cast<unsigned int>(uIndex);
+#else
+	return static_cast<unsigned int>(__builtin_ctz(uMask));
+#endif
+}
+
+// A character of the search string can be the lowercase version of a
+// non-ASCII character if it is a lowercase ASCII letter or non-ASCII
+static bool SU_MayFoldFromNonAscii(TCHAR tch)
+{
+	return ((static_cast<TBYTE>(tch) >= 0x80) || ((tch >= _T('a')) &&
+		(tch <= _T('z'))));
+}
+
+// The text blocks starting at the first and last character of the search
+// string are compared with the broadcasted first and last character;
+// only candidate positions are compared completely. Case-insensitive
+// comparisons fold ASCII letters in the registers; non-ASCII characters
+// are candidates if the search character might be their lowercase
+// version, and are compared using _totlower.
+SU_SSE2_TARGET static LPCTSTR SU_FindSubStringSse2(LPCTSTR lpText,
+	size_t cchText, LPCTSTR lpFind, size_t cchFind, BOOL bCaseSensitive)
+{
+	const size_t cchLastOffset = cchFind - 1;
+	const __m128i vFirst = _mm_set1_epi16(static_cast<short>(lpFind[0]));
+	const __m128i vLast = _mm_set1_epi16(static_cast<short>(lpFind[cchLastOffset]));
+
+	const __m128i vUpperMin = _mm_set1_epi16(static_cast<short>(_T('A') - 1));
+	const __m128i vUpperMax = _mm_set1_epi16(static_cast<short>(_T('Z') + 1));
+	const __m128i vCaseBit = _mm_set1_epi16(0x20);
+	const __m128i vNonAscii = _mm_set1_epi16(static_cast<short>(0xFF80));
+	const __m128i vZero = _mm_setzero_si128();
+	const __m128i vFirstNA = (SU_MayFoldFromNonAscii(lpFind[0]) ?
+		_mm_set1_epi16(-1) : vZero);
+	const __m128i vLastNA = (SU_MayFoldFromNonAscii(lpFind[cchLastOffset]) ?
+		_mm_set1_epi16(-1) : vZero);
+
+	size_t i = 0;
+	for(; (i + cchLastOffset + 8) <= cchText; i += 8)
+	{
+		__m128i vA = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&lpText[i]));
+		__m128i vB = _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+			&lpText[i + cchLastOffset]));
+
+		__m128i vEqA, vEqB;
+		if(bCaseSensitive != FALSE)
+		{
+			vEqA = _mm_cmpeq_epi16(vA, vFirst);
+			vEqB = _mm_cmpeq_epi16(vB, vLast);
+		}
+		else
+		{
+			const __m128i vUpA = _mm_and_si128(_mm_cmpgt_epi16(vA, vUpperMin),
+				_mm_cmplt_epi16(vA, vUpperMax));
+			const __m128i vUpB = _mm_and_si128(_mm_cmpgt_epi16(vB, vUpperMin),
+				_mm_cmplt_epi16(vB, vUpperMax));
+			const __m128i vNaA = _mm_andnot_si128(_mm_cmpeq_epi16(_mm_and_si128(
+				vA, vNonAscii), vZero), vFirstNA);
+			const __m128i vNaB = _mm_andnot_si128(_mm_cmpeq_epi16(_mm_and_si128(
+				vB, vNonAscii), vZero), vLastNA);
+
+			vA = _mm_or_si128(vA, _mm_and_si128(vUpA, vCaseBit));
+			vB = _mm_or_si128(vB, _mm_and_si128(vUpB, vCaseBit));
+
+			vEqA = _mm_or_si128(_mm_cmpeq_epi16(vA, vFirst), vNaA);
+			vEqB = _mm_or_si128(_mm_cmpeq_epi16(vB, vLast), vNaB);
+		}
+
+		UINT32 uMask = static_cast<UINT32>(_mm_movemask_epi8(_mm_and_si128(
+			vEqA, vEqB)));
+		while(uMask != 0)
+		{
+			const unsigned int uBit = SU_LowestBit(uMask);
+			const size_t iPos = i + (uBit >> 1);
+
+			if(SU_MatchAt(&lpText[iPos], lpFind, cchFind, bCaseSensitive))
+				return &lpText[iPos];
+
+			uMask &= ~(3U << uBit);
+		}
+	}
+
+	return SU_FindSubStringScalar(&lpText[i], cchText - i, lpFind, cchFind,
+		bCaseSensitive);
+}
+
+#ifdef SU_AVX2_AVAILABLE
+SU_AVX2_TARGET static LPCTSTR SU_FindSubStringAvx2(LPCTSTR lpText,
+	size_t cchText, LPCTSTR lpFind, size_t cchFind, BOOL bCaseSensitive)
+{
+	const size_t cchLastOffset = cchFind - 1;
+	const __m256i vFirst = _mm256_set1_epi16(static_cast<short>(lpFind[0]));
+	const __m256i vLast = _mm256_set1_epi16(static_cast<short>(lpFind[cchLastOffset]));
+
+	const __m256i vUpperMin = _mm256_set1_epi16(static_cast<short>(_T('A') - 1));
+	const __m256i vUpperMax = _mm256_set1_epi16(static_cast<short>(_T('Z')));
+	const __m256i vCaseBit = _mm256_set1_epi16(0x20);
+	const __m256i vNonAscii = _mm256_set1_epi16(static_cast<short>(0xFF80));
+	const __m256i vZero = _mm256_setzero_si256();
+	const __m256i vFirstNA = (SU_MayFoldFromNonAscii(lpFind[0]) ?
+		_mm256_set1_epi16(-1) : vZero);
+	const __m256i vLastNA = (SU_MayFoldFromNonAscii(lpFind[cchLastOffset]) ?
+		_mm256_set1_epi16(-1) : vZero);
+
+	size_t i = 0;
+	for(; (i + cchLastOffset + 16) <= cchText; i += 16)
+	{
+		__m256i vA = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&lpText[i]));
+		__m256i vB = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+			&lpText[i + cchLastOffset]));
+
+		__m256i vEqA, vEqB;
+		if(bCaseSensitive != FALSE)
+		{
+			vEqA = _mm256_cmpeq_epi16(vA, vFirst);
+			vEqB = _mm256_cmpeq_epi16(vB, vLast);
+		}
+		else
+		{
+			const __m256i vUpA = _mm256_andnot_si256(_mm256_cmpgt_epi16(vA,
+				vUpperMax), _mm256_cmpgt_epi16(vA, vUpperMin));
+			const __m256i vUpB = _mm256_andnot_si256(_mm256_cmpgt_epi16(vB,
+				vUpperMax), _mm256_cmpgt_epi16(vB, vUpperMin));
+			const __m256i vNaA = _mm256_andnot_si256(_mm256_cmpeq_epi16(
+				_mm256_and_si256(vA, vNonAscii), vZero), vFirstNA);
+			const __m256i vNaB = _mm256_andnot_si256(_mm256_cmpeq_epi16(
+				_mm256_and_si256(vB, vNonAscii), vZero), vLastNA);
+
+			vA = _mm256_or_si256(vA, _mm256_and_si256(vUpA, vCaseBit));
+			vB = _mm256_or_si256(vB, _mm256_and_si256(vUpB, vCaseBit));
+
+			vEqA = _mm256_or_si256(_mm256_cmpeq_epi16(vA, vFirst), vNaA);
+			vEqB = _mm256_or_si256(_mm256_cmpeq_epi16(vB, vLast), vNaB);
+		}
+
+		UINT32 uMask = static_cast<UINT32>(_mm256_movemask_epi8(
+			_mm256_and_si256(vEqA, vEqB)));
+		while(uMask != 0)
+		{
+			const unsigned int uBit = SU_LowestBit(uMask);
+			const size_t iPos = i + (uBit >> 1);
+
+			if(SU_MatchAt(&lpText[iPos], lpFind, cchFind, bCaseSensitive))
+				return &lpText[iPos];
+
+			uMask &= ~(3U << uBit);
+		}
+	}
+
+	// Blocks of 8 characters and the tail
+	return SU_FindSubStringSse2(&lpText[i], cchText - i, lpFind, cchFind,
+		bCaseSensitive);
+}
+#endif // SU_AVX2_AVAILABLE
+
+#endif // SU_SSE2_AVAILABLE
+
+LPCTSTR SU_FindSubString(LPCTSTR lpText, LPCTSTR lpFind, BOOL bCaseSensitive)
+{
+	return SU_FindSubStringEx(lpText, lpFind, bCaseSensitive, SU_SIMD_AVX2);
+}
+
+LPCTSTR SU_FindSubStringEx(LPCTSTR lpText, LPCTSTR lpFind, BOOL bCaseSensitive,
+	LONG lMaxSimdLevel)
+{
+	ASSERT((lpText != NULL) && (lpFind != NULL));
+	if((lpText == NULL) || (lpFind == NULL)) return NULL;
+
+	const size_t cchFind = _tcslen(lpFind);
+	if(cchFind == 0) return lpText;
+
+	const size_t cchText = _tcslen(lpText);
+	if(cchFind > cchText) return NULL;
+
+#ifdef SU_SSE2_AVAILABLE
+	const LONG lLevel = min(SU_GetSimdLevel(), lMaxSimdLevel);
+#ifdef SU_AVX2_AVAILABLE
+	if(lLevel >= 2)
+		return SU_FindSubStringAvx2(lpText, cchText, lpFind, cchFind, bCaseSensitive);
+#endif
+	if(lLevel >= 1)
+		return SU_FindSubStringSse2(lpText, cchText, lpFind, cchFind, bCaseSensitive);
+#else
+	UNREFERENCED_PARAMETER(lMaxSimdLevel);
+#endif
+
+	return SU_FindSubStringScalar(lpText, cchText, lpFind, cchFind, bCaseSensitive);
+}
+
+UINT64 SU_BenchmarkFindSubString(size_t cchText, DWORD dwTimeMs, LONG lMaxSimdLevel)
+{
+	if((cchText == 0) || (dwTimeMs == 0)) { ASSERT(FALSE); return 0; }
+
+	// Mixed-case letters and some non-ASCII characters; the first and last
+	// characters of the search string match often, the string never
+	std::vector<TCHAR> vText(cchText + 1, 0);
+	for(size_t i = 0; i < cchText; ++i)
+	{
+		if((i % 61) == 60) vText[i] = static_cast<TCHAR>(0xE4);
+		else vText[i] = static_cast<TCHAR>(((i & 1) ? _T('a') : _T('A')) + ((i * 7) % 26));
+	}
+
+	UINT64 qwChars = 0;
+	const DWORD dwStartTime = timeGetTime();
+	DWORD dwElapsed = 0;
+	do
+	{
+		if(SU_FindSubStringEx(&vText[0], _T("hoxc"), FALSE, lMaxSimdLevel) != NULL)
+			{ ASSERT(FALSE); return 0; }
+
+		qwChars += cchText;
+		dwElapsed = timeGetTime() - dwStartTime;
+	}
+	while(dwElapsed < dwTimeMs);
+
+	return ((qwChars * 1000) / max(dwElapsed, static_cast<DWORD>(1)));
+}
+
 // Assumes that lpSearch is lower-case when bCaseSensitive == FALSE
 // If pUseRegex is not NULL, a regular expression search will be
 // performed, otherwise a simple substring matching.
@@ -807,14 +1190,7 @@ bool StrMatchText(LPCTSTR lpEntryData, LPCTSTR lpSearch,
 	// UNREFERENCED_PARAMETER(pUseRegex);
 	// #endif
 
-	if(bCaseSensitive == FALSE)
-	{
-		CString strEntryData = lpEntryData;
-		strEntryData = strEntryData.MakeLower();
-		return (strEntryData.Find(lpSearch) != -1);
-	}
-
-	return (_tcsstr(lpEntryData, lpSearch) != NULL);
+	return (SU_FindSubString(lpEntryData, lpSearch, bCaseSensitive) != NULL);
 }
 
 std::vector<std::basic_string<TCHAR> > SU_SplitSearchTerms(LPCTSTR lpSearch)
@@ -78,6 +78,17 @@ std::basic_string<WCHAR> _StringToUnicodeStl(const TCHAR* pszString);
 UTF8_BYTE *_StringToUTF8(const TCHAR *pszSourceString);
 TCHAR *_UTF8ToString(const UTF8_BYTE *pUTF8String);
 
+// Convert to UTF-8 into a caller-supplied buffer, which must be able to
+// hold _UTF8MaxBytes(pszSourceString) bytes; returns the number of bytes
+// written, including the terminating NULL byte (0 on failure)
+DWORD _StringToUTF8Buffer(const TCHAR *pszSourceString, UTF8_BYTE *pDest);
+DWORD _UTF8MaxBytes(const TCHAR *pszString);
+
+// Convert from UTF-8 into a caller-supplied buffer of cchDest characters,
+// which must be at least the UTF-8 byte length plus one; returns the number
+// of characters written, including the terminating NULL (0 on failure)
+DWORD _UTF8ToStringBuffer(const UTF8_BYTE *pUTF8String, TCHAR *pDest, DWORD cchDest);
+
 DWORD _UTF8NumChars(const UTF8_BYTE *pUTF8String);
 
 // This returns the needed bytes to represent the string, without terminating NULL character
@@ -120,6 +131,24 @@ LPTSTR _TcsCryptDupAlloc(LPCTSTR lpSource);
 void RemoveAcceleratorTip(CString *pString);
 CString RemoveAcceleratorTipEx(LPCTSTR lpString);
 
+// Returns the first occurrence of lpFind in lpText (like _tcsstr) or NULL.
+// If bCaseSensitive == FALSE, the characters of lpText are converted to
+// lower-case before comparing, i.e. lpFind must be lower-case.
+LPCTSTR SU_FindSubString(LPCTSTR lpText, LPCTSTR lpFind, BOOL bCaseSensitive);
+
+#define SU_SIMD_NONE 0
+#define SU_SIMD_SSE2 1
+#define SU_SIMD_AVX2 2
+
+// SU_FindSubString using at most the specified SU_SIMD_* implementation
+// (for tests and benchmarks; unsupported ones are skipped)
+LPCTSTR SU_FindSubStringEx(LPCTSTR lpText, LPCTSTR lpFind, BOOL bCaseSensitive,
+	LONG lMaxSimdLevel);
+
+// Number of characters per second that SU_FindSubStringEx searches
+// case-insensitively (in texts of cchText characters without a match)
+UINT64 SU_BenchmarkFindSubString(size_t cchText, DWORD dwTimeMs, LONG lMaxSimdLevel);
+
 // Assumes that lpSearch is lower-case when bCaseSensitive == FALSE
 // If pUseRegex is not NULL, a regular expression search will be
 // performed, otherwise a simple substring matching.
@@ -0,0 +1,224 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "StdAfx.h"
+#include "../SysDefEx.h"
+#include "StringArena.h"
+#include "MemUtil.h"
+#include <algorithm>
+
+struct SA_RANGE
+{
+	const TCHAR* pBegin;
+	const TCHAR* pEnd;
+};
+
+static bool Priv_SaRangeLess(const SA_RANGE& a, const SA_RANGE& b)
+{
+	return (a.pBegin < b.pBegin);
+}
+
+// Address ranges of the blocks of all arenas, sorted by start address
+class CStringArenaRegistry : boost::noncopyable
+{
+public:
+	CStringArenaRegistry() { InitializeCriticalSection(&m_cs); }
+	~CStringArenaRegistry() { ASSERT(m_vRanges.size() == 0); DeleteCriticalSection(&m_cs); }
+
+	void Add(const TCHAR* pBegin, size_t cch)
+	{
+		SA_RANGE r;
+		r.pBegin = pBegin;
+		r.pEnd = pBegin + cch;
+
+		EnterCriticalSection(&m_cs);
+		m_vRanges.insert(std::upper_bound(m_vRanges.begin(), m_vRanges.end(),
+			r, Priv_SaRangeLess), r);
+		LeaveCriticalSection(&m_cs);
+	}
+
+	void Remove(const TCHAR* pBegin)
+	{
+		SA_RANGE r;
+		r.pBegin = pBegin;
+		r.pEnd = NULL;
+
+		EnterCriticalSection(&m_cs);
+		std::vector<SA_RANGE>::iterator it = std::lower_bound(m_vRanges.begin(),
+			m_vRanges.end(), r, Priv_SaRangeLess);
+		ASSERT((it != m_vRanges.end()) && (it->pBegin == pBegin));
+		if((it != m_vRanges.end()) && (it->pBegin == pBegin)) m_vRanges.erase(it);
+		LeaveCriticalSection(&m_cs);
+	}
+
+	bool Contains(const TCHAR* p)
+	{
+		SA_RANGE r;
+		r.pBegin = p;
+		r.pEnd = NULL;
+
+		EnterCriticalSection(&m_cs);
+		std::vector<SA_RANGE>::const_iterator it = std::upper_bound(
+			m_vRanges.begin(), m_vRanges.end(), r, Priv_SaRangeLess);
+		const bool b = ((it != m_vRanges.begin()) && (p < (it - 1)->pEnd));
+		LeaveCriticalSection(&m_cs);
+		return b;
+	}
+
+private:
+	CRITICAL_SECTION m_cs;
+	std::vector<SA_RANGE> m_vRanges;
+};
+
+static CStringArenaRegistry g_saRegistry;
+
+CStringArena::CStringArena() :
+	m_pFree(NULL), m_cchFree(0), m_pLast(NULL), m_cchLast(0)
+{
+}
+
+CStringArena::~CStringArena()
+{
+	Clear();
+}
+
+LPTSTR CStringArena::AddBlock(size_t cch)
+{
+	TCHAR* p = NULL;
+	try { p = new TCHAR[cch]; }
+	catch(...) { p = NULL; }
+	if(p == NULL) return NULL;
+
+	SA_BLOCK b;
+	b.pBase = p;
+	b.cch = cch;
+
+	std::vector<SA_BLOCK>::iterator it = m_vBlocks.begin();
+	while((it != m_vBlocks.end()) && (it->pBase < p)) ++it;
+	m_vBlocks.insert(it, b);
+
+	g_saRegistry.Add(p, cch);
+	return p;
+}
+
+LPTSTR CStringArena::Alloc(size_t cch)
+{
+	ASSERT(cch != 0); if(cch == 0) return NULL;
+
+	if(cch > (SA_BLOCK_CHARS / 8)) return AddBlock(cch);
+
+	if(cch > m_cchFree)
+	{
+		TCHAR* p = AddBlock(SA_BLOCK_CHARS);
+		if(p == NULL) return NULL;
+
+		m_pFree = p;
+		m_cchFree = SA_BLOCK_CHARS;
+	}
+
+	LPTSTR lp = m_pFree;
+	m_pFree += cch;
+	m_cchFree -= cch;
+
+	m_pLast = lp;
+	m_cchLast = cch;
+	return lp;
+}
+
+LPTSTR CStringArena::Dup(LPCTSTR lpString)
+{
+	if(lpString == NULL) lpString = _T("");
+
+	const size_t cch = _tcslen(lpString) + 1;
+	LPTSTR lp = Alloc(cch);
+	if(lp != NULL) memcpy(lp, lpString, cch * sizeof(TCHAR));
+	return lp;
+}
+
+void CStringArena::Shrink(LPTSTR lpString, size_t cchUsed)
+{
+	if((lpString == NULL) || (lpString != m_pLast)) return;
+	ASSERT((cchUsed != 0) && (cchUsed <= m_cchLast));
+	if((cchUsed == 0) || (cchUsed > m_cchLast)) return;
+
+	m_pFree = lpString + cchUsed;
+	m_cchFree += m_cchLast - cchUsed;
+	m_cchLast = cchUsed;
+}
+
+void CStringArena::Clear()
+{
+	for(size_t i = 0; i < m_vBlocks.size(); ++i)
+	{
+		g_saRegistry.Remove(m_vBlocks[i].pBase);
+
+		mem_erase(m_vBlocks[i].pBase, m_vBlocks[i].cch * sizeof(TCHAR));
+		delete[] m_vBlocks[i].pBase;
+	}
+	m_vBlocks.clear();
+
+	m_pFree = NULL;
+	m_cchFree = 0;
+	m_pLast = NULL;
+	m_cchLast = 0;
+}
+
+void CStringArena::Swap(CStringArena& other)
+{
+	m_vBlocks.swap(other.m_vBlocks);
+	std::swap(m_pFree, other.m_pFree);
+	std::swap(m_cchFree, other.m_cchFree);
+	std::swap(m_pLast, other.m_pLast);
+	std::swap(m_cchLast, other.m_cchLast);
+}
+
+bool CStringArena::Contains(LPCTSTR lpString) const
+{
+	if(lpString == NULL) return false;
+
+	size_t l = 0, r = m_vBlocks.size();
+	while(l < r) // Find the first block starting after lpString
+	{
+		const size_t m = l + ((r - l) >> 1);
+		if(m_vBlocks[m].pBase <= lpString) l = m + 1;
+		else r = m;
+	}
+	if(l == 0) return false;
+
+	const SA_BLOCK& b = m_vBlocks[l - 1];
+	return (lpString < (b.pBase + b.cch));
+}
+
+bool CStringArena::IsArenaString(LPCTSTR lpString)
+{
+	if(lpString == NULL) return false;
+	return g_saRegistry.Contains(lpString);
+}
+
+void CStringArena::FreeString(LPTSTR& lpString)
+{
+	if(lpString == NULL) return;
+
+	if(IsArenaString(lpString))
+	{
+		mem_erase(lpString, _tcslen(lpString) * sizeof(TCHAR));
+		lpString = NULL;
+	}
+	else SAFE_DELETE_ARRAY(lpString);
+}
@@ -0,0 +1,84 @@
+/*
+  KeePass Password Safe - The Open-Source Password Manager
+  Copyright (C) 2003-2024 Dominik Reichl <dominik.reichl@t-online.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ___STRING_ARENA_H___
+#define ___STRING_ARENA_H___
+
+#pragma once
+
+#include <windows.h>
+#include <tchar.h>
+#include <vector>
+#include <boost/utility.hpp>
+
+// Number of characters of a shared arena block; longer strings (more than
+// an eighth of a block) get a block of their own
+#define SA_BLOCK_CHARS 16384
+
+// Bump allocator for strings that share one lifetime, e.g. all strings
+// decoded while opening a database. Strings cannot be freed individually;
+// Clear erases and frees all blocks at once. The blocks of all arenas are
+// registered globally, such that code that does not know the owning arena
+// can tell arena strings from heap strings (see FreeString).
+class CStringArena : boost::noncopyable
+{
+public:
+	CStringArena();
+	virtual ~CStringArena();
+
+	// Returns NULL if out of memory
+	LPTSTR Alloc(size_t cch);
+	LPTSTR Dup(LPCTSTR lpString);
+
+	// Give back the unused tail of the most recent allocation
+	void Shrink(LPTSTR lpString, size_t cchUsed);
+
+	// Erase and free all strings
+	void Clear();
+
+	// Exchange all strings with another arena
+	void Swap(CStringArena& other);
+
+	bool Contains(LPCTSTR lpString) const;
+	size_t GetBlockCount() const { return m_vBlocks.size(); }
+
+	static bool IsArenaString(LPCTSTR lpString);
+
+	// Arena strings are erased, others are deleted; lpString is set to NULL
+	static void FreeString(LPTSTR& lpString);
+
+private:
+	struct SA_BLOCK
+	{
+		TCHAR* pBase;
+		size_t cch;
+	};
+
+	LPTSTR AddBlock(size_t cch);
+
+	std::vector<SA_BLOCK> m_vBlocks; // Sorted by address
+
+	TCHAR* m_pFree; // Free part of the current shared block
+	size_t m_cchFree;
+
+	TCHAR* m_pLast; // Most recent allocation in the shared block
+	size_t m_cchLast;
+};
+
+#endif // ___STRING_ARENA_H___
@@ -271,6 +271,8 @@ CPwSafeDlg::CPwSafeDlg(CWnd* pParent /*=NULL*/)
 	m_bShowTrayOnlyIfTrayed = FALSE;
 
 	m_mgr.InitPrimaryInstance();
+	m_mgr.SetSearchIndex(TRUE, FALSE); // Passwords are only searched by a scan
+	m_mgr.SetSearchShadows(TRUE);
 }
 
 void CPwSafeDlg::DoDataExchange(CDataExchange* pDX)
@@ -1158,6 +1160,14 @@ BOOL CPwSafeDlg::OnInitDialog()
 			{ strTCI += TRL("- Twofish algorithm"); strTCI += _T("\r\n"); }
 		if((ulTest & TI_ERR_CHACHA20) != 0)
 			{ strTCI += TRL("- ChaCha20 algorithm"); strTCI += _T("\r\n"); }
+		if((ulTest & TI_ERR_AESNI) != 0)
+			{ strTCI += TRL("- AES-NI implementation"); strTCI += _T("\r\n"); }
+		if((ulTest & TI_ERR_FINDSUBSTR) != 0)
+			{ strTCI += TRL("- Substring search"); strTCI += _T("\r\n"); }
+		if((ulTest & TI_ERR_INDEXES) != 0)
+			{ strTCI += TRL("- Database indexes"); strTCI += _T("\r\n"); }
+		if((ulTest & TI_ERR_GROUPSORT) != 0)
+			{ strTCI += TRL("- Group list sorting"); strTCI += _T("\r\n"); }
 
 		strTCI += _T("\r\n");
 		strTCI += TRL("The program will exit now.");
@@ -2838,19 +2848,19 @@ void CPwSafeDlg::UpdatePasswordList()
 	PW_TIME tNow;
 	_GetCurrentPwTime(&tNow);
 
+	const DWORD *pIndices = NULL;
+	const DWORD dwCount = m_mgr.GetEntryIndicesInGroup(dwGroupId, &pIndices);
+
 	DWORD j = 0;
-	for(DWORD i = 0; i < m_mgr.GetNumberOfEntries(); ++i)
+	for(DWORD i = 0; i < dwCount; ++i)
 	{
-		PW_ENTRY *pwe = m_mgr.GetEntry(i);
+		PW_ENTRY *pwe = m_mgr.GetEntry(pIndices[i]);
 		ASSERT_ENTRY(pwe);
 
 		if(pwe != NULL)
 		{
-			if(pwe->uGroupId == dwGroupId)
-			{
-				_List_SetEntry(j, pwe, TRUE, &tNow);
-				++j;
-			}
+			_List_SetEntry(j, pwe, TRUE, &tNow);
+			++j;
 		}
 	}
 
@@ -3554,13 +3564,15 @@ void CPwSafeDlg::OnPwlistDelete()
 	const DWORD dwInvGroup1 = m_mgr.GetGroupId(PWS_BACKUPGROUP);
 	const DWORD dwInvGroup2 = m_mgr.GetGroupId(PWS_BACKUPGROUP_SRC);
 
+	const std::vector<DWORD> vSel = GetSelectedEntriesUIIndices();
+	std::vector<DWORD> vDelSel, vDelIdx;
+	vDelSel.reserve(vSel.size());
+	vDelIdx.reserve(vSel.size());
+
 	BOOL bNeedGroupUpdate = FALSE;
-	while(true)
+	for(size_t i = 0; i < vSel.size(); ++i)
 	{
-		const DWORD dwSel = GetSelectedEntry();
-		if(dwSel == DWORD_MAX) break;
-
-		const DWORD dwIndex = _ListSelToEntryIndex(dwSel);
+		const DWORD dwIndex = _ListSelToEntryIndex(vSel[i]);
 		ASSERT(dwIndex != DWORD_MAX); if(dwIndex == DWORD_MAX) break;
 
 		if(m_bBackupEntries != FALSE)
@@ -3574,14 +3586,23 @@ void CPwSafeDlg::OnPwlistDelete()
 				BOOL b = FALSE;
 				m_mgr.BackupEntry(p, &b);
 				bNeedGroupUpdate |= b;
-				m_mgr.LockEntryPassword(p);
+				m_mgr.LockEntryPassword(m_mgr.GetEntry(dwIndex)); // List may have been reallocated
 			}
 		}
 
-		VERIFY(m_mgr.DeleteEntry(dwIndex)); // Delete from password manager
-		VERIFY(m_cList.DeleteItem(static_cast<int>(dwSel))); // Delete from GUI
+		vDelSel.push_back(vSel[i]);
+		vDelIdx.push_back(dwIndex);
 	}
 
+	if(!vDelIdx.empty()) // Delete from password manager
+	{
+		VERIFY(m_mgr.DeleteEntries(&vDelIdx[0], static_cast<DWORD>(
+			vDelIdx.size())) == static_cast<DWORD>(vDelIdx.size()));
+	}
+
+	for(size_t i = vDelSel.size(); i > 0; --i) // Delete from GUI
+		VERIFY(m_cList.DeleteItem(static_cast<int>(vDelSel[i - 1])));
+
 	if(bNeedGroupUpdate == TRUE)
 	{
 		_Groups_SaveView(TRUE);
@@ -4667,7 +4688,7 @@ void CPwSafeDlg::_OpenDatabase(CPwManager *pDbMgr, const TCHAR *pszFile,
 				if(bIgnoreCorrupted == TRUE)
 					nErr = pMgr->OpenDatabase(strFile, &repairInfo);
 				else
-					nErr = pMgr->OpenDatabase(strFile, NULL);
+					nErr = pMgr->OpenDatabaseMapped(strFile, NULL);
 
 				CTaskbarListEx::SetProgressState(this->m_hWnd, TBPF_NOPROGRESS);
 
@@ -5007,16 +5028,9 @@ void CPwSafeDlg::OnFileSave()
 
 	WU_FlushStorageBuffersEx(m_strFile, TRUE);
 
-	// Update file contents hash
-	m_bHashValid = SHA256_HashFile(m_strFile, (BYTE *)m_aHashOfFile);
-
-	if((m_bHashValid == FALSE) || (memcmp(vWrittenHash, m_aHashOfFile, 32) != 0))
-	{
-		CNewDialogsEx::ShowError(this->m_hWnd, PWE_FILEERROR_VERIFY,
-			PWFF_DATALOSS_WITHOUT_SAVE);
-		_SetDisplayDialog(false);
-		return;
-	}
+	// Update file contents hash (computed while writing the file)
+	memcpy(m_aHashOfFile, vWrittenHash, 32);
+	m_bHashValid = TRUE;
 
 	// if(m_bCreateBackupFileAfterSaving != FALSE)
 	// {
@@ -5088,16 +5102,9 @@ void CPwSafeDlg::OnFileSaveAs()
 		{
 			WU_FlushStorageBuffersEx(strFile, TRUE);
 
-			// Update file contents hash
-			m_bHashValid = SHA256_HashFile(strFile, (BYTE *)m_aHashOfFile);
-
-			if((m_bHashValid == FALSE) || (memcmp(vWrittenHash, m_aHashOfFile, 32) != 0))
-			{
-				CNewDialogsEx::ShowError(this->m_hWnd, PWE_FILEERROR_VERIFY,
-					PWFF_DATALOSS_WITHOUT_SAVE);
-				_SetDisplayDialog(false);
-				return;
-			}
+			// Update file contents hash (computed while writing the file)
+			memcpy(m_aHashOfFile, vWrittenHash, 32);
+			m_bHashValid = TRUE;
 
 			// if(m_bCreateBackupFileAfterSaving != FALSE)
 			// {
@@ -5544,24 +5551,17 @@ void CPwSafeDlg::OnSafeRemoveGroup()
 	if(_CallPlugins(KPM_GROUP_REMOVE_PRE, 0, 0) == FALSE)
 		{ _SetDisplayDialog(false); return; }
 
-	DWORD dwGroupIndex = m_mgr.GetGroupByIdN(dwGroupId);
-	PW_GROUP *p = m_mgr.GetGroup(dwGroupIndex);
-	ASSERT(p != NULL); if(p == NULL) { _SetDisplayDialog(false); return; }
-	const USHORT usTopLevel = p->usLevel;
+	const DWORD dwGroupIndex = m_mgr.GetGroupByIdN(dwGroupId);
+	if(dwGroupIndex == DWORD_MAX) { ASSERT(FALSE); _SetDisplayDialog(false); return; }
 
-	while(true)
+	// The group and its subgroups are stored consecutively
+	const DWORD dwSubtreeSize = m_mgr.GetGroupSubtreeSize(dwGroupIndex);
+	for(DWORD i = 0; i < dwSubtreeSize; ++i)
 	{
-		aGroupIds.Add(dwGroupId);
-
-		++dwGroupIndex;
-		if(dwGroupIndex == m_mgr.GetNumberOfGroups()) break;
-
-		p = m_mgr.GetGroup(dwGroupIndex);
+		PW_GROUP *p = m_mgr.GetGroup(dwGroupIndex + i);
 		ASSERT(p != NULL); if(p == NULL) break;
 
-		if(p->usLevel <= usTopLevel) break;
-
-		dwGroupId = p->uGroupId;
+		aGroupIds.Add(p->uGroupId);
 	}
 
 	CVistaTaskDialog dlgTask(this->m_hWnd, AfxGetInstanceHandle(), false);
@@ -6143,8 +6143,6 @@ void CPwSafeDlg::OnPwlistFind()
 	_Find(DWORD_MAX);
 }
 
-#define CPSDFM_CONTINUE { cnt = dw + 1; if(cnt >= dwMaxItems) break; continue; }
-
 void CPwSafeDlg::_Find(DWORD dwFindGroupId)
 {
 	if(m_bFileOpen == FALSE) return;
@@ -6212,63 +6210,43 @@ void CPwSafeDlg::_Find(DWORD dwFindGroupId)
 
 		_UpdateCachedGroupIDs();
 
-		DWORD cnt = 0;
 		PW_ENTRY *pwFirst = NULL;
 		std_string strError;
 
-		while(true)
-		{
-			const DWORD dw = m_mgr.FindEx(dlg.m_strFind, dlg.m_bCaseSensitive,
-				dwFlags, cnt, &strError);
-
-			if(dw == DWORD_MAX) break;
-			else
-			{
-				PW_ENTRY *p = m_mgr.GetEntry(dw);
-				ASSERT_ENTRY(p);
-				if(p == NULL) break;
-
-				if(p->uGroupId != dwGroupId) // Not in 'Search Results' group
-				{
-					const DWORD dwGroupInx = m_mgr.GetGroupByIdN(p->uGroupId);
-					ASSERT(dwGroupInx != DWORD_MAX);
-
-					// Only accept entries that are stored in the specified group
-					if((dwFindGroupIndexMin == DWORD_MAX) || ((dwGroupInx >= dwFindGroupIndexMin) &&
-						(dwGroupInx <= dwFindGroupIndexMax)))
-					{
-						if(dlg.m_bExcludeBackups != FALSE)
-						{
-							if(_tcscmp(m_mgr.GetGroup(dwGroupInx)->pszGroupName, PWS_BACKUPGROUP) == 0)
-								CPSDFM_CONTINUE;
+		// Only entries that are stored in the specified group are returned
+		std::vector<DWORD> vResults;
+		m_mgr.FindAll(dlg.m_strFind, dlg.m_bCaseSensitive, dwFlags | PWMS_PARALLEL,
+			dwFindGroupIndexMin, dwFindGroupIndexMax, NULL, vResults, &strError, NULL);
 
-							if(_tcscmp(m_mgr.GetGroup(dwGroupInx)->pszGroupName, PWS_BACKUPGROUP_SRC) == 0)
-								CPSDFM_CONTINUE;
-						}
+		for(size_t i = 0; i < vResults.size(); ++i)
+		{
+			PW_ENTRY *p = m_mgr.GetEntry(vResults[i]);
+			ASSERT_ENTRY(p);
+			if(p == NULL) break;
 
-						if(dlg.m_bExcludeExpired != FALSE)
-						{
-							if(_pwtimecmp(&tNow, &p->tExpire) > 0)
-								CPSDFM_CONTINUE;
-						}
+			if(p->uGroupId == dwGroupId) continue; // In 'Search Results' group
 
-						// The entry could get reallocated by AddEntry, therefore
-						// save it to a local CString object
-						// m_mgr.UnlockEntryPassword(p);
-						// CString strTemp = p->pszPassword;
-						// m_mgr.LockEntryPassword(p);
+			const DWORD dwGroupInx = m_mgr.GetGroupByIdN(p->uGroupId);
+			ASSERT(dwGroupInx != DWORD_MAX);
 
-						_List_SetEntry(m_cList.GetItemCount(), p, TRUE, &tNow);
+			if(dlg.m_bExcludeBackups != FALSE)
+			{
+				if(_tcscmp(m_mgr.GetGroup(dwGroupInx)->pszGroupName, PWS_BACKUPGROUP) == 0)
+					continue;
 
-						if(pwFirst == NULL) pwFirst = p;
+				if(_tcscmp(m_mgr.GetGroup(dwGroupInx)->pszGroupName, PWS_BACKUPGROUP_SRC) == 0)
+					continue;
+			}
 
-						// EraseCString(&strTemp); // Destroy the plaintext password
-					}
-				}
+			if(dlg.m_bExcludeExpired != FALSE)
+			{
+				if(_pwtimecmp(&tNow, &p->tExpire) > 0)
+					continue;
 			}
 
-			cnt = dw + 1;
-			if(cnt >= dwMaxItems) break;
+			_List_SetEntry(m_cList.GetItemCount(), p, TRUE, &tNow);
+
+			if(pwFirst == NULL) pwFirst = p;
 		}
 
 		_Groups_SaveView();
@@ -7842,7 +7820,7 @@ void CPwSafeDlg::OnPwlistMassModify()
 				PW_ENTRY *p = m_mgr.GetEntry(dwIndex);
 				ASSERT(p != NULL); if(p == NULL) continue;
 
-				if(dlg.m_bModGroup != FALSE) p->uGroupId = dwGroupId;
+				if(dlg.m_bModGroup != FALSE) m_mgr.SetEntryGroup(dwIndex, dwGroupId);
 				if(dlg.m_bModIcon != FALSE) p->uImageId = (DWORD)dlg.m_nIconId;
 				if(dlg.m_bModExpire != FALSE) p->tExpire = dlg.m_tExpire;
 				if(dlg.m_bDelAttach != FALSE) CPwUtil::RemoveBinaryData(p);
@@ -8573,6 +8551,7 @@ void CPwSafeDlg::OnExtrasTanWizard()
 		dlg.m_strTans += tchTestSep; // Append terminating char
 
 		CString strSubString;
+		std::vector<CString> vPasswords, vUserNames;
 
 		BOOL bValidSubString = FALSE;
 		for(int i = 0; i < dlg.m_strTans.GetLength(); ++i)
@@ -8593,21 +8572,15 @@ void CPwSafeDlg::OnExtrasTanWizard()
 			}
 			else if((bAcceptable == FALSE) && (bValidSubString == TRUE))
 			{
-				ZeroMemory(&pwTemplate.uuid[0], 16);
-				pwTemplate.pszPassword = const_cast<LPTSTR>((LPCTSTR)strSubString);
-				pwTemplate.uPasswordLen = strSubString.GetLength();
+				vPasswords.push_back(strSubString);
 
 				CString strNumberTemp;
-				if(dlg.m_bAssignNumbers == FALSE)
-					pwTemplate.pszUserName = _T("");
-				else
+				if(dlg.m_bAssignNumbers != FALSE)
 				{
 					strNumberTemp.Format(bNatural ? _T("%u") : _T("%03u"), dwNumber);
-					pwTemplate.pszUserName = const_cast<LPTSTR>((LPCTSTR)strNumberTemp);
 					++dwNumber;
 				}
-
-				VERIFY(m_mgr.AddEntry(&pwTemplate));
+				vUserNames.push_back(strNumberTemp);
 
 				bValidSubString = FALSE;
 				EraseCString(&strSubString);
@@ -8616,6 +8589,25 @@ void CPwSafeDlg::OnExtrasTanWizard()
 
 		EraseCString(&dlg.m_strTans);
 
+		// Add all TAN entries at once
+		std::vector<PW_ENTRY> vTemplates(vPasswords.size(), pwTemplate);
+		for(size_t iTan = 0; iTan < vPasswords.size(); ++iTan)
+		{
+			PW_ENTRY& pe = vTemplates[iTan];
+			pe.pszPassword = const_cast<LPTSTR>((LPCTSTR)vPasswords[iTan]);
+			pe.uPasswordLen = vPasswords[iTan].GetLength();
+			pe.pszUserName = const_cast<LPTSTR>((LPCTSTR)vUserNames[iTan]);
+		}
+
+		if(!vTemplates.empty())
+		{
+			VERIFY(m_mgr.AddEntries(&vTemplates[0], static_cast<DWORD>(
+				vTemplates.size())));
+		}
+
+		for(size_t iErase = 0; iErase < vPasswords.size(); ++iErase)
+			EraseCString(&vPasswords[iErase]);
+
 		_SortListIfAutoSort();
 		if(m_nAutoSort == 0) UpdatePasswordList();
 		m_bModified = TRUE;
@@ -9592,7 +9584,7 @@ void CPwSafeDlg::_HandleEntryDrop(DWORD dwDropType, HTREEITEM hTreeItem)
 			{
 				p->tLastAccess = tNow;
 				// p->tLastMod = tNow;
-				p->uGroupId = dwToGroupId;
+				m_mgr.SetEntryGroup(dwIndex, dwToGroupId);
 			}
 			else if(dwDropType == DROPEFFECT_COPY)
 			{
@@ -9688,7 +9680,6 @@ void CPwSafeDlg::_DoQuickFind(LPCTSTR lpText)
 	_GetCurrentPwTime(&tNow);
 
 	PW_ENTRY *pwFirst = NULL;
-	const DWORD dwMaxItems = m_mgr.GetNumberOfEntries();
 
 	// Create the search group if it doesn't exist already
 	DWORD dwGroupId = m_mgr.GetGroupId(PWS_SEARCHGROUP);
@@ -9714,46 +9705,32 @@ void CPwSafeDlg::_DoQuickFind(LPCTSTR lpText)
 
 	m_bTANsOnly = TRUE;
 
-	DWORD cnt = 0;
+	std::vector<DWORD> vResults;
 	std_string strError;
-	while(true)
-	{
-		const DWORD dw = m_mgr.FindEx(lpSearch, FALSE, dwFlags, cnt, &strError);
+	m_findSession.Find(&m_mgr, lpSearch, FALSE, dwFlags | PWMS_PARALLEL,
+		vResults, &strError, NULL);
 
-		if(dw == DWORD_MAX) break;
-		else
-		{
-			PW_ENTRY *p = m_mgr.GetEntry(dw);
-			ASSERT_ENTRY(p);
-			if(p == NULL) break;
+	for(size_t i = 0; i < vResults.size(); ++i)
+	{
+		PW_ENTRY *p = m_mgr.GetEntry(vResults[i]);
+		ASSERT_ENTRY(p);
+		if(p == NULL) break;
 
-			const bool bTimeValid = ((m_bQuickFindIncExpired != FALSE) ||
-				(_pwtimecmp(&tNow, &p->tExpire) <= 0));
+		const bool bTimeValid = ((m_bQuickFindIncExpired != FALSE) ||
+			(_pwtimecmp(&tNow, &p->tExpire) <= 0));
 
-			if(p->uGroupId != dwGroupId) // Not in 'Search Results' group
+		if(p->uGroupId != dwGroupId) // Not in 'Search Results' group
+		{
+			if(((m_bQuickFindIncBackup != FALSE) || ((p->uGroupId != dwBackup1) &&
+				(p->uGroupId != dwBackup2))) && bTimeValid)
 			{
-				if(((m_bQuickFindIncBackup != FALSE) || ((p->uGroupId != dwBackup1) &&
-					(p->uGroupId != dwBackup2))) && bTimeValid)
-				{
-					ASSERT(m_mgr.GetGroupByIdN(p->uGroupId) != DWORD_MAX);
+				ASSERT(m_mgr.GetGroupByIdN(p->uGroupId) != DWORD_MAX);
 
-					// The entry could get reallocated by AddEntry, therefore
-					// save it to a local CString object
-					// m_mgr.UnlockEntryPassword(p);
-					// CString strTemp = p->pszPassword;
-					// m_mgr.LockEntryPassword(p);
+				_List_SetEntry(m_cList.GetItemCount(), p, TRUE, &tNow);
 
-					_List_SetEntry(m_cList.GetItemCount(), p, TRUE, &tNow);
-
-					if(pwFirst == NULL) pwFirst = p;
-
-					// EraseCString(&strTemp); // Destroy the plaintext password
-				}
+				if(pwFirst == NULL) pwFirst = p;
 			}
 		}
-
-		cnt = dw + 1;
-		if(cnt >= dwMaxItems) break;
 	}
 
 	_Groups_SaveView();
@@ -10431,7 +10408,7 @@ LRESULT CPwSafeDlg::OnHotKey(WPARAM wParam, LPARAM lParam)
 					bool bDoAdd = false;
 					if(bLeft && bRight && (nSubLen <= nLen))
 					{
-						if(strCurWindow.Find(strWindowExp, 0) != -1)
+						if(SU_FindSubString(strCurWindow, strWindowExp, TRUE) != NULL)
 							bDoAdd = true;
 					}
 					else if(bLeft && (nSubLen <= nLen))
@@ -10474,7 +10451,7 @@ LRESULT CPwSafeDlg::OnHotKey(WPARAM wParam, LPARAM lParam)
 					if((nSubLen != 0) && (nSubLen <= nLen))
 					{
 						strWindowExp = _AutoTypeNormalizeWindowText(strWindowExp);
-						if(strCurWindow.Find(strWindowExp, 0) != -1)
+						if(SU_FindSubString(strCurWindow, strWindowExp, TRUE) != NULL)
 						{
 							memcpy(pwUuid.uuid, pe->uuid, 16);
 							dlg.m_vEntryList.push_back(pwUuid);
@@ -10544,7 +10521,7 @@ LRESULT CPwSafeDlg::OnHotKey(WPARAM wParam, LPARAM lParam)
 
 							if(bLeft && bRight && (nSubLen <= nLen))
 							{
-								if(strCurWindow.Find(strWindowExp, 0) != -1)
+								if(SU_FindSubString(strCurWindow, strWindowExp, TRUE) != NULL)
 								{
 									dwWindowFieldSeqFound = dwWindowFieldSeq;
 									break;
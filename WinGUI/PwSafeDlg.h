@@ -26,6 +26,7 @@
 
 #include "../KeePassLibCpp/SysDefEx.h"
 #include "../KeePassLibCpp/PwManager.h"
+#include "../KeePassLibCpp/Util/PwFindSession.h"
 #include "../KeePassLibCpp/DataExchange/PwExport.h"
 #include "../KeePassLibCpp/PasswordGenerator/PasswordGenerator.h"
 
@@ -312,6 +313,7 @@ public:
 	BOOL m_bInitialCmdLineFile;
 
 	CPwManager m_mgr;
+	CPwFindSession m_findSession; // Quick find results
 
 	static BOOL m_bMiniMode;
 	static BOOL m_bSecureEdits;